@@ -2,19 +2,87 @@
 // esp1.cpp - Load Cell and Motor Control
 
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
 #include <WiFiClient.h>
+#include <WiFiUdp.h>
 #include <ArduinoJson.h>
 #include <HX711.h>
 #include <Servo.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include "src/CooperativeScheduler.h"
+#include "src/Hx711Sampler.h"
+#include "src/WeightFilter.h"
+#include "src/CutoffPredictor.h"
+#include "src/TelemetryBatch.h"
+#include "src/PersistentHttp.h"
+#include "src/HeapMonitor.h"
+#include "src/OfflineQueue.h"
+#include "src/WifiLink.h"
+#include "src/BootCache.h"
+#include "src/DeadbandReporter.h"
+#include "src/UdpTelemetry.h"
+#include "src/LanState.h"
+#include "src/DispenseCommand.h"
+#include "src/ButtonEvents.h"
 
 // WiFi credentials
 const char* ssid = "YOUR_WIFI_SSID";
 const char* password = "YOUR_WIFI_PASSWORD";
+WifiLink wifiLink; // connects in the background; dispensing never waits for it
 
 // Supabase configuration
 const char* supabaseUrl = "YOUR_SUPABASE_URL";
 const char* supabaseKey = "YOUR_SUPABASE_KEY";
+PersistentHttp supabase; // one keep-alive socket for every Supabase call
+
+// Weight telemetry transport. TELEMETRY_UDP sends 28-byte frames to a gateway
+// on the LAN that acknowledges them and writes the rows; dispense events and
+// anything the gateway never acknowledged still go to Supabase over REST.
+enum TelemetryMode { TELEMETRY_REST, TELEMETRY_UDP };
+TelemetryMode telemetryMode = TELEMETRY_REST;
+IPAddress telemetryGateway(192, 168, 1, 50);
+const uint16_t TELEMETRY_GATEWAY_PORT = 47800;
+const uint16_t TELEMETRY_DEVICE_ID = 1; // this controller's id at the gateway
+UdpTelemetry udpTelemetry(47801, 1000); // local port, retransmit after 1 s without an ack
+
+// Weight and dispense status multicast to the display on the same LAN, on
+// every change past 1 g and at least once a second
+IPAddress lanStateGroup(239, 255, 42, 1);
+const uint16_t LAN_STATE_PORT = 47802;
+LanStatePublisher lanState(lanStateGroup, LAN_STATE_PORT, 1000, 1000); // group, port, heartbeat ms, deadband mg
+
+// Dispense commands from the display and the app arrive over the LAN and open
+// the gate on the next button scan; the cloud only gets the history rows
+const uint16_t DISPENSE_COMMAND_PORT = 47803;
+const uint16_t MAX_REMOTE_DISPENSE_GRAMS = 1000;
+const char* dispenseSecret = "YOUR_DISPENSE_SECRET"; // same on the display and in the app
+DispenseCommandServer dispenseCommands(DISPENSE_COMMAND_PORT);
+
+// Dispense requests the app leaves in Supabase. Each poll asks only for
+// pending rows after the last one seen (requested_at, then id), and each row
+// is claimed with a PATCH conditional on it still being pending, so two
+// dispensers never run the same request. Polls are frequent for a while after
+// a request and slow when nothing happens.
+const unsigned long REQUEST_POLL_IDLE = 15000;
+const unsigned long REQUEST_POLL_ACTIVE = 2000;
+const unsigned long REQUEST_ACTIVE_WINDOW = 120000;   // active polling this long after the last request
+const unsigned long REQUEST_RESCAN_INTERVAL = 600000; // restart from the oldest pending row now and then
+const uint8_t REQUEST_PAGE_SIZE = 4;
+struct RequestCursor {
+  char requestedAt[40]; // as PostgREST returns it, e.g. 2024-05-01T08:15:00.123456+00:00
+  char id[40];
+};
+RequestCursor requestCursor = {"", ""};
+char activeRequestId[40] = ""; // the claimed row being dispensed or awaiting its completion PATCH
+uint32_t activeCommandKey = 0;  // the LAN command being dispensed, audited when it settles
+bool commandDispensing = false;
+bool requestCompletionPending = false;
+float requestDispensedGrams = 0.0;
+unsigned long lastRequestActivity = 0;
+unsigned long lastRequestRescan = 0;
+char requestPath[360];
+char requestResponse[640];
+StaticJsonDocument<JSON_ARRAY_SIZE(REQUEST_PAGE_SIZE) + REQUEST_PAGE_SIZE * JSON_OBJECT_SIZE(3) + 192> requestDoc;
 
 // Hardware pins (ESP8266 NodeMCU)
 #define LOADCELL_DOUT_PIN  D4  // GPIO2
@@ -22,142 +90,551 @@ const char* supabaseKey = "YOUR_SUPABASE_KEY";
 #define SERVO_PIN          D6  // GPIO12
 #define LED_PIN           D7  // GPIO13
 #define BUTTON_PIN        D3  // GPIO0
+#define TARE_BUTTON_PIN   D2  // GPIO4; not a boot strapping pin like GPIO0
 
 // Hardware objects
 HX711 scale;
+Hx711Sampler loadCellSampler;
+WeightFilter weightFilter;
+uint32_t filterCycles = 0;
+uint32_t filterSamples = 0;
+CutoffPredictor cutoffPredictor;
 Servo dispenserServo;
 
 // Calibration values
 const float CALIBRATION_FACTOR = -7050.0; // Adjust based on your load cell
+
+// Tare offset kept across reboots so setup() does not wait for a fresh tare;
+// hold the tare button with the hopper empty to tare again
+struct ScaleCalibration {
+  int32_t tareOffset;
+  float calibrationFactor; // the offset is only reused with the same factor
+};
+BootCache<ScaleCalibration> scaleCache(0x31455254, 40, "/boot/scale"); // "TRE1", RTC blocks 40-43
 const float RICE_DENSITY_FACTOR = 0.8; // Approximate grams per mL for rice
 
+// Dispense profiles: open wide for the bulk, then trickle the last grams
+struct DispenseProfile {
+  const char* grain;
+  int coarseAngle;       // servo angle for the bulk of the target
+  int fineAngle;         // trickle angle near the target
+  float fineBandGrams;   // switch to the trickle this far before the target (0 = single stage)
+};
+
+const DispenseProfile DISPENSE_PROFILES[] = {
+  {"white", 90, 25, 20.0},
+  {"jasmine", 90, 25, 20.0},
+  {"brown", 90, 30, 25.0},     // coarser grains need a wider trickle
+  {"glutinous", 80, 35, 30.0}, // sticky grains bridge at narrow openings
+};
+const char* GRAIN_TYPE = "white"; // Set to the rice loaded in the hopper
+const DispenseProfile* dispenseProfile = &DISPENSE_PROFILES[0];
+
 // System state
 float currentWeight = 0.0;
+bool weightValid = false; // false until the first conversion after boot
+unsigned long firstReportMs = 0; // boot to the first accepted upload, 0 until then
 float targetWeight = 0.0;
 bool isDispensing = false;
-unsigned long lastWeightRead = 0;
-unsigned long lastDataSend = 0;
 const unsigned long WEIGHT_READ_INTERVAL = 1000; // 1 second
-const unsigned long DATA_SEND_INTERVAL = 5000;   // 5 seconds
+const unsigned long DATA_SEND_INTERVAL = 1000;   // deadband check; rows only on change or heartbeat
+const unsigned long BUTTON_SCAN_INTERVAL = 20;   // 20 ms
+const unsigned long DISPENSE_CONTROL_INTERVAL = 100; // one HX711 conversion at 10 SPS
+const unsigned long STATS_REPORT_INTERVAL = 60000; // 1 minute
+const unsigned long DISPENSE_SETTLE_TIME = 1500; // wait for the last grains and the filter after closing
+const unsigned long FIRST_WEIGHT_DELAY = 120; // the HX711's first conversion is ready ~100 ms after power-up
+
+// Weight is reported by exception: a row when it moves more than the deadband,
+// and a heartbeat row when it has not for 10 minutes
+const float WEIGHT_DEADBAND_GRAMS = 5.0;
+const unsigned long WEIGHT_HEARTBEAT_INTERVAL = 600000;
+DeadbandReporter weightReport(WEIGHT_DEADBAND_GRAMS, WEIGHT_HEARTBEAT_INTERVAL);
+
+// While the weight keeps changing, rows are uploaded in bulk: every 12 rows
+// or 5 seconds at most
+const uint8_t WEIGHT_BATCH_SIZE = 12;
+const unsigned long WEIGHT_BATCH_MAX_AGE = 5000;
+TelemetryBatch<float, 32> weightBatch(WEIGHT_BATCH_SIZE, WEIGHT_BATCH_MAX_AGE);
+bool weightRowsHeld = false; // recorded while dispensing; sent once the gate has settled
+unsigned long lastWeightFlush = 0;
+
+// Request bodies are serialized into static buffers so uploads never touch the heap
+const size_t WEIGHT_ROW_BYTES = 80; // {"weight":...,"timestamp":"...","device_id":"..."},
+StaticJsonDocument<JSON_ARRAY_SIZE(WEIGHT_BATCH_SIZE) + WEIGHT_BATCH_SIZE * (JSON_OBJECT_SIZE(3) + 16)> weightDoc;
+char weightPayload[WEIGHT_BATCH_SIZE * WEIGHT_ROW_BYTES + 2];
+const uint8_t EVENT_REPLAY_SIZE = 4; // dispense events per replayed request
+StaticJsonDocument<JSON_ARRAY_SIZE(EVENT_REPLAY_SIZE) + EVENT_REPLAY_SIZE * (JSON_OBJECT_SIZE(4) + 16)> eventDoc;
+char eventPayload[EVENT_REPLAY_SIZE * 100 + 2];
+HeapMonitor heapMonitor;
+
+// Uploads that cannot go out are kept on flash and replayed once WiFi is back
+struct QueuedWeight {
+  float weight;
+  uint32_t takenAt;
+};
+struct QueuedEvent {
+  char action[12];
+  float weight;
+  uint32_t takenAt;
+};
+OfflineQueue weightQueue("/queue/weight", 8192, 8); // 64 KB, about 6 hours of samples
+OfflineQueue eventQueue("/queue/event", 8192, 2);
+// A LAN dispense is written to dispense_request after the fact: one upsert
+// when the command is accepted and one when it settles, on the row named by
+// the command's key
+struct QueuedCommand {
+  uint32_t key;
+  uint16_t requestedGrams;
+  uint16_t dispensedGrams;
+  bool completed;
+};
+OfflineQueue commandQueue("/queue/command", 2048, 2);
+const unsigned long REPLAY_INTERVAL = 1000; // at most one replayed bulk request per second
+const unsigned long HEAP_SAMPLE_INTERVAL = 1000; // 1 second
+const unsigned long WIFI_CHECK_INTERVAL = 100; // link state poll
+const unsigned long COMPLETION_BLINK_INTERVAL = 200; // LED off/on steps after a dispense
+const uint8_t COMPLETION_BLINK_STEPS = 6;            // three flashes
+
+// EEPROM layout
+const int EEPROM_SIZE = 64;
+const int CUTOFF_MODEL_ADDRESS = 0;
+
+// Dispense progress
+enum DispenseStage { STAGE_IDLE, STAGE_COARSE, STAGE_FINE, STAGE_SETTLING };
+DispenseStage dispenseStage = STAGE_IDLE;
+float dispenseStartWeight = 0.0;
+bool cutoffPending = false;
+unsigned long gateClosedAt = 0;
+
+// Task scheduler
+CooperativeScheduler scheduler;
+uint8_t weightTask;
+uint8_t dispenseTask;
+uint8_t telemetryTask;
+uint8_t replayTask;
+uint8_t requestTask;
+uint8_t blinkTask;
+uint8_t blinkStepsLeft = 0;
+
+// Manual dispense and tare buttons: edges are timestamped in the pin interrupt
+ButtonEvents buttons;
+uint8_t dispenseButton;
+uint8_t tareButton;
 
 void setup() {
   Serial.begin(115200);
   
   // Initialize hardware
   pinMode(LED_PIN, OUTPUT);
-  pinMode(BUTTON_PIN, INPUT_PULLUP);
+  dispenseButton = buttons.add(BUTTON_PIN);
+  tareButton = buttons.add(TARE_BUTTON_PIN);
+  
+  // Cached tare, WiFi lease and anything stored while offline live here
+  LittleFS.begin();
   
   // Initialize load cell
   scale.begin(LOADCELL_DOUT_PIN, LOADCELL_SCK_PIN);
   scale.set_scale(CALIBRATION_FACTOR);
-  scale.tare(); // Reset to zero
+  restoreTare();
+  WeightFilter::Config filterConfig; // median of 3, then Kalman smoothing
+  weightFilter.begin(filterConfig);
+  weightFilter.setCalibration(scale.get_offset(), CALIBRATION_FACTOR);
+  weightFilter.setZeroTracking(true);
+  // From here on conversions are captured by the DOUT interrupt
+  loadCellSampler.begin(LOADCELL_DOUT_PIN, LOADCELL_SCK_PIN);
+  
+  selectDispenseProfile(GRAIN_TYPE);
+  
+  // Learned cutoff model survives reboots
+  EEPROM.begin(EEPROM_SIZE);
+  cutoffPredictor.begin(CUTOFF_MODEL_ADDRESS);
+  Serial.printf("Cutoff model: lag %.3f s over %u dispenses\n", cutoffPredictor.learned().lagSeconds,
+                (unsigned)cutoffPredictor.learned().dispenses);
   
   // Initialize servo
   dispenserServo.attach(SERVO_PIN);
   dispenserServo.write(0); // Closed position
   
-  // Connect to WiFi
+  // Anything stored while offline is replayed once connected
+  weightQueue.begin();
+  eventQueue.begin();
+  commandQueue.begin();
+  
+  // Start connecting to WiFi; the wifi task finishes the job. Modem sleep
+  // would hold incoming commands at the AP until the next beacon.
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
   connectToWiFi();
+  supabase.begin(supabaseUrl, supabaseKey);
+  if (telemetryMode == TELEMETRY_UDP) {
+    udpTelemetry.begin(TELEMETRY_DEVICE_ID, telemetryGateway, TELEMETRY_GATEWAY_PORT);
+    udpTelemetry.onEvicted(spillWeightFrame);
+  }
+  lanState.begin(TELEMETRY_DEVICE_ID);
+  dispenseCommands.begin(dispenseSecret);
+  
+  // Register periodic tasks (period, deadline in ms)
+  weightTask = scheduler.addTask("weight", readWeight, WEIGHT_READ_INTERVAL, WEIGHT_READ_INTERVAL);
+  dispenseTask = scheduler.addTask("dispense", handleDispensing, DISPENSE_CONTROL_INTERVAL, DISPENSE_CONTROL_INTERVAL, false);
+  scheduler.addTask("button", scanButton, BUTTON_SCAN_INTERVAL, BUTTON_SCAN_INTERVAL);
+  telemetryTask = scheduler.addTask("telemetry", sendWeightData, DATA_SEND_INTERVAL, 1000);
+  scheduler.addTask("stats", reportSchedulerStats, STATS_REPORT_INTERVAL, 1000);
+  scheduler.addTask("heap", sampleHeap, HEAP_SAMPLE_INTERVAL, 1000);
+  replayTask = scheduler.addTask("replay", replayOfflineQueue, REPLAY_INTERVAL, 1000);
+  scheduler.addTask("wifi", maintainWiFi, WIFI_CHECK_INTERVAL, WIFI_CHECK_INTERVAL);
+  requestTask = scheduler.addTask("requests", pollDispenseRequests, REQUEST_POLL_IDLE, 2000);
+  blinkTask = scheduler.addTask("blink", blinkCompletion, COMPLETION_BLINK_INTERVAL, 50, false);
+  scheduler.triggerIn(weightTask, FIRST_WEIGHT_DELAY);
   
   Serial.println("Smart Rice Dispenser initialized!");
   digitalWrite(LED_PIN, HIGH); // Ready indicator
 }
 
 void loop() {
-  unsigned long currentTime = millis();
-  
-  // Read weight sensor
-  if (currentTime - lastWeightRead >= WEIGHT_READ_INTERVAL) {
-    readWeight();
-    lastWeightRead = currentTime;
-  }
-  
-  // Send data to Supabase
-  if (currentTime - lastDataSend >= DATA_SEND_INTERVAL) {
-    sendWeightData();
-    lastDataSend = currentTime;
+  // Run whatever is due, then sleep until the next task release
+  scheduler.runDueTasks();
+  scheduler.sleepUntilNextTask();
+}
+
+void scanButton() {
+  // Manual dispense 50g, once per debounced press; holding the button does
+  // not start another. Holding the tare button re-tares.
+  buttons.update();
+  ButtonEvent event;
+  while (buttons.read(event)) {
+    if (event.button == dispenseButton && event.type == ButtonEvent::PRESS && !isDispensing) {
+      startDispensing(50.0);
+    } else if (event.button == tareButton && event.type == ButtonEvent::LONG_PRESS && !isDispensing) {
+      retare();
+    }
   }
-  
-  // Check for manual dispense button
-  if (digitalRead(BUTTON_PIN) == LOW && !isDispensing) {
-    // Manual dispense 50g
-    startDispensing(50.0);
+  handleRemoteDispense();
+}
+
+void reportSchedulerStats() {
+  scheduler.printStats(Serial);
+  Serial.printf("hx711: %lu captured, %lu dropped\n", (unsigned long)loadCellSampler.capturedCount(),
+                (unsigned long)loadCellSampler.droppedCount());
+  if (filterSamples > 0) {
+    Serial.printf("weight filter: %lu cycles/sample, zero drift %ld mg\n",
+                  (unsigned long)(filterCycles / filterSamples), (long)weightFilter.zeroDriftMg());
+    filterCycles = 0;
+    filterSamples = 0;
   }
-  
-  // Handle dispensing process
-  if (isDispensing) {
-    handleDispensing();
+  wifiLink.printStats(Serial);
+  supabase.printStats(Serial);
+  if (telemetryMode == TELEMETRY_UDP) udpTelemetry.printStats(Serial);
+  lanState.printStats(Serial);
+  dispenseCommands.printStats(Serial);
+  buttons.printStats(Serial);
+  heapMonitor.printStats(Serial);
+  weightReport.printStats(Serial, "weight");
+  weightQueue.printStats(Serial);
+  eventQueue.printStats(Serial);
+  commandQueue.printStats(Serial);
+}
+
+void sampleHeap() {
+  heapMonitor.sample();
+}
+
+void connectToWiFi() {
+  wifiLink.begin(ssid, password);
+  Serial.println("Connecting to WiFi");
+}
+
+void restoreTare() {
+  ScaleCalibration calibration;
+  if (scaleCache.load(calibration) && calibration.calibrationFactor == CALIBRATION_FACTOR) {
+    scale.set_offset(calibration.tareOffset);
+    Serial.printf("Tare offset %ld from %s\n", (long)calibration.tareOffset,
+                  scaleCache.loadedFrom() == BootCache<ScaleCalibration>::FROM_RTC ? "RTC memory" : "flash");
+    return;
   }
   
-  delay(100);
+  scale.tare(); // Reset to zero; the hopper must be empty
+  memset(&calibration, 0, sizeof(calibration));
+  calibration.tareOffset = scale.get_offset();
+  calibration.calibrationFactor = CALIBRATION_FACTOR;
+  scaleCache.save(calibration);
+  Serial.printf("Tared: offset %ld\n", (long)calibration.tareOffset);
 }
 
-void connectToWiFi() {
-  WiFi.begin(ssid, password);
-  Serial.print("Connecting to WiFi");
+void retare() {
+  // The sampler owns the HX711 by now, so the filtered load becomes the
+  // new zero instead of a blocking scale.tare()
+  ScaleCalibration calibration;
+  memset(&calibration, 0, sizeof(calibration));
+  calibration.tareOffset = weightFilter.tare();
+  calibration.calibrationFactor = CALIBRATION_FACTOR;
+  scale.set_offset(calibration.tareOffset);
+  scaleCache.save(calibration);
+  currentWeight = 0;
+  Serial.printf("Re-tared: offset %ld\n", (long)calibration.tareOffset);
+}
+
+void maintainWiFi() {
+  if (!wifiLink.update()) return;
   
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
+  if (wifiLink.isConnected()) {
+    Serial.printf("Connected in %lu ms%s! IP address: ", wifiLink.lastConnectMs(),
+                  wifiLink.usedCachedLease() ? " (cached AP and IP)" : "");
+    Serial.println(WiFi.localIP());
+    lanState.expire(); // let the display know we are back without waiting for the heartbeat
+    requestFirstReport();
+  } else {
+    Serial.println("WiFi lost, reconnecting in the background");
+    supabase.stop(); // the old socket is dead; don't wait for it to time out
   }
-  
-  Serial.println();
-  Serial.print("Connected! IP address: ");
-  Serial.println(WiFi.localIP());
 }
 
 void readWeight() {
-  if (scale.is_ready()) {
-    currentWeight = scale.get_units(5); // Average of 5 readings
+  // Drain everything the interrupt captured since the last call; never waits.
+  // Each conversion goes through the fixed-point filter, so no float per sample.
+  Hx711Sample sample;
+  bool updated = false;
+  while (loadCellSampler.read(sample)) {
+    uint32_t start = ESP.getCycleCount();
+    weightFilter.update(sample.raw);
+    filterCycles += ESP.getCycleCount() - start;
+    filterSamples++;
+    updated = true;
+  }
+  
+  if (updated) {
+    currentWeight = weightFilter.weightMg() / 1000.0f;
     if (currentWeight < 0) currentWeight = 0; // Prevent negative weights
+    if (!weightValid) {
+      weightValid = true;
+      requestFirstReport();
+    }
     
     Serial.print("Current weight: ");
     Serial.print(currentWeight);
     Serial.println(" g");
   }
+  publishLanState();
+}
+
+void publishLanState() {
+  if (!weightValid) return;
+  TelemetryFrame frame = TelemetryFrame::state(TELEMETRY_DEVICE_ID);
+  frame.weightMg = TelemetryFrame::toMilli(currentWeight);
+  frame.status = dispenseStage == STAGE_IDLE ? TelemetryFrame::STATUS_READY
+               : dispenseStage == STAGE_SETTLING ? TelemetryFrame::STATUS_SETTLING
+               : TelemetryFrame::STATUS_DISPENSING;
+  frame.fields = TelemetryFrame::HAS_WEIGHT | TelemetryFrame::HAS_STATUS;
+  lanState.publish(frame, millis());
 }
 
 void sendWeightData() {
-  if (WiFi.status() == WL_CONNECTED) {
-    HTTPClient http;
-    http.begin(String(supabaseUrl) + "/rest/v1/rice_weights");
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", supabaseKey);
-    http.addHeader("Authorization", "Bearer " + String(supabaseKey));
-    
-    // Create JSON payload
-    DynamicJsonDocument doc(1024);
-    doc["weight"] = currentWeight;
-    doc["timestamp"] = getCurrentTimestamp();
-    doc["device_id"] = "ESP32_001";
-    
-    String payload;
-    serializeJson(doc, payload);
-    
-    int httpResponseCode = http.POST(payload);
-    
-    if (httpResponseCode > 0) {
-      String response = http.getString();
-      Serial.println("Data sent successfully");
-    } else {
-      Serial.print("Error sending data: ");
-      Serial.println(httpResponseCode);
+  if (telemetryMode == TELEMETRY_UDP) pollWeightFrames();
+  if (!weightValid) return; // nothing measured yet
+  
+  // Record a row only when the weight moved past the deadband or the
+  // heartbeat is due. The first change after a quiet spell goes out at once;
+  // while the weight keeps moving, rows are batched.
+  unsigned long now = millis();
+  if (weightReport.due(currentWeight, now)) {
+    bool quiet = weightBatch.size() == 0 && (lastWeightFlush == 0 || now - lastWeightFlush >= WEIGHT_BATCH_MAX_AGE);
+    weightReport.reported(currentWeight, now);
+    if (telemetryMode == TELEMETRY_UDP) {
+      sendWeightFrame(currentWeight, now); // one datagram per row; nothing to batch
+      return;
+    }
+    if (isDispensing && weightBatch.size() == weightBatch.capacity()) spillWeightBatch(); // flash, not the network
+    weightBatch.add(currentWeight, now);
+    if (quiet && !isDispensing && wifiLink.isConnected()) {
+      flushWeightBatch();
+      return;
+    }
+  } else {
+    weightReport.skipped();
+  }
+  
+  // While the gate is open the control loop must not wait on an upload;
+  // what was held goes out on the first run after the dispense has settled
+  if (isDispensing) {
+    weightRowsHeld = weightRowsHeld || weightBatch.size() > 0;
+    return;
+  }
+  
+  // The first row after boot goes out as soon as WiFi is up
+  bool firstReport = firstReportMs == 0 && wifiLink.isConnected();
+  if (weightBatch.size() > 0 && (weightBatch.due(now) || firstReport || weightRowsHeld)) {
+    flushWeightBatch();
+  }
+}
+
+void reportWeightNow() {
+  // Next check sends the current weight even inside the deadband
+  weightReport.expire();
+  scheduler.trigger(telemetryTask);
+}
+
+void requestFirstReport() {
+  if (firstReportMs == 0 && weightValid && wifiLink.isConnected()) scheduler.trigger(telemetryTask);
+}
+
+void flushWeightBatch() {
+  lastWeightFlush = millis();
+  weightRowsHeld = false;
+  if (wifiLink.isConnected()) {
+    // One JSON array, inserted by PostgREST as one row per element. A backlog
+    // larger than one batch goes out over the next flushes.
+    uint8_t rowCount = min(weightBatch.size(), WEIGHT_BATCH_SIZE);
+    JsonArray rows = weightDoc.to<JsonArray>();
+    for (uint8_t i = 0; i < rowCount; i++) {
+      addWeightRow(rows, weightBatch.at(i), weightBatch.takenAtMs(i));
     }
     
-    http.end();
+    int httpResponseCode = postWeightRows();
+    if (httpResponseCode >= 200 && httpResponseCode < 300) {
+      weightBatch.consume(rowCount);
+      if (firstReportMs == 0) {
+        firstReportMs = millis();
+        Serial.printf("First report %lu ms after boot\n", firstReportMs);
+      }
+      Serial.print("Weight batch sent: ");
+      Serial.print(rowCount);
+      Serial.println(" samples");
+      return;
+    }
+    Serial.print("Error sending data: ");
+    Serial.println(httpResponseCode);
+  }
+  
+  // Offline or rejected: move the batch to flash so it survives the outage
+  spillWeightBatch();
+}
+
+void spillWeightBatch() {
+  uint8_t spilled = 0;
+  while (spilled < weightBatch.size()) {
+    QueuedWeight sample = {weightBatch.at(spilled), (uint32_t)weightBatch.takenAtMs(spilled)};
+    if (!weightQueue.append(&sample, sizeof(sample))) break;
+    spilled++;
   }
+  weightQueue.sync();
+  weightBatch.consume(spilled);
+}
+
+void sendWeightFrame(float weight, unsigned long takenAtMs) {
+  TelemetryFrame frame = TelemetryFrame::data(TELEMETRY_DEVICE_ID);
+  frame.takenAtMs = takenAtMs;
+  frame.weightMg = TelemetryFrame::toMilli(weight);
+  frame.fields = TelemetryFrame::HAS_WEIGHT;
+  udpTelemetry.send(frame);
+}
+
+void pollWeightFrames() {
+  // Collect acks and resend what the gateway has not confirmed
+  udpTelemetry.poll();
+  if (firstReportMs == 0 && udpTelemetry.statistics().acked > 0) {
+    firstReportMs = millis();
+    Serial.printf("First report %lu ms after boot\n", firstReportMs);
+  }
+}
+
+void spillWeightFrame(const TelemetryFrame& frame) {
+  // No ack for a whole window of frames: keep the row for the REST replay
+  QueuedWeight sample = {frame.weightMg / 1000.0f, frame.takenAtMs};
+  if (weightQueue.append(&sample, sizeof(sample))) weightQueue.sync();
+}
+
+void addWeightRow(JsonArray rows, float weight, unsigned long takenAtMs) {
+  char takenAt[11]; // device time the sample was taken; copied into weightDoc
+  snprintf(takenAt, sizeof(takenAt), "%lu", takenAtMs);
+  JsonObject row = rows.createNestedObject();
+  row["weight"] = weight;
+  row["timestamp"] = takenAt;
+  row["device_id"] = "ESP32_001";
+}
+
+int postWeightRows() {
+  size_t payloadLength = serializeJson(weightDoc, weightPayload, sizeof(weightPayload));
+  if (weightDoc.overflowed() || payloadLength >= sizeof(weightPayload) - 1) {
+    Serial.println("Weight batch does not fit the payload buffer");
+    return PersistentHttp::ERROR_REQUEST_TOO_LARGE;
+  }
+  return supabase.post("/rest/v1/rice_weights", weightPayload, payloadLength, "Prefer: return=minimal\r\n");
+}
+
+void replayOfflineQueue() {
+  // One bulk request per run keeps the drain from hogging the loop or the link,
+  // and none while the gate is open: the control loop must not wait on the cloud
+  if (!wifiLink.isConnected() || isDispensing) return;
+  
+  if (!eventQueue.isEmpty()) {
+    JsonArray rows = eventDoc.to<JsonArray>();
+    uint16_t count = eventQueue.peek(EVENT_REPLAY_SIZE, [&](const uint8_t* data, uint8_t length) {
+      if (length != sizeof(QueuedEvent)) return;
+      QueuedEvent event;
+      memcpy(&event, data, sizeof(event));
+      addEventRow(rows, event);
+    });
+    if (count > 0 && !shouldRetryUpload(postEventRows())) eventQueue.consume();
+    return;
+  }
+  
+  if (!commandQueue.isEmpty()) {
+    // One row per request: both records of a command name the same row
+    QueuedCommand command = {};
+    uint16_t count = commandQueue.peek(1, [&](const uint8_t* data, uint8_t length) {
+      if (length == sizeof(QueuedCommand)) memcpy(&command, data, sizeof(command));
+    });
+    bool malformed = command.requestedGrams == 0; // accepted commands are never 0 g
+    if (count > 0 && (malformed || !shouldRetryUpload(upsertCommandRow(command)))) commandQueue.consume();
+    return;
+  }
+  
+  if (!weightQueue.isEmpty()) {
+    JsonArray rows = weightDoc.to<JsonArray>();
+    uint16_t count = weightQueue.peek(WEIGHT_BATCH_SIZE, [&](const uint8_t* data, uint8_t length) {
+      if (length != sizeof(QueuedWeight)) return;
+      QueuedWeight sample;
+      memcpy(&sample, data, sizeof(sample));
+      addWeightRow(rows, sample.weight, sample.takenAt);
+    });
+    if (count > 0 && !shouldRetryUpload(postWeightRows())) weightQueue.consume();
+  }
+}
+
+bool shouldRetryUpload(int httpResponseCode) {
+  if (httpResponseCode >= 200 && httpResponseCode < 300) return false;
+  // These fail the same way every time; drop them rather than block the queue
+  if (httpResponseCode == PersistentHttp::ERROR_REQUEST_TOO_LARGE) return false;
+  bool throttled = httpResponseCode == 408 || httpResponseCode == 429;
+  return httpResponseCode < 400 || httpResponseCode >= 500 || throttled;
 }
 
 void startDispensing(float weight) {
+  readWeight(); // start from the freshest reading
   targetWeight = weight;
   isDispensing = true;
+  dispenseStartWeight = currentWeight;
+  weightFilter.setZeroTracking(false); // the load is meant to change now
+  cutoffPredictor.startDispense();
   
   Serial.print("Starting dispensing: ");
   Serial.print(targetWeight);
   Serial.println(" g");
   
-  // Open dispenser
-  dispenserServo.write(90); // Open position
+  // Open dispenser: wide for the bulk, or straight to the trickle when the
+  // whole request fits in the fine band
+  cutoffPending = false;
+  if (dispenseProfile->fineBandGrams > 0 && targetWeight <= dispenseProfile->fineBandGrams) {
+    dispenseStage = STAGE_FINE;
+    dispenserServo.write(dispenseProfile->fineAngle);
+  } else {
+    dispenseStage = STAGE_COARSE;
+    dispenserServo.write(dispenseProfile->coarseAngle);
+  }
+  
+  // Sample the scale at the HX711 rate and run the control loop after it:
+  // the tighter deadline keeps readWeight() ahead of handleDispensing()
+  scheduler.setPeriod(weightTask, DISPENSE_CONTROL_INTERVAL, DISPENSE_CONTROL_INTERVAL / 2);
+  scheduler.trigger(weightTask);
+  scheduler.setEnabled(dispenseTask, true);
   
   // Log dispensing start
   logDispenseEvent("start", targetWeight);
@@ -166,74 +643,274 @@ void startDispensing(float weight) {
 void handleDispensing() {
   float dispensedWeight = getDispensedWeight();
   
-  if (dispensedWeight >= targetWeight) {
-    // Target reached, stop dispensing
+  if (dispenseStage == STAGE_COARSE || dispenseStage == STAGE_FINE) {
+    if (!cutoffPending) {
+      cutoffPredictor.observe(dispensedWeight, millis());
+      
+      if (dispenseStage == STAGE_COARSE && dispenseProfile->fineBandGrams > 0) {
+        // Narrow to the trickle once the bulk (and what is in flight) is in
+        if (cutoffPredictor.millisUntilCutoff(targetWeight - dispenseProfile->fineBandGrams) > 0) return;
+        dispenserServo.write(dispenseProfile->fineAngle);
+        dispenseStage = STAGE_FINE;
+        cutoffPredictor.restartFlow(cutoffPredictor.flowRate() * dispenseProfile->fineAngle / dispenseProfile->coarseAngle,
+                                    millis());
+        return;
+      }
+      
+      // Close early by the rice that will still arrive after the gate shuts
+      unsigned long wait = cutoffPredictor.millisUntilCutoff(targetWeight);
+      if (wait >= DISPENSE_CONTROL_INTERVAL) return;
+      if (wait > 0) {
+        // Cutoff falls between two samples; come back exactly then
+        cutoffPending = true;
+        scheduler.triggerIn(dispenseTask, wait);
+        return;
+      }
+    }
     dispenserServo.write(0); // Close position
+    dispenseStage = STAGE_SETTLING;
+    cutoffPending = false;
+    gateClosedAt = millis();
+    cutoffPredictor.gateClosed(gateClosedAt);
+    publishLanState();
+    return;
+  }
+  
+  if (millis() - gateClosedAt >= DISPENSE_SETTLE_TIME) {
+    // Settled: the final weight is what was really dispensed
+    cutoffPredictor.settled(dispensedWeight);
+    dispenseStage = STAGE_IDLE;
     isDispensing = false;
+    weightFilter.setZeroTracking(true);
+    scheduler.setEnabled(dispenseTask, false);
+    scheduler.setPeriod(weightTask, WEIGHT_READ_INTERVAL, WEIGHT_READ_INTERVAL);
+    reportWeightNow(); // the settled weight, even if close to the last row
+    publishLanState();
+    if (activeRequestId[0]) {
+      // The requests task marks the row completed, then looks for the next one
+      requestCompletionPending = true;
+      requestDispensedGrams = dispensedWeight;
+      scheduler.trigger(requestTask);
+    }
+    if (commandDispensing) {
+      commandDispensing = false;
+      queueCommandRow(activeCommandKey, targetWeight, dispensedWeight, true);
+    }
     
     Serial.print("Dispensing complete: ");
     Serial.print(dispensedWeight);
-    Serial.println(" g");
+    Serial.print(" g of ");
+    Serial.print(targetWeight);
+    Serial.print(" g, cutoff lag now ");
+    Serial.print(cutoffPredictor.learned().lagSeconds, 3);
+    Serial.println(" s");
     
     // Log dispensing completion
     logDispenseEvent("complete", dispensedWeight);
     
-    // Flash LED to indicate completion
-    for (int i = 0; i < 3; i++) {
-      digitalWrite(LED_PIN, LOW);
-      delay(200);
-      digitalWrite(LED_PIN, HIGH);
-      delay(200);
+    // Flash LED to indicate completion, from a task so the loop keeps going
+    blinkStepsLeft = COMPLETION_BLINK_STEPS;
+    scheduler.setEnabled(blinkTask, true);
+  }
+}
+
+void blinkCompletion() {
+  blinkStepsLeft--;
+  digitalWrite(LED_PIN, blinkStepsLeft % 2 ? LOW : HIGH); // ends on, the ready indicator
+  if (blinkStepsLeft == 0) scheduler.setEnabled(blinkTask, false);
+}
+
+void selectDispenseProfile(const char* grain) {
+  for (const DispenseProfile& profile : DISPENSE_PROFILES) {
+    if (strcmp(profile.grain, grain) == 0) {
+      dispenseProfile = &profile;
+      return;
     }
   }
+  Serial.print("Unknown grain type, keeping profile: ");
+  Serial.println(dispenseProfile->grain);
 }
 
 float getDispensedWeight() {
-  // This would be calculated based on the weight difference
-  // from when dispensing started
-  static float initialWeight = 0;
-  if (isDispensing && initialWeight == 0) {
-    initialWeight = currentWeight;
-  }
-  
-  if (!isDispensing) {
-    initialWeight = 0;
-    return 0;
-  }
+  // Weight difference from when dispensing started
+  if (!isDispensing) return 0;
+  return dispenseStartWeight - currentWeight;
+}
+
+void logDispenseEvent(const char* action, float weight) {
+  QueuedEvent event;
+  strncpy(event.action, action, sizeof(event.action) - 1);
+  event.action[sizeof(event.action) - 1] = 0;
+  event.weight = weight;
+  event.takenAt = millis();
   
-  return initialWeight - currentWeight;
+  // Queued on flash and uploaded by the replay task once the dispense is
+  // over, so the gate never waits on Supabase and no event is lost offline
+  eventQueue.append(&event, sizeof(event));
+  eventQueue.sync();
+  if (!isDispensing) scheduler.trigger(replayTask);
+}
+
+void addEventRow(JsonArray rows, const QueuedEvent& event) {
+  char timestamp[11]; // copied into eventDoc
+  getTimestamp(event.takenAt, timestamp, sizeof(timestamp));
+  JsonObject row = rows.createNestedObject();
+  row["action"] = (char*)event.action; // copied: the event is a temporary
+  row["weight"] = event.weight;
+  row["timestamp"] = timestamp;
+  row["device_id"] = "ESP32_001";
+}
+
+int postEventRows() {
+  size_t payloadLength = serializeJson(eventDoc, eventPayload, sizeof(eventPayload));
+  if (eventDoc.overflowed() || payloadLength >= sizeof(eventPayload) - 1) return PersistentHttp::ERROR_REQUEST_TOO_LARGE;
+  return supabase.post("/rest/v1/dispense_history", eventPayload, payloadLength);
+}
+
+void getTimestamp(unsigned long deviceMillis, char* timestamp, size_t size) {
+  // In a real implementation, you would use an NTP client
+  // to get the actual current time
+  snprintf(timestamp, size, "%lu", deviceMillis);
+}
+
+// Dispense commands from the display and the Flutter app (src/DispenseCommand.h)
+void handleRemoteDispense() {
+  dispenseCommands.poll(executeRemoteDispense);
 }
 
-void logDispenseEvent(String action, float weight) {
-  if (WiFi.status() == WL_CONNECTED) {
-    HTTPClient http;
-    http.begin(String(supabaseUrl) + "/rest/v1/dispense_history");
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", supabaseKey);
-    http.addHeader("Authorization", "Bearer " + String(supabaseKey));
+void pollDispenseRequests() {
+  if (!wifiLink.isConnected()) return;
+  if (requestCompletionPending && !completeDispenseRequest()) return; // close the last row first
+  if (isDispensing) return; // one request at a time
+  
+  unsigned long now = millis();
+  if (now - lastRequestActivity > REQUEST_ACTIVE_WINDOW) scheduler.setPeriod(requestTask, REQUEST_POLL_IDLE);
+  if (now - lastRequestRescan >= REQUEST_RESCAN_INTERVAL) {
+    // A row committed after a newer one was already seen would stay behind the cursor
+    lastRequestRescan = now;
+    requestCursor.requestedAt[0] = 0;
+  }
+  
+  if (!fetchDispenseRequests()) return;
+  for (JsonObject row : requestDoc.as<JsonArray>()) {
+    const char* id = row["id"];
+    const char* requestedAt = row["requested_at"];
+    int grams = row["requested_grams"];
+    if (!id || !requestedAt || strlen(id) >= sizeof(requestCursor.id) ||
+        strlen(requestedAt) >= sizeof(requestCursor.requestedAt)) {
+      continue;
+    }
     
-    DynamicJsonDocument doc(1024);
-    doc["action"] = action;
-    doc["weight"] = weight;
-    doc["timestamp"] = getCurrentTimestamp();
-    doc["device_id"] = "ESP32_001";
+    // The display inserted this one after a LAN command went unanswered, but
+    // the command did arrive: its audit upsert completes the row
+    uint32_t commandKey;
+    bool ranFromLan = DispenseCommand::keyFromRequestId(id, commandKey) && dispenseCommands.remembers(commandKey);
     
-    String payload;
-    serializeJson(doc, payload);
+    bool valid = grams > 0 && grams <= MAX_REMOTE_DISPENSE_GRAMS;
+    int claimed = ranFromLan ? 0 : claimDispenseRequest(id, valid ? "dispensing" : "failed");
+    if (claimed < 0) return; // not sure it was claimed: ask again from the same cursor
+    // Claimed here, by another dispenser or rejected: never look at this row again
+    strcpy(requestCursor.requestedAt, requestedAt);
+    strcpy(requestCursor.id, id);
+    lastRequestActivity = millis();
+    scheduler.setPeriod(requestTask, REQUEST_POLL_ACTIVE);
+    if (claimed == 0 || !valid) continue;
     
-    http.POST(payload);
-    http.end();
+    Serial.printf("Cloud dispense request %s: %d g\n", id, grams);
+    strcpy(activeRequestId, id);
+    startDispensing(grams);
+    return;
   }
 }
 
-String getCurrentTimestamp() {
-  // In a real implementation, you would use an NTP client
-  // to get the actual current time
-  return String(millis());
+bool fetchDispenseRequests() {
+  // Only the columns used, only pending rows after the cursor, oldest first
+  int n = snprintf(requestPath, sizeof(requestPath),
+                   "/rest/v1/dispense_request?select=id,requested_grams,requested_at&status=eq.pending"
+                   "&order=requested_at.asc,id.asc&limit=%u", (unsigned)REQUEST_PAGE_SIZE);
+  if (requestCursor.requestedAt[0]) {
+    char requestedAt[3 * sizeof(requestCursor.requestedAt)];
+    encodeQueryValue(requestCursor.requestedAt, requestedAt, sizeof(requestedAt));
+    n += snprintf(requestPath + n, sizeof(requestPath) - n,
+                  "&or=(requested_at.gt.%%22%s%%22,and(requested_at.eq.%%22%s%%22,id.gt.%s))", requestedAt,
+                  requestedAt, requestCursor.id);
+  }
+  if (n <= 0 || (size_t)n >= sizeof(requestPath)) return false;
+  
+  if (supabase.get(requestPath) != 200) return false;
+  size_t length = supabase.readBody(requestResponse, sizeof(requestResponse));
+  return !deserializeJson(requestDoc, requestResponse, length) && requestDoc.is<JsonArray>();
 }
 
-// Web server handlers for remote control
-void handleRemoteDispense() {
-  // This would handle remote dispensing requests from the Flutter app
-  // Implementation would depend on your communication protocol
-}
\ No newline at end of file
+// 1 claimed, 0 someone else had it, -1 unknown (no answer)
+int claimDispenseRequest(const char* id, const char* status) {
+  snprintf(requestPath, sizeof(requestPath), "/rest/v1/dispense_request?id=eq.%s&status=eq.pending&select=id", id);
+  char body[80];
+  size_t length = snprintf(body, sizeof(body), "{\"status\":\"%s\",\"claimed_by\":\"ESP32_001\"}", status);
+  int httpResponseCode = supabase.patch(requestPath, body, length, "Prefer: return=representation\r\n");
+  if (httpResponseCode != 200) return -1;
+  // The updated rows come back; none means the row was no longer pending
+  supabase.readBody(requestResponse, sizeof(requestResponse));
+  return strstr(requestResponse, id) ? 1 : 0;
+}
+
+// completed_at is stamped by the database trigger; there is no wall clock here
+bool completeDispenseRequest() {
+  snprintf(requestPath, sizeof(requestPath), "/rest/v1/dispense_request?id=eq.%s", activeRequestId);
+  char body[64];
+  size_t length = snprintf(body, sizeof(body), "{\"status\":\"completed\",\"dispensed_grams\":%d}",
+                           (int)(requestDispensedGrams + 0.5f));
+  int httpResponseCode = supabase.patch(requestPath, body, length, "Prefer: return=minimal\r\n");
+  if (shouldRetryUpload(httpResponseCode)) return false;
+  requestCompletionPending = false;
+  activeRequestId[0] = 0;
+  return true;
+}
+
+void encodeQueryValue(const char* value, char* out, size_t size) {
+  // Timestamps carry a '+' offset, which a query string would turn into a space
+  size_t n = 0;
+  for (; *value && n + 4 < size; value++) {
+    if (*value == '+') {
+      memcpy(out + n, "%2B", 3);
+      n += 3;
+    } else {
+      out[n++] = *value;
+    }
+  }
+  out[n] = 0;
+}
+
+uint8_t executeRemoteDispense(const DispenseCommand& command) {
+  if (command.grams == 0 || command.grams > MAX_REMOTE_DISPENSE_GRAMS) return DispenseCommand::STATUS_REJECTED;
+  if (isDispensing) return DispenseCommand::STATUS_BUSY;
+  Serial.printf("Remote dispense: %u g\n", (unsigned)command.grams);
+  startDispensing(command.grams);
+  // Audited in dispense_request once the gate has closed, like the history events
+  activeCommandKey = command.key;
+  commandDispensing = true;
+  queueCommandRow(command.key, command.grams, 0, false);
+  return DispenseCommand::STATUS_ACCEPTED;
+}
+
+void queueCommandRow(uint32_t key, float requestedGrams, float dispensedGrams, bool completed) {
+  QueuedCommand record = {key, (uint16_t)(requestedGrams + 0.5f), (uint16_t)(dispensedGrams + 0.5f), completed};
+  commandQueue.append(&record, sizeof(record));
+  commandQueue.sync();
+  if (!isDispensing) scheduler.trigger(replayTask);
+}
+
+// Inserts the command's row, or updates it if the display already inserted
+// it after giving up on the LAN; the triggers stamp claimed_at and completed_at
+int upsertCommandRow(const QueuedCommand& command) {
+  char id[40];
+  DispenseCommand::requestId(command.key, id, sizeof(id));
+  char body[200];
+  size_t length = snprintf(body, sizeof(body),
+                           "{\"id\":\"%s\",\"requested_grams\":%u,\"requested_cups\":%.2f,\"status\":\"%s\","
+                           "\"claimed_by\":\"ESP32_001\",\"dispensed_grams\":%u}",
+                           id, (unsigned)command.requestedGrams, command.requestedGrams / 200.0,
+                           command.completed ? "completed" : "dispensing", (unsigned)command.dispensedGrams);
+  return supabase.post("/rest/v1/dispense_request", body, length,
+                       "Prefer: resolution=merge-duplicates,return=minimal\r\n");
+}
\ No newline at end of file
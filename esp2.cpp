@@ -2,24 +2,52 @@
 // esp2.cpp - Environmental Sensors and Status LEDs
 
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
 #include <WiFiClient.h>
+#include <WiFiUdp.h>
 #include <ArduinoJson.h>
 #include <DHT.h>
+#include <LittleFS.h>
+#include "src/CooperativeScheduler.h"
+#include "src/TelemetryBatch.h"
+#include "src/PersistentHttp.h"
+#include "src/HeapMonitor.h"
+#include "src/OfflineQueue.h"
+#include "src/WifiLink.h"
+#include "src/DeadbandReporter.h"
+#include "src/UdpTelemetry.h"
+#include "src/LanState.h"
+#include "src/UltrasonicRanger.h"
 
 // WiFi credentials
 const char* ssid = "YOUR_WIFI_SSID";
 const char* password = "YOUR_WIFI_PASSWORD";
+WifiLink wifiLink; // connects in the background; sensing never waits for it
 
 // Supabase configuration
 const char* supabaseUrl = "YOUR_SUPABASE_URL";
 const char* supabaseKey = "YOUR_SUPABASE_KEY";
+PersistentHttp supabase; // one keep-alive socket for every Supabase call
+
+// Environment telemetry transport. TELEMETRY_UDP sends 28-byte frames to a
+// gateway on the LAN that acknowledges them and writes the rows; anything it
+// never acknowledged still goes to Supabase over REST.
+enum TelemetryMode { TELEMETRY_REST, TELEMETRY_UDP };
+TelemetryMode telemetryMode = TELEMETRY_REST;
+IPAddress telemetryGateway(192, 168, 1, 50);
+const uint16_t TELEMETRY_GATEWAY_PORT = 47800;
+const uint16_t TELEMETRY_DEVICE_ID = 2; // this controller's id at the gateway
+UdpTelemetry udpTelemetry(47801, 2000); // local port, retransmit after 2 s without an ack
+
+// Readings multicast to the display on the same LAN after every sensor read
+IPAddress lanStateGroup(239, 255, 42, 1);
+const uint16_t LAN_STATE_PORT = 47802;
+LanStatePublisher lanState(lanStateGroup, LAN_STATE_PORT, 2000, 0); // group, port, heartbeat ms, deadband mg
 
 // Hardware pins (ESP8266 NodeMCU)
 #define DHT_PIN           D2  // GPIO4
 #define DHT_TYPE          DHT22
-#define ULTRASONIC_TRIG   D8  // GPIO15
-#define ULTRASONIC_ECHO   D0  // GPIO16
+#define ULTRASONIC_TRIG   D0  // GPIO16
+#define ULTRASONIC_ECHO   D8  // GPIO15: the echo is timed by interrupt, which GPIO16 cannot raise
 #define STATUS_LED_RED    D1  // GPIO5
 #define STATUS_LED_GREEN  D7  // GPIO13
 #define STATUS_LED_BLUE   D6  // GPIO12
@@ -27,15 +55,63 @@ const char* supabaseKey = "YOUR_SUPABASE_KEY";
 
 // Hardware objects
 DHT dht(DHT_PIN, DHT_TYPE);
+UltrasonicRanger ranger; // pings in the background, median of each burst
 
 // System state
 float temperature = 0.0;
 float humidity = 0.0;
 float containerLevel = 0.0;
-unsigned long lastSensorRead = 0;
-unsigned long lastDataSend = 0;
+unsigned long firstReportMs = 0; // boot to the first accepted upload, 0 until then
 const unsigned long SENSOR_READ_INTERVAL = 2000;  // 2 seconds
-const unsigned long DATA_SEND_INTERVAL = 10000;   // 10 seconds
+const unsigned long DATA_SEND_INTERVAL = 2000;    // deadband check after each sensor read
+const unsigned long ALERT_CHECK_INTERVAL = 1000;  // 1 second
+const unsigned long STATS_REPORT_INTERVAL = 60000; // 1 minute
+const unsigned long HEAP_SAMPLE_INTERVAL = 1000;   // 1 second
+const unsigned long WIFI_CHECK_INTERVAL = 100;     // link state poll
+const unsigned long ALERT_BEEP_INTERVAL = 200;     // buzzer on/off steps of an alert
+const uint8_t ALERT_BEEP_STEPS = 6;                // three beeps
+const unsigned long ULTRASONIC_BURST_TIME = UltrasonicRanger::BURST_PINGS * UltrasonicRanger::PING_SPACING_MS; // last echo collected here
+
+// Task scheduler
+CooperativeScheduler scheduler;
+uint8_t telemetryTask;
+uint8_t sensorsTask;
+uint8_t rangerTask;
+uint8_t beepTask;
+uint8_t beepStepsLeft = 0;
+
+// Environment is reported by exception: a row when any signal moves more than
+// its deadband, and a heartbeat row when none has for 15 minutes
+const unsigned long ENVIRONMENT_HEARTBEAT_INTERVAL = 900000;
+DeadbandReporter temperatureReport(0.5, ENVIRONMENT_HEARTBEAT_INTERVAL);   // degrees C
+DeadbandReporter humidityReport(2.0, ENVIRONMENT_HEARTBEAT_INTERVAL);      // % RH
+DeadbandReporter containerLevelReport(2.0, ENVIRONMENT_HEARTBEAT_INTERVAL); // % full
+
+// While readings keep changing, rows are uploaded in bulk: every 12 rows or
+// 10 seconds at most
+struct EnvironmentSample {
+  float temperature;
+  float humidity;
+  float containerLevel;
+};
+const uint8_t ENVIRONMENT_BATCH_SIZE = 12;
+const unsigned long ENVIRONMENT_BATCH_MAX_AGE = 10000;
+TelemetryBatch<EnvironmentSample, 32> environmentBatch(ENVIRONMENT_BATCH_SIZE, ENVIRONMENT_BATCH_MAX_AGE);
+unsigned long lastEnvironmentFlush = 0;
+
+// Request bodies are serialized into static buffers so uploads never touch the heap
+const size_t ENVIRONMENT_ROW_BYTES = 120; // {"temperature":...,"humidity":...,"container_level":...,"timestamp":"..."},
+StaticJsonDocument<JSON_ARRAY_SIZE(ENVIRONMENT_BATCH_SIZE) + ENVIRONMENT_BATCH_SIZE * (JSON_OBJECT_SIZE(4) + 16)> environmentDoc;
+char environmentPayload[ENVIRONMENT_BATCH_SIZE * ENVIRONMENT_ROW_BYTES + 2];
+HeapMonitor heapMonitor;
+
+// Uploads that cannot go out are kept on flash and replayed once WiFi is back
+struct QueuedEnvironment {
+  EnvironmentSample sample;
+  uint32_t takenAt;
+};
+OfflineQueue environmentQueue("/queue/environment", 8192, 8); // 64 KB, about 9 hours of samples
+const unsigned long REPLAY_INTERVAL = 1000; // at most one replayed bulk request per second
 
 // Container specifications
 const float CONTAINER_HEIGHT_CM = 30.0; // Adjust based on your container
@@ -49,14 +125,40 @@ void setup() {
   pinMode(STATUS_LED_GREEN, OUTPUT);
   pinMode(STATUS_LED_BLUE, OUTPUT);
   pinMode(BUZZER_PIN, OUTPUT);
-  pinMode(ULTRASONIC_TRIG, OUTPUT);
-  pinMode(ULTRASONIC_ECHO, INPUT);
+  digitalWrite(BUZZER_PIN, LOW); // quiet until an alert
   
   // Initialize sensors
   dht.begin();
+  ranger.begin(ULTRASONIC_TRIG, ULTRASONIC_ECHO);
   
-  // Connect to WiFi
+  // Cached WiFi lease and anything stored while offline live here
+  LittleFS.begin();
+  environmentQueue.begin();
+  
+  // Start connecting to WiFi; the wifi task finishes the job
   connectToWiFi();
+  supabase.begin(supabaseUrl, supabaseKey);
+  if (telemetryMode == TELEMETRY_UDP) {
+    udpTelemetry.begin(TELEMETRY_DEVICE_ID, telemetryGateway, TELEMETRY_GATEWAY_PORT);
+    udpTelemetry.onEvicted(spillEnvironmentFrame);
+  }
+  lanState.begin(TELEMETRY_DEVICE_ID);
+  
+  // Register periodic tasks (period, deadline in ms)
+  sensorsTask = scheduler.addTask("sensors", sampleSensors, SENSOR_READ_INTERVAL, 500);
+  telemetryTask = scheduler.addTask("telemetry", sendSensorData, DATA_SEND_INTERVAL, 1000);
+  rangerTask = scheduler.addTask("ranger", serviceRanger, UltrasonicRanger::PING_SPACING_MS, 10);
+  scheduler.addTask("alerts", checkEnvironmentalAlerts, ALERT_CHECK_INTERVAL, ALERT_CHECK_INTERVAL);
+  scheduler.addTask("stats", reportSchedulerStats, STATS_REPORT_INTERVAL, 1000);
+  scheduler.addTask("heap", sampleHeap, HEAP_SAMPLE_INTERVAL, 1000);
+  scheduler.addTask("replay", replayOfflineQueue, REPLAY_INTERVAL, 1000);
+  scheduler.addTask("wifi", maintainWiFi, WIFI_CHECK_INTERVAL, WIFI_CHECK_INTERVAL);
+  beepTask = scheduler.addTask("beep", stepAlertBeep, ALERT_BEEP_INTERVAL, 50, false);
+  
+  // The first level comes from a burst started now; read and report after it
+  ranger.startBurst();
+  scheduler.triggerIn(sensorsTask, ULTRASONIC_BURST_TIME);
+  scheduler.triggerIn(telemetryTask, ULTRASONIC_BURST_TIME);
   
   // Initial status indication
   setStatusLED(0, 255, 0); // Green - ready
@@ -64,41 +166,62 @@ void setup() {
 }
 
 void loop() {
-  unsigned long currentTime = millis();
-  
-  // Read sensors periodically
-  if (currentTime - lastSensorRead >= SENSOR_READ_INTERVAL) {
-    readSensors();
-    updateStatusLED();
-    lastSensorRead = currentTime;
-  }
-  
-  // Send data to server periodically
-  if (currentTime - lastDataSend >= DATA_SEND_INTERVAL) {
-    sendSensorData();
-    lastDataSend = currentTime;
-  }
-  
-  // Check for environmental alerts
-  checkEnvironmentalAlerts();
-  
-  delay(100);
+  // Run whatever is due, then sleep until the next task release
+  scheduler.runDueTasks();
+  scheduler.sleepUntilNextTask();
+}
+
+void sampleSensors() {
+  readSensors();
+  publishLanState();
+  updateStatusLED();
+}
+
+void publishLanState() {
+  TelemetryFrame frame = TelemetryFrame::state(TELEMETRY_DEVICE_ID);
+  EnvironmentSample sample = {temperature, humidity, containerLevel};
+  setEnvironmentFields(frame, sample);
+  lanState.publish(frame, millis());
+}
+
+void reportSchedulerStats() {
+  scheduler.printStats(Serial);
+  wifiLink.printStats(Serial);
+  supabase.printStats(Serial);
+  if (telemetryMode == TELEMETRY_UDP) udpTelemetry.printStats(Serial);
+  lanState.printStats(Serial);
+  ranger.printStats(Serial);
+  heapMonitor.printStats(Serial);
+  temperatureReport.printStats(Serial, "temperature");
+  humidityReport.printStats(Serial, "humidity");
+  containerLevelReport.printStats(Serial, "container level");
+  environmentQueue.printStats(Serial);
+}
+
+void sampleHeap() {
+  heapMonitor.sample();
 }
 
 void connectToWiFi() {
-  WiFi.begin(ssid, password);
-  Serial.print("Connecting to WiFi");
+  wifiLink.begin(ssid, password);
+  Serial.println("Connecting to WiFi");
+  setStatusLED(255, 255, 0); // Yellow - connecting
+}
+
+void maintainWiFi() {
+  if (!wifiLink.update()) return;
   
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-    setStatusLED(255, 255, 0); // Yellow - connecting
+  if (wifiLink.isConnected()) {
+    Serial.printf("Connected in %lu ms%s! IP address: ", wifiLink.lastConnectMs(),
+                  wifiLink.usedCachedLease() ? " (cached AP and IP)" : "");
+    Serial.println(WiFi.localIP());
+    // First sample goes out right away, once the first ping burst has given a level
+    if (firstReportMs == 0 && scheduler.stats(sensorsTask).runs > 0) scheduler.trigger(telemetryTask);
+  } else {
+    Serial.println("WiFi lost, reconnecting in the background");
+    supabase.stop(); // the old socket is dead; don't wait for it to time out
   }
-  
-  Serial.println();
-  Serial.print("Connected! IP address: ");
-  Serial.println(WiFi.localIP());
-  setStatusLED(0, 255, 0); // Green - connected
+  updateStatusLED();
 }
 
 void readSensors() {
@@ -106,8 +229,12 @@ void readSensors() {
   temperature = dht.readTemperature();
   humidity = dht.readHumidity();
   
-  // Read ultrasonic sensor for container level
+  // Container level from the last ping burst; the next one starts now,
+  // timed with the speed of sound at this temperature
   containerLevel = readUltrasonicLevel();
+  ranger.setTemperature(temperature);
+  ranger.startBurst();
+  scheduler.setEnabled(rangerTask, true);
   
   // Print sensor values
   Serial.print("Temperature: ");
@@ -120,63 +247,181 @@ void readSensors() {
 }
 
 float readUltrasonicLevel() {
-  // Trigger ultrasonic sensor
-  digitalWrite(ULTRASONIC_TRIG, LOW);
-  delayMicroseconds(2);
-  digitalWrite(ULTRASONIC_TRIG, HIGH);
-  delayMicroseconds(10);
-  digitalWrite(ULTRASONIC_TRIG, LOW);
-  
-  // Read echo
-  long duration = pulseIn(ULTRASONIC_ECHO, HIGH);
-  float distance = (duration * 0.034) / 2; // Convert to cm
+  // Until a burst has enough echoes, keep the level we have
+  if (!ranger.hasDistance()) return containerLevel;
+  float distance = ranger.distanceCm();
   
   // Convert distance to level percentage
   float level = ((EMPTY_DISTANCE_CM - distance) / EMPTY_DISTANCE_CM) * 100.0;
   return constrain(level, 0, 100);
 }
 
+void serviceRanger() {
+  // One ping per run; the task sleeps between bursts
+  if (!ranger.update()) scheduler.setEnabled(rangerTask, false);
+}
+
 void sendSensorData() {
-  if (WiFi.status() != WL_CONNECTED) {
-    connectToWiFi();
-    return;
+  // Record a row only when a reading moved past its deadband or the heartbeat
+  // is due; the row carries all three readings. The first change after a
+  // quiet spell goes out at once; while readings keep moving, rows are batched.
+  if (telemetryMode == TELEMETRY_UDP) pollEnvironmentFrames();
+  unsigned long now = millis();
+  if (temperatureReport.due(temperature, now) || humidityReport.due(humidity, now) ||
+      containerLevelReport.due(containerLevel, now)) {
+    bool quiet = environmentBatch.size() == 0 &&
+                 (lastEnvironmentFlush == 0 || now - lastEnvironmentFlush >= ENVIRONMENT_BATCH_MAX_AGE);
+    temperatureReport.reported(temperature, now);
+    humidityReport.reported(humidity, now);
+    containerLevelReport.reported(containerLevel, now);
+    EnvironmentSample sample = {temperature, humidity, containerLevel};
+    if (telemetryMode == TELEMETRY_UDP) {
+      sendEnvironmentFrame(sample, now); // one datagram per row; nothing to batch
+      return;
+    }
+    environmentBatch.add(sample, now);
+    if (quiet && wifiLink.isConnected()) {
+      flushEnvironmentBatch();
+      return;
+    }
+  } else {
+    temperatureReport.skipped();
+    humidityReport.skipped();
+    containerLevelReport.skipped();
   }
   
-  WiFiClient client;
-  HTTPClient http;
-  
-  String url = String(supabaseUrl) + "/rest/v1/environmental_data";
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Authorization", "Bearer " + String(supabaseKey));
-  http.addHeader("apikey", supabaseKey);
-  
-  // Create JSON payload
-  StaticJsonDocument<200> doc;
-  doc["temperature"] = temperature;
-  doc["humidity"] = humidity;
-  doc["container_level"] = containerLevel;
-  doc["timestamp"] = getTimestamp();
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  int httpResponseCode = http.POST(jsonString);
-  
-  if (httpResponseCode > 0) {
-    Serial.print("HTTP Response: ");
-    Serial.println(httpResponseCode);
-  } else {
+  // The first row after boot goes out as soon as WiFi is up
+  bool firstReport = firstReportMs == 0 && wifiLink.isConnected();
+  if (environmentBatch.size() > 0 && (environmentBatch.due(now) || firstReport)) {
+    flushEnvironmentBatch();
+  }
+}
+
+void flushEnvironmentBatch() {
+  lastEnvironmentFlush = millis();
+  // Never wait for WiFi here: the wifi task reconnects in the background
+  if (wifiLink.isConnected()) {
+    // One JSON array, inserted by PostgREST as one row per element. A backlog
+    // larger than one batch goes out over the next uploads.
+    uint8_t rowCount = min(environmentBatch.size(), ENVIRONMENT_BATCH_SIZE);
+    JsonArray rows = environmentDoc.to<JsonArray>();
+    for (uint8_t i = 0; i < rowCount; i++) {
+      addEnvironmentRow(rows, environmentBatch.at(i), environmentBatch.takenAtMs(i));
+    }
+    
+    int httpResponseCode = postEnvironmentRows();
+    if (httpResponseCode >= 200 && httpResponseCode < 300) {
+      environmentBatch.consume(rowCount);
+      if (firstReportMs == 0) {
+        firstReportMs = millis();
+        Serial.printf("First report %lu ms after boot\n", firstReportMs);
+      }
+      Serial.print("HTTP Response: ");
+      Serial.print(httpResponseCode);
+      Serial.print(", ");
+      Serial.print(rowCount);
+      Serial.println(" samples");
+      return;
+    }
     Serial.print("HTTP Error: ");
     Serial.println(httpResponseCode);
   }
   
-  http.end();
+  // Offline or rejected: move the batch to flash so it survives the outage
+  uint8_t spilled = 0;
+  while (spilled < environmentBatch.size()) {
+    QueuedEnvironment queued = {environmentBatch.at(spilled), (uint32_t)environmentBatch.takenAtMs(spilled)};
+    if (!environmentQueue.append(&queued, sizeof(queued))) break;
+    spilled++;
+  }
+  environmentQueue.sync();
+  environmentBatch.consume(spilled);
+}
+
+void sendEnvironmentFrame(const EnvironmentSample& sample, unsigned long takenAtMs) {
+  TelemetryFrame frame = TelemetryFrame::data(TELEMETRY_DEVICE_ID);
+  frame.takenAtMs = takenAtMs;
+  setEnvironmentFields(frame, sample);
+  udpTelemetry.send(frame);
+}
+
+void setEnvironmentFields(TelemetryFrame& frame, const EnvironmentSample& sample) {
+  // A failed DHT read is NAN; leave that field out rather than send garbage
+  if (!isnan(sample.temperature)) {
+    frame.temperatureCentiC = TelemetryFrame::toCentiSigned(sample.temperature);
+    frame.fields |= TelemetryFrame::HAS_TEMPERATURE;
+  }
+  if (!isnan(sample.humidity)) {
+    frame.humidityCentiPct = TelemetryFrame::toCenti(sample.humidity);
+    frame.fields |= TelemetryFrame::HAS_HUMIDITY;
+  }
+  frame.levelCentiPct = TelemetryFrame::toCenti(sample.containerLevel);
+  frame.fields |= TelemetryFrame::HAS_LEVEL;
+}
+
+void pollEnvironmentFrames() {
+  // Collect acks and resend what the gateway has not confirmed
+  udpTelemetry.poll();
+  if (firstReportMs == 0 && udpTelemetry.statistics().acked > 0) {
+    firstReportMs = millis();
+    Serial.printf("First report %lu ms after boot\n", firstReportMs);
+  }
+}
+
+void spillEnvironmentFrame(const TelemetryFrame& frame) {
+  // No ack for a whole window of frames: keep the row for the REST replay
+  EnvironmentSample sample = {NAN, NAN, frame.levelCentiPct / 100.0f};
+  if (frame.fields & TelemetryFrame::HAS_TEMPERATURE) sample.temperature = frame.temperatureCentiC / 100.0f;
+  if (frame.fields & TelemetryFrame::HAS_HUMIDITY) sample.humidity = frame.humidityCentiPct / 100.0f;
+  QueuedEnvironment queued = {sample, frame.takenAtMs};
+  if (environmentQueue.append(&queued, sizeof(queued))) environmentQueue.sync();
+}
+
+void addEnvironmentRow(JsonArray rows, const EnvironmentSample& sample, unsigned long takenAtMs) {
+  char takenAt[11]; // when the sample was taken; copied into environmentDoc
+  getTimestamp(takenAtMs, takenAt, sizeof(takenAt));
+  JsonObject row = rows.createNestedObject();
+  row["temperature"] = sample.temperature;
+  row["humidity"] = sample.humidity;
+  row["container_level"] = sample.containerLevel;
+  row["timestamp"] = takenAt;
+}
+
+int postEnvironmentRows() {
+  size_t payloadLength = serializeJson(environmentDoc, environmentPayload, sizeof(environmentPayload));
+  if (environmentDoc.overflowed() || payloadLength >= sizeof(environmentPayload) - 1) {
+    Serial.println("Environment batch does not fit the payload buffer");
+    return PersistentHttp::ERROR_REQUEST_TOO_LARGE;
+  }
+  return supabase.post("/rest/v1/environmental_data", environmentPayload, payloadLength,
+                       "Prefer: return=minimal\r\n");
+}
+
+void replayOfflineQueue() {
+  // One bulk request per run keeps the drain from hogging the loop or the link
+  if (!wifiLink.isConnected() || environmentQueue.isEmpty()) return;
+  
+  JsonArray rows = environmentDoc.to<JsonArray>();
+  uint16_t count = environmentQueue.peek(ENVIRONMENT_BATCH_SIZE, [&](const uint8_t* data, uint8_t length) {
+    if (length != sizeof(QueuedEnvironment)) return;
+    QueuedEnvironment queued;
+    memcpy(&queued, data, sizeof(queued));
+    addEnvironmentRow(rows, queued.sample, queued.takenAt);
+  });
+  if (count > 0 && !shouldRetryUpload(postEnvironmentRows())) environmentQueue.consume();
+}
+
+bool shouldRetryUpload(int httpResponseCode) {
+  if (httpResponseCode >= 200 && httpResponseCode < 300) return false;
+  // These fail the same way every time; drop them rather than block the queue
+  if (httpResponseCode == PersistentHttp::ERROR_REQUEST_TOO_LARGE) return false;
+  bool throttled = httpResponseCode == 408 || httpResponseCode == 429;
+  return httpResponseCode < 400 || httpResponseCode >= 500 || throttled;
 }
 
 void updateStatusLED() {
   // Set LED color based on system status
-  if (WiFi.status() != WL_CONNECTED) {
+  if (!wifiLink.isConnected()) {
     setStatusLED(255, 255, 0); // Yellow - no WiFi
   } else if (containerLevel < 10) {
     setStatusLED(255, 0, 0); // Red - low level
@@ -208,15 +453,18 @@ void checkEnvironmentalAlerts() {
 }
 
 void soundAlert() {
-  for (int i = 0; i < 3; i++) {
-    digitalWrite(BUZZER_PIN, HIGH);
-    delay(200);
-    digitalWrite(BUZZER_PIN, LOW);
-    delay(200);
-  }
+  // Beeps from a task so the ranger and the uploads keep their timing
+  beepStepsLeft = ALERT_BEEP_STEPS;
+  scheduler.setEnabled(beepTask, true);
+}
+
+void stepAlertBeep() {
+  beepStepsLeft--;
+  digitalWrite(BUZZER_PIN, beepStepsLeft % 2 ? HIGH : LOW); // ends off
+  if (beepStepsLeft == 0) scheduler.setEnabled(beepTask, false);
 }
 
-String getTimestamp() {
+void getTimestamp(unsigned long deviceMillis, char* timestamp, size_t size) {
   // Simple timestamp - in production, sync with NTP
-  return String(millis());
+  snprintf(timestamp, size, "%lu", deviceMillis);
 }
\ No newline at end of file
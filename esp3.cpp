@@ -2,26 +2,62 @@
 // esp3.cpp - OLED Display and User Interface
 
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
 #include <WiFiClient.h>
 #include <ArduinoJson.h>
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
+#include <LittleFS.h>
+#include "src/CooperativeScheduler.h"
+#include "src/PersistentHttp.h"
+#include "src/HeapMonitor.h"
+#include "src/WifiLink.h"
+#include "src/LanState.h"
+#include "src/DispenseCommand.h"
+#include "src/RealtimeChannel.h"
+#include "src/OledFlusher.h"
+#include "src/RotaryEncoder.h"
+#include "src/ButtonEvents.h"
 
 // WiFi credentials
 const char* ssid = "YOUR_WIFI_SSID";
 const char* password = "YOUR_WIFI_PASSWORD";
+WifiLink wifiLink; // connects in the background; the menus never wait for it
 
 // Supabase configuration
 const char* supabaseUrl = "YOUR_SUPABASE_URL";
 const char* supabaseKey = "YOUR_SUPABASE_KEY";
+PersistentHttp supabase; // one keep-alive socket for every Supabase call
+
+// New rice_weight rows are pushed over one websocket as they are inserted.
+// While it is joined, the GET poll only runs as a slow resync; it is back at
+// DATA_FETCH_INTERVAL whenever the socket is down. Two TLS sessions do not
+// fit in the heap: while the websocket is open, the REST socket is closed
+// after every request, and it is only kept alive while the websocket is down.
+RealtimeChannel realtime;
+
+// The other controllers multicast their state on the LAN: weight and dispense
+// status from the main controller, temperature, humidity and container level
+// from the sensor controller. Supabase is only asked for the weight while the
+// main controller has gone quiet.
+IPAddress lanStateGroup(239, 255, 42, 1);
+const uint16_t LAN_STATE_PORT = 47802;
+const uint16_t SCALE_DEVICE_ID = 1;            // esp1
+const unsigned long LAN_STATE_TIMEOUT = 5000;  // several missed heartbeats: fall back to Supabase
+LanStateListener lanState(lanStateGroup, LAN_STATE_PORT);
+
+// Dispense requests go straight to the main controller, at the address its
+// state frames come from; Supabase only gets them while it is not on the LAN
+const uint16_t DISPENSE_COMMAND_PORT = 47803;
+const char* dispenseSecret = "YOUR_DISPENSE_SECRET"; // same as on the main controller
+DispenseCommandClient dispenseCommand(47804, 50, 6); // local port, repeat every 50 ms, 6 attempts
 
 // Display configuration
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
 #define OLED_RESET     -1
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+OledFlusher<SCREEN_WIDTH, SCREEN_HEIGHT> oled(display, Wire); // changed spans go out in slices between the other tasks
 
 // Hardware pins (ESP8266 NodeMCU)
 #define BUTTON_UP     D3  // GPIO0
@@ -31,6 +67,12 @@ Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 #define ENCODER_B     D6  // GPIO12
 #define BACKLIGHT_PIN D7  // GPIO13
 
+RotaryEncoder encoder; // decoded in the pin interrupts, read by the button task
+ButtonEvents buttons;  // debounced press/hold/repeat events, timestamped at the edge
+uint8_t buttonUp;
+uint8_t buttonDown;
+uint8_t buttonSelect;
+
 // System state
 struct SystemData {
   float currentWeight;
@@ -46,12 +88,39 @@ SystemData systemData;
 int currentMenu = 0;
 int selectedAmount = 100; // grams
 bool backlightOn = true;
-unsigned long lastDataFetch = 0;
-unsigned long lastDisplayUpdate = 0;
 unsigned long lastButtonPress = 0;
 const unsigned long DATA_FETCH_INTERVAL = 5000;   // 5 seconds
 const unsigned long DISPLAY_UPDATE_INTERVAL = 500; // 0.5 seconds
 const unsigned long BACKLIGHT_TIMEOUT = 30000;    // 30 seconds
+const unsigned long BUTTON_SCAN_INTERVAL = 20;    // 20 ms
+const unsigned long BACKLIGHT_CHECK_INTERVAL = 1000; // 1 second
+const unsigned long STATS_REPORT_INTERVAL = 60000; // 1 minute
+const unsigned long HEAP_SAMPLE_INTERVAL = 1000;   // 1 second
+const unsigned long WIFI_CHECK_INTERVAL = 100;     // link state poll
+const unsigned long LAN_POLL_INTERVAL = 20;        // state frames and command results wait at most this long
+const unsigned long NOTICE_DURATION = 2000;        // confirmation shown in place of the menu
+const unsigned long REALTIME_POLL_INTERVAL = 20;   // pushed rows reach the screen in the next display frame
+const unsigned long REALTIME_RESYNC_INTERVAL = 600000; // 10 minutes: GET anyway while subscribed
+const unsigned long OLED_PUMP_INTERVAL = 1;        // slices run back to back while a frame is in flight
+const uint32_t OLED_SLICE_BYTES = 32;              // about 0.8 ms of bus time per slice at 400 kHz
+
+// Request bodies live in static buffers and responses are parsed straight off
+// the socket, so network calls never touch the heap. The filters keep only the
+// two fields the screen shows, so the documents stay small whatever the rows hold.
+char requestPayload[192];
+StaticJsonDocument<64> weightRowFilter;   // [{"weight_grams":true,"level_state":true}]
+StaticJsonDocument<128> realtimeFilter;   // the same fields under payload.data.record
+StaticJsonDocument<128> weightRowDoc;
+StaticJsonDocument<192> realtimeDoc;
+HeapMonitor heapMonitor;
+
+// Task scheduler
+CooperativeScheduler scheduler;
+uint8_t fetchTask;
+uint8_t displayTask;
+uint8_t oledTask;
+bool realtimeJoined = false;
+unsigned long firstDataMs = 0; // boot to the first successful fetch, 0 until then
 
 // Menu system
 enum MenuState {
@@ -62,16 +131,17 @@ enum MenuState {
 };
 
 MenuState currentMenuState = MENU_HOME;
+const char* notice = nullptr; // shown instead of the menu until noticeUntil
+unsigned long noticeUntil = 0;
 
 void setup() {
   Serial.begin(115200);
   
   // Initialize hardware
-  pinMode(BUTTON_UP, INPUT_PULLUP);
-  pinMode(BUTTON_DOWN, INPUT_PULLUP);
-  pinMode(BUTTON_SELECT, INPUT_PULLUP);
-  pinMode(ENCODER_A, INPUT_PULLUP);
-  pinMode(ENCODER_B, INPUT_PULLUP);
+  buttonUp = buttons.add(BUTTON_UP);
+  buttonDown = buttons.add(BUTTON_DOWN);
+  buttonSelect = buttons.add(BUTTON_SELECT); // GPIO16 has no interrupt; sampled by the scan
+  encoder.begin(ENCODER_A, ENCODER_B);
   pinMode(BACKLIGHT_PIN, OUTPUT);
   
   // Initialize display
@@ -88,68 +158,89 @@ void setup() {
   display.println(F("Initializing..."));
   display.display();
   
-  // Connect to WiFi
+  // Start connecting to WiFi from the cached lease; the wifi task finishes the job
+  LittleFS.begin();
+  WiFi.setSleepMode(WIFI_NONE_SLEEP); // modem sleep holds multicast back until the DTIM beacon
   connectToWiFi();
+  supabase.begin(supabaseUrl, supabaseKey);
+  if (!realtime.begin(supabaseUrl, supabaseKey, "rice_weight")) {
+    Serial.println("Realtime URL not understood; polling Supabase instead");
+  }
+  dispenseCommand.begin(dispenseSecret);
+  dispenseCommand.onResult(showDispenseResult);
   
   // Initialize system data
   initializeSystemData();
+  buildJsonFilters();
   
   // Turn on backlight
   digitalWrite(BACKLIGHT_PIN, HIGH);
   
+  // Register periodic tasks (period, deadline in ms)
+  scheduler.addTask("buttons", handleButtons, BUTTON_SCAN_INTERVAL, BUTTON_SCAN_INTERVAL);
+  displayTask = scheduler.addTask("display", updateDisplay, DISPLAY_UPDATE_INTERVAL, 100);
+  oledTask = scheduler.addTask("oled", pumpDisplay, OLED_PUMP_INTERVAL, 10, false);
+  fetchTask = scheduler.addTask("fetch", fetchSystemData, DATA_FETCH_INTERVAL, 1000);
+  scheduler.addTask("backlight", checkBacklightTimeout, BACKLIGHT_CHECK_INTERVAL, BACKLIGHT_CHECK_INTERVAL);
+  scheduler.addTask("stats", reportSchedulerStats, STATS_REPORT_INTERVAL, 1000);
+  scheduler.addTask("heap", sampleHeap, HEAP_SAMPLE_INTERVAL, 1000);
+  scheduler.addTask("wifi", maintainWiFi, WIFI_CHECK_INTERVAL, WIFI_CHECK_INTERVAL);
+  scheduler.addTask("lan", serviceLan, LAN_POLL_INTERVAL, LAN_POLL_INTERVAL);
+  scheduler.addTask("realtime", serviceRealtime, REALTIME_POLL_INTERVAL, REALTIME_POLL_INTERVAL);
+  
   Serial.println("ESP8266 Display Controller Ready");
 }
 
 void loop() {
-  unsigned long currentTime = millis();
-  
-  // Handle button inputs
-  handleButtons();
-  
-  // Fetch data from server periodically
-  if (currentTime - lastDataFetch >= DATA_FETCH_INTERVAL) {
-    fetchSystemData();
-    lastDataFetch = currentTime;
-  }
-  
-  // Update display periodically
-  if (currentTime - lastDisplayUpdate >= DISPLAY_UPDATE_INTERVAL) {
-    updateDisplay();
-    lastDisplayUpdate = currentTime;
-  }
-  
-  // Handle backlight timeout
-  if (backlightOn && (currentTime - lastButtonPress > BACKLIGHT_TIMEOUT)) {
+  // Run whatever is due, then sleep until the next task release
+  scheduler.runDueTasks();
+  scheduler.sleepUntilNextTask();
+}
+
+void checkBacklightTimeout() {
+  if (backlightOn && (millis() - lastButtonPress > BACKLIGHT_TIMEOUT)) {
     digitalWrite(BACKLIGHT_PIN, LOW);
     backlightOn = false;
   }
-  
-  delay(50);
+}
+
+void reportSchedulerStats() {
+  scheduler.printStats(Serial);
+  wifiLink.printStats(Serial);
+  supabase.printStats(Serial);
+  realtime.printStats(Serial);
+  lanState.printStats(Serial);
+  dispenseCommand.printStats(Serial);
+  oled.printStats(Serial);
+  buttons.printStats(Serial);
+  encoder.printStats(Serial);
+  heapMonitor.printStats(Serial);
+}
+
+void sampleHeap() {
+  heapMonitor.sample();
 }
 
 void connectToWiFi() {
-  WiFi.begin(ssid, password);
-  Serial.print("Connecting to WiFi");
-  
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-    
-    display.clearDisplay();
-    display.setCursor(0, 20);
-    display.println(F("Connecting to WiFi..."));
-    display.display();
+  wifiLink.begin(ssid, password);
+  Serial.println("Connecting to WiFi");
+}
+
+void maintainWiFi() {
+  if (!wifiLink.update()) return;
+  
+  if (wifiLink.isConnected()) {
+    Serial.printf("Connected in %lu ms%s! IP address: ", wifiLink.lastConnectMs(),
+                  wifiLink.usedCachedLease() ? " (cached AP and IP)" : "");
+    Serial.println(WiFi.localIP());
+    lanState.begin(); // join the state group on the new address
+    scheduler.trigger(fetchTask); // don't leave the screen stale until the next fetch
+  } else {
+    Serial.println("WiFi lost, reconnecting in the background");
+    supabase.stop(); // the old socket is dead; don't wait for it to time out
+    realtime.stop();
+    systemData.isConnected = false;
   }
-  
-  Serial.println();
-  Serial.print("Connected! IP address: ");
-  Serial.println(WiFi.localIP());
-  
-  display.clearDisplay();
-  display.setCursor(0, 20);
-  display.println(F("WiFi Connected!"));
-  display.display();
-  delay(2000);
 }
 
 void initializeSystemData() {
@@ -162,47 +253,61 @@ void initializeSystemData() {
   systemData.isConnected = false;
 }
 
+void buildJsonFilters() {
+  JsonObject row = weightRowFilter.createNestedObject(); // applies to every element of the array
+  row["weight_grams"] = true;
+  row["level_state"] = true;
+  JsonObject record = realtimeFilter["payload"]["data"].createNestedObject("record");
+  record["weight_grams"] = true;
+  record["level_state"] = true;
+}
+
 void handleButtons() {
-  static bool buttonUpPressed = false;
-  static bool buttonDownPressed = false;
-  static bool buttonSelectPressed = false;
-  
-  bool upState = !digitalRead(BUTTON_UP);
-  bool downState = !digitalRead(BUTTON_DOWN);
-  bool selectState = !digitalRead(BUTTON_SELECT);
-  
-  // Button UP
-  if (upState && !buttonUpPressed) {
-    handleButtonUp();
-    lastButtonPress = millis();
-    if (!backlightOn) {
-      digitalWrite(BACKLIGHT_PIN, HIGH);
-      backlightOn = true;
+  // Debounced events in the order they happened, including presses made
+  // while loop() was blocked in HTTP
+  buttons.update();
+  ButtonEvent event;
+  while (buttons.read(event)) {
+    if (event.type == ButtonEvent::RELEASE) continue;
+    // Up and Down repeat while held; Select acts once per press
+    if (event.button == buttonUp) {
+      handleButtonUp();
+    } else if (event.button == buttonDown) {
+      handleButtonDown();
+    } else if (event.button == buttonSelect && event.type == ButtonEvent::PRESS) {
+      handleButtonSelect();
+    } else {
+      continue;
     }
+    registerInput();
   }
-  buttonUpPressed = upState;
   
-  // Button DOWN
-  if (downState && !buttonDownPressed) {
-    handleButtonDown();
-    lastButtonPress = millis();
-    if (!backlightOn) {
-      digitalWrite(BACKLIGHT_PIN, HIGH);
-      backlightOn = true;
-    }
+  // Encoder: every detent since the last scan, even if loop() was blocked
+  int steps = encoder.takeSteps();
+  if (steps != 0) {
+    handleEncoder(steps);
+    registerInput();
   }
-  buttonDownPressed = downState;
-  
-  // Button SELECT
-  if (selectState && !buttonSelectPressed) {
-    handleButtonSelect();
-    lastButtonPress = millis();
-    if (!backlightOn) {
-      digitalWrite(BACKLIGHT_PIN, HIGH);
-      backlightOn = true;
-    }
+}
+
+void registerInput() {
+  lastButtonPress = millis();
+  if (!backlightOn) {
+    digitalWrite(BACKLIGHT_PIN, HIGH);
+    backlightOn = true;
+  }
+  scheduler.trigger(displayTask);
+}
+
+void handleEncoder(int steps) {
+  // Clockwise turns up; a quick spin arrives as several steps at once
+  if (currentMenuState == MENU_DISPENSE) {
+    selectedAmount = constrain(selectedAmount + steps * 50, 50, 1000);
+  } else if (steps > 0) {
+    handleButtonUp();
+  } else {
+    handleButtonDown();
   }
-  buttonSelectPressed = selectState;
 }
 
 void handleButtonUp() {
@@ -260,6 +365,15 @@ void handleButtonSelect() {
 void updateDisplay() {
   display.clearDisplay();
   
+  if (notice && (long)(noticeUntil - millis()) > 0) {
+    display.setTextSize(1);
+    display.setCursor(0, 20);
+    display.println(notice);
+    presentDisplay();
+    return;
+  }
+  notice = nullptr;
+  
   switch (currentMenuState) {
     case MENU_HOME:
       drawHomeScreen();
@@ -275,7 +389,21 @@ void updateDisplay() {
       break;
   }
   
-  display.display();
+  presentDisplay();
+}
+
+void presentDisplay() {
+  // The frame is sent by the oled task; drawing the next one may start now
+  if (oled.present()) scheduler.setEnabled(oledTask, true);
+}
+
+void pumpDisplay() {
+  oled.pump(OLED_SLICE_BYTES);
+  if (oled.busy()) {
+    scheduler.trigger(oledTask); // next slice after whatever else is due
+  } else {
+    scheduler.setEnabled(oledTask, false);
+  }
 }
 
 void drawHomeScreen() {
@@ -338,7 +466,13 @@ void drawStatusScreen() {
   
   display.setCursor(0, 45);
   display.print(F("WiFi: "));
-  display.println(systemData.isConnected ? F("OK") : F("FAIL"));
+  if (!wifiLink.isConnected()) {
+    display.print(F("down "));
+    display.print(wifiLink.downtimeMs() / 1000);
+    display.println(F("s"));
+  } else {
+    display.println(systemData.isConnected ? F("OK") : F("FAIL"));
+  }
 }
 
 void drawSettingsScreen() {
@@ -358,82 +492,183 @@ void drawSettingsScreen() {
 }
 
 void fetchSystemData() {
-  if (WiFi.status() != WL_CONNECTED) {
+  if (!wifiLink.isConnected()) {
     systemData.isConnected = false;
     return;
   }
   
-  WiFiClient client;
-  HTTPClient http;
+  // The main controller's own frames are fresher than its last row in Supabase
+  if (lanState.heardFrom(SCALE_DEVICE_ID, LAN_STATE_TIMEOUT)) return;
   
   // Fetch latest rice weight
-  String url = String(supabaseUrl) + "/rest/v1/rice_weight?select=*&order=timestamp.desc&limit=1";
-  http.begin(client, url);
-  http.addHeader("Authorization", "Bearer " + String(supabaseKey));
-  http.addHeader("apikey", supabaseKey);
-  
-  int httpResponseCode = http.GET();
+  int httpResponseCode = supabase.get("/rest/v1/rice_weight?select=*&order=timestamp.desc&limit=1");
   
-  if (httpResponseCode == 200) {
-    String response = http.getString();
-    parseSystemData(response);
+  if (httpResponseCode == 200 && parseSystemData(supabase.body())) {
     systemData.isConnected = true;
+    recordFirstData();
   } else {
     systemData.isConnected = false;
   }
-  
-  http.end();
+  releaseRestSocket();
+}
+
+// Frees the REST socket's TLS buffers for the websocket while that is open
+void releaseRestSocket() {
+  if (realtime.open()) supabase.stop();
 }
 
-void parseSystemData(String jsonResponse) {
-  StaticJsonDocument<512> doc;
-  deserializeJson(doc, jsonResponse);
+void serviceRealtime() {
+  if (!wifiLink.isConnected()) return;
+  if (realtime.connectDue()) supabase.stop(); // the websocket's TLS session needs the heap
+  if (realtime.poll(applyRealtimeChange) > 0) {
+    systemData.isConnected = true;
+    recordFirstData();
+    scheduler.trigger(displayTask); // on screen in this pass, not at the next 500 ms tick
+  }
   
-  if (doc.size() > 0) {
-    JsonObject data = doc[0];
-    systemData.currentWeight = data["weight_grams"];
-    systemData.dispenserStatus = data["level_state"].as<String>();
+  if (realtime.joined() != realtimeJoined) {
+    realtimeJoined = realtime.joined();
+    // Pushes only carry rows inserted from now on: fetch the latest row once, then rarely
+    scheduler.setPeriod(fetchTask, realtimeJoined ? REALTIME_RESYNC_INTERVAL : DATA_FETCH_INTERVAL);
+    scheduler.trigger(fetchTask);
   }
 }
 
-void requestDispense(int grams) {
-  if (WiFi.status() != WL_CONNECTED) {
+void applyRealtimeChange(const char* message, size_t length) {
+  // The column list and the envelope are skipped while parsing
+  DeserializationError error = deserializeJson(realtimeDoc, message, length, DeserializationOption::Filter(realtimeFilter));
+  if (error) {
+    Serial.print("Realtime message not parsed: ");
+    Serial.println(error.c_str());
     return;
   }
+  applyWeightRow(realtimeDoc["payload"]["data"]["record"]);
+}
+
+void serviceLan() {
+  pollLanState();
+  dispenseCommand.poll();
+}
+
+void pollLanState() {
+  if (lanState.poll(applyLanState) > 0) {
+    systemData.isConnected = true;
+    recordFirstData();
+  }
+}
+
+void applyLanState(const TelemetryFrame& frame) {
+  if (frame.fields & TelemetryFrame::HAS_WEIGHT) systemData.currentWeight = frame.weightMg / 1000.0f;
+  if (frame.fields & TelemetryFrame::HAS_TEMPERATURE) systemData.temperature = frame.temperatureCentiC / 100.0f;
+  if (frame.fields & TelemetryFrame::HAS_HUMIDITY) systemData.humidity = frame.humidityCentiPct / 100.0f;
+  if (frame.fields & TelemetryFrame::HAS_LEVEL) systemData.containerLevel = frame.levelCentiPct / 100.0f;
+  if (frame.fields & TelemetryFrame::HAS_STATUS) {
+    // Literals into the same String: its buffer is reused, not reallocated
+    systemData.dispenserStatus = frame.status == TelemetryFrame::STATUS_DISPENSING ? "Dispensing"
+                               : frame.status == TelemetryFrame::STATUS_SETTLING ? "Settling"
+                               : "Ready";
+  }
+}
+
+void recordFirstData() {
+  if (firstDataMs == 0) {
+    firstDataMs = millis();
+    Serial.printf("First data %lu ms after boot\n", firstDataMs);
+  }
+}
+
+// Parses the rice_weight rows as they come off the socket; false if the body
+// was cut short, malformed or did not fit the document
+bool parseSystemData(Stream& body) {
+  DeserializationError error = deserializeJson(weightRowDoc, body, DeserializationOption::Filter(weightRowFilter));
+  if (error) {
+    Serial.print("Weight response not parsed: ");
+    Serial.println(error.c_str());
+    return false;
+  }
   
-  WiFiClient client;
-  HTTPClient http;
+  if (weightRowDoc.size() > 0) applyWeightRow(weightRowDoc[0]);
+  return true;
+}
+
+void applyWeightRow(JsonObject row) {
+  if (row.isNull()) return;
+  // The main controller's own frames are fresher than its rows in Supabase
+  if (!lanState.heardFrom(SCALE_DEVICE_ID, LAN_STATE_TIMEOUT)) systemData.currentWeight = row["weight_grams"];
+  const char* levelState = row["level_state"];
+  if (levelState) systemData.dispenserStatus = levelState; // reuses the String's buffer
+}
+
+void requestDispense(int grams) {
+  if (!wifiLink.isConnected()) {
+    return;
+  }
   
-  String url = String(supabaseUrl) + "/rest/v1/dispense_requests";
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Authorization", "Bearer " + String(supabaseKey));
-  http.addHeader("apikey", supabaseKey);
+  // The main controller answers within milliseconds; serviceLan() shows its result.
+  // A press while the last command is still unanswered is not sent at all.
+  if (lanState.heardFrom(SCALE_DEVICE_ID, LAN_STATE_TIMEOUT)) {
+    if (!dispenseCommand.send(lanState.addressOf(SCALE_DEVICE_ID), DISPENSE_COMMAND_PORT, grams)) {
+      showNotice("Dispenser busy");
+    }
+    return;
+  }
   
+  postDispenseRequest(grams, nullptr);
+}
+
+// Inserts a pending dispense_request row for the main controller to pick up;
+// false if Supabase did not answer. `id` is null for a new row, or the id of
+// a LAN command that went unanswered.
+bool postDispenseRequest(int grams, const char* id) {
   StaticJsonDocument<200> doc;
+  if (id) doc["id"] = id;
   doc["requested_grams"] = grams;
   doc["requested_cups"] = grams / 200.0;
   doc["status"] = "pending";
   doc["dispensed_grams"] = 0;
   
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  int httpResponseCode = http.POST(jsonString);
+  size_t payloadLength = serializeJson(doc, requestPayload, sizeof(requestPayload));
+  int httpResponseCode = supabase.post("/rest/v1/dispense_request", requestPayload, payloadLength);
+  releaseRestSocket();
+  if (httpResponseCode <= 0) return false;
   
-  if (httpResponseCode > 0) {
-    Serial.print("Dispense request sent: ");
-    Serial.println(httpResponseCode);
-    
-    // Show confirmation on display
-    display.clearDisplay();
-    display.setTextSize(1);
-    display.setCursor(0, 20);
-    display.println(F("Dispense Request"));
-    display.println(F("Sent!"));
-    display.display();
-    delay(2000);
+  Serial.print("Dispense request sent: ");
+  Serial.println(httpResponseCode);
+  if (httpResponseCode == 409) {
+    // The command got through after all and the main controller has already recorded it
+    showNotice("Dispensing...");
+  } else {
+    showNotice("Dispense Request\nSent!");
   }
-  
-  http.end();
+  return true;
+}
+
+void showDispenseResult(const DispenseCommand& result) {
+  Serial.printf("Dispense command %lu: status %u\n", (unsigned long)result.key, (unsigned)result.status);
+  switch (result.status) {
+    case DispenseCommand::STATUS_ACCEPTED:
+      showNotice("Dispensing...");
+      break;
+    case DispenseCommand::STATUS_BUSY:
+      showNotice("Dispenser busy");
+      break;
+    case DispenseCommand::STATUS_REJECTED:
+      showNotice("Amount not allowed");
+      break;
+    default: {
+      // Leave it in Supabase instead, under the command's own id, so the main
+      // controller cannot run it a second time if the command did arrive
+      char id[40];
+      DispenseCommand::requestId(result.key, id, sizeof(id));
+      if (!wifiLink.isConnected() || !postDispenseRequest(result.grams, id)) showNotice("Dispenser not\nanswering");
+      break;
+    }
+  }
+}
+
+void showNotice(const char* text) {
+  // Shown by updateDisplay() in place of the menu; nothing waits for it
+  notice = text;
+  noticeUntil = millis() + NOTICE_DURATION;
+  updateDisplay();
 }
\ No newline at end of file
@@ -0,0 +1,140 @@
+// Microbenchmark harness for the host build of the sketches
+//
+// Each benchmark reports two costs per call:
+//   wall ns   - host CPU time spent in the call (relative cost, not ESP cycles)
+//   block us  - simulated time the call kept loop() busy: HX711 conversion
+//               waits, delay(), TCP handshakes, request round trips, I2C
+// plus the network and I2C traffic it generated and the heap allocations
+// (String growth, DynamicJsonDocument pools) it made.
+
+#pragma once
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Arduino.h"
+#include "sim.h"
+
+namespace bench {
+
+struct Options {
+  uint32_t scaleDivisor = 1;
+
+  Options(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+      if (std::strcmp(argv[i], "--quick") == 0) scaleDivisor = 100;
+    }
+  }
+
+  uint32_t iterations(uint32_t full) const {
+    uint32_t n = full / scaleDivisor;
+    return n ? n : 1;
+  }
+};
+
+inline void header(const char* title) {
+  std::printf("\n%s\n", title);
+  std::printf("%-28s %8s %12s %12s %9s %9s %10s %10s %8s\n", "benchmark", "calls", "wall ns", "block us", "req",
+              "connects", "tx bytes", "i2c bytes", "allocs");
+}
+
+// Run `call` `iterations` times; `prepare` runs untimed before each call to
+// put the sketch into the state the call expects (e.g. let time pass).
+template <typename Prepare, typename Call>
+void run(const char* name, uint32_t iterations, Prepare prepare, Call call) {
+  uint64_t wallNanos = 0;
+  uint64_t blockedMicros = 0;
+  uint64_t requests = 0;
+  uint64_t connects = 0;
+  uint64_t txBytes = 0;
+  uint64_t i2cBytes = 0;
+  uint64_t allocations = 0;
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    prepare();
+    uint64_t simStart = sim::nowMicros();
+    uint64_t requestsStart = sim::net.requests;
+    uint64_t connectsStart = sim::net.connects;
+    uint64_t txStart = sim::net.bytesSent;
+    uint64_t i2cStart = sim::i2c.bytes;
+    uint64_t allocationsStart = sim::heap().allocations;
+    auto start = std::chrono::steady_clock::now();
+    call();
+    auto stop = std::chrono::steady_clock::now();
+    wallNanos += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    blockedMicros += sim::nowMicros() - simStart;
+    requests += sim::net.requests - requestsStart;
+    connects += sim::net.connects - connectsStart;
+    txBytes += sim::net.bytesSent - txStart;
+    i2cBytes += sim::i2c.bytes - i2cStart;
+    allocations += sim::heap().allocations - allocationsStart;
+  }
+
+  double n = iterations;
+  std::printf("%-28s %8u %12.0f %12.0f %9.2f %9.2f %10.0f %10.0f %8.2f\n", name, iterations, wallNanos / n,
+              blockedMicros / n, requests / n, connects / n, txBytes / n, i2cBytes / n, allocations / n);
+}
+
+template <typename Call>
+void run(const char* name, uint32_t iterations, Call call) {
+  run(name, iterations, [] {}, call);
+}
+
+// Print sink for sketch-side reports (scheduler stats etc.)
+class StdoutPrint : public Print {
+public:
+  size_t write(uint8_t c) override { return std::fputc(c, stdout) == EOF ? 0 : 1; }
+  using Print::write;
+};
+
+inline StdoutPrint& out() {
+  static StdoutPrint stdoutPrint;
+  return stdoutPrint;
+}
+
+// Run `boot` in a child process and return the non-volatile state it left
+// behind. The sketch's globals can only be initialised once per process, so
+// this is how a benchmark boots, "reboots" from the saved state, and still
+// continues with a fresh sketch in the parent.
+template <typename Boot>
+std::string bootInChild(Boot boot) {
+  std::fflush(stdout);
+  int fds[2];
+  if (pipe(fds) != 0) return std::string();
+  pid_t child = fork();
+  if (child == 0) {
+    close(fds[0]);
+    boot();
+    std::string state = sim::saveNonVolatile();
+    for (size_t sent = 0; sent < state.size();) {
+      ssize_t n = write(fds[1], state.data() + sent, state.size() - sent);
+      if (n <= 0) break;
+      sent += (size_t)n;
+    }
+    std::fflush(stdout);
+    _exit(0);
+  }
+  close(fds[1]);
+  std::string state;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) state.append(buffer, (size_t)n);
+  close(fds[0]);
+  waitpid(child, nullptr, 0);
+  return state;
+}
+
+// Drive the sketch's loop() for `ms` of simulated time
+template <typename Loop>
+void runLoopFor(unsigned long ms, Loop loop) {
+  uint64_t end = sim::nowMicros() + (uint64_t)ms * 1000;
+  while (sim::nowMicros() < end) loop();
+}
+
+}  // namespace bench
@@ -0,0 +1,786 @@
+// Microbenchmarks for esp1.cpp - load cell and motor control
+
+#include "esp1_sketch.cpp"
+
+#include "bench.h"
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace {
+
+// Synthetic HX711 stream: a 2 kg hopper draining at 40 g/s after 10 s, with
+// uniform noise and an occasional vibration spike
+struct RawStream {
+  std::vector<int32_t> raw;
+  std::vector<float> grams;
+};
+
+RawStream makeRawStream(size_t samples) {
+  RawStream stream;
+  uint32_t state = 1;
+  for (size_t i = 0; i < samples; i++) {
+    float seconds = i / 10.0f;
+    float grams = seconds < 10.0f ? 2000.0f : std::max(0.0f, 2000.0f - 40.0f * (seconds - 10.0f));
+    state = state * 1103515245u + 12345u;
+    float noise = ((state >> 8) & 0xFFFF) / 32767.5f - 1.0f;
+    int32_t counts = 84000 + (int32_t)(grams * CALIBRATION_FACTOR + noise * 3000.0f);
+    if (i % 23 == 7) counts += 60000;  // ~8 g spike
+    stream.raw.push_back(counts);
+    stream.grams.push_back(grams);
+  }
+  return stream;
+}
+
+// The pre-filter readWeight() path: float conversion, average of the last 5
+struct FloatAverage {
+  float window[5] = {};
+  uint8_t count = 0;
+  uint8_t next = 0;
+
+  float update(int32_t raw) {
+    window[next] = (raw - 84000) / CALIBRATION_FACTOR;
+    next = (next + 1) % 5;
+    if (count < 5) count++;
+    float sum = 0;
+    for (uint8_t i = 0; i < count; i++) sum += window[i];
+    return sum / count;
+  }
+};
+
+volatile float filterSink;
+
+// ns per sample, plus RMS error against the true load while the hopper is
+// still (noise and spikes) and while it drains (lag)
+template <typename Update>
+void benchFilter(const char* name, const RawStream& stream, uint32_t passes, Update update) {
+  double squaredError[2] = {0, 0};
+  size_t count[2] = {0, 0};
+  for (size_t i = 0; i < stream.raw.size(); i++) {
+    double error = update(stream.raw[i]) - stream.grams[i];
+    if (i < 20 || i >= 600) continue;  // let every filter settle; stop before empty
+    int draining = i >= 100;
+    squaredError[draining] += error * error;
+    count[draining]++;
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (int32_t raw : stream.raw) filterSink = update(raw);
+  }
+  auto stop = std::chrono::steady_clock::now();
+  double nanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+  std::printf("%-28s %12.1f %12.2f %12.2f\n", name, nanos / passes / stream.raw.size(),
+              std::sqrt(squaredError[0] / count[0]), std::sqrt(squaredError[1] / count[1]));
+}
+
+// One full dispense from a freshly filled hopper; returns ms from start to
+// gate closed and the grams that actually left the hopper
+void timedDispense(float target, double& closedAfterMs, double& dispensed) {
+  sim::hopper.grams = 1150.0;
+  bench::runLoopFor(3000, loop);
+  double before = sim::hopper.dispensedGrams;
+  unsigned long start = millis();
+  startDispensing(target);
+  while (isDispensing) loop();
+  closedAfterMs = gateClosedAt - start;
+  dispensed = sim::hopper.dispensedGrams - before;
+}
+
+WeightFilter makeFilter(WeightFilter::Smoothing smoothing, uint8_t medianWindow) {
+  WeightFilter::Config config;
+  config.smoothing = smoothing;
+  config.medianWindow = medianWindow;
+  WeightFilter filter;
+  filter.begin(config);
+  filter.setCalibration(84000, CALIBRATION_FACTOR);
+  return filter;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options(argc, argv);
+
+  // Boot from blank flash, then again after a power cycle (RTC memory lost,
+  // caches read from flash) and after a reset (RTC memory kept). The bench
+  // continues with the sketch from the last boot.
+  auto boot = [](const char* kind, const std::string& state, bool keepRtcMemory) {
+    sim::reset();
+    sim::hopper.enabled = true;
+    sim::hopper.grams = 0.0;  // tare with the hopper empty, then fill it
+    sim::hx711.noiseCounts = 400.0;
+    sim::restoreNonVolatile(state, keepRtcMemory);
+    supabaseUrl = "https://bench.supabase.co";
+    setup();
+    unsigned long setupMs = millis();
+    while (firstReportMs == 0 && millis() < 30000) loop();
+    std::printf("%-28s %12lu %12lu %12lu\n", kind, setupMs, wifiLink.lastConnectMs(), firstReportMs);
+  };
+  std::printf("\n%-28s %12s %12s %12s\n", "boot", "setup ms", "wifi ms", "report ms");
+  std::string bootState = bench::bootInChild([&] { boot("blank flash", std::string(), false); });
+  bench::bootInChild([&] { boot("power cycle", bootState, false); });
+  boot("reset", bootState, true);
+  sim::hopper.grams = 1000.0;  // about the HX711's full scale at this calibration
+
+  // Scheduler view of a simulated minute of normal operation
+  bench::runLoopFor(60000, loop);
+  std::printf("\nscheduler, 60 s idle:\n");
+  scheduler.printStats(bench::out());
+  std::printf("hx711: %lu conversions, %lu captured, %lu dropped\n", (unsigned long)sim::hx711.conversions,
+              (unsigned long)loadCellSampler.capturedCount(), (unsigned long)loadCellSampler.droppedCount());
+  heapMonitor.printStats(bench::out());
+
+  // A full hopper left alone for an hour should only send heartbeats. Then
+  // 50 g are scooped out; a row showing it should reach the server within
+  // seconds.
+  {
+    uint64_t rows = 0;
+    double lastRowGrams = 0;
+    sim::net.handler = [&](const sim::HttpRequest& request) {
+      sim::HttpResponse response;
+      if (request.path == "/rest/v1/rice_weights") {
+        rows += std::count(request.body.begin(), request.body.end(), '{');
+        size_t last = request.body.rfind("\"weight\":");
+        if (last != std::string::npos) lastRowGrams = std::atof(request.body.c_str() + last + 9);
+      }
+      return response;
+    };
+    bench::runLoopFor(30000, loop);  // the fill above is reported first
+    rows = 0;
+    uint32_t idleMs = options.iterations(3600000);
+    bench::runLoopFor(idleMs, loop);
+    uint64_t idleRows = rows;
+    double before = lastRowGrams;
+    sim::hopper.grams -= 50.0;
+    unsigned long removedAt = millis();
+    while (lastRowGrams > before - WEIGHT_DEADBAND_GRAMS && millis() - removedAt < 120000) loop();
+    std::printf("\nidle %.0f min: %llu weight rows (%.0f at a fixed 5 s interval); 50 g removed: row at the server "
+                "%.1f s later\n",
+                idleMs / 60000.0, (unsigned long long)idleRows, idleMs / 5000.0, (millis() - removedAt) / 1000.0);
+    weightReport.printStats(bench::out(), "weight");
+    bench::runLoopFor(10000, loop);
+    sim::net.handler = nullptr;
+  }
+
+  // Button press to servo opening. Presses land at pseudo-random points of
+  // the loop() cycle; dispensing runs to completion between trials. No
+  // weight upload may run while the gate is open.
+  uint32_t weightPostsWhileDispensing = 0;
+  sim::net.handler = [&](const sim::HttpRequest& request) {
+    if (isDispensing && request.path.find("/rest/v1/rice_weights") == 0) weightPostsWhileDispensing++;
+    return sim::HttpResponse();
+  };
+  uint32_t trials = options.iterations(200);
+  uint64_t totalLatency = 0;
+  uint64_t maxLatency = 0;
+  double firstError = 0;
+  double learnedAbsError = 0;
+  double learnedMaxError = 0;
+  uint32_t learnedTrials = 0;
+  for (uint32_t i = 0; i < trials; i++) {
+    if (sim::hopper.grams < 400.0) {
+      sim::hopper.grams = 1000.0;  // refill and let the filter settle
+      bench::runLoopFor(3000, loop);
+    }
+    bench::runLoopFor(500, loop);
+    double dispensedBefore = sim::hopper.dispensedGrams;
+    uint64_t pressed = sim::nowMicros() + (i * 7919) % 1000 * 1000;
+    sim::schedule(pressed, [] { sim::driveInput(BUTTON_PIN, LOW); });
+    while (sim::servo.openedMicros < pressed) loop();
+    uint64_t latency = sim::servo.openedMicros - pressed;
+    totalLatency += latency;
+    maxLatency = std::max(maxLatency, latency);
+    sim::driveInput(BUTTON_PIN, HIGH);
+    while (isDispensing) loop();
+
+    // What actually left the hopper against the 50 g request
+    double error = sim::hopper.dispensedGrams - dispensedBefore - targetWeight;
+    if (i == 0) firstError = error;
+    if (i >= trials / 2) {
+      learnedAbsError += std::fabs(error);
+      learnedMaxError = std::max(learnedMaxError, std::fabs(error));
+      learnedTrials++;
+    }
+  }
+  sim::net.handler = nullptr;
+  std::printf("\nbutton -> servo open: avg %.1f ms, max %.1f ms over %u presses; %u weight uploads while dispensing\n",
+              totalLatency / 1000.0 / trials, maxLatency / 1000.0, trials, weightPostsWhileDispensing);
+  if (weightPostsWhileDispensing) {
+    std::fprintf(stderr, "weight rows were uploaded while the gate was open\n");
+    return 1;
+  }
+  std::printf("dispense error: first %+.2f g; after learning avg %.2f g, max %.2f g (lag %.3f s)\n", firstError,
+              learnedTrials ? learnedAbsError / learnedTrials : 0.0, learnedMaxError,
+              cutoffPredictor.learned().lagSeconds);
+
+  // The learned model has to come back after a reboot
+  CutoffPredictor rebooted;
+  rebooted.begin(CUTOFF_MODEL_ADDRESS);
+  std::printf("cutoff model after reboot: lag %.3f s, %u dispenses, %llu EEPROM commits\n",
+              rebooted.learned().lagSeconds, (unsigned)rebooted.learned().dispenses,
+              (unsigned long long)sim::eeprom.commits);
+
+  // A bouncing press held for 10 s, then a tap made while loop() is stuck
+  // in a 2 s blocking call: each is one 50 g dispense
+  {
+    auto bounce = [](uint64_t at, int level) {
+      // 3 ms of contact bounce settling on `level`
+      for (int i = 0; i < 5; i++) {
+        int contact = i % 2 ? !level : level;
+        sim::schedule(at + i * 600, [contact] { sim::driveInput(BUTTON_PIN, contact); });
+      }
+    };
+    auto countStarts = [](unsigned long ms) {
+      uint32_t starts = 0;
+      bool was = isDispensing;
+      unsigned long start = millis();
+      while (millis() - start < ms) {
+        loop();
+        if (isDispensing && !was) starts++;
+        was = isDispensing;
+      }
+      return starts;
+    };
+    sim::hopper.grams = 1000.0;
+    bench::runLoopFor(3000, loop);
+    uint32_t edges = buttons.statistics().edges;
+    bounce(sim::nowMicros() + 1000, LOW);
+    bounce(sim::nowMicros() + 10000000, HIGH);
+    uint32_t held = countStarts(15000);
+    uint32_t heldEdges = buttons.statistics().edges - edges;
+
+    uint64_t tapAt = sim::nowMicros() + 500000;
+    bounce(tapAt, LOW);
+    bounce(tapAt + 150000, HIGH);
+    delay(2000);
+    uint64_t resumedAt = sim::nowMicros();
+    while (!isDispensing && sim::nowMicros() - resumedAt < 1000000) loop();
+    uint64_t startedAfter = sim::nowMicros() - resumedAt;
+    uint32_t tapped = isDispensing + countStarts(10000);
+    std::printf("held 10 s with bounce: %u dispense(s) from %u edges; tap during a 2 s block: %u dispense(s), "
+                "started %.1f ms after the loop resumed\n",
+                held, heldEdges, tapped, startedAfter / 1000.0);
+    buttons.printStats(bench::out());
+    if (held != 1 || tapped != 1) {
+      std::fprintf(stderr, "manual button started %u and %u dispenses instead of one each\n", held, tapped);
+      return 1;
+    }
+
+    // Interference on the button line: 20 spikes pulling it low for 50 us
+    // to 5 ms, none of them a press
+    for (int i = 0; i < 20; i++) {
+      uint64_t at = sim::nowMicros() + 1000 + i * 100000;
+      uint64_t width = 50 + (uint64_t)i * 250;
+      sim::schedule(at, [] { sim::driveInput(BUTTON_PIN, LOW); });
+      sim::schedule(at + width, [] { sim::driveInput(BUTTON_PIN, HIGH); });
+    }
+    uint32_t spiked = countStarts(3000);
+    std::printf("20 spikes of 50 us to 5 ms on the button line: %u dispense(s)\n", spiked);
+    if (spiked) {
+      std::fprintf(stderr, "a spike on the button line started %u dispenses\n", spiked);
+      return 1;
+    }
+  }
+
+  // Re-tare while running: holding the tare button with 1 kg on the scale
+  // makes that zero; emptying the hopper and holding it again brings the
+  // real weight back. Neither hold may start a dispense.
+  {
+    auto holdTare = [] {
+      uint32_t starts = 0;
+      sim::driveInput(TARE_BUTTON_PIN, LOW);
+      unsigned long start = millis();
+      while (millis() - start < 1000) {
+        loop();
+        starts += isDispensing;
+      }
+      sim::driveInput(TARE_BUTTON_PIN, HIGH);
+      bench::runLoopFor(3000, loop);
+      return starts;
+    };
+    sim::hopper.grams = 1000.0;
+    bench::runLoopFor(3000, loop);
+    uint32_t starts = holdTare();
+    float loaded = currentWeight;
+    sim::hopper.grams = 0.0;
+    bench::runLoopFor(3000, loop);
+    starts += holdTare();
+    sim::hopper.grams = 1000.0;
+    bench::runLoopFor(3000, loop);
+    std::printf("re-tare with 1 kg loaded: reads %.2f g; tared empty again, 1 kg reads %.2f g\n", loaded,
+                currentWeight);
+    if (starts || std::fabs(loaded) > 1.0 || std::fabs(currentWeight - 1000.0) > 2.0) {
+      std::fprintf(stderr, "holding the tare button did not re-tare the scale\n");
+      return 1;
+    }
+  }
+
+  // The same 50 g request as a command from the display over the LAN,
+  // arriving at pseudo-random points of the loop() cycle. Every third one is
+  // delivered twice, as after a lost RESULT: the repeat must get the same
+  // answer without a second dispense. With modem sleep the AP holds each
+  // command until the next beacon. Commands tagged with another secret
+  // must not dispense at all. Each dispensed command ends as a completed
+  // dispense_request row.
+  {
+    DispenseSecret secret;
+    secret.set(dispenseSecret);
+    std::map<std::string, std::string> commandRows;  // id -> status last upserted
+    std::string pendingId;                           // a row the display inserted itself
+    uint32_t claims = 0;
+    sim::net.handler = [&](const sim::HttpRequest& request) {
+      sim::HttpResponse response;
+      if (request.path.find("/rest/v1/dispense_request") != 0) return response;
+      auto field = [&](const char* name) {
+        size_t at = request.body.find(std::string("\"") + name + "\":\"");
+        if (at == std::string::npos) return std::string();
+        at += std::strlen(name) + 4;
+        return request.body.substr(at, request.body.find('"', at) - at);
+      };
+      if (request.method == "POST") {
+        commandRows[field("id")] = field("status");
+      } else if (request.method == "PATCH") {
+        claims++;
+        response.status = 200;
+        response.body = "[]";
+      } else {
+        response.status = 200;
+        response.body = pendingId.empty() ? "[]"
+                                          : "[{\"id\":\"" + pendingId +
+                                                "\",\"requested_grams\":50,\"requested_at\":\"2026-03-01T08:00:00+00:00\"}]";
+      }
+      return response;
+    };
+    uint32_t results = 0;
+    sim::udp.handler = [&](const sim::Datagram& datagram) {
+      DispenseCommand result;
+      const uint8_t* payload = (const uint8_t*)datagram.payload.data();
+      if (result.decode(payload, datagram.payload.size()) && DispenseCommand::authentic(payload, secret) &&
+          result.type == DispenseCommand::TYPE_RESULT && result.status == DispenseCommand::STATUS_ACCEPTED) {
+        results++;
+      }
+      return std::vector<std::string>();
+    };
+    uint32_t commandsBefore = dispenseCommands.statistics().commands;
+    uint32_t repeatsBefore = dispenseCommands.statistics().repeats;
+    uint32_t sent = 0;
+    for (WiFiSleepType_t sleepMode : {WIFI_NONE_SLEEP, WIFI_MODEM_SLEEP}) {
+      WiFi.setSleepMode(sleepMode);
+      uint64_t total = 0;
+      uint64_t worst = 0;
+      for (uint32_t i = 0; i < trials; i++) {
+        if (sim::hopper.grams < 400.0) {
+          sim::hopper.grams = 1000.0;
+          bench::runLoopFor(3000, loop);
+        }
+        bench::runLoopFor(500, loop);
+        DispenseCommand command = {DispenseCommand::TYPE_DISPENSE, 0xC0DE0000 + sent++, 50, 0};
+        uint8_t buffer[DispenseCommand::BYTES];
+        sim::Datagram datagram;
+        datagram.remoteIp = (uint32_t)IPAddress(192, 168, 1, 43);
+        datagram.remotePort = 47804;
+        datagram.localPort = DISPENSE_COMMAND_PORT;
+        datagram.payload.assign((const char*)buffer, command.encode(buffer, secret));
+        uint64_t arrives = sim::nowMicros() + (i * 7919) % 1000 * 1000;
+        sim::schedule(arrives, [datagram] { sim::udpReceive(datagram, false); });
+        if (i % 3 == 0) sim::schedule(arrives + 30000, [datagram] { sim::udpReceive(datagram, false); });
+        while (sim::servo.openedMicros < arrives) loop();
+        uint64_t latency = sim::servo.openedMicros - arrives;
+        total += latency;
+        worst = std::max(worst, latency);
+        while (isDispensing) loop();
+      }
+      std::printf("LAN command -> servo open, %s: avg %.1f ms, max %.1f ms\n",
+                  sleepMode == WIFI_NONE_SLEEP ? "no sleep" : "modem sleep", total / 1000.0 / trials,
+                  worst / 1000.0);
+    }
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+    bench::runLoopFor(1000, loop);
+    uint32_t commands = dispenseCommands.statistics().commands - commandsBefore;
+    uint32_t repeats = dispenseCommands.statistics().repeats - repeatsBefore;
+    std::printf("%lu commands, %lu dispensed, %lu repeats answered again, %lu accepted results\n",
+                (unsigned long)sent, (unsigned long)commands, (unsigned long)repeats, (unsigned long)results);
+    if (commands != sent) {
+      std::fprintf(stderr, "a repeated command dispensed twice\n");
+      sim::udp.handler = nullptr;
+      return 1;
+    }
+
+    DispenseSecret wrong;
+    wrong.set("not the dispense secret");
+    uint32_t forgedBefore = dispenseCommands.statistics().forged;
+    uint32_t resultsBefore = results;
+    for (uint32_t i = 0; i < 10; i++) {
+      DispenseCommand command = {DispenseCommand::TYPE_DISPENSE, 0xBAD00000 + i, 50, 0};
+      uint8_t buffer[DispenseCommand::BYTES];
+      sim::Datagram datagram;
+      datagram.remoteIp = (uint32_t)IPAddress(192, 168, 1, 66);
+      datagram.remotePort = 47804;
+      datagram.localPort = DISPENSE_COMMAND_PORT;
+      datagram.payload.assign((const char*)buffer, command.encode(buffer, wrong));
+      sim::udpReceive(datagram, false);
+      bench::runLoopFor(100, loop);
+    }
+    bool dispensed = isDispensing || dispenseCommands.statistics().commands - commandsBefore != commands;
+    uint32_t forged = dispenseCommands.statistics().forged - forgedBefore;
+    std::printf("10 commands under another secret: %lu dropped as forged, %lu answered\n", (unsigned long)forged,
+                (unsigned long)(results - resultsBefore));
+    sim::udp.handler = nullptr;
+    if (forged != 10 || dispensed) {
+      std::fprintf(stderr, "a command with the wrong tag was accepted\n");
+      return 1;
+    }
+
+    // The audit rows go out one upsert per second once the gate is shut
+    unsigned long drainStart = millis();
+    while (!commandQueue.isEmpty() && millis() - drainStart < 1200000) loop();
+    uint32_t completedRows = 0;
+    for (const auto& row : commandRows) completedRows += row.second == "completed";
+
+    // The display gave up on the last command and inserted its row itself,
+    // but the command had arrived: the row must not be claimed or dispensed again
+    char id[40];
+    DispenseCommand::requestId(0xC0DE0000 + sent - 1, id, sizeof(id));
+    pendingId = id;
+    uint32_t claimsBefore = claims;
+    bool redispensed = false;
+    unsigned long pollStart = millis();
+    while (millis() - pollStart < REQUEST_POLL_IDLE + 5000) {
+      loop();
+      redispensed = redispensed || isDispensing;
+    }
+    pendingId.clear();
+    sim::net.handler = nullptr;
+    std::printf("%lu dispense_request rows completed from %lu commands; display's own row: %s\n",
+                (unsigned long)completedRows, (unsigned long)commands,
+                redispensed ? "dispensed again" : claims != claimsBefore ? "claimed" : "left to the audit");
+    if (completedRows != commands || redispensed || claims != claimsBefore) {
+      std::fprintf(stderr, "LAN dispenses were not audited once each in dispense_request\n");
+      return 1;
+    }
+  }
+
+  // Requests from the app in dispense_request, served by a small PostgREST
+  // stand-in: cursor filter, oldest first, limit, and the conditional PATCH.
+  // After an idle hour requests arrive a few seconds apart, some in pairs
+  // with the same requested_at. Every fourth one is claimed by a second
+  // dispenser between our GET and our PATCH; it must not be dispensed here.
+  {
+    struct Row {
+      std::string id;
+      std::string requestedAt;
+      int grams;
+      std::string status;
+      std::string claimedBy;
+      uint64_t insertedMicros;
+    };
+    std::vector<Row> rows;
+    std::set<std::string> contested;  // the other dispenser takes these after our next GET
+    std::map<std::string, int> claims;
+    uint64_t polls = 0, pollBytes = 0, lost = 0;
+    auto between = [](const std::string& text, const char* from, const char* to) {
+      size_t start = text.find(from);
+      if (start == std::string::npos) return std::string();
+      start += strlen(from);
+      return text.substr(start, text.find(to, start) - start);
+    };
+    sim::net.handler = [&](const sim::HttpRequest& request) {
+      sim::HttpResponse response;
+      if (request.path.compare(0, 26, "/rest/v1/dispense_request?") != 0) return response;
+      response.status = 200;
+      if (request.method == "GET") {
+        std::string after = between(request.path, "requested_at.gt.%22", "%22");
+        for (size_t plus; (plus = after.find("%2B")) != std::string::npos;) after.replace(plus, 3, "+");
+        std::string afterId = between(request.path, "id.gt.", ")");
+        response.body = "[";
+        int listed = 0;
+        for (Row& row : rows) {  // kept in (requested_at, id) order
+          if (row.status != "pending" || listed == REQUEST_PAGE_SIZE) continue;
+          if (!after.empty() && (row.requestedAt < after || (row.requestedAt == after && row.id <= afterId))) continue;
+          char json[160];
+          std::snprintf(json, sizeof(json), "%s{\"id\":\"%s\",\"requested_grams\":%d,\"requested_at\":\"%s\"}",
+                        listed++ ? "," : "", row.id.c_str(), row.grams, row.requestedAt.c_str());
+          response.body += json;
+          if (contested.erase(row.id)) {
+            row.status = "dispensing";
+            row.claimedBy = "ESP32_002";
+          }
+        }
+        response.body += "]";
+        polls++;
+        pollBytes += request.path.size() + response.body.size();
+        return response;
+      }
+      std::string id = between(request.path, "id=eq.", "&");
+      for (Row& row : rows) {
+        if (row.id != id) continue;
+        if (request.path.find("status=eq.pending") == std::string::npos) {
+          row.status = "completed";  // the completion PATCH
+          response.status = 204;
+        } else if (row.status == "pending") {
+          row.status = between(request.body, "\"status\":\"", "\"");
+          row.claimedBy = between(request.body, "\"claimed_by\":\"", "\"");
+          claims[id]++;
+          response.body = "[{\"id\":\"" + id + "\"}]";
+        } else {
+          if (row.claimedBy == "ESP32_002") lost++;
+          response.body = "[]";
+        }
+      }
+      return response;
+    };
+    auto insert = [&](int grams) {
+      unsigned long ms = millis();
+      char requestedAt[40], id[40];
+      std::snprintf(requestedAt, sizeof(requestedAt), "2026-03-01T%02lu:%02lu:%02lu.%03lu000+00:00", ms / 3600000 % 24,
+                    ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+      std::snprintf(id, sizeof(id), "0f5c%04x-0000-4000-8000-%012zx", (unsigned)(rows.size() * 40503u % 65536),
+                    rows.size());
+      Row row = {id, requestedAt, grams, "pending", "", sim::nowMicros()};
+      rows.insert(std::upper_bound(rows.begin(), rows.end(), row,
+                                   [](const Row& a, const Row& b) {
+                                     return a.requestedAt < b.requestedAt ||
+                                            (a.requestedAt == b.requestedAt && a.id < b.id);
+                                   }),
+                  row);
+      return std::string(id);
+    };
+
+    uint32_t idleMs = options.iterations(3600000);
+    bench::runLoopFor(idleMs, loop);
+    std::printf("\ndispense_request idle %.0f min: %llu polls, %llu bytes (%.0f polls/h)\n", idleMs / 60000.0,
+                (unsigned long long)polls, (unsigned long long)pollBytes, polls * 3600000.0 / idleMs);
+
+    uint32_t requests = options.iterations(24);
+    uint64_t total = 0, worst = 0, first = 0;
+    uint32_t served = 0;
+    for (uint32_t i = 0; i < requests; i++) {
+      if (sim::hopper.grams < 400.0) {
+        sim::hopper.grams = 1000.0;
+        bench::runLoopFor(3000, loop);
+      }
+      bench::runLoopFor(1000 + (i * 7919) % 5000, loop);
+      std::vector<std::string> ids = {insert(50)};
+      if (i % 5 == 2) ids.push_back(insert(30));  // same requested_at
+      if (i % 4 == 3) contested.insert(ids[0]);
+      unsigned long insertedAt = millis();
+      for (const std::string& id : ids) {
+        const Row* row = nullptr;
+        while (true) {
+          for (const Row& candidate : rows) {
+            if (candidate.id == id) row = &candidate;
+          }
+          if (row->status != "pending" || millis() - insertedAt > 120000) break;
+          loop();
+        }
+        if (row->claimedBy != "ESP32_001") continue;
+        uint64_t inserted = row->insertedMicros;
+        while (sim::servo.openedMicros < inserted) loop();
+        uint64_t latency = sim::servo.openedMicros - inserted;
+        if (served++ == 0) first = latency;
+        total += latency;
+        worst = std::max(worst, latency);
+        while (isDispensing || requestCompletionPending) loop();
+      }
+    }
+    bench::runLoopFor(REQUEST_ACTIVE_WINDOW + REQUEST_POLL_IDLE, loop);
+    uint32_t mine = 0, theirs = 0, completed = 0, doubled = 0;
+    for (const Row& row : rows) {
+      if (row.claimedBy == "ESP32_001") mine++;
+      if (row.claimedBy == "ESP32_002") theirs++;
+      if (row.claimedBy == "ESP32_001" && row.status == "completed") completed++;
+    }
+    for (const auto& claim : claims) doubled += claim.second > 1;
+    std::printf("%zu requests: %u dispensed here, %u completed, %u taken by the other dispenser (%llu claims lost)\n",
+                rows.size(), (unsigned)mine, (unsigned)completed, (unsigned)theirs, (unsigned long long)lost);
+    std::printf("insert -> servo open: first after idle %.1f s, avg %.1f s, max %.1f s\n", first / 1e6,
+                served ? total / 1e6 / served : 0.0, worst / 1e6);
+    sim::net.handler = nullptr;
+    if (doubled || mine + theirs != rows.size() || completed != mine) {
+      std::fprintf(stderr, "a dispense request was claimed twice or left unfinished\n");
+      return 1;
+    }
+  }
+
+  // Large requests: time to target and accuracy per dispense profile. Each
+  // profile gets two warm-up dispenses so the cutoff lag adapts to it.
+  const DispenseProfile singleWide = {"single 90", 90, 90, 0.0};
+  const DispenseProfile singleNarrow = {"single 25", 25, 25, 0.0};
+  const DispenseProfile* profiles[] = {&singleWide, &singleNarrow, &DISPENSE_PROFILES[0]};
+  uint32_t repeats = options.iterations(300);
+  std::printf("\n%-28s %8s %12s %12s %12s\n", "dispense profile", "target g", "time s", "avg err g", "max err g");
+  for (const DispenseProfile* profile : profiles) {
+    dispenseProfile = profile;
+    double closedAfterMs, dispensed;
+    for (int i = 0; i < 2; i++) timedDispense(500.0f, closedAfterMs, dispensed);
+    for (float target : {500.0f, 1000.0f}) {
+      double totalMs = 0, totalError = 0, maxError = 0;
+      for (uint32_t i = 0; i < repeats; i++) {
+        timedDispense(target, closedAfterMs, dispensed);
+        totalMs += closedAfterMs;
+        totalError += std::fabs(dispensed - target);
+        maxError = std::max(maxError, std::fabs(dispensed - target));
+      }
+      std::printf("%-28s %8.0f %12.1f %12.2f %12.2f\n", profile->grain, target, totalMs / repeats / 1000.0,
+                  totalError / repeats, maxError);
+    }
+  }
+  selectDispenseProfile(GRAIN_TYPE);
+
+  // Router reboot: the AP disappears for 30 minutes while rice is scooped out
+  // now and then. Every row recorded meanwhile has to reach the server once
+  // it is back.
+  uint64_t rowsReceived = 0;
+  sim::net.handler = [&](const sim::HttpRequest& request) {
+    sim::HttpResponse response;
+    if (request.path == "/rest/v1/rice_weights") {
+      rowsReceived += std::count(request.body.begin(), request.body.end(), '{');
+    }
+    return response;
+  };
+  sim::hopper.grams = 1000.0;  // the profile runs above emptied it
+  bench::runLoopFor(120000, loop);  // start from an empty queue
+  uint32_t samplesBefore = weightReport.reportedCount() - weightBatch.size();
+  rowsReceived = 0;
+  uint64_t flashBytesBefore = sim::flash.bytesWritten;
+  uint64_t flashSyncsBefore = sim::flash.syncs;
+  unsigned long outageStart = millis();
+  sim::wifi.apUp = false;
+  for (unsigned long elapsed = 0; elapsed < options.iterations(1800000) + 60000; elapsed += 20000) {
+    if (elapsed % 60000 == 0) sim::hopper.grams -= 10.0;
+    bench::runLoopFor(20000, loop);
+  }
+  sim::wifi.apUp = true;
+  unsigned long outageEnd = millis();
+  uint32_t queuedAtReconnect = weightQueue.bytesQueued();
+  while (!weightQueue.isEmpty() && millis() - outageEnd < 3600000) loop();
+  unsigned long drainedAt = millis();
+  uint32_t samplesTaken = weightReport.reportedCount() - samplesBefore;
+  std::printf("\noffline %.1f min: %lu rows recorded, %llu delivered, %u still batched; %lu bytes queued at "
+              "reconnect, drained %.1f s later; %llu flash bytes in %llu syncs\n",
+              (outageEnd - outageStart) / 60000.0, (unsigned long)samplesTaken, (unsigned long long)rowsReceived,
+              (unsigned)weightBatch.size(), (unsigned long)queuedAtReconnect, (drainedAt - outageEnd) / 1000.0,
+              (unsigned long long)(sim::flash.bytesWritten - flashBytesBefore),
+              (unsigned long long)(sim::flash.syncs - flashSyncsBefore));
+  weightQueue.printStats(bench::out());
+  sim::net.handler = nullptr;
+
+  // The same weight rows as binary frames over UDP to a LAN gateway that
+  // loses 10% of the datagrams each way. Every row has to arrive exactly
+  // once; acks are cumulative, so a lost ack is covered by the next one.
+  std::set<uint32_t> gatewaySeqs;
+  uint32_t gatewayDuplicates = 0;
+  uint32_t gatewayAcked = 0;
+  sim::udp.handler = [&](const sim::Datagram& datagram) {
+    std::vector<std::string> replies;
+    TelemetryFrame frame;
+    if (!frame.decode((const uint8_t*)datagram.payload.data(), datagram.payload.size()) ||
+        frame.type != TelemetryFrame::TYPE_DATA) {
+      return replies;
+    }
+    if (!gatewaySeqs.insert(frame.seq).second) gatewayDuplicates++;
+    while (gatewaySeqs.count(gatewayAcked + 1)) gatewayAcked++;
+    uint8_t ack[TelemetryFrame::ACK_BYTES];
+    size_t length = TelemetryFrame::ack(frame.deviceId, frame.bootId, gatewayAcked).encode(ack);
+    replies.emplace_back((const char*)ack, length);
+    return replies;
+  };
+  {
+    telemetryMode = TELEMETRY_UDP;
+    udpTelemetry.begin(TELEMETRY_DEVICE_ID, telemetryGateway, TELEMETRY_GATEWAY_PORT);
+    udpTelemetry.onEvicted(spillWeightFrame);
+    sim::udp.lossPercent = 10;
+    uint64_t requestsBefore = sim::net.requests;
+    uint32_t runMs = options.iterations(1800000);
+    for (unsigned long elapsed = 0; elapsed < runMs; elapsed += 20000) {
+      sim::hopper.grams += elapsed % 40000 == 0 ? -10.0 : 10.0;
+      bench::runLoopFor(20000, loop);
+    }
+    sim::udp.lossPercent = 0;
+    bench::runLoopFor(10000, loop);  // let the last retransmissions land
+    const UdpTelemetry::Stats& udpStats = udpTelemetry.statistics();
+    std::printf("\nudp, 10%% loss each way, %.1f min: %lu rows sent, %zu received (%lu duplicates), %u pending, "
+                "%lu evicted; %llu datagrams (%lu retransmits), %.0f payload bytes per row, %llu REST requests\n",
+                runMs / 60000.0, (unsigned long)udpStats.frames, gatewaySeqs.size(), (unsigned long)gatewayDuplicates,
+                (unsigned)udpTelemetry.pending(), (unsigned long)udpStats.evicted,
+                (unsigned long long)udpStats.datagrams, (unsigned long)udpStats.retransmits,
+                udpStats.frames ? (double)udpStats.datagrams * TelemetryFrame::DATA_BYTES / udpStats.frames : 0.0,
+                (unsigned long long)(sim::net.requests - requestsBefore));
+    udpTelemetry.printStats(bench::out());
+    telemetryMode = TELEMETRY_REST;
+  }
+
+  // Power cut mid-append: the torn record is skipped after the reboot and
+  // every record before it is replayed exactly once
+  {
+    OfflineQueue queue("/bench", 8192, 2);
+    queue.begin();
+    for (uint32_t i = 0; i < 1000; i++) {
+      QueuedWeight sample = {1.0f, i};
+      queue.append(&sample, sizeof(sample));
+    }
+    queue.sync();
+    sim::flash.files["/bench/00000001"] += std::string("\xA5\x08\x01\x02", 4);
+    OfflineQueue rebooted("/bench", 8192, 2);
+    rebooted.begin();
+    uint32_t replayed = 0;
+    uint32_t outOfOrder = 0;
+    auto check = [&](const uint8_t* data, uint8_t) {
+      QueuedWeight sample;
+      memcpy(&sample, data, sizeof(sample));
+      if (sample.takenAt != replayed++) outOfOrder++;
+    };
+    while (rebooted.peek(50, check) > 0) rebooted.consume();
+    std::printf("queue after power cut: 1000 appended, %lu replayed (%lu out of order), %lu corrupt frames, "
+                "%zu files left\n",
+                (unsigned long)replayed, (unsigned long)outOfOrder,
+                (unsigned long)rebooted.statistics().corruptFrames,
+                (size_t)std::count_if(sim::flash.files.begin(), sim::flash.files.end(),
+                                      [](const std::pair<const std::string, std::string>& file) {
+                                        return file.first.compare(0, 7, "/bench/") == 0;
+                                      }));
+  }
+
+  bench::header("esp1.cpp - load cell and motor control");
+
+  // Let a read interval pass first so every call sees a fresh conversion
+  bench::run("readWeight()", options.iterations(2000),
+             [] { sim::advanceMicros(WEIGHT_READ_INTERVAL * 1000); },
+             [] { readWeight(); });
+
+  bench::run("sendWeightData()", options.iterations(5000), [] { sendWeightData(); });
+
+  // One reported row each: appended to the REST batch (one bulk POST per 12
+  // rows) against one UDP frame to the gateway
+  auto nextRow = [] {
+    currentWeight += currentWeight < 500.0f ? 10.0f : -10.0f;
+    sim::advanceMicros(10000);
+  };
+  bench::run("weight row, REST batch", options.iterations(4800), nextRow, [] { sendWeightData(); });
+  telemetryMode = TELEMETRY_UDP;
+  bench::run("weight row, UDP frame", options.iterations(4800), nextRow, [] { sendWeightData(); });
+  telemetryMode = TELEMETRY_REST;
+
+  bench::run("logDispenseEvent()", options.iterations(5000), [] { logDispenseEvent("start", 50.0); });
+
+  // Per-sample cost of the weight filter against the old float average. The
+  // host has an FPU, so this understates the float path: on the ESP8266 every
+  // float op is a soft-float call. The sketch reports on-target cycles/sample.
+  RawStream stream = makeRawStream(1000);
+  uint32_t passes = options.iterations(2000);
+  std::printf("\n%-28s %12s %12s %12s\n", "weight filter", "ns/sample", "still err g", "drain err g");
+  FloatAverage floatAverage;
+  benchFilter("float average of 5", stream, passes, [&](int32_t raw) { return floatAverage.update(raw); });
+  WeightFilter ema = makeFilter(WeightFilter::SMOOTH_EMA, 3);
+  benchFilter("fixed median3 + EMA", stream, passes, [&](int32_t raw) { return ema.update(raw) / 1000.0f; });
+  WeightFilter kalman = makeFilter(WeightFilter::SMOOTH_KALMAN, 3);
+  benchFilter("fixed median3 + Kalman", stream, passes,
+              [&](int32_t raw) { return kalman.update(raw) / 1000.0f; });
+  WeightFilter kalman5 = makeFilter(WeightFilter::SMOOTH_KALMAN, 5);
+  benchFilter("fixed median5 + Kalman", stream, passes,
+              [&](int32_t raw) { return kalman5.update(raw) / 1000.0f; });
+
+  return 0;
+}
@@ -0,0 +1,248 @@
+// Microbenchmarks for esp2.cpp - environmental sensors and status LEDs
+
+#include "esp2_sketch.cpp"
+
+#include "bench.h"
+
+namespace {
+
+// The reading before the ranger: one pulseIn() ping with its default 1 s
+// timeout, converted at a fixed 0.034 cm/us
+float legacyDistanceCm() {
+  long duration = pulseIn(ULTRASONIC_ECHO, HIGH);
+  return (duration * 0.034) / 2;
+}
+
+// One ranger burst at the task's pace; returns the time spent in update()
+uint64_t rangerBurst() {
+  uint64_t busy = 0;
+  ranger.startBurst();
+  for (;;) {
+    uint64_t start = sim::nowMicros();
+    bool more = ranger.update();
+    busy += sim::nowMicros() - start;
+    if (!more) return busy;
+    sim::advanceMicros(UltrasonicRanger::PING_SPACING_MS * 1000);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options(argc, argv);
+
+  // Boot from blank flash, then again after a power cycle (RTC memory lost,
+  // cached lease read from flash) and after a reset (RTC memory kept). The
+  // bench continues with the sketch from the last boot.
+  auto boot = [](const char* kind, const std::string& state, bool keepRtcMemory) {
+    sim::reset();
+    sim::dht.temperature = 27.5f;
+    sim::dht.humidity = 61.0f;
+    sim::ultrasonic.distanceCm = 11.0f;
+    sim::ultrasonic.trigPin = ULTRASONIC_TRIG;
+    sim::ultrasonic.echoPin = ULTRASONIC_ECHO;
+    sim::driveInput(ULTRASONIC_ECHO, LOW);  // the module holds echo low between pings
+    sim::restoreNonVolatile(state, keepRtcMemory);
+    supabaseUrl = "https://bench.supabase.co";
+    setup();
+    unsigned long setupMs = millis();
+    while (firstReportMs == 0 && millis() < 30000) loop();
+    std::printf("%-28s %12lu %12lu %12lu\n", kind, setupMs, wifiLink.lastConnectMs(), firstReportMs);
+  };
+  std::printf("\n%-28s %12s %12s %12s\n", "boot", "setup ms", "wifi ms", "report ms");
+  std::string bootState = bench::bootInChild([&] { boot("blank flash", std::string(), false); });
+  bench::bootInChild([&] { boot("power cycle", bootState, false); });
+  boot("reset", bootState, true);
+
+  // Scheduler view of a simulated minute of normal operation
+  bench::runLoopFor(60000, loop);
+  std::printf("\nscheduler, 60 s:\n");
+  scheduler.printStats(bench::out());
+  ranger.printStats(bench::out());
+  heapMonitor.printStats(bench::out());
+
+  // A quiet storeroom for an hour should only send heartbeats. Then the
+  // temperature jumps 2 C; a row showing it should reach the server within
+  // seconds.
+  {
+    uint64_t rows = 0;
+    double lastRowTemperature = 0;
+    bool lastRowHasTemperature = false;
+    sim::net.handler = [&](const sim::HttpRequest& request) {
+      sim::HttpResponse response;
+      if (request.path == "/rest/v1/environmental_data") {
+        rows += std::count(request.body.begin(), request.body.end(), '{');
+        size_t last = request.body.rfind("\"temperature\":");
+        if (last != std::string::npos) lastRowTemperature = std::atof(request.body.c_str() + last + 14);
+        lastRowHasTemperature = last != std::string::npos && last > request.body.rfind('{') &&
+                                request.body.compare(last + 14, 4, "null") != 0;
+      }
+      return response;
+    };
+    bench::runLoopFor(30000, loop);
+    rows = 0;
+    uint32_t idleMs = options.iterations(3600000);
+    bench::runLoopFor(idleMs, loop);
+    uint64_t idleRows = rows;
+    sim::dht.temperature += 2.0f;
+    unsigned long changedAt = millis();
+    while (lastRowTemperature < sim::dht.temperature - 0.5 && millis() - changedAt < 120000) loop();
+    std::printf("\nidle %.0f min: %llu environment rows (%.0f at a fixed 10 s interval); +2 C: row at the server "
+                "%.1f s later\n",
+                idleMs / 60000.0, (unsigned long long)idleRows, idleMs / 10000.0, (millis() - changedAt) / 1000.0);
+    temperatureReport.printStats(bench::out(), "temperature");
+    sim::dht.temperature -= 2.0f;
+    bench::runLoopFor(10000, loop);
+
+    // The DHT stops answering for a minute and comes back at the same
+    // temperature: both edges are changes, not something for the 15 min
+    // heartbeat to pick up
+    float celsius = sim::dht.temperature;
+    sim::dht.temperature = NAN;
+    changedAt = millis();
+    while (lastRowHasTemperature && millis() - changedAt < 1200000) loop();
+    unsigned long failedMs = millis() - changedAt;
+    bench::runLoopFor(60000, loop);
+    sim::dht.temperature = celsius;
+    changedAt = millis();
+    while (!lastRowHasTemperature && millis() - changedAt < 1200000) loop();
+    unsigned long recoveredMs = millis() - changedAt;
+    std::printf("DHT failing for 1 min: row without temperature %.1f s after, row with it %.1f s after recovery\n",
+                failedMs / 1000.0, recoveredMs / 1000.0);
+    if (failedMs > 30000 || recoveredMs > 30000) {
+      std::fprintf(stderr, "a failed or recovered DHT reading waited for the heartbeat\n");
+      return 1;
+    }
+
+    // Too hot: the alert beeps three times while the other tasks keep running
+    sim::dht.temperature = 40.0f;
+    uint32_t beeps = 0;
+    uint64_t longestBusyMicros = 0;  // time loop() spent in tasks rather than asleep
+    int buzzer = sim::gpio.level[BUZZER_PIN];
+    unsigned long hotAt = millis();
+    while (millis() - hotAt < 8000) {
+      uint64_t start = sim::nowMicros();
+      scheduler.runDueTasks();
+      longestBusyMicros = std::max(longestBusyMicros, sim::nowMicros() - start);
+      if (sim::gpio.level[BUZZER_PIN] == HIGH && buzzer == LOW) beeps++;
+      buzzer = sim::gpio.level[BUZZER_PIN];
+      scheduler.sleepUntilNextTask();
+    }
+    sim::dht.temperature = celsius;
+    bench::runLoopFor(10000, loop);
+    std::printf("temperature alert: %u beeps, longest busy loop() %.1f ms\n", beeps, longestBusyMicros / 1000.0);
+    if (beeps != 3 || buzzer != LOW || longestBusyMicros > 100000) {
+      std::fprintf(stderr, "the alert beeped %u times or held loop() for %.1f ms\n", beeps,
+                   longestBusyMicros / 1000.0);
+      return 1;
+    }
+    sim::net.handler = nullptr;
+  }
+
+  // Router reboot: the AP is gone for 10 minutes. Sensing has to carry on
+  // and the link has to come back on its own once the AP answers again.
+  {
+    uint32_t samplesBefore = scheduler.stats(0).runs;  // task 0 is "sensors"
+    uint64_t longestBusyMicros = 0;  // time loop() spent in tasks rather than asleep
+    unsigned long outageStart = millis();
+    sim::wifi.apUp = false;
+    while (millis() - outageStart < options.iterations(600000) + 30000) {
+      uint64_t start = sim::nowMicros();
+      scheduler.runDueTasks();
+      longestBusyMicros = std::max(longestBusyMicros, sim::nowMicros() - start);
+      scheduler.sleepUntilNextTask();
+    }
+    uint32_t samplesTaken = scheduler.stats(0).runs - samplesBefore;
+    sim::wifi.apUp = true;
+    unsigned long outageEnd = millis();
+    while (!wifiLink.isConnected()) loop();
+    std::printf("AP down %.1f min: %lu sensor reads, longest busy loop() %.1f ms, link back %.1f s after the AP\n",
+                (outageEnd - outageStart) / 60000.0, (unsigned long)samplesTaken, longestBusyMicros / 1000.0,
+                (millis() - outageEnd) / 1000.0);
+    wifiLink.printStats(bench::out());
+    bench::runLoopFor(60000, loop);  // drain what was queued meanwhile
+  }
+
+  bench::header("esp2.cpp - environmental sensors");
+
+  // The DHT driver caches a transfer for 2 s; advance past it so every call
+  // pays for a fresh read, as it does at SENSOR_READ_INTERVAL.
+  bench::run("readSensors()", options.iterations(2000),
+             [] { sim::advanceMicros(SENSOR_READ_INTERVAL * 1000); },
+             [] { readSensors(); });
+
+  bench::run("readUltrasonicLevel()", options.iterations(5000), [] { readUltrasonicLevel(); });
+  bench::run("serviceRanger() ping", options.iterations(5000), [] {
+    if (!ranger.busy()) ranger.startBurst();
+    sim::advanceMicros(UltrasonicRanger::PING_SPACING_MS * 1000);
+  }, [] { serviceRanger(); });
+  scheduler.setEnabled(rangerTask, true);
+
+  // Level distance 11 cm across storeroom temperatures and with a noisy
+  // echo: one blocking pulseIn() ping at 0.034 cm/us against a background
+  // burst of five, median taken, corrected for the DHT temperature
+  {
+    struct Condition {
+      const char* name;
+      float celsius;
+      float jitterCm;
+      uint32_t strayEvery;
+      uint32_t missEvery;
+    };
+    const Condition conditions[] = {{"5 C", 5.0f, 0, 0, 0},
+                                    {"20 C", 20.0f, 0, 0, 0},
+                                    {"35 C", 35.0f, 0, 0, 0},
+                                    {"24.5 C, +/-0.5 cm jitter", 24.5f, 0.5f, 0, 0},
+                                    {"24.5 C, stray echo 1 in 7", 24.5f, 0, 7, 0},
+                                    {"24.5 C, no echo 1 in 11", 24.5f, 0, 0, 11}};
+    const float trueCm = 11.0f;
+    uint32_t reads = options.iterations(200);
+    std::printf("\n%-28s %12s %12s %12s %12s\n", "ultrasonic, 11 cm", "ping err cm", "ping blk ms",
+                "burst err cm", "burst cpu us");
+    uint8_t trigPin = sim::ultrasonic.trigPin;
+    bool accurate = true;
+    for (const Condition& c : conditions) {
+      sim::ultrasonic.distanceCm = trueCm;
+      sim::ultrasonic.jitterCm = c.jitterCm;
+      sim::ultrasonic.strayEvery = c.strayEvery;
+      sim::ultrasonic.missEvery = c.missEvery;
+      sim::dht.temperature = c.celsius;
+      ranger.setTemperature(c.celsius);
+
+      float pingError = 0;
+      uint64_t pingBlock = 0;
+      sim::ultrasonic.trigPin = 0xFF;  // pulseIn() models the whole ping itself
+      for (uint32_t i = 0; i < reads; i++) {
+        uint64_t start = sim::nowMicros();
+        pingError = std::max(pingError, std::fabs(legacyDistanceCm() - trueCm));
+        pingBlock = std::max(pingBlock, sim::nowMicros() - start);
+      }
+      sim::ultrasonic.trigPin = trigPin;
+
+      float burstError = 0;
+      uint64_t burstBusy = 0;
+      for (uint32_t i = 0; i < reads; i++) {
+        burstBusy = std::max(burstBusy, rangerBurst());
+        burstError = std::max(burstError, std::fabs(ranger.distanceCm() - trueCm));
+      }
+      accurate = accurate && burstError <= c.jitterCm + 0.05f;
+      std::printf("%-28s %12.2f %12.1f %12.2f %12llu\n", c.name, pingError, pingBlock / 1000.0, burstError,
+                  (unsigned long long)burstBusy);
+    }
+    ranger.printStats(bench::out());
+    sim::ultrasonic = sim::Ultrasonic();
+    sim::ultrasonic.trigPin = ULTRASONIC_TRIG;
+    sim::ultrasonic.echoPin = ULTRASONIC_ECHO;
+    sim::dht.temperature = 27.5f;
+    if (!accurate) {
+      std::fprintf(stderr, "ranger median was off by more than the echo jitter\n");
+      return 1;
+    }
+  }
+
+  bench::run("sendSensorData()", options.iterations(5000), [] { sendSensorData(); });
+
+  bench::run("updateStatusLED()", options.iterations(20000), [] { updateStatusLED(); });
+
+  return 0;
+}
@@ -0,0 +1,560 @@
+// Microbenchmarks for esp3.cpp - OLED display and user interface
+
+#include "esp3_sketch.cpp"
+
+#include "bench.h"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// A rice_weight row as PostgREST returns it for the fetchSystemData() query
+static const char* LATEST_WEIGHT_RESPONSE =
+    "[{\"id\":\"5b0f6c3e-8a0d-4c52-9d2b-3f1e6a7c9b10\",\"timestamp\":\"2024-05-01T08:15:00.123456+00:00\","
+    "\"weight_grams\":1375,\"level_state\":\"partial\",\"created_at\":\"2024-05-01T08:15:00.234567+00:00\"}]";
+
+namespace {
+
+// A response body as the socket delivers it, one byte at a time
+class TextStream : public Stream {
+public:
+  void load(const std::string& body) {
+    text = body;
+    pos = 0;
+  }
+  int available() override { return (int)(text.size() - pos); }
+  int read() override { return pos < text.size() ? (uint8_t)text[pos++] : -1; }
+  int peek() override { return pos < text.size() ? (uint8_t)text[pos] : -1; }
+  size_t write(uint8_t) override { return 0; }
+  using Print::write;
+
+private:
+  std::string text;
+  size_t pos = 0;
+};
+
+// The parse before streaming: the body copied into a 512-byte buffer, then
+// parsed whole into a StaticJsonDocument<512>
+char bufferedBody[512];
+StaticJsonDocument<512> bufferedDoc;
+
+bool parseBuffered(Stream& body) {
+  size_t n = 0;
+  int c;
+  while (n + 1 < sizeof(bufferedBody) && (c = body.read()) >= 0) bufferedBody[n++] = (char)c;
+  bufferedBody[n] = 0;
+  if (deserializeJson(bufferedDoc, bufferedBody, n) || bufferedDoc.size() == 0) return false;
+  systemData.currentWeight = bufferedDoc[0]["weight_grams"];
+  return true;
+}
+
+// Turns the encoder by `detents` clicks, `intervalUs` apart, starting at
+// `startUs`: four A/B edges per click, A leading B when clockwise
+void spinEncoder(uint64_t startUs, int detents, uint32_t intervalUs) {
+  static const int CLOCKWISE[4][2] = {{LOW, HIGH}, {LOW, LOW}, {HIGH, LOW}, {HIGH, HIGH}};
+  int clicks = detents < 0 ? -detents : detents;
+  for (int click = 0; click < clicks; click++) {
+    for (int edge = 0; edge < 4; edge++) {
+      // Counter-clockwise runs the same states backwards, back to rest
+      const int* levels = CLOCKWISE[detents > 0 || edge == 3 ? edge : 2 - edge];
+      uint64_t at = startUs + (uint64_t)click * intervalUs + edge * intervalUs / 4;
+      sim::schedule(at, [levels] {
+        sim::driveInput(ENCODER_A, levels[0]);
+        sim::driveInput(ENCODER_B, levels[1]);
+      });
+    }
+  }
+}
+
+// A press or release with 3 ms of contact bounce, settling on `level`
+void bounceButton(uint8_t pin, uint64_t atUs, int level) {
+  for (int i = 0; i < 5; i++) {
+    int contact = i % 2 ? !level : level;
+    sim::schedule(atUs + i * 600, [pin, contact] { sim::driveInput(pin, contact); });
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bench::Options options(argc, argv);
+
+  // Boot from blank flash, then again after a power cycle (RTC memory lost,
+  // cached lease read from flash) and after a reset (RTC memory kept). The
+  // bench continues with the sketch from the last boot.
+  auto boot = [](const char* kind, const std::string& state, bool keepRtcMemory) {
+    sim::reset();
+    sim::net.handler = [](const sim::HttpRequest& request) {
+      sim::HttpResponse response;
+      response.status = request.method == "GET" ? 200 : 201;
+      if (request.method == "GET") response.body = LATEST_WEIGHT_RESPONSE;
+      return response;
+    };
+    sim::restoreNonVolatile(state, keepRtcMemory);
+    supabaseUrl = "https://bench.supabase.co";
+    setup();
+    unsigned long setupMs = millis();
+    while (firstDataMs == 0 && millis() < 30000) loop();
+    std::printf("%-28s %12lu %12lu %12lu\n", kind, setupMs, wifiLink.lastConnectMs(), firstDataMs);
+  };
+  std::printf("\n%-28s %12s %12s %12s\n", "boot", "setup ms", "wifi ms", "data ms");
+  std::string bootState = bench::bootInChild([&] { boot("blank flash", std::string(), false); });
+  bench::bootInChild([&] { boot("power cycle", bootState, false); });
+  boot("reset", bootState, true);
+  fetchSystemData();
+  if (systemData.currentWeight != 1375.0f || systemData.dispenserStatus != "partial") {
+    std::fprintf(stderr, "fetchSystemData() did not parse the latest row\n");
+    return 1;
+  }
+
+  // Scheduler view of a simulated minute of normal operation
+  bench::runLoopFor(60000, loop);
+  std::printf("\nscheduler, 60 s:\n");
+  scheduler.printStats(bench::out());
+  heapMonitor.printStats(bench::out());
+
+  // The main controller multicasts its weight every 100 ms (as while
+  // dispensing) and the sensor controller its readings every 2 s. Freshness
+  // is the time from a frame reaching the AP to its value being in
+  // systemData. In modem sleep the AP holds multicast for the next DTIM
+  // beacon; once the scale goes quiet the display falls back to Supabase.
+  auto lanRun = [](const char* label, WiFiSleepType_t sleepMode, bool scaleTalking) {
+    WiFi.setSleepMode(sleepMode);
+    systemData.currentWeight = 0;
+    std::map<long, uint64_t> sentAt;  // weight in whole grams -> time its frame reached the AP
+    uint64_t start = sim::nowMicros() + 7300;  // the senders' clocks are not in step with the display's
+    static long nextGrams = 1000;
+    for (uint32_t ms = 0; ms < 60000; ms += 100) {
+      bool scale = scaleTalking;
+      bool sensors = ms % 2000 == 0;
+      if (!scale && !sensors) continue;
+      long grams = nextGrams++;
+      sentAt[grams] = start + ms * 1000ULL;
+      sim::schedule(start + ms * 1000ULL, [scale, sensors, grams] {
+        for (int device = 1; device <= 2; device++) {
+          if ((device == 1 && !scale) || (device == 2 && !sensors)) continue;
+          static uint32_t seqs[3];
+          TelemetryFrame frame = TelemetryFrame::state(device);
+          frame.bootId = 0x1234 + device;
+          frame.seq = ++seqs[device];
+          if (device == 1) {
+            frame.weightMg = grams * 1000;
+            frame.fields = TelemetryFrame::HAS_WEIGHT | TelemetryFrame::HAS_STATUS;
+            frame.status = TelemetryFrame::STATUS_DISPENSING;
+          } else {
+            frame.temperatureCentiC = 2150;
+            frame.humidityCentiPct = 6200;
+            frame.levelCentiPct = 4500;
+            frame.fields = TelemetryFrame::HAS_TEMPERATURE | TelemetryFrame::HAS_HUMIDITY | TelemetryFrame::HAS_LEVEL;
+          }
+          uint8_t buffer[TelemetryFrame::DATA_BYTES];
+          sim::Datagram datagram;
+          datagram.remoteIp = (uint32_t)IPAddress(192, 168, 1, 40 + device);
+          datagram.remotePort = 49152;
+          datagram.localPort = LAN_STATE_PORT;
+          datagram.payload.assign((const char*)buffer, frame.encode(buffer));
+          sim::udpReceive(datagram, true);
+        }
+      });
+    }
+
+    uint64_t requestsBefore = sim::net.requests;
+    uint64_t totalUs = 0;
+    uint64_t worstUs = 0;
+    uint32_t seen = 0;
+    long shownGrams = sentAt.empty() ? 0 : sentAt.begin()->first - 1;
+    bench::runLoopFor(60000, [&] {
+      scheduler.runDueTasks();
+      long grams = lround(systemData.currentWeight);
+      if (scaleTalking && grams > shownGrams) {
+        // Frames are applied in order, so every weight up to the one shown has just landed
+        for (auto it = sentAt.upper_bound(shownGrams); it != sentAt.upper_bound(grams); ++it) {
+          uint64_t age = sim::nowMicros() - it->second;
+          totalUs += age;
+          worstUs = std::max(worstUs, age);
+          seen++;
+        }
+      }
+      shownGrams = grams;
+      scheduler.sleepUntilNextTask();
+    });
+    std::printf("%-28s %10lu %10.1f %10.1f %10llu %10.1f\n", label, (unsigned long)seen,
+                seen ? totalUs / 1000.0 / seen : 0.0, worstUs / 1000.0,
+                (unsigned long long)(sim::net.requests - requestsBefore), systemData.temperature);
+    return worstUs;
+  };
+  std::printf("\n%-28s %10s %10s %10s %10s %10s\n", "lan state, 60 s", "frames", "avg ms", "worst ms",
+              "cloud req", "temp C");
+  uint64_t worstAwakeUs = lanRun("no sleep", WIFI_NONE_SLEEP, true);
+  lanRun("modem sleep", WIFI_MODEM_SLEEP, true);
+  lanRun("scale quiet (fallback)", WIFI_NONE_SLEEP, false);
+  lanState.printStats(bench::out());
+  if (worstAwakeUs >= 100000) {
+    std::fprintf(stderr, "LAN state took %.1f ms to reach systemData\n", worstAwakeUs / 1000.0);
+    return 1;
+  }
+
+  // A new rice_weight row every few seconds, pushed over the realtime
+  // socket: time from the insert to the end of the first display flush
+  // showing it. Then an idle hour with the socket up
+  // against the same hour on the GET poll alone (realtime refused). Between
+  // loop passes there is never more than one TLS session holding the heap.
+  {
+    char record[256];
+    auto insert = [&record](long grams) {
+      std::snprintf(record, sizeof(record),
+                    "{\"id\":\"5b0f6c3e-8a0d-4c52-9d2b-%012ld\",\"timestamp\":\"2024-05-01T08:15:00.123456+00:00\","
+                    "\"weight_grams\":%ld,\"level_state\":\"partial\",\"created_at\":\"2024-05-01T08:15:00.234567+00:00\"}",
+                    grams, grams);
+      sim::realtimeInsert("rice_weight", record);
+    };
+    bench::runLoopFor(2000, loop);
+    uint32_t pushes = options.iterations(500);
+    uint64_t shownTotal = 0, shownWorst = 0;
+    uint32_t shown = 0;
+    for (uint32_t i = 0; i < pushes; i++) {
+      long grams = 2000 + i;
+      uint64_t insertedAt = sim::nowMicros() + 1000000 + (i * 7919) % 2000 * 1000;
+      sim::schedule(insertedAt, [&insert, grams] { insert(grams); });
+      bool onScreen = false;
+      bool drawn = false;
+      while (!onScreen && sim::nowMicros() < insertedAt + 1000000) {
+        uint32_t frames = scheduler.stats(displayTask).runs;
+        scheduler.runDueTasks();
+        // The row is applied and the display redrawn in the same pass; the
+        // oled task then pumps the frame out
+        drawn = drawn || (lround(systemData.currentWeight) == grams && scheduler.stats(displayTask).runs > frames);
+        onScreen = drawn && !oled.busy();
+        if (!onScreen) scheduler.sleepUntilNextTask();
+      }
+      if (!onScreen) continue;
+      uint64_t shownUs = sim::nowMicros() - insertedAt;
+      shownTotal += shownUs;
+      shownWorst = std::max(shownWorst, shownUs);
+      shown++;
+    }
+    std::printf("\nrealtime push -> on screen: avg %.1f ms, max %.1f ms (%u of %u rows)\n",
+                shown ? shownTotal / 1000.0 / shown : 0.0, shownWorst / 1000.0, (unsigned)shown, (unsigned)pushes);
+    if (shown != pushes || shownWorst >= 100000) {
+      std::fprintf(stderr, "pushed rows took up to %.1f ms to reach the screen\n", shownWorst / 1000.0);
+      return 1;
+    }
+
+    uint32_t idleMs = options.iterations(3600000);
+    std::printf("%-28s %10s %10s %10s %10s %10s\n", "idle, per hour", "requests", "tx bytes", "rx bytes", "heartbeats",
+                "tls hands");
+    uint32_t sessionsMax = 0;
+    auto watchSessions = [&sessionsMax] {
+      loop();
+      sessionsMax = std::max(sessionsMax, sim::net.tlsSessions);
+    };
+    for (bool subscribed : {true, false}) {
+      sim::realtime.accept = subscribed;
+      if (!subscribed) sim::realtimeDrop();
+      bench::runLoopFor(5000, watchSessions);
+      uint64_t requests = sim::net.requests, sent = sim::net.bytesSent, received = sim::net.bytesReceived;
+      uint64_t heartbeats = sim::realtime.heartbeats, handshakes = sim::net.tlsHandshakes;
+      bench::runLoopFor(idleMs, watchSessions);
+      double scale = 3600000.0 / idleMs;
+      std::printf("%-28s %10.0f %10.0f %10.0f %10.0f %10.0f\n", subscribed ? "realtime subscription" : "GET poll only",
+                  (sim::net.requests - requests) * scale, (sim::net.bytesSent - sent) * scale,
+                  (sim::net.bytesReceived - received) * scale, (sim::realtime.heartbeats - heartbeats) * scale,
+                  (sim::net.tlsHandshakes - handshakes) * scale);
+    }
+
+    // The server drops the socket: back on pushes after the retry delay
+    sim::realtime.accept = true;
+    bench::runLoopFor(RealtimeChannel::RETRY_MAX_MS, watchSessions);
+    uint32_t joins = realtime.statistics().joins;
+    sim::realtimeDrop();
+    unsigned long droppedAt = millis();
+    while (realtime.statistics().joins == joins && millis() - droppedAt < 120000) watchSessions();
+    std::printf("socket dropped: joined again %lu ms later; %llu server timeouts\n", millis() - droppedAt,
+                (unsigned long long)sim::realtime.timeouts);
+    realtime.printStats(bench::out());
+    if (sim::realtime.timeouts > 0) {
+      std::fprintf(stderr, "the realtime server timed out a socket that should have sent heartbeats\n");
+      return 1;
+    }
+    if (sessionsMax > 1) {
+      std::fprintf(stderr, "the REST and realtime sockets held %u TLS sessions at once\n", (unsigned)sessionsMax);
+      return 1;
+    }
+  }
+
+  // Parsing the fetchSystemData() response: the latest row, the same row
+  // with the wide columns a select=* picks up once the table grows, and a
+  // body cut off mid-row. RAM is what the parse holds while it runs.
+  {
+    std::string wide = LATEST_WEIGHT_RESPONSE;
+    wide.insert(wide.size() - 2, ",\"notes\":\"" + std::string(400, 'n') + "\",\"sensor_raw\":[" +
+                                     std::string("8412345,8412351,8412349,8412340,") + "8412338]");
+    std::string cut = std::string(LATEST_WEIGHT_RESPONSE).substr(0, 120);
+    const std::pair<const char*, std::string> bodies[] = {
+        {"latest row", LATEST_WEIGHT_RESPONSE}, {"wide row", wide}, {"cut off", cut}};
+    std::printf("\n%-28s %8s %8s %8s %10s %10s %8s\n", "response parse", "body B", "RAM B", "pool B", "wall ns",
+                "allocs", "result");
+    TextStream body;
+    uint32_t parses = options.iterations(20000);
+    bool streamedOk[3];
+    for (int streamed = 0; streamed < 2; streamed++) {
+      for (int i = 0; i < 3; i++) {
+        bool ok = false;
+        uint64_t allocations = sim::heap().allocations;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < parses; n++) {
+          body.load(bodies[i].second);
+          systemData.currentWeight = 0;
+          ok = streamed ? parseSystemData(body) : parseBuffered(body);
+        }
+        auto stop = std::chrono::steady_clock::now();
+        ok = ok && systemData.currentWeight == 1375.0f;
+        if (streamed) streamedOk[i] = ok;
+        size_t ram = streamed ? weightRowDoc.capacity() : sizeof(bufferedBody) + bufferedDoc.capacity();
+        size_t pool = streamed ? weightRowDoc.memoryUsage() : bufferedDoc.memoryUsage();
+        char label[40];
+        std::snprintf(label, sizeof(label), "%s, %s", streamed ? "streamed" : "buffered", bodies[i].first);
+        std::printf("%-28s %8zu %8zu %8zu %10.0f %10.2f %8s\n", label, bodies[i].second.size(), ram, pool,
+                    std::chrono::duration<double, std::nano>(stop - start).count() / parses,
+                    (double)(sim::heap().allocations - allocations) / parses, ok ? "ok" : "failed");
+      }
+    }
+    if (!streamedOk[0] || !streamedOk[1] || streamedOk[2]) {
+      std::fprintf(stderr, "parseSystemData() lost a row or accepted a cut-off body\n");
+      return 1;
+    }
+  }
+
+  bench::header("esp3.cpp - display and user interface");
+
+  // Unchanged screens send nothing; the changes below are what a frame
+  // costs from present() to the last byte on the bus
+  const MenuState screens[] = {MENU_HOME, MENU_DISPENSE, MENU_STATUS, MENU_SETTINGS};
+  const char* names[] = {"updateDisplay() home", "updateDisplay() dispense", "updateDisplay() status",
+                         "updateDisplay() settings"};
+  for (int i = 0; i < 4; i++) {
+    currentMenuState = screens[i];
+    bench::run(names[i], options.iterations(5000), [] {
+      updateDisplay();
+      oled.finish();
+    });
+  }
+  currentMenuState = MENU_HOME;
+  bench::run("updateDisplay() full frame", options.iterations(5000), [] { oled.invalidate(); }, [] {
+    updateDisplay();
+    oled.finish();
+  });
+  bench::run("updateDisplay() new weight", options.iterations(5000), [] { systemData.currentWeight += 7; }, [] {
+    updateDisplay();
+    oled.finish();
+  });
+  currentMenuState = MENU_DISPENSE;
+  bench::run("updateDisplay() amount +50", options.iterations(5000),
+             [] { selectedAmount = selectedAmount >= 1000 ? 50 : selectedAmount + 50; }, [] {
+               updateDisplay();
+               oled.finish();
+             });
+  bench::run("updateDisplay() menu change", options.iterations(5000),
+             [] { currentMenuState = currentMenuState == MENU_HOME ? MENU_STATUS : MENU_HOME; }, [] {
+               updateDisplay();
+               oled.finish();
+             });
+
+  // What the display and oled tasks hold the loop for: drawing and queuing
+  // a frame, then one slice of it. A blocking flush held it for the whole frame.
+  bench::run("updateDisplay() draw only", options.iterations(5000), [] {
+    oled.finish();
+    currentMenuState = currentMenuState == MENU_HOME ? MENU_STATUS : MENU_HOME;
+  }, [] { updateDisplay(); });
+  bench::run("pumpDisplay() slice", options.iterations(20000), [] {
+    if (oled.busy()) return;
+    oled.invalidate();
+    updateDisplay();
+  }, [] { pumpDisplay(); });
+  bench::run("oled.flush() full, blocking", options.iterations(5000), [] { oled.invalidate(); },
+             [] { oled.flush(); });
+  oled.finish();
+  currentMenuState = MENU_HOME;
+
+  // Full redraws every 100 ms for a minute: how late the button scan starts
+  {
+    bench::runLoopFor(1000, loop);
+    scheduler.resetStats();
+    oled.resetStats();
+    uint32_t redraws = options.iterations(600);
+    for (uint32_t i = 0; i < redraws; i++) {
+      currentMenuState = currentMenuState == MENU_HOME ? MENU_STATUS : MENU_HOME;
+      oled.invalidate();
+      scheduler.trigger(displayTask);
+      bench::runLoopFor(100, loop);
+    }
+    currentMenuState = MENU_HOME;
+    uint8_t buttonTask = 0;  // registered first in setup()
+    uint32_t jitterUs = scheduler.stats(buttonTask).maxJitterUs;
+    std::printf("\nbutton scan during full redraws: start jitter max %.2f ms\n", jitterUs / 1000.0);
+    oled.printStats(bench::out());
+    if (jitterUs >= 5000) {
+      std::fprintf(stderr, "button scan started %.1f ms late during redraws\n", jitterUs / 1000.0);
+      return 1;
+    }
+  }
+
+  // Buttons on the dispense screen: a bouncing tap, Down held for 2 s
+  // (long press at 0.6 s, then a repeat every 150 ms) and a tap made while
+  // a slow fetch blocks the loop
+  {
+    struct Press {
+      const char* name;
+      uint8_t pin;
+      uint32_t holdUs;
+      bool duringFetch;
+      int startGrams;
+      int expected;
+    };
+    const Press presses[] = {{"Up tap, bouncing", BUTTON_UP, 120000, false, 100, 150},
+                             {"Down held 2 s", BUTTON_DOWN, 2000000, false, 1000, 450},
+                             {"Up tap during 1.5 s fetch", BUTTON_UP, 150000, true, 100, 150}};
+    std::printf("\n%-28s %10s %10s %10s\n", "buttons", "events", "grams", "expected");
+    currentMenuState = MENU_DISPENSE;
+    bench::runLoopFor(100, loop);
+    uint32_t requestMicros = sim::net.requestMicros;
+    bool ok = true;
+    for (const Press& press : presses) {
+      selectedAmount = press.startGrams;
+      ButtonEvents::Stats before = buttons.statistics();
+      uint64_t at = sim::nowMicros() + 1000;
+      bounceButton(press.pin, at, LOW);
+      bounceButton(press.pin, at + press.holdUs, HIGH);
+      if (press.duringFetch) {
+        sim::net.requestMicros = 1500000;
+        fetchSystemData();
+        sim::net.requestMicros = requestMicros;
+      }
+      bench::runLoopFor(press.holdUs / 1000 + 200, loop);
+      ButtonEvents::Stats after = buttons.statistics();
+      uint32_t events = (after.presses - before.presses) + (after.longPresses - before.longPresses) +
+                        (after.repeats - before.repeats);
+      std::printf("%-28s %10lu %10d %10d\n", press.name, (unsigned long)events, selectedAmount, press.expected);
+      ok = ok && selectedAmount == press.expected;
+    }
+    // Select sits on GPIO16, which has no interrupt: sampled by the scan
+    currentMenuState = MENU_HOME;
+    bounceButton(BUTTON_SELECT, sim::nowMicros() + 1000, LOW);
+    bounceButton(BUTTON_SELECT, sim::nowMicros() + 100000, HIGH);
+    bench::runLoopFor(300, loop);
+    std::printf("%-28s %10s %10s %10s\n", "Select tap (polled pin)", "1",
+                currentMenuState == MENU_DISPENSE ? "dispense" : "other", "dispense");
+    ok = ok && currentMenuState == MENU_DISPENSE;
+    currentMenuState = MENU_HOME;
+    buttons.printStats(bench::out());
+    if (!ok) {
+      std::fprintf(stderr, "button events were lost or repeated\n");
+      return 1;
+    }
+  }
+
+  // Encoder on the dispense screen from 50 g: a slow turn, one brisk spin
+  // of 20 clicks, and clicks turned while a slow fetch blocks the loop
+  {
+    struct Spin {
+      const char* name;
+      int detents;
+      uint32_t intervalUs;
+      bool duringFetch;
+    };
+    const Spin spins[] = {{"slow, 19 clicks", 19, 150000, false},
+                          {"one spin, 20 clicks", 20, 15000, false},
+                          {"half a spin, 10 clicks", 10, 15000, false},
+                          {"back, 5 slow clicks", -5, 150000, false},
+                          {"during 1.5 s fetch, 8", 8, 120000, true}};
+    std::printf("\n%-28s %10s %10s %10s\n", "encoder", "detents", "grams", "expected");
+    currentMenuState = MENU_DISPENSE;
+    bench::runLoopFor(100, loop);
+    uint32_t requestMicros = sim::net.requestMicros;
+    bool ok = true;
+    for (const Spin& spin : spins) {
+      selectedAmount = spin.detents > 0 ? 50 : 1000;
+      uint32_t detents = encoder.statistics().detents;
+      spinEncoder(sim::nowMicros() + 1000, spin.detents, spin.intervalUs);
+      if (spin.duringFetch) {
+        sim::net.requestMicros = 1500000;
+        fetchSystemData();
+        sim::net.requestMicros = requestMicros;
+      }
+      bench::runLoopFor(abs(spin.detents) * spin.intervalUs / 1000 + 100, loop);
+      int expected = spin.detents > 0 ? (spin.intervalUs >= RotaryEncoder::ACCEL_INTERVAL_US ? 50 + spin.detents * 50 : 1000)
+                                      : 1000 + spin.detents * 50;
+      uint32_t counted = encoder.statistics().detents - detents;
+      std::printf("%-28s %10lu %10d %10d\n", spin.name, (unsigned long)counted, selectedAmount, expected);
+      ok = ok && counted == (uint32_t)abs(spin.detents) && selectedAmount == expected;
+    }
+    currentMenuState = MENU_HOME;
+    encoder.printStats(bench::out());
+    if (!ok) {
+      std::fprintf(stderr, "encoder lost clicks or landed on the wrong amount\n");
+      return 1;
+    }
+  }
+
+  // The main controller is heard on the LAN but never answers the command:
+  // the press goes to Supabase under the command's own id. A 409 means the
+  // command got through after all and the controller has recorded it.
+  {
+    auto hearScale = [] {
+      TelemetryFrame frame = TelemetryFrame::state(SCALE_DEVICE_ID);
+      frame.bootId = 0x4321;
+      frame.seq = 1;
+      frame.weightMg = 500000;
+      frame.fields = TelemetryFrame::HAS_WEIGHT;
+      uint8_t buffer[TelemetryFrame::DATA_BYTES];
+      sim::Datagram datagram;
+      datagram.remoteIp = (uint32_t)IPAddress(192, 168, 1, 41);
+      datagram.remotePort = 49152;
+      datagram.localPort = LAN_STATE_PORT;
+      datagram.payload.assign((const char*)buffer, frame.encode(buffer));
+      sim::udpReceive(datagram, true);
+    };
+    std::vector<std::string> posted;
+    int status = 201;
+    sim::net.handler = [&](const sim::HttpRequest& request) {
+      sim::HttpResponse response;
+      if (request.method == "POST" && request.path == "/rest/v1/dispense_request") {
+        posted.push_back(request.body);
+        response.status = status;
+      }
+      return response;
+    };
+    std::printf("\n%-28s %10s %10s\n", "unanswered command", "posts", "notice");
+    bool ok = true;
+    for (int answer : {201, 409}) {
+      status = answer;
+      hearScale();
+      bench::runLoopFor(50, loop);
+      size_t before = posted.size();
+      uint32_t unanswered = dispenseCommand.statistics().unanswered;
+      requestDispense(150);
+      bench::runLoopFor(500, loop);
+      const char* expected = answer == 409 ? "Dispensing..." : "Dispense Request\nSent!";
+      bool sent = posted.size() == before + 1 && dispenseCommand.statistics().unanswered == unanswered + 1;
+      bool sameId = sent && posted.back().find("-0000-4000-8000-000000000000\"") != std::string::npos &&
+                    posted.back().find("\"requested_grams\":150") != std::string::npos;
+      std::printf("%-28d %10lu %10s\n", answer, (unsigned long)(posted.size() - before),
+                  notice && std::strcmp(notice, expected) == 0 ? "as expected" : notice ? "wrong" : "none");
+      ok = ok && sameId && notice && std::strcmp(notice, expected) == 0;
+    }
+    sim::net.handler = nullptr;
+    if (!ok) {
+      std::fprintf(stderr, "an unanswered command was not handed to Supabase under its own id\n");
+      return 1;
+    }
+  }
+
+  TextStream latestBody;
+  bench::run("parseSystemData()", options.iterations(20000), [&] { latestBody.load(LATEST_WEIGHT_RESPONSE); },
+             [&] { parseSystemData(latestBody); });
+
+  bench::run("fetchSystemData()", options.iterations(5000), [] { fetchSystemData(); });
+
+  return 0;
+}
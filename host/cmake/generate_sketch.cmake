@@ -0,0 +1,50 @@
+# Turn an Arduino sketch into a translation unit a host compiler accepts.
+#
+# Like the Arduino builder, this scans the sketch for top-level function
+# definitions and inserts prototypes for them just before the first one, so
+# the sketch itself can keep calling functions before they are defined.
+# #line directives keep diagnostics pointing at the original file.
+#
+# Usage: cmake -DSKETCH=<in.cpp> -DOUTPUT=<out.cpp> -P generate_sketch.cmake
+
+file(READ "${SKETCH}" content)
+set(content "\n${content}")
+
+set(definition_regex "\n[A-Za-z_][^\n;(){}=/#]* [*&]?[A-Za-z_][A-Za-z0-9_]*\\([^\n;{}()]*\\) {")
+string(REGEX MATCHALL "${definition_regex}" definitions "${content}")
+
+if(NOT definitions)
+  file(WRITE "${OUTPUT}" "#line 1 \"${SKETCH}\"\n")
+  file(READ "${SKETCH}" original)
+  file(APPEND "${OUTPUT}" "${original}")
+  return()
+endif()
+
+list(GET definitions 0 first_definition)
+string(FIND "${content}" "${first_definition}" insert_at)
+math(EXPR prefix_length "${insert_at} + 1")
+string(SUBSTRING "${content}" 1 ${insert_at} prefix)
+string(SUBSTRING "${content}" ${prefix_length} -1 rest)
+
+string(REGEX MATCHALL "\n" prefix_newlines "${prefix}")
+list(LENGTH prefix_newlines rest_line)
+math(EXPR rest_line "${rest_line} + 1")
+
+set(prototypes "")
+foreach(definition IN LISTS definitions)
+  string(REGEX REPLACE "^\n(.*) {$" "\\1;" prototype "${definition}")
+  string(APPEND prototypes "${prototype}\n")
+endforeach()
+
+set(generated "#line 1 \"${SKETCH}\"\n${prefix}")
+string(APPEND generated "// Prototypes generated by generate_sketch.cmake\n${prototypes}")
+string(APPEND generated "#line ${rest_line} \"${SKETCH}\"\n${rest}")
+
+# Only touch the output when it changes to avoid needless rebuilds
+if(EXISTS "${OUTPUT}")
+  file(READ "${OUTPUT}" previous)
+  if(previous STREQUAL generated)
+    return()
+  endif()
+endif()
+file(WRITE "${OUTPUT}" "${generated}")
@@ -0,0 +1,115 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// BatchWriter.cpp - Writer thread loop
+
+#include "BatchWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+const unsigned FIRST_RETRY_MS = 100;
+const unsigned MAX_RETRY_MS = 5000;
+const unsigned STOP_RETRIES = 3;
+const unsigned IDLE_WAIT_MS = 100;
+
+int64_t wallMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+BatchWriter::BatchWriter(const Config& writerConfig, std::unique_ptr<RecordSink> recordSink, GatewayMetrics& counters)
+    : config(writerConfig), sink(std::move(recordSink)), metrics(counters), queue(writerConfig.queueCapacity) {
+  batch.reserve(config.batchRows);
+}
+
+BatchWriter::~BatchWriter() {
+  stop();
+}
+
+void BatchWriter::start() {
+  if (thread.joinable()) return;
+  stopRequested.store(false);
+  thread = std::thread(&BatchWriter::run, this);
+}
+
+void BatchWriter::stop() {
+  if (!thread.joinable()) return;
+  stopRequested.store(true);
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    wake.notify_one();
+  }
+  thread.join();
+}
+
+bool BatchWriter::submitAll(const IngestRecord* records, size_t count) {
+  if (!queue.tryPushAll(records, count)) return false;
+  // Only wake the writer when it is asleep and there is enough to do
+  if (sleeping.load() && queue.size() >= wakeRows.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    wake.notify_one();
+  }
+  return true;
+}
+
+void BatchWriter::run() {
+  for (;;) {
+    IngestRecord record;
+    while (batch.size() < config.batchRows && queue.tryPop(record)) batch.push_back(record);
+
+    bool stopping = stopRequested.load();
+    int64_t ageMs = batch.empty() ? 0 : (wallMicros() - batch.front().receivedAtUs) / 1000;
+    if (!batch.empty() && (batch.size() >= config.batchRows || ageMs >= (int64_t)config.batchMs || stopping)) {
+      flush(stopping);
+      continue;
+    }
+    if (stopping && batch.empty() && queue.size() == 0) return;
+
+    // Sleep until the batch is due or enough rows arrive to fill it
+    unsigned waitMs = batch.empty() ? IDLE_WAIT_MS : (unsigned)(config.batchMs - ageMs);
+    wakeRows.store(batch.empty() ? 1 : config.batchRows - batch.size(), std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    sleeping.store(true);
+    if (queue.size() < wakeRows.load(std::memory_order_relaxed) && !stopRequested.load()) {
+      wake.wait_for(lock, std::chrono::milliseconds(waitMs));
+    }
+    sleeping.store(false);
+  }
+}
+
+void BatchWriter::flush(bool stopping) {
+  auto start = std::chrono::steady_clock::now();
+  if (sink->write(batch.data(), batch.size())) {
+    uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    metrics.recordFlush(batch.size(), micros);
+    if (failing) std::fprintf(stderr, "writer: sink recovered\n");
+    batch.clear();
+    retryMs = 0;
+    stopRetries = 0;
+    failing = false;
+    return;
+  }
+
+  bump(metrics.flushFailures);
+  if (!failing) std::fprintf(stderr, "writer: %zu rows not written, retrying: %s\n", batch.size(), sink->lastError());
+  failing = true;
+  if (stopping && ++stopRetries > STOP_RETRIES) {
+    std::fprintf(stderr, "writer: giving up on %zu rows at shutdown\n", batch.size());
+    batch.clear();
+    return;
+  }
+  if (stopping) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(FIRST_RETRY_MS));
+    return;
+  }
+  retryMs = retryMs == 0 ? FIRST_RETRY_MS : std::min(retryMs * 2, MAX_RETRY_MS);
+  std::unique_lock<std::mutex> lock(wakeMutex);
+  wake.wait_for(lock, std::chrono::milliseconds(retryMs), [this] { return stopRequested.load(); });
+}
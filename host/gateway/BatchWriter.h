@@ -0,0 +1,75 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// BatchWriter.h - One writer thread: an MPSC queue drained into a sink in batches
+//
+// Listener threads submit() records; the writer pops them into a batch and
+// hands the batch to its sink once it holds `batchRows` rows or its oldest
+// row is `batchMs` old. A failed write is retried with the same rows after
+// a growing pause (100 ms up to 5 s). Meanwhile the queue fills and
+// submit() starts returning false, which the listeners turn into "try
+// again later" for the devices, so nothing is dropped inside the gateway.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GatewayMetrics.h"
+#include "IngestRecord.h"
+#include "MpscQueue.h"
+
+class RecordSink {
+public:
+  virtual ~RecordSink() {}
+  // All rows or none; false keeps the batch for a retry
+  virtual bool write(const IngestRecord* records, size_t count) = 0;
+  virtual const char* lastError() const { return "write failed"; }
+};
+
+class BatchWriter {
+public:
+  struct Config {
+    size_t queueCapacity = 65536;
+    size_t batchRows = 1000;
+    unsigned batchMs = 200;
+  };
+
+  BatchWriter(const Config& config, std::unique_ptr<RecordSink> sink, GatewayMetrics& metrics);
+  ~BatchWriter();
+
+  void start();
+  // Flushes everything queued before returning; gives up on a batch the
+  // sink keeps rejecting after a few retries
+  void stop();
+
+  // Any thread. False when the queue is full.
+  bool submit(const IngestRecord& record) { return submitAll(&record, 1); }
+  // Any thread. All of the records or none of them.
+  bool submitAll(const IngestRecord* records, size_t count);
+  size_t depth() const { return queue.size(); }
+  size_t capacity() const { return queue.capacity(); }
+
+private:
+  void run();
+  void flush(bool stopping);
+
+  Config config;
+  std::unique_ptr<RecordSink> sink;
+  GatewayMetrics& metrics;
+  MpscQueue<IngestRecord> queue;
+  std::vector<IngestRecord> batch;
+
+  std::thread thread;
+  std::atomic<bool> stopRequested{false};
+  std::atomic<bool> sleeping{false};
+  std::atomic<size_t> wakeRows{1};  // queued rows worth waking the writer for
+  std::mutex wakeMutex;
+  std::condition_variable wake;
+
+  unsigned retryMs = 0;
+  unsigned stopRetries = 0;
+  bool failing = false;
+};
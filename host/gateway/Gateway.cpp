@@ -0,0 +1,169 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// Gateway.cpp - Start/stop, routing and metrics output
+
+#include "Gateway.h"
+
+#include <chrono>
+
+#include "HttpListener.h"
+#include "UdpListener.h"
+
+namespace {
+
+uint64_t steadyMicros() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void appendMetric(std::string& out, const char* name, const char* type, const char* help) {
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+void appendSample(std::string& out, const char* name, const char* labels, double value) {
+  char line[160];
+  std::snprintf(line, sizeof(line), "%s%s %.17g\n", name, labels, value);
+  out += line;
+}
+
+uint64_t load(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+Gateway::Gateway(const Config& gatewayConfig, SinkFactory sinkFactory)
+    : config(gatewayConfig), makeSink(std::move(sinkFactory)) {
+  if (config.writers == 0) config.writers = 1;
+}
+
+Gateway::~Gateway() {
+  stop();
+}
+
+bool Gateway::start() {
+  http.reset(new HttpListener(*this));
+  udp.reset(new UdpListener(*this));
+  if (!http->open(config.httpPort) || !udp->open(config.udpPort)) return false;
+
+  for (unsigned i = 0; i < config.writers; i++) {
+    writers.emplace_back(new BatchWriter(config.writer, makeSink(), counters));
+    writers.back()->start();
+  }
+  stopListening.store(false);
+  httpThread = std::thread([this] { http->run(stopListening); });
+  udpThread = std::thread([this] { udp->run(stopListening); });
+  lastStatsUs = steadyMicros();
+  return true;
+}
+
+void Gateway::stop() {
+  stopListening.store(true);
+  if (httpThread.joinable()) httpThread.join();
+  if (udpThread.joinable()) udpThread.join();
+  // Nothing new can arrive now; let the writers drain
+  for (auto& writer : writers) writer->stop();
+}
+
+uint16_t Gateway::httpPort() const {
+  return http ? http->port() : 0;
+}
+
+uint16_t Gateway::udpPort() const {
+  return udp ? udp->port() : 0;
+}
+
+uint32_t Gateway::routeKey(const char* deviceId, uint32_t fallback) {
+  if (!deviceId || !deviceId[0]) return fallback;
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (const char* c = deviceId; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+  return hash;
+}
+
+bool Gateway::submit(const IngestRecord& record, uint32_t key) {
+  return writerFor(key).submit(record);
+}
+
+bool Gateway::submitAll(const IngestRecord* records, size_t count, uint32_t key) {
+  return writerFor(key).submitAll(records, count);
+}
+
+size_t Gateway::queueDepth() const {
+  size_t depth = 0;
+  for (const auto& writer : writers) depth += writer->depth();
+  return depth;
+}
+
+size_t Gateway::queueCapacity() const {
+  size_t capacity = 0;
+  for (const auto& writer : writers) capacity += writer->capacity();
+  return capacity;
+}
+
+std::string Gateway::renderMetrics() const {
+  std::string out;
+  appendMetric(out, "rice_gateway_rows_ingested_total", "counter", "Rows accepted into the writer queues.");
+  appendSample(out, "rice_gateway_rows_ingested_total", "{source=\"http\"}", load(counters.httpRows));
+  appendSample(out, "rice_gateway_rows_ingested_total", "{source=\"udp\"}", load(counters.udpFrames));
+  appendMetric(out, "rice_gateway_http_requests_total", "counter", "HTTP requests handled.");
+  appendSample(out, "rice_gateway_http_requests_total", "", load(counters.httpRequests));
+  appendMetric(out, "rice_gateway_rejected_total", "counter", "Requests or frames turned away; devices retry.");
+  appendSample(out, "rice_gateway_rejected_total", "{source=\"http\"}", load(counters.httpRejected));
+  appendSample(out, "rice_gateway_rejected_total", "{source=\"udp\"}", load(counters.udpRejected));
+  appendMetric(out, "rice_gateway_udp_duplicates_total", "counter", "Retransmitted frames already queued.");
+  appendSample(out, "rice_gateway_udp_duplicates_total", "", load(counters.udpDuplicates));
+  appendMetric(out, "rice_gateway_udp_malformed_total", "counter", "Datagrams that were not telemetry frames.");
+  appendSample(out, "rice_gateway_udp_malformed_total", "", load(counters.udpMalformed));
+  appendMetric(out, "rice_gateway_udp_skipped_total", "counter", "Frames a device evicted to its REST fallback.");
+  appendSample(out, "rice_gateway_udp_skipped_total", "", load(counters.udpSkipped));
+  appendMetric(out, "rice_gateway_queue_depth", "gauge", "Rows waiting for a writer.");
+  appendSample(out, "rice_gateway_queue_depth", "", (double)queueDepth());
+  appendMetric(out, "rice_gateway_queue_capacity", "gauge", "Rows the writer queues can hold.");
+  appendSample(out, "rice_gateway_queue_capacity", "", (double)queueCapacity());
+  appendMetric(out, "rice_gateway_rows_written_total", "counter", "Rows committed to the database.");
+  appendSample(out, "rice_gateway_rows_written_total", "", load(counters.rowsWritten));
+  appendMetric(out, "rice_gateway_flush_seconds", "summary", "Time to write one batch.");
+  appendSample(out, "rice_gateway_flush_seconds_sum", "", load(counters.flushMicrosTotal) / 1e6);
+  appendSample(out, "rice_gateway_flush_seconds_count", "", load(counters.batches));
+  appendMetric(out, "rice_gateway_flush_seconds_max", "gauge", "Slowest batch write since start.");
+  appendSample(out, "rice_gateway_flush_seconds_max", "", load(counters.flushMicrosMax) / 1e6);
+  appendMetric(out, "rice_gateway_flush_failures_total", "counter", "Batch writes that failed and were retried.");
+  appendSample(out, "rice_gateway_flush_failures_total", "", load(counters.flushFailures));
+  return out;
+}
+
+void Gateway::printStats(FILE* out) {
+  uint64_t now = steadyMicros();
+  double seconds = (now - lastStatsUs) / 1e6;
+  if (seconds <= 0) seconds = 1e-6;
+  uint64_t httpRows = load(counters.httpRows);
+  uint64_t udpRows = load(counters.udpFrames);
+  uint64_t rowsWritten = load(counters.rowsWritten);
+  uint64_t batches = load(counters.batches);
+  uint64_t flushMicros = load(counters.flushMicrosTotal);
+  uint64_t newBatches = batches - lastBatches;
+
+  std::fprintf(out,
+               "ingest %.0f rows/s (http %.0f, udp %.0f), %llu duplicates, %llu rejected; queue %zu/%zu; "
+               "wrote %llu rows in %llu batches, flush avg %.1f ms max %.1f ms, %llu failures\n",
+               (httpRows - lastHttpRows + udpRows - lastUdpRows) / seconds, (httpRows - lastHttpRows) / seconds,
+               (udpRows - lastUdpRows) / seconds, (unsigned long long)load(counters.udpDuplicates),
+               (unsigned long long)(load(counters.httpRejected) + load(counters.udpRejected)), queueDepth(),
+               queueCapacity(), (unsigned long long)(rowsWritten - lastRowsWritten), (unsigned long long)newBatches,
+               newBatches ? (flushMicros - lastFlushMicros) / 1000.0 / newBatches : 0.0,
+               load(counters.flushMicrosMax) / 1000.0, (unsigned long long)load(counters.flushFailures));
+  lastStatsUs = now;
+  lastHttpRows = httpRows;
+  lastUdpRows = udpRows;
+  lastRowsWritten = rowsWritten;
+  lastBatches = batches;
+  lastFlushMicros = flushMicros;
+}
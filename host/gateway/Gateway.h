@@ -0,0 +1,87 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// Gateway.h - Listeners, writer pool and metrics of the ingest daemon
+//
+// Telemetry reaches the gateway two ways: as the PostgREST-shaped JSON the
+// sketches post to Supabase (HttpListener, so a controller only needs its
+// URL changed) and as TelemetryFrames over UDP (UdpListener). Every row is
+// routed by device to one of `writers` BatchWriters, so rows from one device
+// stay in order, and each writer batches into its own database connection.
+// GET /metrics on the HTTP port returns the counters in Prometheus format.
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchWriter.h"
+#include "GatewayMetrics.h"
+
+class HttpListener;
+class UdpListener;
+
+class Gateway {
+public:
+  struct Config {
+    uint16_t httpPort = 8080;  // 0 picks a free port
+    uint16_t udpPort = 47800;
+    unsigned writers = 4;
+    BatchWriter::Config writer;
+    std::string apiKey;  // when set, HTTP requests must carry it as apikey
+  };
+
+  // Called once per writer, from start(); each sink is used by one thread only
+  typedef std::function<std::unique_ptr<RecordSink>()> SinkFactory;
+
+  Gateway(const Config& config, SinkFactory makeSink);
+  ~Gateway();
+
+  // Binds both ports and starts the threads; false (with the reason on
+  // stderr) if a port cannot be bound
+  bool start();
+  // Stops listening, then waits for the writers to flush what is queued
+  void stop();
+
+  uint16_t httpPort() const;
+  uint16_t udpPort() const;
+  const std::string& apiKey() const { return config.apiKey; }
+
+  // Listener side: rows from one request or frame go to one writer
+  static uint32_t routeKey(const char* deviceId, uint32_t fallback);
+  bool submit(const IngestRecord& record, uint32_t key);
+  // All of the rows or none of them, so a device retrying never repeats any
+  bool submitAll(const IngestRecord* records, size_t count, uint32_t key);
+
+  GatewayMetrics& metrics() { return counters; }
+  size_t queueDepth() const;
+  size_t queueCapacity() const;
+
+  std::string renderMetrics() const;
+  // One line with rates since the previous call
+  void printStats(FILE* out);
+
+private:
+  BatchWriter& writerFor(uint32_t key) const { return *writers[key % writers.size()]; }
+
+  Config config;
+  SinkFactory makeSink;
+  GatewayMetrics counters;
+  std::vector<std::unique_ptr<BatchWriter>> writers;
+  std::unique_ptr<HttpListener> http;
+  std::unique_ptr<UdpListener> udp;
+  std::thread httpThread;
+  std::thread udpThread;
+  std::atomic<bool> stopListening{false};
+
+  // printStats() bookkeeping
+  uint64_t lastStatsUs = 0;
+  uint64_t lastHttpRows = 0;
+  uint64_t lastUdpRows = 0;
+  uint64_t lastRowsWritten = 0;
+  uint64_t lastBatches = 0;
+  uint64_t lastFlushMicros = 0;
+};
@@ -0,0 +1,46 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// GatewayMetrics.h - Counters shared by the listeners and the writers
+//
+// Plain relaxed atomics: each counter is bumped by the thread that owns the
+// event and read by the stats reporter and the /metrics endpoint, so they
+// never need to agree with each other at an instant.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct GatewayMetrics {
+  std::atomic<uint64_t> httpRequests{0};
+  std::atomic<uint64_t> httpRows{0};
+  std::atomic<uint64_t> httpRejected{0};  // 4xx/5xx answers, including queue full
+  std::atomic<uint64_t> udpFrames{0};     // new rows from DATA frames
+  std::atomic<uint64_t> udpDuplicates{0};
+  std::atomic<uint64_t> udpRejected{0};   // queue full or too far ahead; the device resends
+  std::atomic<uint64_t> udpMalformed{0};
+  std::atomic<uint64_t> udpSkipped{0};    // below a device's window base, sent over REST instead
+  std::atomic<uint64_t> acksSent{0};
+
+  std::atomic<uint64_t> rowsWritten{0};
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> flushFailures{0};
+  std::atomic<uint64_t> flushMicrosTotal{0};
+  std::atomic<uint64_t> flushMicrosMax{0};
+
+  void recordFlush(uint64_t rows, uint64_t micros) {
+    rowsWritten.fetch_add(rows, std::memory_order_relaxed);
+    batches.fetch_add(1, std::memory_order_relaxed);
+    flushMicrosTotal.fetch_add(micros, std::memory_order_relaxed);
+    uint64_t max = flushMicrosMax.load(std::memory_order_relaxed);
+    while (micros > max && !flushMicrosMax.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {
+    }
+  }
+
+  uint64_t rowsIngested() const {
+    return httpRows.load(std::memory_order_relaxed) + udpFrames.load(std::memory_order_relaxed);
+  }
+};
+
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t by = 1) {
+  counter.fetch_add(by, std::memory_order_relaxed);
+}
@@ -0,0 +1,294 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// HttpListener.cpp - epoll loop and request handling
+
+#include "HttpListener.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Gateway.h"
+#include "JsonRows.h"
+
+namespace {
+
+const int POLL_TIMEOUT_MS = 100;  // how quickly run() notices a stop request
+const int MAX_EVENTS = 64;
+
+bool setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+int64_t wallMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Value of `name` in a raw header block, trimmed; empty if absent
+std::string headerValue(const char* headers, size_t length, const char* name) {
+  size_t nameLength = std::strlen(name);
+  const char* end = headers + length;
+  for (const char* line = headers; line < end;) {
+    const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+    if (!lineEnd) lineEnd = end;
+    if ((size_t)(lineEnd - line) > nameLength && line[nameLength] == ':' &&
+        strncasecmp(line, name, nameLength) == 0) {
+      const char* value = line + nameLength + 1;
+      const char* valueEnd = lineEnd;
+      while (value < valueEnd && (*value == ' ' || *value == '\t')) value++;
+      while (valueEnd > value && (valueEnd[-1] == '\r' || valueEnd[-1] == ' ')) valueEnd--;
+      return std::string(value, valueEnd - value);
+    }
+    line = lineEnd + 1;
+  }
+  return std::string();
+}
+
+}  // namespace
+
+HttpListener::~HttpListener() {
+  for (auto& entry : connections) ::close(entry.first);
+  if (epollFd >= 0) ::close(epollFd);
+  if (listenFd >= 0) ::close(listenFd);
+}
+
+bool HttpListener::open(uint16_t port) {
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0) return false;
+  int yes = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 128) != 0 ||
+      !setNonBlocking(listenFd)) {
+    std::fprintf(stderr, "http: cannot listen on port %u: %s\n", port, std::strerror(errno));
+    return false;
+  }
+  socklen_t length = sizeof(address);
+  getsockname(listenFd, (sockaddr*)&address, &length);
+  boundPort = ntohs(address.sin_port);
+
+  epollFd = epoll_create1(0);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = listenFd;
+  return epollFd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) == 0;
+}
+
+void HttpListener::run(const std::atomic<bool>& stop) {
+  epoll_event events[MAX_EVENTS];
+  while (!stop.load()) {
+    int ready = epoll_wait(epollFd, events, MAX_EVENTS, POLL_TIMEOUT_MS);
+    for (int i = 0; i < ready; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listenFd) {
+        acceptAll();
+        continue;
+      }
+      auto connection = connections.find(fd);
+      if (connection != connections.end()) service(connection->second, events[i].events);
+    }
+  }
+}
+
+void HttpListener::acceptAll() {
+  for (;;) {
+    sockaddr_in peer = {};
+    socklen_t length = sizeof(peer);
+    int fd = accept(listenFd, (sockaddr*)&peer, &length);
+    if (fd < 0) return;
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    setNonBlocking(fd);
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      ::close(fd);
+      continue;
+    }
+    Connection& connection = connections[fd];
+    connection.fd = fd;
+    connection.peer = ntohl(peer.sin_addr.s_addr);
+  }
+}
+
+void HttpListener::service(Connection& connection, uint32_t events) {
+  int fd = connection.fd;
+  if (events & EPOLLIN) {
+    char buffer[16384];
+    for (;;) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n > 0) {
+        connection.in.append(buffer, (size_t)n);
+        continue;
+      }
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        closeConnection(fd);
+        return;
+      }
+      break;
+    }
+    if (!handleRequests(connection)) connection.closeAfterWrite = true;
+  }
+  flushOut(connection);
+}
+
+bool HttpListener::handleRequests(Connection& connection) {
+  while (!connection.closeAfterWrite) {
+    size_t headEnd = connection.in.find("\r\n\r\n");
+    if (headEnd == std::string::npos) {
+      if (connection.in.size() > MAX_REQUEST_BYTES) {
+        respond(connection, 431, "Request Header Fields Too Large", "", "");
+        return false;
+      }
+      return true;
+    }
+    const char* head = connection.in.data();
+    size_t lineEnd = connection.in.find("\r\n");
+    std::string requestLine = connection.in.substr(0, lineEnd);
+    size_t space1 = requestLine.find(' ');
+    size_t space2 = requestLine.find(' ', space1 + 1);
+    if (space1 == std::string::npos || space2 == std::string::npos) {
+      respond(connection, 400, "Bad Request", "", "");
+      return false;
+    }
+    std::string method = requestLine.substr(0, space1);
+    std::string path = requestLine.substr(space1 + 1, space2 - space1 - 1);
+    size_t query = path.find('?');
+    if (query != std::string::npos) path.resize(query);
+
+    const char* headers = head + lineEnd + 2;
+    size_t headersLength = headEnd + 2 - (lineEnd + 2);
+    if (!headerValue(headers, headersLength, "Transfer-Encoding").empty()) {
+      respond(connection, 411, "Length Required", "", "");
+      return false;
+    }
+    std::string contentLength = headerValue(headers, headersLength, "Content-Length");
+    size_t bodyLength = contentLength.empty() ? 0 : std::strtoul(contentLength.c_str(), nullptr, 10);
+    if (bodyLength > MAX_REQUEST_BYTES) {
+      respond(connection, 413, "Payload Too Large", "", "");
+      return false;
+    }
+    size_t total = headEnd + 4 + bodyLength;
+    if (connection.in.size() < total) return true;  // wait for the rest of the body
+
+    std::string connectionHeader = headerValue(headers, headersLength, "Connection");
+    if (strcasecmp(connectionHeader.c_str(), "close") == 0) connection.closeAfterWrite = true;
+    handle(connection, method, path, headerValue(headers, headersLength, "apikey"),
+           connection.in.data() + headEnd + 4, bodyLength);
+    connection.in.erase(0, total);
+  }
+  return true;
+}
+
+void HttpListener::handle(Connection& connection, const std::string& method, const std::string& path,
+                          const std::string& apiKey, const char* body, size_t bodyLength) {
+  GatewayMetrics& metrics = gateway.metrics();
+  bump(metrics.httpRequests);
+
+  if (method == "GET" && path == "/metrics") {
+    respond(connection, 200, "OK", "Content-Type: text/plain; version=0.0.4\r\n", gateway.renderMetrics());
+    return;
+  }
+
+  IngestRecord::Table table;
+  if (path == "/rest/v1/rice_weights") {
+    table = IngestRecord::RICE_WEIGHTS;
+  } else if (path == "/rest/v1/environmental_data") {
+    table = IngestRecord::ENVIRONMENTAL_DATA;
+  } else {
+    bump(metrics.httpRejected);
+    respond(connection, 404, "Not Found", "", "");
+    return;
+  }
+  if (method != "POST") {
+    bump(metrics.httpRejected);
+    respond(connection, 405, "Method Not Allowed", "Allow: POST\r\n", "");
+    return;
+  }
+  if (!gateway.apiKey().empty() && apiKey != gateway.apiKey()) {
+    bump(metrics.httpRejected);
+    respond(connection, 401, "Unauthorized", "", "");
+    return;
+  }
+
+  rows.clear();
+  const char* error = nullptr;
+  if (!JsonRows::parse(body, bodyLength, table, wallMicros(), rows, error)) {
+    bump(metrics.httpRejected);
+    respond(connection, 400, "Bad Request", "Content-Type: application/json\r\n",
+            std::string("{\"message\":\"") + error + "\"}");
+    return;
+  }
+
+  // Same device for every row of a request
+  uint32_t key = Gateway::routeKey(rows.empty() ? "" : rows[0].deviceId, connection.peer);
+  // The whole request or none of it: the device resends every row on a 503
+  if (!gateway.submitAll(rows.data(), rows.size(), key)) {
+    bump(metrics.httpRejected);
+    respond(connection, 503, "Service Unavailable", "Retry-After: 1\r\n", "");
+    return;
+  }
+  bump(metrics.httpRows, rows.size());
+  respond(connection, 201, "Created", "", "");
+}
+
+void HttpListener::respond(Connection& connection, int status, const char* reason, const std::string& extraHeaders,
+                           const std::string& body) {
+  char statusLine[160];
+  std::snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n", status, reason,
+                body.size());
+  connection.out += statusLine;
+  connection.out += extraHeaders;
+  if (connection.closeAfterWrite) connection.out += "Connection: close\r\n";
+  connection.out += "\r\n";
+  connection.out += body;
+}
+
+void HttpListener::flushOut(Connection& connection) {
+  int fd = connection.fd;
+  while (!connection.out.empty()) {
+    ssize_t n = send(fd, connection.out.data(), connection.out.size(), MSG_NOSIGNAL);
+    if (n > 0) {
+      connection.out.erase(0, (size_t)n);
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    closeConnection(fd);
+    return;
+  }
+  if (connection.out.empty() && connection.closeAfterWrite) {
+    closeConnection(fd);
+    return;
+  }
+  // Ask for EPOLLOUT only while a response is stuck in the socket buffer
+  bool wantWrite = !connection.out.empty();
+  if (wantWrite == connection.waitingToWrite) return;
+  connection.waitingToWrite = wantWrite;
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? (uint32_t)EPOLLOUT : 0u);
+  event.data.fd = fd;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void HttpListener::closeConnection(int fd) {
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  ::close(fd);
+  connections.erase(fd);
+}
@@ -0,0 +1,63 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// HttpListener.h - Minimal HTTP/1.1 endpoint for PostgREST-style inserts
+//
+// One thread, one epoll set, non-blocking sockets and keep-alive, which is
+// what the controllers' PersistentHttp expects. Handles
+//   POST /rest/v1/rice_weights and /rest/v1/environmental_data -> 201
+//   GET /metrics -> Prometheus text
+// A request is parsed completely and only queued if every row fits; when
+// the writers are behind it is answered 503 with Retry-After, and the
+// controller keeps the rows in its offline queue. Bodies must carry a
+// Content-Length (the sketches always send one).
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IngestRecord.h"
+
+class Gateway;
+
+class HttpListener {
+public:
+  static const size_t MAX_REQUEST_BYTES = 1 << 20;
+
+  explicit HttpListener(Gateway& owner) : gateway(owner) {}
+  ~HttpListener();
+
+  bool open(uint16_t port);
+  uint16_t port() const { return boundPort; }
+  void run(const std::atomic<bool>& stop);
+
+private:
+  struct Connection {
+    int fd;
+    uint32_t peer;  // IPv4 address, routes rows without a device_id
+    std::string in;
+    std::string out;
+    bool closeAfterWrite = false;
+    bool waitingToWrite = false;  // registered for EPOLLOUT
+  };
+
+  void acceptAll();
+  void service(Connection& connection, uint32_t events);
+  // Handles every complete request in `in`; false on a protocol error
+  bool handleRequests(Connection& connection);
+  void handle(Connection& connection, const std::string& method, const std::string& path, const std::string& apiKey,
+              const char* body, size_t bodyLength);
+  void respond(Connection& connection, int status, const char* reason, const std::string& extraHeaders,
+               const std::string& body);
+  void flushOut(Connection& connection);
+  void closeConnection(int fd);
+
+  Gateway& gateway;
+  int listenFd = -1;
+  int epollFd = -1;
+  uint16_t boundPort = 0;
+  std::unordered_map<int, Connection> connections;
+  std::vector<IngestRecord> rows;  // reused for every request
+};
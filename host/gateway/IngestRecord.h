@@ -0,0 +1,34 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// IngestRecord.h - One telemetry row on its way to Postgres
+//
+// A fixed-size value, so moving it through the queues never allocates.
+// Rows arrive either as PostgREST-shaped JSON (what the sketches post to
+// Supabase) or as a TelemetryFrame over UDP; both end up here. Fields the
+// device did not send are written as NULL.
+
+#pragma once
+
+#include <cstdint>
+
+struct IngestRecord {
+  enum Table : uint8_t { RICE_WEIGHTS, ENVIRONMENTAL_DATA };
+
+  static const uint8_t HAS_WEIGHT = 0x01;  // same bits as TelemetryFrame
+  static const uint8_t HAS_TEMPERATURE = 0x02;
+  static const uint8_t HAS_HUMIDITY = 0x04;
+  static const uint8_t HAS_LEVEL = 0x08;
+
+  Table table;
+  uint8_t fields;
+  char deviceId[24];   // empty: NULL
+  char timestamp[24];  // as sent by the device (millis since boot until it has NTP); empty: NULL
+  float weight;
+  float temperature;
+  float humidity;
+  float containerLevel;
+  int64_t receivedAtUs;  // gateway wall clock
+};
+
+inline const char* tableName(IngestRecord::Table table) {
+  return table == IngestRecord::RICE_WEIGHTS ? "rice_weights" : "environmental_data";
+}
@@ -0,0 +1,213 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// JsonRows.h - PostgREST-shaped JSON rows to IngestRecords
+//
+// Accepts what the sketches post to Supabase: one flat object or an array
+// of them, with numbers, strings and null as values. Like PostgREST, a key
+// that is not a column of the target table rejects the whole request, so a
+// firmware typo shows up as a 400 instead of silently missing data. The
+// body is parsed in place; nothing is allocated per row beyond the output.
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "IngestRecord.h"
+
+class JsonRows {
+public:
+  // Appends the parsed rows to `rows`. On false, `rows` is left as it was
+  // and `error` says why.
+  static bool parse(const char* body, size_t length, IngestRecord::Table table, int64_t receivedAtUs,
+                    std::vector<IngestRecord>& rows, const char*& error) {
+    JsonRows parser(body, length, table, receivedAtUs);
+    size_t before = rows.size();
+    if (!parser.parseDocument(rows)) {
+      rows.resize(before);
+      error = parser.error;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  JsonRows(const char* body, size_t length, IngestRecord::Table rowTable, int64_t receivedAt)
+      : p(body), end(body + length), table(rowTable), receivedAtUs(receivedAt) {}
+
+  bool parseDocument(std::vector<IngestRecord>& rows) {
+    skipSpace();
+    if (p < end && *p == '[') {
+      p++;
+      skipSpace();
+      if (p < end && *p == ']') {
+        p++;
+      } else {
+        for (;;) {
+          if (!parseObject(rows)) return false;
+          skipSpace();
+          if (p < end && *p == ',') {
+            p++;
+            continue;
+          }
+          if (p < end && *p == ']') {
+            p++;
+            break;
+          }
+          return fail("expected , or ] in array");
+        }
+      }
+    } else if (!parseObject(rows)) {
+      return false;
+    }
+    skipSpace();
+    return p == end || fail("trailing data after JSON");
+  }
+
+  bool parseObject(std::vector<IngestRecord>& rows) {
+    skipSpace();
+    if (p >= end || *p != '{') return fail("expected an object");
+    p++;
+    IngestRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.table = table;
+    record.receivedAtUs = receivedAtUs;
+    skipSpace();
+    if (p < end && *p == '}') {
+      p++;
+      rows.push_back(record);
+      return true;
+    }
+    for (;;) {
+      char key[32];
+      skipSpace();
+      if (!parseString(key, sizeof(key))) return fail("expected a column name");
+      skipSpace();
+      if (p >= end || *p != ':') return fail("expected :");
+      p++;
+      skipSpace();
+      if (!parseField(key, record)) return false;
+      skipSpace();
+      if (p < end && *p == ',') {
+        p++;
+        continue;
+      }
+      if (p < end && *p == '}') {
+        p++;
+        break;
+      }
+      return fail("expected , or } in object");
+    }
+    rows.push_back(record);
+    return true;
+  }
+
+  bool parseField(const char* key, IngestRecord& record) {
+    if (std::strcmp(key, "device_id") == 0) return parseText(record.deviceId, sizeof(record.deviceId));
+    if (std::strcmp(key, "timestamp") == 0) return parseText(record.timestamp, sizeof(record.timestamp));
+    bool weightTable = table == IngestRecord::RICE_WEIGHTS;
+    if (weightTable && std::strcmp(key, "weight") == 0) {
+      return parseNumber(record.weight, record.fields, IngestRecord::HAS_WEIGHT);
+    }
+    if (!weightTable && std::strcmp(key, "temperature") == 0) {
+      return parseNumber(record.temperature, record.fields, IngestRecord::HAS_TEMPERATURE);
+    }
+    if (!weightTable && std::strcmp(key, "humidity") == 0) {
+      return parseNumber(record.humidity, record.fields, IngestRecord::HAS_HUMIDITY);
+    }
+    if (!weightTable && std::strcmp(key, "container_level") == 0) {
+      return parseNumber(record.containerLevel, record.fields, IngestRecord::HAS_LEVEL);
+    }
+    return fail("unknown column");
+  }
+
+  // A string, or a number kept as its text (the sketches send both for timestamps)
+  bool parseText(char* out, size_t size) {
+    if (parseNull()) {
+      out[0] = 0;
+      return true;
+    }
+    if (p < end && *p == '"') return parseString(out, size);
+    const char* start = p;
+    while (p < end && (std::strchr("+-.eE", *p) || (*p >= '0' && *p <= '9'))) p++;
+    size_t length = (size_t)(p - start);
+    if (length == 0 || length >= size) return fail("expected a string");
+    std::memcpy(out, start, length);
+    out[length] = 0;
+    return true;
+  }
+
+  bool parseNumber(float& out, uint8_t& fields, uint8_t bit) {
+    if (parseNull()) return true;
+    char text[32];
+    const char* start = p;
+    while (p < end && (std::strchr("+-.eE", *p) || (*p >= '0' && *p <= '9'))) p++;
+    size_t length = (size_t)(p - start);
+    if (length == 0 || length >= sizeof(text)) return fail("expected a number");
+    std::memcpy(text, start, length);
+    text[length] = 0;
+    char* parsedEnd;
+    out = std::strtof(text, &parsedEnd);
+    if (*parsedEnd != 0) return fail("expected a number");
+    fields |= bit;
+    return true;
+  }
+
+  bool parseNull() {
+    if (end - p >= 4 && std::memcmp(p, "null", 4) == 0) {
+      p += 4;
+      return true;
+    }
+    return false;
+  }
+
+  // Escapes are decoded; anything outside ASCII is replaced with '?'
+  bool parseString(char* out, size_t size) {
+    if (p >= end || *p != '"') return false;
+    p++;
+    size_t used = 0;
+    while (p < end && *p != '"') {
+      char c = *p++;
+      if (c == '\\') {
+        if (p >= end) return fail("bad escape");
+        char escaped = *p++;
+        switch (escaped) {
+          case 'b': c = '\b'; break;
+          case 'f': c = '\f'; break;
+          case 'n': c = '\n'; break;
+          case 'r': c = '\r'; break;
+          case 't': c = '\t'; break;
+          case 'u':
+            if (end - p < 4) return fail("bad escape");
+            p += 4;
+            c = '?';
+            break;
+          default: c = escaped; break;
+        }
+      } else if ((unsigned char)c >= 0x80) {
+        c = '?';
+      }
+      if (used + 1 >= size) return fail("string too long");
+      out[used++] = c;
+    }
+    if (p >= end) return fail("unterminated string");
+    p++;
+    out[used] = 0;
+    return true;
+  }
+
+  void skipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+  }
+
+  bool fail(const char* message) {
+    if (!error) error = message;
+    return false;
+  }
+
+  const char* p;
+  const char* end;
+  IngestRecord::Table table;
+  int64_t receivedAtUs;
+  const char* error = nullptr;
+};
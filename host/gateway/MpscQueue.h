@@ -0,0 +1,115 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// MpscQueue.h - Bounded lock-free multi-producer, single-consumer ring
+//
+// The HTTP and UDP listeners push records; one writer thread pops them.
+// Each slot carries a sequence number (Vyukov's bounded queue): a producer
+// claims a slot with one compare-and-swap on the tail and publishes it by
+// bumping the slot's sequence, so producers never wait on each other or on
+// the consumer, and a full queue is reported instead of blocking. A run of
+// values is claimed the same way with one wider step of the tail, so it
+// goes in whole or not at all. The consumer owns the head and needs no
+// atomic read-modify-write at all.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+template <typename T>
+class MpscQueue {
+public:
+  // Capacity is rounded up to a power of two
+  explicit MpscQueue(size_t minCapacity) {
+    size_t capacity = 2;
+    while (capacity < minCapacity) capacity <<= 1;
+    mask = capacity - 1;
+    cells.reset(new Cell[capacity]);
+    for (size_t i = 0; i < capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // Any thread. False when the queue is full.
+  bool tryPush(const T& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // the consumer has not freed this slot yet
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Any thread. Queues all `count` values in consecutive slots, or none of
+  // them (false) when the queue cannot take them all.
+  bool tryPushAll(const T* values, size_t count) {
+    if (count == 0) return true;
+    if (count > capacity()) return false;
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      // The consumer frees slots in order, so the run is free when its last
+      // slot is
+      size_t first = cells[pos & mask].sequence.load(std::memory_order_acquire);
+      size_t last = cells[(pos + count - 1) & mask].sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)first - (intptr_t)pos;
+      intptr_t lastDiff = (intptr_t)last - (intptr_t)(pos + count - 1);
+      if (diff == 0 && lastDiff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+      } else if (diff < 0 || lastDiff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    for (size_t i = 0; i < count; i++) {
+      Cell& cell = cells[(pos + i) & mask];
+      cell.value = values[i];
+      cell.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // Consumer thread only. False when nothing is ready.
+  bool tryPop(T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Cell& cell = cells[pos & mask];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0) return false;
+    value = cell.value;
+    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+    head.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Approximate while producers are active; for metrics and admission only
+  size_t size() const {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+  size_t capacity() const { return mask + 1; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask = 0;
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) std::atomic<size_t> head{0};
+};
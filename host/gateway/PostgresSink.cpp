@@ -0,0 +1,149 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// PostgresSink.cpp - COPY text encoding and libpq calls
+
+#include "PostgresSink.h"
+
+#include <libpq-fe.h>
+
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+// COPY text format: tab separated, \N for NULL, backslash escapes
+void appendText(std::string& out, const char* text) {
+  if (!text[0]) {
+    out += "\\N";
+    return;
+  }
+  for (const char* c = text; *c; c++) {
+    switch (*c) {
+      case '\\': out += "\\\\"; break;
+      case '\t': out += "\\t"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      default: out += *c; break;
+    }
+  }
+}
+
+void appendNumber(std::string& out, bool present, float value) {
+  if (!present) {
+    out += "\\N";
+    return;
+  }
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.7g", value);
+  out += text;
+}
+
+void appendTimestamp(std::string& out, int64_t micros) {
+  time_t seconds = (time_t)(micros / 1000000);
+  tm utc;
+  gmtime_r(&seconds, &utc);
+  char text[48];
+  std::snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d.%06d+00", utc.tm_year + 1900, utc.tm_mon + 1,
+                utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec, (int)(micros % 1000000));
+  out += text;
+}
+
+}  // namespace
+
+PostgresSink::~PostgresSink() {
+  if (conn) PQfinish(conn);
+}
+
+bool PostgresSink::write(const IngestRecord* records, size_t count) {
+  if (!connect()) return false;
+  if (!exec("BEGIN")) return false;
+  if (!copy(IngestRecord::RICE_WEIGHTS, records, count) || !copy(IngestRecord::ENVIRONMENTAL_DATA, records, count)) {
+    exec("ROLLBACK");
+    return false;
+  }
+  return exec("COMMIT");
+}
+
+bool PostgresSink::connect() {
+  if (conn && PQstatus(conn) == CONNECTION_OK) return true;
+  if (conn) {
+    PQreset(conn);  // keeps the parameters, opens a new socket
+  } else {
+    conn = PQconnectdb(conninfo.c_str());
+  }
+  if (PQstatus(conn) == CONNECTION_OK) return true;
+  fail("connect");
+  return false;
+}
+
+bool PostgresSink::exec(const char* sql) {
+  PGresult* result = PQexec(conn, sql);
+  bool ok = PQresultStatus(result) == PGRES_COMMAND_OK;
+  PQclear(result);
+  if (!ok) fail(sql);
+  return ok;
+}
+
+bool PostgresSink::copy(IngestRecord::Table table, const IngestRecord* records, size_t count) {
+  rows.clear();
+  for (size_t i = 0; i < count; i++) {
+    const IngestRecord& record = records[i];
+    if (record.table != table) continue;
+    appendText(rows, record.deviceId);
+    rows += '\t';
+    if (table == IngestRecord::RICE_WEIGHTS) {
+      appendNumber(rows, record.fields & IngestRecord::HAS_WEIGHT, record.weight);
+    } else {
+      appendNumber(rows, record.fields & IngestRecord::HAS_TEMPERATURE, record.temperature);
+      rows += '\t';
+      appendNumber(rows, record.fields & IngestRecord::HAS_HUMIDITY, record.humidity);
+      rows += '\t';
+      appendNumber(rows, record.fields & IngestRecord::HAS_LEVEL, record.containerLevel);
+    }
+    rows += '\t';
+    appendText(rows, record.timestamp);
+    rows += '\t';
+    appendTimestamp(rows, record.receivedAtUs);
+    rows += '\n';
+  }
+  if (rows.empty()) return true;
+
+  const char* statement = table == IngestRecord::RICE_WEIGHTS
+                              ? "COPY rice_weights (device_id, weight, timestamp, received_at) FROM STDIN"
+                              : "COPY environmental_data (device_id, temperature, humidity, container_level, "
+                                "timestamp, received_at) FROM STDIN";
+  PGresult* result = PQexec(conn, statement);
+  bool ready = PQresultStatus(result) == PGRES_COPY_IN;
+  PQclear(result);
+  if (!ready) {
+    fail(statement);
+    return false;
+  }
+  bool sent = PQputCopyData(conn, rows.data(), (int)rows.size()) == 1;
+  if (!sent) fail("COPY data");
+  // End the COPY either way (aborting it if the rows did not go out) and
+  // read its results, so the connection leaves COPY_IN and the caller's
+  // ROLLBACK can run
+  if (PQputCopyEnd(conn, sent ? nullptr : "gateway aborted the batch") != 1 && sent) {
+    fail("COPY end");
+    sent = false;
+  }
+  bool ok = sent;
+  while ((result = PQgetResult(conn)) != nullptr) {
+    ExecStatusType status = PQresultStatus(result);
+    PQclear(result);
+    if (status == PGRES_COPY_IN) {
+      PQreset(conn);  // the COPY could not be ended; a new session drops the transaction
+      return false;
+    }
+    if (status != PGRES_COMMAND_OK) ok = false;
+  }
+  if (sent && !ok) fail("COPY");
+  return ok;
+}
+
+void PostgresSink::fail(const char* what) {
+  error = what;
+  error += ": ";
+  error += PQerrorMessage(conn);
+  while (!error.empty() && (error.back() == '\n' || error.back() == ' ')) error.pop_back();
+}
@@ -0,0 +1,36 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// PostgresSink.h - Batches into Postgres with COPY, one connection per writer
+//
+// A batch is written in one transaction with one COPY ... FROM STDIN per
+// table, which costs a round trip or two instead of one INSERT (and one
+// commit) per row. A failure rolls the whole batch back so the writer can
+// retry it as is; a broken connection is reopened on the next attempt.
+// The tables are created by sql/04_device_telemetry.sql.
+
+#pragma once
+
+#include <string>
+
+#include "BatchWriter.h"
+
+struct pg_conn;
+
+class PostgresSink : public RecordSink {
+public:
+  explicit PostgresSink(const std::string& connectionInfo) : conninfo(connectionInfo) {}
+  ~PostgresSink() override;
+
+  bool write(const IngestRecord* records, size_t count) override;
+  const char* lastError() const override { return error.c_str(); }
+
+private:
+  bool connect();
+  bool exec(const char* sql);
+  bool copy(IngestRecord::Table table, const IngestRecord* records, size_t count);
+  void fail(const char* what);
+
+  std::string conninfo;
+  pg_conn* conn = nullptr;
+  std::string error;
+  std::string rows;  // COPY text for one table, reused across batches
+};
@@ -0,0 +1,166 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// UdpListener.cpp - Frame decoding, duplicate detection and acks
+
+#include "UdpListener.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "Gateway.h"
+
+namespace {
+
+const int RECEIVE_BUFFER_BYTES = 4 << 20;  // rides out a burst while a writer is slow
+const int POLL_TIMEOUT_MS = 100;           // how quickly run() notices a stop request
+
+int64_t wallMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+IngestRecord toRecord(const TelemetryFrame& frame) {
+  IngestRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.table = frame.fields & TelemetryFrame::HAS_WEIGHT ? IngestRecord::RICE_WEIGHTS
+                                                           : IngestRecord::ENVIRONMENTAL_DATA;
+  record.fields = frame.fields;
+  std::snprintf(record.deviceId, sizeof(record.deviceId), "%u", (unsigned)frame.deviceId);
+  std::snprintf(record.timestamp, sizeof(record.timestamp), "%lu", (unsigned long)frame.takenAtMs);
+  record.weight = frame.weightMg / 1000.0f;
+  record.temperature = frame.temperatureCentiC / 100.0f;
+  record.humidity = frame.humidityCentiPct / 100.0f;
+  record.containerLevel = frame.levelCentiPct / 100.0f;
+  record.receivedAtUs = wallMicros();
+  return record;
+}
+
+}  // namespace
+
+UdpListener::~UdpListener() {
+  if (fd >= 0) ::close(fd);
+}
+
+bool UdpListener::open(uint16_t port) {
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return false;
+  int bufferBytes = RECEIVE_BUFFER_BYTES;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+  timeval timeout = {0, POLL_TIMEOUT_MS * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    std::fprintf(stderr, "udp: cannot bind port %u: %s\n", port, std::strerror(errno));
+    return false;
+  }
+  socklen_t length = sizeof(address);
+  getsockname(fd, (sockaddr*)&address, &length);
+  boundPort = ntohs(address.sin_port);
+  return true;
+}
+
+void UdpListener::run(const std::atomic<bool>& stop) {
+  uint8_t buffers[BURST][TelemetryFrame::DATA_BYTES + 4];
+  sockaddr_in peers[BURST];
+  iovec vectors[BURST];
+  mmsghdr messages[BURST];
+  uint8_t ackBuffers[BURST][TelemetryFrame::ACK_BYTES];
+  iovec ackVectors[BURST];
+  mmsghdr acks[BURST];
+  GatewayMetrics& metrics = gateway.metrics();
+
+  while (!stop.load()) {
+    for (unsigned i = 0; i < BURST; i++) {
+      vectors[i] = {buffers[i], sizeof(buffers[i])};
+      std::memset(&messages[i], 0, sizeof(messages[i]));
+      messages[i].msg_hdr.msg_name = &peers[i];
+      messages[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Blocks for the first datagram (up to the receive timeout), then takes
+    // whatever else is already waiting
+    int received = recvmmsg(fd, messages, BURST, MSG_WAITFORONE, nullptr);
+    if (received <= 0) continue;
+
+    unsigned ackCount = 0;
+    for (int i = 0; i < received; i++) {
+      TelemetryFrame frame;
+      if ((messages[i].msg_hdr.msg_flags & MSG_TRUNC) || !frame.decode(buffers[i], messages[i].msg_len) ||
+          frame.type != TelemetryFrame::TYPE_DATA) {
+        bump(metrics.udpMalformed);
+        continue;
+      }
+      uint32_t acked = accept(frame);
+      TelemetryFrame::ack(frame.deviceId, frame.bootId, acked).encode(ackBuffers[ackCount]);
+      ackVectors[ackCount] = {ackBuffers[ackCount], TelemetryFrame::ACK_BYTES};
+      std::memset(&acks[ackCount], 0, sizeof(acks[ackCount]));
+      acks[ackCount].msg_hdr.msg_name = &peers[i];
+      acks[ackCount].msg_hdr.msg_namelen = messages[i].msg_hdr.msg_namelen;
+      acks[ackCount].msg_hdr.msg_iov = &ackVectors[ackCount];
+      acks[ackCount].msg_hdr.msg_iovlen = 1;
+      ackCount++;
+    }
+    if (ackCount > 0) {
+      int sent = sendmmsg(fd, acks, ackCount, 0);
+      if (sent > 0) bump(metrics.acksSent, (uint64_t)sent);
+    }
+  }
+}
+
+uint32_t UdpListener::accept(const TelemetryFrame& frame) {
+  GatewayMetrics& metrics = gateway.metrics();
+  auto found = devices.find(frame.deviceId);
+  if (found == devices.end() || found->second.bootId != frame.bootId) {
+    // New device, a reboot or a gateway restart: start at the device's
+    // window base, so frames it still holds below this one are not lost
+    DeviceWindow start = {frame.bootId, frame.windowBase() - 1, 0};
+    found = devices.insert_or_assign(frame.deviceId, start).first;
+  }
+  DeviceWindow& window = found->second;
+
+  // The device has given up on everything below its window base (it went
+  // to the REST fallback), so a gap there would stall the acks for good
+  int32_t skip = (int32_t)(frame.windowBase() - 1 - window.acked);
+  if (skip > 0) {
+    bump(metrics.udpSkipped, (uint64_t)skip);
+    window.above = skip < 64 ? window.above >> skip : 0;
+    window.acked += (uint32_t)skip;
+    while (window.above & 1) {
+      window.above >>= 1;
+      window.acked++;
+    }
+  }
+
+  int32_t offset = (int32_t)(frame.seq - window.acked);  // 1 = the next frame expected
+  if (offset <= 0 || (offset <= 64 && (window.above >> (offset - 1)) & 1)) {
+    bump(metrics.udpDuplicates);
+    return window.acked;
+  }
+  if (offset > 64) {
+    bump(metrics.udpRejected);  // a gap wider than the window; wait for the missing frames
+    return window.acked;
+  }
+  if (!gateway.submit(toRecord(frame), Gateway::routeKey("", frame.deviceId))) {
+    bump(metrics.udpRejected);
+    return window.acked;
+  }
+  bump(metrics.udpFrames);
+  window.above |= 1ull << (offset - 1);
+  while (window.above & 1) {
+    window.above >>= 1;
+    window.acked++;
+  }
+  return window.acked;
+}
@@ -0,0 +1,52 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// UdpListener.h - TelemetryFrames in, cumulative acks out
+//
+// Reads datagrams in bursts with recvmmsg() and answers each burst's acks
+// with one sendmmsg(). Per device it tracks the boot id, the highest
+// sequence up to which every frame was queued, and which of the next 64
+// have arrived, so a retransmitted frame is acked again but stored once.
+// Each frame also names the oldest sequence its device still holds; the
+// ack point jumps to it when frames were evicted on the device while the
+// gateway could not be reached.
+// A frame is only acked once it is in a writer queue: when the writers are
+// behind it is left unacked and the device sends it again later. After a
+// gateway restart the window base of the first frame seen from a device
+// sets its starting point: everything the device still holds is taken,
+// and earlier sequence numbers were acked before the restart.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+#include "src/TelemetryFrame.h"
+
+class Gateway;
+
+class UdpListener {
+public:
+  static const unsigned BURST = 64;
+
+  explicit UdpListener(Gateway& owner) : gateway(owner) {}
+  ~UdpListener();
+
+  bool open(uint16_t port);
+  uint16_t port() const { return boundPort; }
+  void run(const std::atomic<bool>& stop);
+
+private:
+  struct DeviceWindow {
+    uint32_t bootId;
+    uint32_t acked;  // every frame up to here is queued
+    uint64_t above;  // bit i: frame acked + 1 + i is queued
+  };
+
+  // Queues the frame if it is new; returns the cumulative ack to send back
+  uint32_t accept(const TelemetryFrame& frame);
+
+  Gateway& gateway;
+  int fd = -1;
+  uint16_t boundPort = 0;
+  std::unordered_map<uint16_t, DeviceWindow> devices;
+};
@@ -0,0 +1,446 @@
+// Benchmarks for the telemetry ingest gateway
+//
+//   bench_gateway [--quick] [--postgres CONNINFO]
+//
+// Without --postgres the writers feed a simulated database that charges a
+// fixed cost per transaction plus a small cost per row, which is where
+// batching pays off; with it they write to a real (local) Postgres that has
+// sql/04_device_telemetry.sql applied.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Gateway.h"
+#include "MpscQueue.h"
+#include "PostgresSink.h"
+#include "src/TelemetryFrame.h"
+
+namespace {
+
+const uint32_t TRANSACTION_MICROS = 1000;  // commit round trip to the simulated database
+const uint32_t ROW_MICROS = 2;
+
+class SimulatedDatabase : public RecordSink {
+public:
+  bool write(const IngestRecord*, size_t count) override {
+    std::this_thread::sleep_for(std::chrono::microseconds(TRANSACTION_MICROS + ROW_MICROS * count));
+    return true;
+  }
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// `producers` threads push `perProducer` records each while one thread pops
+template <typename Push, typename Pop>
+double queueNanosPerRecord(unsigned producers, uint32_t perProducer, Push push, Pop pop) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      IngestRecord record;
+      std::memset(&record, 0, sizeof(record));
+      record.receivedAtUs = p;
+      for (uint32_t i = 0; i < perProducer; i++) {
+        while (!push(record)) std::this_thread::yield();
+      }
+    });
+  }
+  uint64_t expected = (uint64_t)producers * perProducer;
+  IngestRecord record;
+  for (uint64_t popped = 0; popped < expected;) {
+    if (pop(record)) {
+      popped++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  for (auto& thread : threads) thread.join();
+  return secondsSince(start) * 1e9 / expected;
+}
+
+struct LockedDeque {
+  std::mutex mutex;
+  std::deque<IngestRecord> records;
+  size_t limit;
+
+  explicit LockedDeque(size_t capacity) : limit(capacity) {}
+  bool push(const IngestRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (records.size() >= limit) return false;
+    records.push_back(record);
+    return true;
+  }
+  bool pop(IngestRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (records.empty()) return false;
+    record = records.front();
+    records.pop_front();
+    return true;
+  }
+};
+
+int udpSocket() {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(fd, (sockaddr*)&local, sizeof(local));
+  return fd;
+}
+
+sockaddr_in loopback(uint16_t port) {
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  return address;
+}
+
+struct UdpLoad {
+  uint64_t datagrams = 0;
+  uint64_t unacked = 0;  // rows the devices still hold at the end
+};
+
+// `devices` controllers each send `frames` weight rows, 3% of them twice,
+// and resend whatever stays unacknowledged the way UdpTelemetry does
+UdpLoad runDevices(uint16_t port, uint16_t devices, uint32_t frames) {
+  struct Device {
+    uint32_t acked = 0;
+    std::chrono::steady_clock::time_point lastSend;
+  };
+  std::vector<Device> state(devices + 1);
+  int fd = udpSocket();
+  sockaddr_in gateway = loopback(port);
+  UdpLoad load;
+  uint32_t random = 1;
+
+  auto send = [&](uint16_t device, uint32_t seq) {
+    TelemetryFrame frame = TelemetryFrame::data(device);
+    frame.bootId = 0xB0070000u + device;
+    frame.seq = seq;
+    frame.takenAtMs = seq * 1000;
+    frame.weightMg = (int32_t)(1000000 - seq * 10000);
+    frame.fields = TelemetryFrame::HAS_WEIGHT;
+    uint8_t buffer[TelemetryFrame::DATA_BYTES];
+    size_t length = frame.encode(buffer);
+    sendto(fd, buffer, length, 0, (sockaddr*)&gateway, sizeof(gateway));
+    state[device].lastSend = std::chrono::steady_clock::now();
+    load.datagrams++;
+  };
+  auto drainAcks = [&](int timeoutMs) {
+    pollfd ready = {fd, POLLIN, 0};
+    while (poll(&ready, 1, timeoutMs) > 0) {
+      uint8_t buffer[64];
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      TelemetryFrame ack;
+      if (n > 0 && ack.decode(buffer, (size_t)n) && ack.type == TelemetryFrame::TYPE_ACK &&
+          ack.deviceId <= devices && (int32_t)(ack.seq - state[ack.deviceId].acked) > 0) {
+        state[ack.deviceId].acked = ack.seq;
+      }
+      timeoutMs = 0;
+    }
+  };
+
+  for (uint32_t seq = 1; seq <= frames; seq++) {
+    for (uint16_t device = 1; device <= devices; device++) {
+      send(device, seq);
+      random = random * 1103515245u + 12345u;
+      if ((random >> 16) % 100 < 3) send(device, seq);
+    }
+    drainAcks(0);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (;;) {
+    drainAcks(5);
+    bool done = true;
+    auto now = std::chrono::steady_clock::now();
+    for (uint16_t device = 1; device <= devices; device++) {
+      Device& d = state[device];
+      if (d.acked >= frames) continue;
+      done = false;
+      if (now - d.lastSend < std::chrono::milliseconds(50)) continue;
+      for (uint32_t seq = d.acked + 1; seq <= frames && seq <= d.acked + 4; seq++) send(device, seq);
+    }
+    if (done || secondsSince(start) > 30) break;
+  }
+  for (uint16_t device = 1; device <= devices; device++) load.unacked += frames - state[device].acked;
+  close(fd);
+  return load;
+}
+
+// Keeps the sequence number of every row written (the frames below carry
+// it in the timestamp)
+class RecordingSink : public RecordSink {
+public:
+  RecordingSink(std::mutex& guard, std::vector<uint32_t>& into) : mutex(guard), rows(into) {}
+  bool write(const IngestRecord* records, size_t count) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < count; i++) rows.push_back((uint32_t)(std::strtoul(records[i].timestamp, nullptr, 10) / 1000));
+    return true;
+  }
+
+private:
+  std::mutex& mutex;
+  std::vector<uint32_t>& rows;
+};
+
+struct Outage {
+  uint32_t acked = 0;             // the device's cumulative ack at the end
+  size_t pending = 0;             // still in its window
+  std::vector<uint32_t> evicted;  // handed to the REST fallback
+};
+
+// One device with UdpTelemetry's 32-frame window sends `frames` rows while
+// every datagram either way is lost for `lost` frames from `from` on. A full
+// window evicts its oldest frame, and each datagram names the window base.
+// Readings are far apart compared with a LAN round trip, so every ack is
+// in before the next one is sent.
+Outage runOutage(uint16_t port, uint32_t frames, uint32_t from, uint32_t lost) {
+  const size_t WINDOW = 32;
+  int fd = udpSocket();
+  sockaddr_in gateway = loopback(port);
+  Outage outage;
+  std::deque<uint32_t> window;
+  bool down = false;
+  uint32_t unanswered = 0;
+
+  auto transmit = [&](uint32_t seq) {
+    if (down) return;
+    TelemetryFrame frame = TelemetryFrame::data(7);
+    frame.bootId = 0xB0070007u;
+    frame.seq = seq;
+    frame.held = (uint8_t)(seq - window.front());
+    frame.takenAtMs = seq * 1000;
+    frame.weightMg = 500000;
+    frame.fields = TelemetryFrame::HAS_WEIGHT;
+    uint8_t buffer[TelemetryFrame::DATA_BYTES];
+    size_t length = frame.encode(buffer);
+    if (sendto(fd, buffer, length, 0, (sockaddr*)&gateway, sizeof(gateway)) > 0) unanswered++;
+  };
+  auto drainAcks = [&] {
+    pollfd ready = {fd, POLLIN, 0};
+    while (unanswered > 0 && poll(&ready, 1, 1000) > 0) {
+      uint8_t buffer[64];
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      TelemetryFrame ack;
+      if (n <= 0 || !ack.decode(buffer, (size_t)n) || ack.type != TelemetryFrame::TYPE_ACK) continue;
+      unanswered--;
+      if ((int32_t)(ack.seq - outage.acked) > 0) outage.acked = ack.seq;
+      while (!window.empty() && (int32_t)(ack.seq - window.front()) >= 0) window.pop_front();
+    }
+  };
+  auto retransmit = [&] {
+    for (size_t i = 0; i < window.size() && i < 4; i++) transmit(window[i]);
+  };
+
+  for (uint32_t seq = 1; seq <= frames; seq++) {
+    down = seq >= from && seq < from + lost;
+    if (window.size() == WINDOW) {
+      outage.evicted.push_back(window.front());
+      window.pop_front();
+    }
+    window.push_back(seq);
+    transmit(seq);
+    if (seq % 8 == 0) retransmit();
+    drainAcks();
+  }
+  down = false;
+  for (int round = 0; round < 200 && !window.empty(); round++) {
+    retransmit();
+    drainAcks();
+  }
+  outage.pending = window.size();
+  close(fd);
+  return outage;
+}
+
+// `connections` keep-alive clients, one device each, post `requests`
+// batches of 12 rows shaped like esp1.cpp's sendWeightData()
+std::string weightRequest(unsigned device) {
+  std::string body = "[";
+  for (int i = 0; i < 12; i++) {
+    char row[96];
+    std::snprintf(row, sizeof(row), "%s{\"weight\":%d.5,\"timestamp\":\"%d\",\"device_id\":\"ESP32_%03u\"}",
+                  i ? "," : "", 900 + i, 1000 * i, device);
+    body += row;
+  }
+  body += "]";
+  char head[256];
+  std::snprintf(head, sizeof(head),
+                "POST /rest/v1/rice_weights HTTP/1.1\r\nHost: gateway\r\napikey: bench\r\n"
+                "Content-Type: application/json\r\nPrefer: return=minimal\r\nContent-Length: %zu\r\n\r\n",
+                body.size());
+  return head + body;
+}
+
+uint64_t runHttpClients(uint16_t port, unsigned connections, uint32_t requests) {
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> created(connections, 0);
+  for (unsigned c = 0; c < connections; c++) {
+    threads.emplace_back([&, c] {
+      std::string request = weightRequest(c + 1);
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in gateway = loopback(port);
+      if (connect(fd, (sockaddr*)&gateway, sizeof(gateway)) != 0) return;
+      std::string response;
+      for (uint32_t i = 0; i < requests; i++) {
+        if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) break;
+        response.clear();
+        char buffer[1024];
+        while (response.find("\r\n\r\n") == std::string::npos) {
+          ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+          if (n <= 0) break;
+          response.append(buffer, (size_t)n);
+        }
+        if (response.compare(0, 12, "HTTP/1.1 201") == 0) created[c]++;
+      }
+      close(fd);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  uint64_t total = 0;
+  for (uint64_t count : created) total += count;
+  return total;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t scale = 1;
+  std::string conninfo;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--quick") == 0) scale = 100;
+    if (std::strcmp(argv[i], "--postgres") == 0 && i + 1 < argc) conninfo = argv[++i];
+  }
+  auto iterations = [&](uint32_t full) { return full / scale ? full / scale : 1; };
+
+  // Hand-off cost between 4 listener threads and one writer
+  uint32_t perProducer = iterations(500000);
+  std::printf("\n%-28s %12s %12s\n", "queue, 4 producers", "ns/row", "Mrows/s");
+  MpscQueue<IngestRecord> mpsc(65536);
+  double lockFree = queueNanosPerRecord(
+      4, perProducer, [&](const IngestRecord& r) { return mpsc.tryPush(r); },
+      [&](IngestRecord& r) { return mpsc.tryPop(r); });
+  std::printf("%-28s %12.1f %12.2f\n", "MpscQueue", lockFree, 1000.0 / lockFree);
+  LockedDeque locked(65536);
+  double mutexed = queueNanosPerRecord(
+      4, perProducer, [&](const IngestRecord& r) { return locked.push(r); },
+      [&](IngestRecord& r) { return locked.pop(r); });
+  std::printf("%-28s %12.1f %12.2f\n", "mutex + std::deque", mutexed, 1000.0 / mutexed);
+
+  // Whole gateway: per-row writes against batches, same load
+  uint16_t devices = (uint16_t)iterations(200);
+  uint32_t frames = 50;
+  std::printf("\n%s: %u devices x %u frames over UDP, then 8 HTTP clients x %u requests of 12 rows\n",
+              conninfo.empty() ? "simulated database (1 ms per transaction + 2 us per row)" : "postgres",
+              (unsigned)devices, frames, iterations(500));
+  std::printf("%-28s %12s %12s %12s %12s %12s %12s\n", "writers x batch", "udp rows/s", "http rows/s", "duplicates",
+              "max queue", "flush avg ms", "unwritten");
+  for (size_t batchRows : {(size_t)1, (size_t)1000}) {
+    Gateway::Config config;
+    config.httpPort = 0;
+    config.udpPort = 0;
+    config.writers = 4;
+    config.writer.batchRows = batchRows;
+    config.writer.batchMs = 50;
+    config.writer.queueCapacity = 16384;
+    Gateway gateway(config, [&]() -> std::unique_ptr<RecordSink> {
+      if (!conninfo.empty()) return std::unique_ptr<RecordSink>(new PostgresSink(conninfo));
+      return std::unique_ptr<RecordSink>(new SimulatedDatabase());
+    });
+    if (!gateway.start()) return 1;
+
+    std::atomic<bool> sampling{true};
+    size_t maxDepth = 0;
+    std::thread sampler([&] {
+      while (sampling.load()) {
+        maxDepth = std::max(maxDepth, gateway.queueDepth());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    UdpLoad load = runDevices(gateway.udpPort(), devices, frames);
+    while (gateway.metrics().rowsWritten.load() < gateway.metrics().rowsIngested() && secondsSince(start) < 60) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double udpSeconds = secondsSince(start);
+    uint64_t udpRows = gateway.metrics().udpFrames.load();
+
+    start = std::chrono::steady_clock::now();
+    uint64_t created = runHttpClients(gateway.httpPort(), 8, iterations(500));
+    while (gateway.metrics().rowsWritten.load() < gateway.metrics().rowsIngested() && secondsSince(start) < 60) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double httpSeconds = secondsSince(start);
+
+    sampling.store(false);
+    sampler.join();
+    gateway.stop();
+    GatewayMetrics& metrics = gateway.metrics();
+    uint64_t batches = metrics.batches.load();
+    char name[32];
+    std::snprintf(name, sizeof(name), "%u x %zu", config.writers, batchRows);
+    std::printf("%-28s %12.0f %12.0f %12llu %12zu %12.2f %12llu\n", name, udpRows / udpSeconds,
+                created * 12 / httpSeconds, (unsigned long long)metrics.udpDuplicates.load(), maxDepth,
+                batches ? metrics.flushMicrosTotal.load() / 1000.0 / batches : 0.0,
+                (unsigned long long)(metrics.rowsIngested() - metrics.rowsWritten.load() + load.unacked));
+    std::printf("  %llu datagrams for %u rows, %llu acks; ", (unsigned long long)load.datagrams,
+                (unsigned)devices * frames, (unsigned long long)metrics.acksSent.load());
+    gateway.printStats(stdout);
+  }
+
+  // Gateway unreachable for longer than the device window: the evicted rows
+  // go over REST, so the acks have to move past them and none of them may
+  // also be written from UDP
+  {
+    std::mutex mutex;
+    std::vector<uint32_t> written;
+    Gateway::Config config;
+    config.httpPort = 0;
+    config.udpPort = 0;
+    config.writers = 1;
+    config.writer.batchMs = 20;
+    Gateway gateway(config, [&]() -> std::unique_ptr<RecordSink> {
+      return std::unique_ptr<RecordSink>(new RecordingSink(mutex, written));
+    });
+    if (!gateway.start()) return 1;
+    const uint32_t frames = 200, from = 50, lost = 40;
+    Outage outage = runOutage(gateway.udpPort(), frames, from, lost);
+    auto start = std::chrono::steady_clock::now();
+    while (gateway.metrics().rowsWritten.load() < gateway.metrics().rowsIngested() && secondsSince(start) < 10) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    gateway.stop();
+
+    std::set<uint32_t> rows(written.begin(), written.end());
+    size_t twice = written.size() - rows.size();
+    for (uint32_t seq : outage.evicted) twice += rows.count(seq);
+    size_t missing = frames - rows.size() - outage.evicted.size() + twice;
+    std::printf("\ngateway down for %u of %u frames: acked to %u, %zu pending; %zu rows from udp, %zu evicted to "
+                "REST, %zu skipped by the gateway, %zu written twice, %zu lost\n",
+                lost, frames, outage.acked, outage.pending, written.size(), outage.evicted.size(),
+                (size_t)gateway.metrics().udpSkipped.load(), twice, missing);
+    if (outage.acked != frames || twice || missing) {
+      std::fprintf(stderr, "acks did not resume after the outage, or a row was lost or written twice\n");
+      return 1;
+    }
+  }
+  return 0;
+}
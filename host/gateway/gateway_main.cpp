@@ -0,0 +1,129 @@
+// Ingest gateway for the Smart Rice Dispenser telemetry
+// gateway_main.cpp - rice_gateway daemon
+//
+//   rice_gateway --postgres "host=localhost dbname=rice user=rice"
+//
+// Options (defaults in brackets):
+//   --postgres CONNINFO   libpq connection string [$DATABASE_URL]
+//   --http-port N         PostgREST-style inserts and /metrics [8080]
+//   --udp-port N          TelemetryFrames [47800]
+//   --writers N           writer threads, one database connection each [4]
+//   --batch-rows N        rows per COPY [1000]
+//   --batch-ms N          longest a row waits for its batch [200]
+//   --queue N             rows each writer can hold before turning devices away [65536]
+//   --api-key KEY         require this apikey header on HTTP inserts
+//   --stats-interval S    seconds between stats lines on stdout, 0 = off [10]
+//   --discard             accept and count rows without a database (testing)
+// SIGINT or SIGTERM stops listening and flushes what is queued.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "Gateway.h"
+#include "PostgresSink.h"
+
+namespace {
+
+volatile sig_atomic_t stopSignal = 0;
+
+void onSignal(int) {
+  stopSignal = 1;
+}
+
+class DiscardSink : public RecordSink {
+public:
+  bool write(const IngestRecord*, size_t) override { return true; }
+};
+
+int usage(const char* program) {
+  std::fprintf(stderr,
+               "usage: %s [--postgres CONNINFO | --discard] [--http-port N] [--udp-port N] [--writers N]\n"
+               "          [--batch-rows N] [--batch-ms N] [--queue N] [--api-key KEY] [--stats-interval S]\n",
+               program);
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Gateway::Config config;
+  const char* databaseUrl = std::getenv("DATABASE_URL");
+  std::string conninfo = databaseUrl ? databaseUrl : "";
+  bool discard = false;
+  unsigned statsInterval = 10;
+
+  for (int i = 1; i < argc; i++) {
+    const char* option = argv[i];
+    if (std::strcmp(option, "--discard") == 0) {
+      discard = true;
+      continue;
+    }
+    if (i + 1 >= argc) return usage(argv[0]);
+    const char* value = argv[++i];
+    unsigned long number = std::strtoul(value, nullptr, 10);
+    if (std::strcmp(option, "--postgres") == 0) {
+      conninfo = value;
+    } else if (std::strcmp(option, "--http-port") == 0) {
+      config.httpPort = (uint16_t)number;
+    } else if (std::strcmp(option, "--udp-port") == 0) {
+      config.udpPort = (uint16_t)number;
+    } else if (std::strcmp(option, "--writers") == 0) {
+      config.writers = (unsigned)number;
+    } else if (std::strcmp(option, "--batch-rows") == 0) {
+      config.writer.batchRows = number ? number : 1;
+    } else if (std::strcmp(option, "--batch-ms") == 0) {
+      config.writer.batchMs = (unsigned)number;
+    } else if (std::strcmp(option, "--queue") == 0) {
+      config.writer.queueCapacity = number;
+    } else if (std::strcmp(option, "--api-key") == 0) {
+      config.apiKey = value;
+    } else if (std::strcmp(option, "--stats-interval") == 0) {
+      statsInterval = (unsigned)number;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (conninfo.empty() && !discard) {
+    std::fprintf(stderr, "no database: pass --postgres CONNINFO, set DATABASE_URL, or use --discard\n");
+    return usage(argv[0]);
+  }
+
+  Gateway gateway(config, [&]() -> std::unique_ptr<RecordSink> {
+    if (discard) return std::unique_ptr<RecordSink>(new DiscardSink());
+    return std::unique_ptr<RecordSink>(new PostgresSink(conninfo));
+  });
+  if (!gateway.start()) return 1;
+  std::printf("rice_gateway: http %u, udp %u, %u writers, batches of %zu rows or %u ms%s\n", gateway.httpPort(),
+              gateway.udpPort(), config.writers, config.writer.batchRows, config.writer.batchMs,
+              discard ? ", discarding rows" : "");
+  std::fflush(stdout);
+
+  struct sigaction action = {};
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  auto nextStats = std::chrono::steady_clock::now() + std::chrono::seconds(statsInterval);
+  while (!stopSignal) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (statsInterval > 0 && std::chrono::steady_clock::now() >= nextStats) {
+      gateway.printStats(stdout);
+      std::fflush(stdout);
+      nextStats += std::chrono::seconds(statsInterval);
+    }
+  }
+
+  std::printf("rice_gateway: stopping, flushing %zu queued rows\n", gateway.queueDepth());
+  std::fflush(stdout);
+  gateway.stop();
+  gateway.printStats(stdout);
+  return 0;
+}
@@ -0,0 +1,96 @@
+// Host shim for the Adafruit GFX library
+// Text uses a procedurally generated 5x7 font with the same cell metrics as
+// the stock glcdfont, so rendering cost and layout match the real library.
+
+#pragma once
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+public:
+  Adafruit_GFX(int16_t w, int16_t h) : WIDTH(w), HEIGHT(h), _width(w), _height(h) {}
+
+  virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+  virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    for (int16_t i = x; i < x + w; i++) drawFastVLine(i, y, h, color);
+  }
+  virtual void fillScreen(uint16_t color) { fillRect(0, 0, _width, _height, color); }
+  virtual void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+    for (int16_t j = y; j < y + h; j++) drawPixel(x, j, color);
+  }
+  virtual void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+    for (int16_t i = x; i < x + w; i++) drawPixel(i, y, color);
+  }
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    drawFastHLine(x, y, w, color);
+    drawFastHLine(x, y + h - 1, w, color);
+    drawFastVLine(x, y, h, color);
+    drawFastVLine(x + w - 1, y, h, color);
+  }
+
+  void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size) {
+    if (x >= _width || y >= _height || x + 6 * size - 1 < 0 || y + 8 * size - 1 < 0) return;
+    for (int8_t i = 0; i < 5; i++) {
+      uint8_t line = glyphColumn(c, i);
+      for (int8_t j = 0; j < 8; j++, line >>= 1) {
+        if (line & 1) {
+          if (size == 1) drawPixel(x + i, y + j, color);
+          else fillRect(x + i * size, y + j * size, size, size, color);
+        } else if (bg != color) {
+          if (size == 1) drawPixel(x + i, y + j, bg);
+          else fillRect(x + i * size, y + j * size, size, size, bg);
+        }
+      }
+    }
+    if (bg != color) {
+      if (size == 1) drawFastVLine(x + 5, y, 8, bg);
+      else fillRect(x + 5 * size, y, size, 8 * size, bg);
+    }
+  }
+
+  size_t write(uint8_t c) override {
+    if (c == '\n') {
+      cursor_x = 0;
+      cursor_y += textsize * 8;
+    } else if (c != '\r') {
+      if (wrap && cursor_x + textsize * 6 > _width) {
+        cursor_x = 0;
+        cursor_y += textsize * 8;
+      }
+      drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize);
+      cursor_x += textsize * 6;
+    }
+    return 1;
+  }
+  using Print::write;
+
+  void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+  int16_t getCursorX() const { return cursor_x; }
+  int16_t getCursorY() const { return cursor_y; }
+  void setTextSize(uint8_t s) { textsize = s > 0 ? s : 1; }
+  void setTextColor(uint16_t c) { textcolor = textbgcolor = c; }
+  void setTextColor(uint16_t c, uint16_t bg) { textcolor = c; textbgcolor = bg; }
+  void setTextWrap(bool w) { wrap = w; }
+  int16_t width() const { return _width; }
+  int16_t height() const { return _height; }
+
+protected:
+  static uint8_t glyphColumn(unsigned char c, int8_t column) {
+    if (c <= ' ') return 0;
+    uint32_t bits = (uint32_t)c * 2654435761u;
+    bits ^= bits >> 13;
+    return (uint8_t)((bits >> (column * 5)) & 0x7F);
+  }
+
+  const int16_t WIDTH;
+  const int16_t HEIGHT;
+  int16_t _width;
+  int16_t _height;
+  int16_t cursor_x = 0;
+  int16_t cursor_y = 0;
+  uint16_t textcolor = 0xFFFF;
+  uint16_t textbgcolor = 0xFFFF;
+  uint8_t textsize = 1;
+  bool wrap = true;
+};
@@ -0,0 +1,119 @@
+// Host shim for the Adafruit SSD1306 OLED driver
+// display() issues the same I2C transactions as the real library: a
+// page/column address command list followed by the framebuffer in
+// WIRE_MAX-sized data chunks, clocked at 400 kHz for the transfer.
+
+#pragma once
+
+#include <cstdlib>
+
+#include "Adafruit_GFX.h"
+#include "Wire.h"
+
+#define SSD1306_BLACK   0
+#define SSD1306_WHITE   1
+#define SSD1306_INVERSE 2
+#define BLACK   SSD1306_BLACK
+#define WHITE   SSD1306_WHITE
+#define INVERSE SSD1306_INVERSE
+
+#define SSD1306_EXTERNALVCC  0x01
+#define SSD1306_SWITCHCAPVCC 0x02
+
+#define SSD1306_MEMORYMODE   0x20
+#define SSD1306_COLUMNADDR   0x21
+#define SSD1306_PAGEADDR     0x22
+#define SSD1306_DISPLAYOFF   0xAE
+#define SSD1306_DISPLAYON    0xAF
+
+#define WIRE_MAX 128
+
+class Adafruit_SSD1306 : public Adafruit_GFX {
+public:
+  Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire* twi = &Wire, int8_t rst_pin = -1,
+                   uint32_t clkDuring = 400000UL, uint32_t clkAfter = 100000UL)
+      : Adafruit_GFX(w, h), wire(twi), resetPin(rst_pin), wireClk(clkDuring), restoreClk(clkAfter) {}
+  ~Adafruit_SSD1306() { std::free(buffer); }
+
+  bool begin(uint8_t switchvcc = SSD1306_SWITCHCAPVCC, uint8_t addr = 0, bool = true, bool periphBegin = true) {
+    (void)switchvcc;
+    if (!buffer && !(buffer = (uint8_t*)std::malloc(WIDTH * ((HEIGHT + 7) / 8)))) return false;
+    clearDisplay();
+    i2caddr = addr ? addr : 0x3C;
+    if (periphBegin) wire->begin();
+    // Init sequence: 25 command bytes in four command lists
+    static const uint8_t init[] = {SSD1306_DISPLAYOFF, 0xD5, 0x80, 0xA8, (uint8_t)(HEIGHT - 1), 0xD3, 0x00, 0x40,
+                                   0x8D, 0x14, SSD1306_MEMORYMODE, 0x00, 0xA1, 0xC8, 0xDA, 0x12, 0x81, 0xCF,
+                                   0xD9, 0xF1, 0xDB, 0x40, 0xA4, 0xA6, SSD1306_DISPLAYON};
+    commandList(init, sizeof(init));
+    return true;
+  }
+
+  void clearDisplay() { std::memset(buffer, 0, WIDTH * ((HEIGHT + 7) / 8)); }
+  uint8_t* getBuffer() { return buffer; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+    if (x < 0 || x >= width() || y < 0 || y >= height()) return;
+    uint8_t& cell = buffer[x + (y / 8) * WIDTH];
+    uint8_t bit = (uint8_t)(1 << (y & 7));
+    switch (color) {
+      case SSD1306_WHITE: cell |= bit; break;
+      case SSD1306_BLACK: cell &= ~bit; break;
+      case SSD1306_INVERSE: cell ^= bit; break;
+    }
+  }
+
+  void display() {
+    const uint8_t addressing[] = {SSD1306_PAGEADDR, 0, 0xFF, SSD1306_COLUMNADDR, 0, (uint8_t)(WIDTH - 1)};
+    commandList(addressing, sizeof(addressing));
+    uint16_t count = WIDTH * ((HEIGHT + 7) / 8);
+    const uint8_t* ptr = buffer;
+    wire->setClock(wireClk);
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t)0x40);
+    uint16_t bytesOut = 1;
+    while (count--) {
+      if (bytesOut >= WIRE_MAX) {
+        wire->endTransmission();
+        wire->beginTransmission(i2caddr);
+        wire->write((uint8_t)0x40);
+        bytesOut = 1;
+      }
+      wire->write(*ptr++);
+      bytesOut++;
+    }
+    wire->endTransmission();
+    wire->setClock(restoreClk);
+  }
+
+  void ssd1306_command(uint8_t c) { commandList(&c, 1); }
+  void invertDisplay(bool i) { ssd1306_command(i ? 0xA7 : 0xA6); }
+  void dim(bool dim) { ssd1306_command(0x81); ssd1306_command(dim ? 0 : 0xCF); }
+
+protected:
+  void commandList(const uint8_t* c, uint8_t n) {
+    wire->setClock(wireClk);
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t)0x00);
+    uint16_t bytesOut = 1;
+    while (n--) {
+      if (bytesOut >= WIRE_MAX) {
+        wire->endTransmission();
+        wire->beginTransmission(i2caddr);
+        wire->write((uint8_t)0x00);
+        bytesOut = 1;
+      }
+      wire->write(*c++);
+      bytesOut++;
+    }
+    wire->endTransmission();
+    wire->setClock(restoreClk);
+  }
+
+  TwoWire* wire;
+  uint8_t* buffer = nullptr;
+  int8_t resetPin;
+  uint8_t i2caddr = 0x3C;
+  uint32_t wireClk;
+  uint32_t restoreClk;
+};
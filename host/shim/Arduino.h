@@ -0,0 +1,144 @@
+// Host shim for the ESP8266 Arduino core
+// Time, GPIO and the Serial console are backed by the simulation in sim.h.
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "IPAddress.h"
+#include "Print.h"
+#include "Stream.h"
+#include "WString.h"
+#include "sim.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x00
+#define INPUT_PULLUP 0x02
+#define OUTPUT       0x01
+
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define ICACHE_FLASH_ATTR
+
+// NodeMCU pin labels
+static const uint8_t D0 = 16;
+static const uint8_t D1 = 5;
+static const uint8_t D2 = 4;
+static const uint8_t D3 = 0;
+static const uint8_t D4 = 2;
+static const uint8_t D5 = 14;
+static const uint8_t D6 = 12;
+static const uint8_t D7 = 13;
+static const uint8_t D8 = 15;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::isnan;
+using std::max;
+using std::min;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline unsigned long millis() { return (unsigned long)(sim::nowMicros() / 1000); }
+inline unsigned long micros() { return (unsigned long)sim::nowMicros(); }
+inline void delay(unsigned long ms) { sim::advanceMicros((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { sim::advanceMicros(us); }
+inline void yield() {}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < sim::Gpio::PIN_COUNT) sim::gpio.mode[pin] = mode;
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= sim::Gpio::PIN_COUNT) return;
+  sim::gpio.level[pin] = value ? HIGH : LOW;
+  if (pin == sim::hx711.sckPin) sim::hx711Clock(sim::gpio.level[pin]);
+  if (pin == sim::ultrasonic.trigPin) sim::ultrasonicTrigger(sim::gpio.level[pin]);
+}
+
+inline int digitalRead(uint8_t pin) {
+  return pin < sim::Gpio::PIN_COUNT ? sim::gpio.level[pin] : LOW;
+}
+
+inline void analogWrite(uint8_t pin, int value) {
+  if (pin < sim::Gpio::PIN_COUNT) sim::gpio.analog[pin] = value;
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+
+#define NOT_AN_INTERRUPT -1
+
+// As on the ESP8266, GPIO16 (D0) cannot interrupt
+inline int digitalPinToInterrupt(uint8_t pin) { return pin < 16 ? pin : NOT_AN_INTERRUPT; }
+
+inline void attachInterrupt(uint8_t pin, void (*isr)(), int mode) {
+  if (pin >= sim::Gpio::PIN_COUNT) return;
+  sim::gpio.isr[pin] = isr;
+  sim::gpio.isrMode[pin] = mode;
+}
+
+inline void detachInterrupt(uint8_t pin) {
+  if (pin < sim::Gpio::PIN_COUNT) sim::gpio.isr[pin] = nullptr;
+}
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+inline long random(long howBig) { return howBig > 0 ? std::rand() % howBig : 0; }
+inline long random(long howSmall, long howBig) { return howSmall + random(howBig - howSmall); }
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override {
+    sim::console.bytes++;
+    if (sim::console.capture) sim::console.captured += (char)c;
+    if (sim::console.echo) std::fputc(c, stderr);
+    return 1;
+  }
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+// Only simulated time advances the cycle counter (80 MHz); host CPU time
+// spent in a function is not modelled, so use the benches for that.
+class EspClass {
+public:
+  uint32_t getCycleCount() { return (uint32_t)(sim::nowMicros() * 80); }
+  uint32_t getCpuFreqMHz() { return 80; }
+  uint32_t getFreeHeap() { return (uint32_t)sim::heapFreeBytes(); }
+  uint32_t getMaxFreeBlockSize() { return (uint32_t)sim::heapMaxFreeBlock(); }
+  uint8_t getHeapFragmentation() { return sim::heapFragmentation(); }
+
+  // `offset` in 4-byte blocks, `size` in bytes, as on the ESP8266
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > sim::Rtc::USER_BYTES) return false;
+    std::memcpy(data, sim::rtc.userMemory + offset * 4, size);
+    return true;
+  }
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > sim::Rtc::USER_BYTES) return false;
+    std::memcpy(sim::rtc.userMemory + offset * 4, data, size);
+    return true;
+  }
+};
+
+extern EspClass ESP;
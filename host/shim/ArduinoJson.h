@@ -0,0 +1,876 @@
+// Host shim for ArduinoJson 6
+// A compact tree-based implementation of the API subset used by the
+// sketches: documents with capacity accounting, variant/object/array views,
+// serializeJson()/measureJson() and deserializeJson() from strings and
+// streams with Filter and NestingLimit options.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Arduino.h"
+
+namespace ArduinoJsonShim {
+
+struct Node {
+  enum Kind { Null, Bool, Integer, Float, Str, Array, Object };
+  Kind kind = Null;
+  bool b = false;
+  long long i = 0;
+  double f = 0;
+  std::string s;
+  std::vector<std::string> keys;
+  std::vector<std::unique_ptr<Node>> values;
+
+  void reset() {
+    kind = Null;
+    s.clear();
+    keys.clear();
+    values.clear();
+  }
+  Node* member(const char* key) const {
+    if (kind != Object) return nullptr;
+    for (size_t n = 0; n < keys.size(); n++)
+      if (keys[n] == key) return values[n].get();
+    return nullptr;
+  }
+  Node* element(size_t index) const {
+    return kind == Array && index < values.size() ? values[index].get() : nullptr;
+  }
+};
+
+// Capacity accounting roughly matching ArduinoJson's 16-byte slots
+struct Pool {
+  size_t capacity = 0;
+  size_t used = 0;
+  bool overflowed = false;
+  bool take(size_t bytes) {
+    if (used + bytes > capacity) {
+      overflowed = true;
+      return false;
+    }
+    used += bytes;
+    return true;
+  }
+};
+
+const size_t SLOT_SIZE = 16;
+
+}  // namespace ArduinoJsonShim
+
+#define JSON_ARRAY_SIZE(n) ((n) * ArduinoJsonShim::SLOT_SIZE)
+#define JSON_OBJECT_SIZE(n) ((n) * ArduinoJsonShim::SLOT_SIZE)
+
+class JsonObject;
+class JsonArray;
+class JsonDocument;
+
+class JsonVariant {
+public:
+  JsonVariant() {}
+  JsonVariant(ArduinoJsonShim::Node* n, ArduinoJsonShim::Pool* p) : node(n), pool(p) {}
+  JsonVariant(ArduinoJsonShim::Node* parentNode, ArduinoJsonShim::Pool* p, const char* k)
+      : parent(parentNode), pool(p), key(k) {
+    node = parent ? parent->member(k) : nullptr;
+  }
+
+  bool isNull() const { return !node || node->kind == ArduinoJsonShim::Node::Null; }
+  explicit operator bool() const { return !isNull(); }
+
+  template <typename T>
+  bool is() const { return checkIs(static_cast<T*>(nullptr)); }
+
+  template <typename T>
+  T as() const { return convert(static_cast<T*>(nullptr)); }
+
+  template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  operator T() const { return as<T>(); }
+  operator const char*() const { return as<const char*>(); }
+  operator String() const { return as<String>(); }
+
+  template <typename T>
+  JsonVariant& operator=(const T& value) {
+    set(value);
+    return *this;
+  }
+  JsonVariant& operator=(const JsonVariant& other) {
+    setVariant(other);
+    return *this;
+  }
+  JsonVariant(const JsonVariant&) = default;
+
+  bool set(bool value) { return assign([&](ArduinoJsonShim::Node& n) { n.kind = n.Bool; n.b = value; }); }
+  bool set(const char* value) {
+    if (!value) return assign([](ArduinoJsonShim::Node& n) { n.kind = n.Null; });
+    return assign([&](ArduinoJsonShim::Node& n) { n.kind = n.Str; n.s = value; });
+  }
+  bool set(char* value) { return set((const char*)value); }
+  bool set(const String& value) {
+    if (pool && !pool->take(value.length() + 1)) return false;
+    return assign([&](ArduinoJsonShim::Node& n) { n.kind = n.Str; n.s = value.c_str(); });
+  }
+  bool set(const __FlashStringHelper* value) { return set(String(value)); }
+  bool set(float value) { return set((double)value); }
+  bool set(double value) { return assign([&](ArduinoJsonShim::Node& n) { n.kind = n.Float; n.f = value; }); }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, bool>::type set(T value) {
+    return assign([&](ArduinoJsonShim::Node& n) { n.kind = n.Integer; n.i = (long long)value; });
+  }
+  bool set(const JsonVariant& value) { return setVariant(value); }
+
+  JsonVariant operator[](const char* k) const;
+  JsonVariant operator[](const String& k) const { return (*this)[k.c_str()]; }
+  JsonVariant operator[](int index) const;
+
+  size_t size() const {
+    if (!node) return 0;
+    return node->kind == node->Array || node->kind == node->Object ? node->values.size() : 0;
+  }
+  bool containsKey(const char* k) const { return node && node->member(k); }
+
+  template <typename T>
+  bool add(const T& value);
+  JsonObject createNestedObject() const;
+  JsonArray createNestedArray() const;
+  JsonObject createNestedObject(const char* k) const;
+  JsonArray createNestedArray(const char* k) const;
+
+  template <typename T>
+  T to() const;
+
+  ArduinoJsonShim::Node* getNode() const { return node; }
+  ArduinoJsonShim::Pool* getPool() const { return pool; }
+
+  // Materialize a lazily-referenced member so it can be written to
+  ArduinoJsonShim::Node* resolve() const {
+    if (node || !parent) return node;
+    if (parent->kind == ArduinoJsonShim::Node::Null) parent->kind = ArduinoJsonShim::Node::Object;
+    if (parent->kind != ArduinoJsonShim::Node::Object) return nullptr;
+    if (pool && !pool->take(ArduinoJsonShim::SLOT_SIZE)) return nullptr;
+    parent->keys.push_back(key);
+    parent->values.emplace_back(new ArduinoJsonShim::Node());
+    node = parent->values.back().get();
+    return node;
+  }
+
+protected:
+  template <typename F>
+  bool assign(F apply) {
+    ArduinoJsonShim::Node* target = resolve();
+    if (!target) return false;
+    target->reset();
+    apply(*target);
+    return true;
+  }
+  bool setVariant(const JsonVariant& other);
+
+  bool checkIs(bool*) const { return node && node->kind == node->Bool; }
+  bool checkIs(const char**) const { return node && node->kind == node->Str; }
+  bool checkIs(String*) const { return node && node->kind == node->Str; }
+  bool checkIs(float*) const { return node && (node->kind == node->Float || node->kind == node->Integer); }
+  bool checkIs(double*) const { return checkIs((float*)nullptr); }
+  bool checkIs(JsonObject*) const { return node && node->kind == node->Object; }
+  bool checkIs(JsonArray*) const { return node && node->kind == node->Array; }
+  template <typename T>
+  bool checkIs(T*) const { return node && node->kind == node->Integer; }
+
+  double number() const {
+    if (!node) return 0;
+    switch (node->kind) {
+      case ArduinoJsonShim::Node::Integer: return (double)node->i;
+      case ArduinoJsonShim::Node::Float: return node->f;
+      case ArduinoJsonShim::Node::Bool: return node->b ? 1 : 0;
+      default: return 0;
+    }
+  }
+  bool convert(bool*) const { return node && (node->kind == node->Bool ? node->b : number() != 0); }
+  float convert(float*) const { return (float)number(); }
+  double convert(double*) const { return number(); }
+  const char* convert(const char**) const { return node && node->kind == node->Str ? node->s.c_str() : nullptr; }
+  String convert(String*) const;
+  JsonObject convert(JsonObject*) const;
+  JsonArray convert(JsonArray*) const;
+  JsonVariant convert(JsonVariant*) const { return *this; }
+  template <typename T>
+  T convert(T*) const {
+    if (node && node->kind == node->Integer) return (T)node->i;
+    return (T)number();
+  }
+
+  mutable ArduinoJsonShim::Node* node = nullptr;
+  ArduinoJsonShim::Node* parent = nullptr;
+  ArduinoJsonShim::Pool* pool = nullptr;
+  std::string key;
+};
+
+typedef JsonVariant JsonVariantConst;
+
+class JsonPair {
+public:
+  JsonPair(const std::string* k, JsonVariant v) : k(k), v(v) {}
+  String key() const { return String(*k); }
+  JsonVariant value() const { return v; }
+
+private:
+  const std::string* k;
+  JsonVariant v;
+};
+
+class JsonObject : public JsonVariant {
+public:
+  JsonObject() {}
+  JsonObject(const JsonVariant& v) : JsonVariant(v.resolve(), v.getPool()) {
+    if (node && node->kind == node->Null) node->kind = node->Object;
+    if (node && node->kind != node->Object) node = nullptr;
+  }
+
+  class iterator {
+  public:
+    iterator(ArduinoJsonShim::Node* n, ArduinoJsonShim::Pool* p, size_t i) : n(n), p(p), i(i) {}
+    JsonPair operator*() const { return JsonPair(&n->keys[i], JsonVariant(n->values[i].get(), p)); }
+    iterator& operator++() { i++; return *this; }
+    bool operator!=(const iterator& rhs) const { return i != rhs.i; }
+
+  private:
+    ArduinoJsonShim::Node* n;
+    ArduinoJsonShim::Pool* p;
+    size_t i;
+  };
+  iterator begin() const { return iterator(node, pool, 0); }
+  iterator end() const { return iterator(node, pool, node ? node->values.size() : 0); }
+};
+
+class JsonArray : public JsonVariant {
+public:
+  JsonArray() {}
+  JsonArray(const JsonVariant& v) : JsonVariant(v.resolve(), v.getPool()) {
+    if (node && node->kind == node->Null) node->kind = node->Array;
+    if (node && node->kind != node->Array) node = nullptr;
+  }
+
+  class iterator {
+  public:
+    iterator(ArduinoJsonShim::Node* n, ArduinoJsonShim::Pool* p, size_t i) : n(n), p(p), i(i) {}
+    JsonVariant operator*() const { return JsonVariant(n->values[i].get(), p); }
+    iterator& operator++() { i++; return *this; }
+    bool operator!=(const iterator& rhs) const { return i != rhs.i; }
+
+  private:
+    ArduinoJsonShim::Node* n;
+    ArduinoJsonShim::Pool* p;
+    size_t i;
+  };
+  iterator begin() const { return iterator(node, pool, 0); }
+  iterator end() const { return iterator(node, pool, node ? node->values.size() : 0); }
+};
+
+inline JsonVariant JsonVariant::operator[](const char* k) const {
+  ArduinoJsonShim::Node* self = node ? node : resolve();
+  return JsonVariant(self, pool, k);
+}
+
+inline JsonVariant JsonVariant::operator[](int index) const {
+  ArduinoJsonShim::Node* element = node ? node->element((size_t)index) : nullptr;
+  return JsonVariant(element, pool);
+}
+
+template <typename T>
+inline bool JsonVariant::add(const T& value) {
+  ArduinoJsonShim::Node* self = resolve();
+  if (!self) return false;
+  if (self->kind == self->Null) self->kind = self->Array;
+  if (self->kind != self->Array) return false;
+  if (pool && !pool->take(ArduinoJsonShim::SLOT_SIZE)) return false;
+  self->values.emplace_back(new ArduinoJsonShim::Node());
+  return JsonVariant(self->values.back().get(), pool).set(value);
+}
+
+inline JsonObject JsonVariant::createNestedObject() const {
+  ArduinoJsonShim::Node* self = resolve();
+  if (!self) return JsonObject();
+  if (self->kind == self->Null) self->kind = self->Array;
+  if (self->kind != self->Array || (pool && !pool->take(ArduinoJsonShim::SLOT_SIZE))) return JsonObject();
+  self->values.emplace_back(new ArduinoJsonShim::Node());
+  return JsonObject(JsonVariant(self->values.back().get(), pool));
+}
+
+inline JsonArray JsonVariant::createNestedArray() const {
+  ArduinoJsonShim::Node* self = resolve();
+  if (!self) return JsonArray();
+  if (self->kind == self->Null) self->kind = self->Array;
+  if (self->kind != self->Array || (pool && !pool->take(ArduinoJsonShim::SLOT_SIZE))) return JsonArray();
+  self->values.emplace_back(new ArduinoJsonShim::Node());
+  return JsonArray(JsonVariant(self->values.back().get(), pool));
+}
+
+inline JsonObject JsonVariant::createNestedObject(const char* k) const { return JsonObject((*this)[k]); }
+inline JsonArray JsonVariant::createNestedArray(const char* k) const { return JsonArray((*this)[k]); }
+
+inline JsonObject JsonVariant::convert(JsonObject*) const { return JsonObject(JsonVariant(node, pool)); }
+inline JsonArray JsonVariant::convert(JsonArray*) const { return JsonArray(JsonVariant(node, pool)); }
+
+template <typename T>
+inline T JsonVariant::to() const {
+  ArduinoJsonShim::Node* self = resolve();
+  if (self) self->reset();
+  return T(JsonVariant(self, pool));
+}
+
+inline bool JsonVariant::setVariant(const JsonVariant& other) {
+  ArduinoJsonShim::Node* source = other.getNode();
+  std::function<void(ArduinoJsonShim::Node&, const ArduinoJsonShim::Node&)> copy =
+      [&](ArduinoJsonShim::Node& to, const ArduinoJsonShim::Node& from) {
+        to.kind = from.kind;
+        to.b = from.b;
+        to.i = from.i;
+        to.f = from.f;
+        to.s = from.s;
+        to.keys = from.keys;
+        to.values.clear();
+        for (const auto& v : from.values) {
+          to.values.emplace_back(new ArduinoJsonShim::Node());
+          copy(*to.values.back(), *v);
+        }
+      };
+  return assign([&](ArduinoJsonShim::Node& n) {
+    if (source) copy(n, *source);
+  });
+}
+
+class JsonDocument : public JsonVariant {
+public:
+  JsonDocument(const JsonDocument&) = delete;
+  JsonDocument& operator=(const JsonDocument&) = delete;
+
+  void clear() {
+    root.reset();
+    docPool.used = 0;
+    docPool.overflowed = false;
+  }
+  size_t capacity() const { return docPool.capacity; }
+  size_t memoryUsage() const { return docPool.used; }
+  bool overflowed() const { return docPool.overflowed; }
+
+  JsonVariant as() { return JsonVariant(&root, &docPool); }
+  template <typename T>
+  T as() const { return JsonVariant::as<T>(); }
+  template <typename T>
+  T to() {
+    clear();
+    return JsonVariant::to<T>();
+  }
+
+  JsonVariant operator[](const char* k) { return JsonVariant(&root, &docPool, k); }
+  JsonVariant operator[](const String& k) { return (*this)[k.c_str()]; }
+  JsonVariant operator[](int index) { return JsonVariant(root.element((size_t)index), &docPool); }
+  bool containsKey(const char* k) const { return root.member(k) != nullptr; }
+  void remove(const char* k) {
+    for (size_t n = 0; n < root.keys.size(); n++) {
+      if (root.keys[n] == k) {
+        root.keys.erase(root.keys.begin() + n);
+        root.values.erase(root.values.begin() + n);
+        return;
+      }
+    }
+  }
+
+  ArduinoJsonShim::Node& rootNode() { return root; }
+  ArduinoJsonShim::Pool& rootPool() { return docPool; }
+
+protected:
+  explicit JsonDocument(size_t capacity) {
+    docPool.capacity = capacity;
+    node = &root;
+    pool = &docPool;
+  }
+
+  ArduinoJsonShim::Node root;
+  ArduinoJsonShim::Pool docPool;
+};
+
+// Like the real one, the pool is a single heap block of `capacity` bytes
+class DynamicJsonDocument : public JsonDocument {
+public:
+  explicit DynamicJsonDocument(size_t capacity) : JsonDocument(capacity), heapBlock(capacity) {}
+
+private:
+  std::vector<char, sim::HeapAllocator<char>> heapBlock;
+};
+
+template <size_t N>
+class StaticJsonDocument : public JsonDocument {
+public:
+  StaticJsonDocument() : JsonDocument(N) {}
+};
+
+// ---------------------------------------------------------------------------
+// Serialization
+
+namespace ArduinoJsonShim {
+
+template <typename Out>
+void writeString(Out& out, const std::string& s) {
+  out('"');
+  for (char c : s) {
+    switch (c) {
+      case '"': out('\\'); out('"'); break;
+      case '\\': out('\\'); out('\\'); break;
+      case '\n': out('\\'); out('n'); break;
+      case '\r': out('\\'); out('r'); break;
+      case '\t': out('\\'); out('t'); break;
+      default: out(c);
+    }
+  }
+  out('"');
+}
+
+template <typename Out>
+void writeNode(Out& out, const Node* n) {
+  char tmp[32];
+  if (!n) {
+    for (const char* p = "null"; *p; p++) out(*p);
+    return;
+  }
+  switch (n->kind) {
+    case Node::Null:
+      for (const char* p = "null"; *p; p++) out(*p);
+      break;
+    case Node::Bool:
+      for (const char* p = n->b ? "true" : "false"; *p; p++) out(*p);
+      break;
+    case Node::Integer:
+      std::snprintf(tmp, sizeof(tmp), "%lld", n->i);
+      for (const char* p = tmp; *p; p++) out(*p);
+      break;
+    case Node::Float:
+      if (std::isnan(n->f) || std::isinf(n->f)) std::snprintf(tmp, sizeof(tmp), "null");
+      else std::snprintf(tmp, sizeof(tmp), "%.9g", n->f);
+      for (const char* p = tmp; *p; p++) out(*p);
+      break;
+    case Node::Str:
+      writeString(out, n->s);
+      break;
+    case Node::Array:
+      out('[');
+      for (size_t i = 0; i < n->values.size(); i++) {
+        if (i) out(',');
+        writeNode(out, n->values[i].get());
+      }
+      out(']');
+      break;
+    case Node::Object:
+      out('{');
+      for (size_t i = 0; i < n->values.size(); i++) {
+        if (i) out(',');
+        writeString(out, n->keys[i]);
+        out(':');
+        writeNode(out, n->values[i].get());
+      }
+      out('}');
+      break;
+  }
+}
+
+}  // namespace ArduinoJsonShim
+
+inline String JsonVariant::convert(String*) const {
+  if (node && node->kind == node->Str) return String(node->s);
+  std::string out;
+  auto sink = [&](char c) { out += c; };
+  ArduinoJsonShim::writeNode(sink, node);
+  return String(out);
+}
+
+inline size_t serializeJson(const JsonVariant& source, String& output) {
+  std::string out;
+  auto sink = [&](char c) { out += c; };
+  ArduinoJsonShim::writeNode(sink, source.getNode());
+  output.concat(out.c_str(), out.size());
+  return out.size();
+}
+
+inline size_t serializeJson(const JsonVariant& source, char* buffer, size_t size) {
+  size_t n = 0;
+  auto sink = [&](char c) {
+    if (n + 1 < size) buffer[n] = c;
+    n++;
+  };
+  ArduinoJsonShim::writeNode(sink, source.getNode());
+  if (size) buffer[n < size ? n : size - 1] = 0;
+  return n < size ? n : size - 1;
+}
+
+inline size_t serializeJson(const JsonVariant& source, Print& output) {
+  size_t n = 0;
+  auto sink = [&](char c) { n += output.write((uint8_t)c); };
+  ArduinoJsonShim::writeNode(sink, source.getNode());
+  return n;
+}
+
+inline size_t measureJson(const JsonVariant& source) {
+  size_t n = 0;
+  auto sink = [&](char) { n++; };
+  ArduinoJsonShim::writeNode(sink, source.getNode());
+  return n;
+}
+
+// ---------------------------------------------------------------------------
+// Deserialization
+
+class DeserializationError {
+public:
+  enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+
+  DeserializationError() {}
+  DeserializationError(Code c) : errorCode(c) {}
+
+  Code code() const { return errorCode; }
+  explicit operator bool() const { return errorCode != Ok; }
+  bool operator==(Code c) const { return errorCode == c; }
+  bool operator!=(Code c) const { return errorCode != c; }
+  const char* c_str() const {
+    static const char* names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+    return names[errorCode];
+  }
+
+private:
+  Code errorCode = Ok;
+};
+
+namespace DeserializationOption {
+
+class Filter {
+public:
+  explicit Filter(const JsonVariant& v) : filterNode(v.getNode()) {}
+  const ArduinoJsonShim::Node* node() const { return filterNode; }
+
+private:
+  const ArduinoJsonShim::Node* filterNode;
+};
+
+class NestingLimit {
+public:
+  NestingLimit() {}
+  explicit NestingLimit(uint8_t n) : limit(n) {}
+  uint8_t value() const { return limit; }
+
+private:
+  uint8_t limit = 10;
+};
+
+}  // namespace DeserializationOption
+
+namespace ArduinoJsonShim {
+
+class Reader {
+public:
+  Reader(const char* data, size_t size) : data(data), size(size) {}
+  explicit Reader(Stream& stream) : stream(&stream) {}
+
+  int peek() {
+    if (!hasPeek) {
+      peeked = fetch();
+      hasPeek = true;
+    }
+    return peeked;
+  }
+  int get() {
+    int c = peek();
+    hasPeek = false;
+    return c;
+  }
+
+private:
+  int fetch() {
+    if (stream) return stream->read();
+    if (pos >= size || data[pos] == 0) return -1;
+    return (uint8_t)data[pos++];
+  }
+
+  const char* data = nullptr;
+  size_t size = 0;
+  size_t pos = 0;
+  Stream* stream = nullptr;
+  int peeked = -1;
+  bool hasPeek = false;
+};
+
+// Filter semantics: nullptr accepts everything; a Bool node accepts when
+// true; an Object node accepts listed keys (or "*"); an Array node applies
+// its first element to every element of the input array.
+class Parser {
+public:
+  Parser(Reader& in, Pool& pool, const Node* filter, uint8_t nesting)
+      : in(in), pool(pool), rootFilter(filter), nesting(nesting) {}
+
+  DeserializationError::Code parse(Node& root) {
+    skipSpace();
+    if (in.peek() < 0) return DeserializationError::EmptyInput;
+    if (rootFilter && !accepts(rootFilter)) return skip(nesting);
+    return parseValue(&root, rootFilter, nesting);
+  }
+
+private:
+  static bool accepts(const Node* filter) {
+    if (!filter) return true;
+    if (filter->kind == Node::Bool) return filter->b;
+    return filter->kind == Node::Object || filter->kind == Node::Array;
+  }
+  static const Node* memberFilter(const Node* filter, const std::string& key) {
+    if (!filter || filter->kind == Node::Bool) return filter;
+    if (filter->kind != Node::Object) return nullptr;
+    const Node* f = filter->member(key.c_str());
+    if (!f) f = filter->member("*");
+    return f ? f : &rejectAll();
+  }
+  static const Node* elementFilter(const Node* filter) {
+    if (!filter || filter->kind == Node::Bool) return filter;
+    if (filter->kind == Node::Array && !filter->values.empty()) return filter->values[0].get();
+    return &rejectAll();
+  }
+  static const Node& rejectAll() {
+    static Node reject;
+    reject.kind = Node::Bool;
+    reject.b = false;
+    return reject;
+  }
+  static bool isPassThrough(const Node* filter) { return !filter || (filter->kind == Node::Bool && filter->b); }
+
+  void skipSpace() {
+    while (in.peek() == ' ' || in.peek() == '\n' || in.peek() == '\r' || in.peek() == '\t') in.get();
+  }
+
+  DeserializationError::Code parseValue(Node* out, const Node* filter, uint8_t depth) {
+    skipSpace();
+    int c = in.peek();
+    if (c < 0) return DeserializationError::IncompleteInput;
+    if (c == '{') return parseObject(out, filter, depth);
+    if (c == '[') return parseArray(out, filter, depth);
+    if (filter && !isPassThrough(filter)) {
+      // Objects/arrays in the filter only match containers
+      if (filter->kind == Node::Object || filter->kind == Node::Array) return skip(depth);
+    }
+    if (c == '"' || c == '\'') {
+      std::string s;
+      DeserializationError::Code err = parseString(s);
+      if (err) return err;
+      if (!pool.take(s.size() + 1)) return DeserializationError::NoMemory;
+      out->kind = Node::Str;
+      out->s = std::move(s);
+      return DeserializationError::Ok;
+    }
+    return parseLiteral(out);
+  }
+
+  DeserializationError::Code parseObject(Node* out, const Node* filter, uint8_t depth) {
+    if (depth == 0) return DeserializationError::TooDeep;
+    if (filter && !isPassThrough(filter) && filter->kind != Node::Object) return skip(depth);
+    in.get();
+    out->kind = Node::Object;
+    skipSpace();
+    if (in.peek() == '}') {
+      in.get();
+      return DeserializationError::Ok;
+    }
+    for (;;) {
+      skipSpace();
+      std::string key;
+      if (in.peek() < 0) return DeserializationError::IncompleteInput;
+      DeserializationError::Code err = in.peek() == '"' || in.peek() == '\'' ? parseString(key) : parseBareKey(key);
+      if (err) return err;
+      skipSpace();
+      if (in.peek() < 0) return DeserializationError::IncompleteInput;
+      if (in.get() != ':') return DeserializationError::InvalidInput;
+      const Node* childFilter = memberFilter(filter, key);
+      if (accepts(childFilter)) {
+        if (!pool.take(SLOT_SIZE + key.size() + 1)) return DeserializationError::NoMemory;
+        out->keys.push_back(std::move(key));
+        out->values.emplace_back(new Node());
+        err = parseValue(out->values.back().get(), childFilter, depth - 1);
+      } else {
+        err = skip(depth - 1);
+      }
+      if (err) return err;
+      skipSpace();
+      int c = in.get();
+      if (c == '}') return DeserializationError::Ok;
+      if (c < 0) return DeserializationError::IncompleteInput;
+      if (c != ',') return DeserializationError::InvalidInput;
+    }
+  }
+
+  DeserializationError::Code parseArray(Node* out, const Node* filter, uint8_t depth) {
+    if (depth == 0) return DeserializationError::TooDeep;
+    if (filter && !isPassThrough(filter) && filter->kind != Node::Array) return skip(depth);
+    in.get();
+    out->kind = Node::Array;
+    skipSpace();
+    if (in.peek() == ']') {
+      in.get();
+      return DeserializationError::Ok;
+    }
+    const Node* childFilter = elementFilter(filter);
+    for (;;) {
+      DeserializationError::Code err;
+      if (accepts(childFilter)) {
+        if (!pool.take(SLOT_SIZE)) return DeserializationError::NoMemory;
+        out->values.emplace_back(new Node());
+        err = parseValue(out->values.back().get(), childFilter, depth - 1);
+      } else {
+        err = skip(depth - 1);
+      }
+      if (err) return err;
+      skipSpace();
+      int c = in.get();
+      if (c == ']') return DeserializationError::Ok;
+      if (c < 0) return DeserializationError::IncompleteInput;
+      if (c != ',') return DeserializationError::InvalidInput;
+    }
+  }
+
+  DeserializationError::Code parseString(std::string& s) {
+    int quote = in.get();
+    for (;;) {
+      int c = in.get();
+      if (c < 0) return DeserializationError::IncompleteInput;
+      if (c == quote) return DeserializationError::Ok;
+      if (c == '\\') {
+        c = in.get();
+        if (c < 0) return DeserializationError::IncompleteInput;
+        switch (c) {
+          case 'n': c = '\n'; break;
+          case 'r': c = '\r'; break;
+          case 't': c = '\t'; break;
+          case 'b': c = '\b'; break;
+          case 'f': c = '\f'; break;
+          case 'u': {
+            unsigned code = 0;
+            for (int k = 0; k < 4; k++) {
+              int h = in.get();
+              if (h < 0) return DeserializationError::IncompleteInput;
+              code = code * 16 + (unsigned)(h <= '9' ? h - '0' : (h | 0x20) - 'a' + 10);
+            }
+            if (code < 0x80) {
+              c = (int)code;
+            } else if (code < 0x800) {
+              s += (char)(0xC0 | (code >> 6));
+              c = (int)(0x80 | (code & 0x3F));
+            } else {
+              s += (char)(0xE0 | (code >> 12));
+              s += (char)(0x80 | ((code >> 6) & 0x3F));
+              c = (int)(0x80 | (code & 0x3F));
+            }
+            break;
+          }
+          default: break;
+        }
+      }
+      s += (char)c;
+    }
+  }
+
+  DeserializationError::Code parseBareKey(std::string& s) {
+    while (in.peek() >= 0 && (std::isalnum(in.peek()) || in.peek() == '_')) s += (char)in.get();
+    return s.empty() ? DeserializationError::InvalidInput : DeserializationError::Ok;
+  }
+
+  DeserializationError::Code parseLiteral(Node* out) {
+    std::string token;
+    while (in.peek() >= 0 && (std::isalnum(in.peek()) || in.peek() == '-' || in.peek() == '+' || in.peek() == '.'))
+      token += (char)in.get();
+    if (token.empty()) return in.peek() < 0 ? DeserializationError::IncompleteInput : DeserializationError::InvalidInput;
+    if (token == "null") {
+      out->kind = Node::Null;
+    } else if (token == "true" || token == "false") {
+      out->kind = Node::Bool;
+      out->b = token == "true";
+    } else {
+      char* end = nullptr;
+      if (token.find_first_of(".eE") == std::string::npos) {
+        long long v = std::strtoll(token.c_str(), &end, 10);
+        if (*end) return DeserializationError::InvalidInput;
+        out->kind = Node::Integer;
+        out->i = v;
+      } else {
+        double v = std::strtod(token.c_str(), &end);
+        if (*end) return DeserializationError::InvalidInput;
+        out->kind = Node::Float;
+        out->f = v;
+      }
+    }
+    return DeserializationError::Ok;
+  }
+
+  DeserializationError::Code skip(uint8_t depth) {
+    Node scratch;
+    Pool unlimited;
+    unlimited.capacity = (size_t)-1;
+    Parser skipper(in, unlimited, nullptr, depth);
+    return skipper.parseValue(&scratch, nullptr, depth);
+  }
+
+  Reader& in;
+  Pool& pool;
+  const Node* rootFilter;
+  uint8_t nesting;
+};
+
+inline DeserializationError deserialize(JsonDocument& doc, Reader& reader, const Node* filter, uint8_t nesting) {
+  doc.clear();
+  Parser parser(reader, doc.rootPool(), filter, nesting);
+  DeserializationError::Code err = parser.parse(doc.rootNode());
+  if (err) doc.rootNode().reset();
+  return DeserializationError(err);
+}
+
+}  // namespace ArduinoJsonShim
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t size,
+                                            DeserializationOption::Filter filter,
+                                            DeserializationOption::NestingLimit nesting = DeserializationOption::NestingLimit()) {
+  ArduinoJsonShim::Reader reader(input, size);
+  return ArduinoJsonShim::deserialize(doc, reader, filter.node(), nesting.value());
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t size,
+                                            DeserializationOption::NestingLimit nesting = DeserializationOption::NestingLimit()) {
+  ArduinoJsonShim::Reader reader(input, size);
+  return ArduinoJsonShim::deserialize(doc, reader, nullptr, nesting.value());
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input) {
+  return deserializeJson(doc, input, input ? std::strlen(input) : 0);
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input, DeserializationOption::Filter filter) {
+  return deserializeJson(doc, input, input ? std::strlen(input) : 0, filter);
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& input) {
+  return deserializeJson(doc, input.c_str(), input.length());
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& input, DeserializationOption::Filter filter) {
+  return deserializeJson(doc, input.c_str(), input.length(), filter);
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, Stream& input,
+                                            DeserializationOption::NestingLimit nesting = DeserializationOption::NestingLimit()) {
+  ArduinoJsonShim::Reader reader(input);
+  return ArduinoJsonShim::deserialize(doc, reader, nullptr, nesting.value());
+}
+
+inline DeserializationError deserializeJson(JsonDocument& doc, Stream& input, DeserializationOption::Filter filter,
+                                            DeserializationOption::NestingLimit nesting = DeserializationOption::NestingLimit()) {
+  ArduinoJsonShim::Reader reader(input);
+  return ArduinoJsonShim::deserialize(doc, reader, filter.node(), nesting.value());
+}
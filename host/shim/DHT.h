@@ -0,0 +1,42 @@
+// Host shim for the Adafruit DHT sensor library
+
+#pragma once
+
+#include "Arduino.h"
+
+#define DHT11 11
+#define DHT22 22
+
+class DHT {
+public:
+  DHT(uint8_t pin, uint8_t type) : dataPin(pin), sensorType(type) {}
+
+  void begin() { pinMode(dataPin, INPUT_PULLUP); }
+
+  // The real driver caches a transfer for 2 s and blocks with interrupts
+  // off while bit-banging a fresh one.
+  float readTemperature(bool fahrenheit = false, bool force = false) {
+    read(force);
+    float t = sim::dht.temperature;
+    return fahrenheit ? t * 1.8f + 32 : t;
+  }
+  float readHumidity(bool force = false) {
+    read(force);
+    return sim::dht.humidity;
+  }
+
+private:
+  void read(bool force) {
+    unsigned long now = millis();
+    if (!force && hasRead && now - lastReadTime < 2000) return;
+    hasRead = true;
+    lastReadTime = now;
+    sim::dht.reads++;
+    sim::advanceMicros(sim::dht.readMicros);
+  }
+
+  uint8_t dataPin;
+  uint8_t sensorType;
+  bool hasRead = false;
+  unsigned long lastReadTime = 0;
+};
@@ -0,0 +1,63 @@
+// Host shim for the ESP8266 EEPROM library
+// Backed by sim::eeprom; like the real library, writes only reach the flash
+// sector on commit().
+
+#pragma once
+
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+  void begin(size_t bytes) {
+    size = std::min(bytes, sim::Eeprom::SIZE);
+    std::memcpy(cache, sim::eeprom.bytes, size);
+    dirty = false;
+  }
+
+  uint8_t read(int address) const { return address >= 0 && (size_t)address < size ? cache[address] : 0; }
+  void write(int address, uint8_t value) {
+    if (address < 0 || (size_t)address >= size || cache[address] == value) return;
+    cache[address] = value;
+    dirty = true;
+  }
+
+  template <typename T>
+  T& get(int address, T& value) const {
+    if (address >= 0 && address + sizeof(T) <= size) std::memcpy(&value, cache + address, sizeof(T));
+    return value;
+  }
+
+  template <typename T>
+  const T& put(int address, const T& value) {
+    if (address < 0 || address + sizeof(T) > size) return value;
+    if (std::memcmp(cache + address, &value, sizeof(T)) != 0) {
+      std::memcpy(cache + address, &value, sizeof(T));
+      dirty = true;
+    }
+    return value;
+  }
+
+  bool commit() {
+    if (!size) return false;
+    if (!dirty) return true;
+    std::memcpy(sim::eeprom.bytes, cache, size);
+    sim::eeprom.commits++;
+    dirty = false;
+    return true;
+  }
+
+  bool end() {
+    bool ok = commit();
+    size = 0;
+    return ok;
+  }
+
+  size_t length() const { return size; }
+
+private:
+  uint8_t cache[sim::Eeprom::SIZE];
+  size_t size = 0;
+  bool dirty = false;
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,152 @@
+// Host shim for ESP8266HTTPClient
+// Requests are routed to sim::net.handler. As in the real client, reuse is
+// on by default, so a request only pays a TCP handshake when its WiFiClient
+// is not already connected to the same host.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTPC_ERROR_CONNECTION_FAILED   (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED       (-4)
+#define HTTPC_ERROR_CONNECTION_LOST     (-5)
+#define HTTPC_ERROR_NO_STREAM           (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER      (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM        (-8)
+#define HTTPC_ERROR_ENCODING            (-9)
+#define HTTPC_ERROR_STREAM_WRITE        (-10)
+#define HTTPC_ERROR_READ_TIMEOUT        (-11)
+
+typedef enum {
+  HTTP_CODE_OK = 200,
+  HTTP_CODE_CREATED = 201,
+  HTTP_CODE_NO_CONTENT = 204,
+  HTTP_CODE_PARTIAL_CONTENT = 206,
+  HTTP_CODE_MULTIPLE_CHOICES = 300,
+  HTTP_CODE_BAD_REQUEST = 400,
+  HTTP_CODE_UNAUTHORIZED = 401,
+  HTTP_CODE_NOT_FOUND = 404,
+  HTTP_CODE_CONFLICT = 409,
+  HTTP_CODE_INTERNAL_SERVER_ERROR = 500
+} t_http_codes;
+
+class HTTPClient {
+public:
+  ~HTTPClient() { end(); }
+
+  bool begin(WiFiClient& client, const String& url) {
+    activeClient = &client;
+    return parseUrl(url);
+  }
+  // Deprecated in core 2.x and removed in 3.x; uses a client owned by this object
+  bool begin(const String& url) {
+    ownedClient.reset(new WiFiClient());
+    activeClient = ownedClient.get();
+    return parseUrl(url);
+  }
+
+  void end() {
+    headers.clear();
+    if (activeClient && (!reuse || !lastKeepAlive)) activeClient->stop();
+    ownedClient.reset();
+    activeClient = nullptr;
+  }
+
+  void setReuse(bool value) { reuse = value; }
+  void setTimeout(uint16_t timeout) { timeoutMs = timeout; }
+  void setUserAgent(const String&) {}
+  bool connected() { return activeClient && activeClient->connected(); }
+
+  void addHeader(const String& name, const String& value, bool = false, bool = true) {
+    headers.emplace_back(name.c_str(), value.c_str());
+  }
+
+  int GET() { return sendRequest("GET", (const uint8_t*)nullptr, 0); }
+  int POST(const String& payload) { return sendRequest("POST", (const uint8_t*)payload.c_str(), payload.length()); }
+  int POST(const uint8_t* payload, size_t size) { return sendRequest("POST", payload, size); }
+  int PATCH(const String& payload) { return sendRequest("PATCH", (const uint8_t*)payload.c_str(), payload.length()); }
+  int PATCH(const uint8_t* payload, size_t size) { return sendRequest("PATCH", payload, size); }
+  int sendRequest(const char* type, const String& payload) {
+    return sendRequest(type, (const uint8_t*)payload.c_str(), payload.length());
+  }
+
+  int sendRequest(const char* type, const uint8_t* payload, size_t size) {
+    if (!activeClient) return HTTPC_ERROR_NOT_CONNECTED;
+    if (!sim::wifiConnected()) return HTTPC_ERROR_CONNECTION_FAILED;
+    if (!activeClient->connect(host.c_str(), port)) return HTTPC_ERROR_CONNECTION_FAILED;
+
+    sim::HttpRequest request;
+    request.method = type;
+    request.host = host;
+    request.path = path;
+    request.headers = headers;
+    if (payload) request.body.assign((const char*)payload, size);
+    sim::HttpResponse response = sim::httpExchange(request);
+
+    responseSize = (int)response.body.size();
+    lastKeepAlive = true;
+    activeClient->simReceive(response.body);
+    return response.status;
+  }
+
+  int getSize() const { return responseSize; }
+  WiFiClient& getStream() { return *activeClient; }
+  WiFiClient* getStreamPtr() { return activeClient; }
+  String getString() { return activeClient ? activeClient->readString() : String(); }
+  int writeToStream(Stream* stream) {
+    int n = 0;
+    int c;
+    while (activeClient && (c = activeClient->read()) >= 0) n += (int)stream->write((uint8_t)c);
+    return n;
+  }
+
+  static String errorToString(int error) {
+    switch (error) {
+      case HTTPC_ERROR_CONNECTION_FAILED: return F("connection failed");
+      case HTTPC_ERROR_NOT_CONNECTED: return F("not connected");
+      case HTTPC_ERROR_CONNECTION_LOST: return F("connection lost");
+      case HTTPC_ERROR_READ_TIMEOUT: return F("read Timeout");
+      default: return String();
+    }
+  }
+
+private:
+  bool parseUrl(const String& url) {
+    std::string s = url.c_str();
+    port = 80;
+    size_t scheme = s.find("://");
+    if (scheme != std::string::npos) {
+      if (s.compare(0, scheme, "https") == 0) port = 443;
+      s = s.substr(scheme + 3);
+    }
+    size_t slash = s.find('/');
+    host = s.substr(0, slash);
+    path = slash == std::string::npos ? "/" : s.substr(slash);
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+      port = (uint16_t)std::atoi(host.c_str() + colon + 1);
+      host = host.substr(0, colon);
+    }
+    headers.clear();
+    return !host.empty();
+  }
+
+  WiFiClient* activeClient = nullptr;
+  std::unique_ptr<WiFiClient> ownedClient;
+  std::string host;
+  std::string path;
+  uint16_t port = 80;
+  std::vector<std::pair<std::string, std::string>> headers;
+  bool reuse = true;
+  bool lastKeepAlive = false;
+  uint16_t timeoutMs = 5000;
+  int responseSize = -1;
+};
@@ -0,0 +1,102 @@
+// Host shim for the ESP8266WiFi station interface
+
+#pragma once
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+typedef enum {
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_WRONG_PASSWORD = 6,
+  WL_DISCONNECTED = 7
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+typedef enum { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 } WiFiSleepType_t;
+
+class ESP8266WiFiClass {
+public:
+  wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true) {
+    (void)ssid;
+    (void)passphrase;
+    sim::wifi.begins++;
+    if (connect && !sim::wifi.connected) {
+      // A channel and BSSID from an earlier connection skip the scan
+      bool hinted = channel > 0 && bssid != nullptr;
+      sim::wifi.wrongHint = hinted && (channel != sim::wifi.apChannel ||
+                                       std::memcmp(bssid, sim::wifi.apBssid, sizeof(sim::wifi.apBssid)) != 0);
+      sim::wifi.associateMicros =
+          (hinted ? 0 : sim::wifi.scanMicros) + sim::wifi.authMicros + (staticIp.isSet() ? 0 : sim::wifi.dhcpMicros);
+      sim::wifi.noSsid = false;
+      sim::wifi.connecting = true;
+      sim::wifi.connectStartMicros = sim::nowMicros();
+    }
+    return status();
+  }
+  wl_status_t begin() { return begin(nullptr); }
+
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress = IPAddress()) {
+    staticIp = local;
+    gatewayIp = gateway;
+    netmask = subnet;
+    dnsIp = dns1;
+    return true;
+  }
+
+  wl_status_t status() {
+    if (sim::wifiConnected()) return WL_CONNECTED;
+    if (sim::wifi.noSsid) return WL_NO_SSID_AVAIL;
+    return sim::wifi.connecting ? WL_DISCONNECTED : WL_IDLE_STATUS;
+  }
+  bool isConnected() { return status() == WL_CONNECTED; }
+  bool disconnect(bool = false) {
+    sim::wifi.connected = false;
+    sim::wifi.connecting = false;
+    sim::wifi.noSsid = false;
+    return true;
+  }
+  bool reconnect() {
+    disconnect();
+    return begin() != WL_CONNECT_FAILED;
+  }
+
+  bool mode(WiFiMode_t m) { currentMode = m; return true; }
+  WiFiMode_t getMode() const { return currentMode; }
+  bool setAutoReconnect(bool) { return true; }
+  bool setSleepMode(WiFiSleepType_t type, uint8_t = 0) {
+    sim::wifi.modemSleep = type != WIFI_NONE_SLEEP;
+    return true;
+  }
+  WiFiSleepType_t getSleepMode() const { return sim::wifi.modemSleep ? WIFI_MODEM_SLEEP : WIFI_NONE_SLEEP; }
+  bool setAutoConnect(bool) { return true; }
+  void persistent(bool) {}
+
+  IPAddress localIP() {
+    if (!isConnected()) return IPAddress();
+    return staticIp.isSet() ? staticIp : IPAddress(192, 168, 1, 42);
+  }
+  IPAddress gatewayIP() { return gatewayIp.isSet() ? gatewayIp : IPAddress(192, 168, 1, 1); }
+  IPAddress subnetMask() { return netmask.isSet() ? netmask : IPAddress(255, 255, 255, 0); }
+  IPAddress dnsIP(uint8_t = 0) { return dnsIp.isSet() ? dnsIp : gatewayIP(); }
+  int32_t RSSI() { return isConnected() ? -58 : 31; }
+  int32_t channel() { return sim::wifi.apChannel; }
+  uint8_t* BSSID() { return sim::wifi.apBssid; }
+  String macAddress() { return String("5C:CF:7F:00:00:01"); }
+  String SSID() { return String("sim-ap"); }
+
+private:
+  WiFiMode_t currentMode = WIFI_STA;
+  IPAddress staticIp;
+  IPAddress gatewayIp;
+  IPAddress netmask;
+  IPAddress dnsIp;
+};
+
+extern ESP8266WiFiClass WiFi;
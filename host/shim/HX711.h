@@ -0,0 +1,64 @@
+// Host shim for the HX711 load cell library (Rob Tillaart API subset)
+// read() bit-bangs DOUT/SCK like the real driver, against the HX711 model.
+
+#pragma once
+
+#include "Arduino.h"
+
+class HX711 {
+public:
+  void begin(uint8_t dataPin, uint8_t clockPin) {
+    doutPin = dataPin;
+    sckPin = clockPin;
+    pinMode(dataPin, INPUT);
+    pinMode(clockPin, OUTPUT);
+    digitalWrite(clockPin, LOW);
+    sim::hx711Start(dataPin, clockPin);
+  }
+
+  bool is_ready() { return digitalRead(doutPin) == LOW; }
+  // The real driver spins here; the simulated clock has to be moved instead
+  void wait_ready(uint32_t = 0) { while (!is_ready()) sim::advanceTo(sim::hx711.nextConversionMicros); }
+
+  long read() {
+    wait_ready();
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < 24; i++) {
+      digitalWrite(sckPin, HIGH);
+      delayMicroseconds(1);
+      value = (value << 1) | (digitalRead(doutPin) ? 1 : 0);
+      digitalWrite(sckPin, LOW);
+      delayMicroseconds(1);
+    }
+    digitalWrite(sckPin, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(sckPin, LOW);
+    return (long)((int32_t)(value << 8) >> 8);
+  }
+  float read_average(uint8_t times = 10) {
+    if (times < 1) times = 1;
+    float sum = 0;
+    for (uint8_t i = 0; i < times; i++) sum += read();
+    return sum / times;
+  }
+
+  float get_value(uint8_t times = 1) { return read_average(times) - offset; }
+  float get_units(uint8_t times = 1) { return get_value(times) * scaleInverse; }
+
+  void tare(uint8_t times = 10) { offset = (long)read_average(times); }
+  bool is_tared() const { return offset != 0; }
+
+  void set_scale(float scale = 1.0f) { scaleInverse = 1.0f / scale; }
+  float get_scale() const { return 1.0f / scaleInverse; }
+  void set_offset(long value = 0) { offset = value; }
+  long get_offset() const { return offset; }
+
+  void power_down() {}
+  void power_up() {}
+
+private:
+  uint8_t doutPin = 0;
+  uint8_t sckPin = 0;
+  long offset = 0;
+  float scaleInverse = 1.0f;
+};
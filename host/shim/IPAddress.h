@@ -0,0 +1,38 @@
+// Host shim for the Arduino IPAddress class
+
+#pragma once
+
+#include <cstdint>
+
+#include "Print.h"
+
+class IPAddress : public Printable {
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 | (uint32_t)d << 24) {}
+  IPAddress(uint32_t raw) : address(raw) {}
+
+  operator uint32_t() const { return address; }
+  uint8_t operator[](int index) const { return (uint8_t)(address >> (8 * index)); }
+  bool operator==(const IPAddress& rhs) const { return address == rhs.address; }
+  bool operator!=(const IPAddress& rhs) const { return address != rhs.address; }
+  bool isSet() const { return address != 0; }
+
+  bool fromString(const char* str) {
+    unsigned a, b, c, d;
+    if (std::sscanf(str, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 || c > 255 || d > 255) return false;
+    *this = IPAddress((uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d);
+    return true;
+  }
+
+  String toString() const {
+    char tmp[16];
+    std::snprintf(tmp, sizeof(tmp), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(tmp);
+  }
+
+  size_t printTo(Print& p) const override { return p.print(toString()); }
+
+private:
+  uint32_t address = 0;
+};
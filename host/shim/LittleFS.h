@@ -0,0 +1,185 @@
+// Host shim for the ESP8266 LittleFS filesystem
+// Files are kept in sim::flash; only the API subset used by the sketches
+// is provided. Directories are implicit in the file paths.
+
+#pragma once
+
+#include <string>
+
+#include "Arduino.h"
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+class File : public Stream {
+public:
+  File() {}
+  File(const std::string& filePath, bool canWrite, size_t startPosition)
+      : path(filePath), writable(canWrite), pos(startPosition), isOpen(true) {}
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (!isOpen || !writable) return 0;
+    std::string& data = sim::flash.files[path];
+    if (pos > data.size()) pos = data.size();
+    data.replace(pos, std::min(size, data.size() - pos), (const char*)buffer, size);
+    pos += size;
+    sim::flash.bytesWritten += size;
+    dirty = true;
+    return size;
+  }
+  using Print::write;
+
+  int available() override { return isOpen ? (int)(contents().size() - std::min(pos, contents().size())) : 0; }
+  int read() override {
+    if (!available()) return -1;
+    return (uint8_t)contents()[pos++];
+  }
+  int peek() override { return available() ? (uint8_t)contents()[pos] : -1; }
+  size_t read(uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, (size_t)available());
+    std::memcpy(buffer, contents().data() + pos, n);
+    pos += n;
+    return n;
+  }
+
+  bool seek(uint32_t offset, SeekMode mode = SeekSet) {
+    if (!isOpen) return false;
+    size_t base = mode == SeekSet ? 0 : mode == SeekCur ? pos : contents().size();
+    if (base + offset > contents().size()) return false;
+    pos = base + offset;
+    return true;
+  }
+  size_t position() const { return pos; }
+  size_t size() const { return isOpen ? contents().size() : 0; }
+
+  void flush() override {
+    if (!dirty) return;
+    dirty = false;
+    sim::flash.syncs++;
+    sim::advanceMicros(sim::flash.syncMicros);
+  }
+  void close() {
+    if (!isOpen) return;
+    flush();
+    isOpen = false;
+  }
+  operator bool() const { return isOpen; }
+  const char* fullName() const { return path.c_str(); }
+
+private:
+  const std::string& contents() const {
+    static const std::string empty;
+    auto file = sim::flash.files.find(path);
+    return file == sim::flash.files.end() ? empty : file->second;
+  }
+
+  std::string path;
+  bool writable = false;
+  size_t pos = 0;
+  bool isOpen = false;
+  bool dirty = false;
+};
+
+class Dir {
+public:
+  explicit Dir(const std::string& directory = "/") : prefix(directory) {
+    if (prefix.empty() || prefix.back() != '/') prefix += '/';
+  }
+
+  // Advances to the next file directly inside the directory
+  bool next() {
+    auto it = started ? sim::flash.files.upper_bound(current) : sim::flash.files.lower_bound(prefix);
+    started = true;
+    for (; it != sim::flash.files.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+      if (it->first.find('/', prefix.size()) != std::string::npos) continue;
+      current = it->first;
+      return true;
+    }
+    current = prefix + '\xff';
+    return false;
+  }
+  String fileName() const { return String(current.substr(prefix.size())); }
+  size_t fileSize() const {
+    auto file = sim::flash.files.find(current);
+    return file == sim::flash.files.end() ? 0 : file->second.size();
+  }
+  bool isFile() const { return true; }
+  bool isDirectory() const { return false; }
+
+private:
+  std::string prefix;
+  std::string current;
+  bool started = false;
+};
+
+class FS {
+public:
+  bool begin() {
+    sim::flash.mounted = true;
+    return true;
+  }
+  void end() { sim::flash.mounted = false; }
+  bool format() {
+    sim::flash.files.clear();
+    return true;
+  }
+
+  // Modes as in fopen(): "r", "w", "a" and their "+" variants
+  File open(const char* path, const char* mode) {
+    if (!sim::flash.mounted || !path || !mode) return File();
+    auto file = sim::flash.files.find(path);
+    if (mode[0] == 'r') {
+      if (file == sim::flash.files.end()) return File();
+      return File(path, mode[1] == '+', 0);
+    }
+    std::string& data = sim::flash.files[path];
+    if (mode[0] == 'w') {
+      data.clear();
+      return File(path, true, 0);
+    }
+    return File(path, true, data.size());
+  }
+  File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+
+  bool exists(const char* path) const { return sim::flash.mounted && sim::flash.files.count(path) > 0; }
+  bool remove(const char* path) {
+    if (!sim::flash.mounted || !sim::flash.files.erase(path)) return false;
+    sim::flash.removes++;
+    return true;
+  }
+  bool rename(const char* from, const char* to) {
+    auto file = sim::flash.files.find(from);
+    if (!sim::flash.mounted || file == sim::flash.files.end()) return false;
+    std::string data = file->second;
+    sim::flash.files.erase(file);
+    sim::flash.files[to] = data;
+    return true;
+  }
+  bool mkdir(const char*) { return sim::flash.mounted; }
+  Dir openDir(const char* path) { return Dir(path); }
+
+  bool info(FSInfo& info) const {
+    size_t used = 0;
+    for (const auto& file : sim::flash.files) {
+      used += (file.second.size() + sim::flash.blockSize - 1) / sim::flash.blockSize * sim::flash.blockSize;
+    }
+    info.totalBytes = sim::flash.totalBytes;
+    info.usedBytes = used;
+    info.blockSize = sim::flash.blockSize;
+    info.pageSize = 256;
+    info.maxOpenFiles = 5;
+    info.maxPathLength = 32;
+    return sim::flash.mounted;
+  }
+};
+
+extern FS LittleFS;
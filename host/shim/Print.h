@@ -0,0 +1,82 @@
+// Host shim for the Arduino Print/Printable interfaces
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, std::strlen(str)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC) {
+    if (base == DEC) return printFormatted("%ld", n);
+    return print((unsigned long)n, base);
+  }
+  size_t print(unsigned long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+  size_t print(long long n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned long long n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(double n, int digits = 2) { return printFormatted("%.*f", digits, n); }
+  size_t print(const Printable& x) { return x.printTo(*this); }
+
+  template <typename T>
+  size_t println(const T& value) { size_t n = print(value); return n + println(); }
+  template <typename T>
+  size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+  size_t println() { return write("\r\n"); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  template <typename... Args>
+  size_t printFormatted(const char* format, Args... args) {
+    char tmp[64];
+    int len = std::snprintf(tmp, sizeof(tmp), format, args...);
+    return len > 0 ? write(tmp, (size_t)len < sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1) : 0;
+  }
+};
+
+#include <cstdarg>
+
+inline size_t Print::printf(const char* format, ...) {
+  char tmp[256];
+  va_list args;
+  va_start(args, format);
+  int len = std::vsnprintf(tmp, sizeof(tmp), format, args);
+  va_end(args);
+  if (len <= 0) return 0;
+  return write(tmp, (size_t)len < sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1);
+}
@@ -0,0 +1,27 @@
+// Host shim for the Arduino Servo library
+
+#pragma once
+
+#include "Arduino.h"
+
+class Servo {
+public:
+  uint8_t attach(int pin) { attachedPin = pin; return 0; }
+  uint8_t attach(int pin, int, int) { return attach(pin); }
+  void detach() { attachedPin = -1; }
+  bool attached() const { return attachedPin >= 0; }
+
+  void write(int value) {
+    sim::hopperUpdate();  // settle flow at the old angle first
+    int angle = constrain(value, 0, 180);
+    if (sim::servo.angle == 0 && angle > 0) sim::servo.openedMicros = sim::nowMicros();
+    sim::servo.angle = angle;
+    sim::servo.writes++;
+    sim::servo.lastWriteMicros = sim::nowMicros();
+  }
+  void writeMicroseconds(int value) { write((value - 544) * 180 / (2400 - 544)); }
+  int read() const { return sim::servo.angle; }
+
+private:
+  int attachedPin = -1;
+};
@@ -0,0 +1,37 @@
+// Host shim for the Arduino Stream interface
+
+#pragma once
+
+#include "Print.h"
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { streamTimeout = timeout; }
+  unsigned long getTimeout() const { return streamTimeout; }
+
+  size_t readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+      int c = read();
+      if (c < 0) break;
+      *buffer++ = (char)c;
+      count++;
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+  String readString() {
+    String result;
+    int c;
+    while ((c = read()) >= 0) result += (char)c;
+    return result;
+  }
+
+protected:
+  unsigned long streamTimeout = 1000;
+};
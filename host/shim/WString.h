@@ -0,0 +1,134 @@
+// Host shim for the Arduino String class
+// Only the subset of the API used by the sketches is provided. Buffers that
+// outgrow the small-string storage are booked in the simulated sketch heap.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "sim.h"
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+#define PSTR(s) (s)
+#define PROGMEM
+
+class String {
+public:
+  String() {}
+  String(const char* cstr) : buffer(cstr ? cstr : "") {}
+  String(const __FlashStringHelper* str) : buffer(reinterpret_cast<const char*>(str)) {}
+  String(const std::string& str) : buffer(str.data(), str.size()) {}
+  explicit String(char c) : buffer(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(int value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(long value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(float value, unsigned char decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+  explicit String(double value, unsigned char decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+
+  bool reserve(unsigned int size) { buffer.reserve(size); return true; }
+  unsigned int length() const { return buffer.size(); }
+  const char* c_str() const { return buffer.c_str(); }
+  char* begin() { return &buffer[0]; }
+  char* end() { return &buffer[0] + buffer.size(); }
+
+  bool concat(const String& str) { buffer += str.buffer; return true; }
+  bool concat(const char* cstr) { if (cstr) buffer += cstr; return true; }
+  bool concat(const char* cstr, unsigned int length) { buffer.append(cstr, length); return true; }
+  bool concat(char c) { buffer += c; return true; }
+  bool concat(int value) { return concat(String(value)); }
+  bool concat(unsigned int value) { return concat(String(value)); }
+  bool concat(long value) { return concat(String(value)); }
+  bool concat(unsigned long value) { return concat(String(value)); }
+  bool concat(float value) { return concat(String(value)); }
+  bool concat(double value) { return concat(String(value)); }
+
+  template <typename T>
+  String& operator+=(const T& rhs) { concat(rhs); return *this; }
+
+  bool operator==(const String& rhs) const { return buffer == rhs.buffer; }
+  bool operator==(const char* rhs) const { return buffer == (rhs ? rhs : ""); }
+  bool operator!=(const String& rhs) const { return !(*this == rhs); }
+  bool operator!=(const char* rhs) const { return !(*this == rhs); }
+  bool operator<(const String& rhs) const { return buffer < rhs.buffer; }
+  bool equals(const String& rhs) const { return *this == rhs; }
+  bool startsWith(const String& prefix) const { return buffer.compare(0, prefix.buffer.size(), prefix.buffer) == 0; }
+  bool endsWith(const String& suffix) const {
+    return buffer.size() >= suffix.buffer.size() &&
+           buffer.compare(buffer.size() - suffix.buffer.size(), suffix.buffer.size(), suffix.buffer) == 0;
+  }
+
+  char charAt(unsigned int index) const { return index < buffer.size() ? buffer[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) { return buffer[index]; }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t pos = buffer.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  int indexOf(const String& str, unsigned int from = 0) const {
+    size_t pos = buffer.find(str.buffer, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  String substring(unsigned int from) const { return from < buffer.size() ? String(buffer.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= buffer.size()) return String();
+    return String(buffer.substr(from, to - from));
+  }
+  void trim() {
+    size_t first = buffer.find_first_not_of(" \t\r\n");
+    size_t last = buffer.find_last_not_of(" \t\r\n");
+    buffer = first == std::string::npos ? Buffer() : buffer.substr(first, last - first + 1);
+  }
+  void clear() { buffer.clear(); }
+
+  long toInt() const { return std::strtol(buffer.c_str(), nullptr, 10); }
+  float toFloat() const { return std::strtof(buffer.c_str(), nullptr); }
+  double toDouble() const { return std::strtod(buffer.c_str(), nullptr); }
+
+private:
+  typedef std::basic_string<char, std::char_traits<char>, sim::HeapAllocator<char>> Buffer;
+
+  explicit String(const Buffer& str) : buffer(str) {}
+
+  void fromSigned(long value, unsigned char base) {
+    if (base == 10) { char tmp[24]; std::snprintf(tmp, sizeof(tmp), "%ld", value); buffer = tmp; return; }
+    fromUnsigned((unsigned long)value, base);
+  }
+  void fromUnsigned(unsigned long value, unsigned char base) {
+    char tmp[72];
+    char* p = tmp + sizeof(tmp) - 1;
+    *p = 0;
+    do {
+      unsigned digit = value % base;
+      *--p = (char)(digit < 10 ? '0' + digit : 'A' + digit - 10);
+      value /= base;
+    } while (value);
+    buffer = p;
+  }
+  void fromDouble(double value, unsigned char decimalPlaces) {
+    char tmp[64];
+    std::snprintf(tmp, sizeof(tmp), "%.*f", (int)decimalPlaces, value);
+    buffer = tmp;
+  }
+
+  Buffer buffer;
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, const char* rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const char* lhs, const String& rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, char rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, int rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, unsigned int rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, long rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, unsigned long rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, float rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const String& lhs, double rhs) { String s(lhs); s.concat(rhs); return s; }
@@ -0,0 +1,152 @@
+// Host shim for the ESP8266 WiFiClient (TCP socket)
+// connect() charges a TCP handshake to the virtual clock; response bodies
+// are served from an in-memory receive buffer filled by the HTTP shim.
+// Raw HTTP/1.1 requests written to the socket are parsed and answered by
+// sim::net with a Content-Length framed response, as a keep-alive server would.
+// A websocket upgrade hands the socket to the sim::realtime stand-in instead.
+// connect(), connected() and stop() are virtual, as on the ESP8266 core, so
+// WiFiClientSecure.h can add the TLS handshake.
+
+#pragma once
+
+#include <string>
+#include <strings.h>
+
+#include "Arduino.h"
+
+class WiFiClient : public Stream {
+public:
+  virtual ~WiFiClient() { detachRealtime(); }
+
+  virtual int connect(const char* host, uint16_t port) {
+    if (!sim::wifiConnected()) return 0;
+    if (connectedFlag && remoteHost == host && remotePort == port) return 1;
+    sim::net.connects++;
+    sim::advanceMicros(sim::net.connectMicros);
+    remoteHost = host;
+    remotePort = port;
+    connectedFlag = true;
+    return 1;
+  }
+  int connect(const String& host, uint16_t port) { return connect(host.c_str(), port); }
+  virtual uint8_t connected() {
+    if (connectedFlag && !sim::wifiConnected()) {
+      connectedFlag = false;
+      detachRealtime();
+    }
+    return connectedFlag || available() > 0;
+  }
+  virtual void stop() {
+    detachRealtime();
+    connectedFlag = false;
+    rx.clear();
+    rxPos = 0;
+    tx.clear();
+  }
+  operator bool() { return connected(); }
+
+  void setNoDelay(bool) {}
+  void keepAlive(uint16_t = 7200, uint16_t = 75, uint8_t = 9) {}
+  void setTimeout(unsigned long timeout) { streamTimeout = timeout; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (!connected()) return 0;
+    tx.append((const char*)buffer, size);
+    serveRawRequests();
+    return size;
+  }
+  using Print::write;
+
+  int available() override { return (int)(rx.size() - rxPos); }
+  int read() override { return rxPos < rx.size() ? (uint8_t)rx[rxPos++] : -1; }
+  int peek() override { return rxPos < rx.size() ? (uint8_t)rx[rxPos] : -1; }
+  int read(uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, rx.size() - rxPos);
+    std::memcpy(buffer, rx.data() + rxPos, n);
+    rxPos += n;
+    return (int)n;
+  }
+
+  // Simulation hook: queue bytes as if received from the peer
+  void simReceive(const std::string& bytes) {
+    if (rxPos == rx.size()) {
+      rx.clear();
+      rxPos = 0;
+    }
+    rx += bytes;
+  }
+  const std::string& simHost() const { return remoteHost; }
+
+private:
+  // Answer every complete request queued in `tx`
+  void serveRawRequests() {
+    for (;;) {
+      if (upgraded) {
+        tx.erase(0, sim::realtimeReceive(tx));
+        return;
+      }
+      size_t headEnd = tx.find("\r\n\r\n");
+      if (headEnd == std::string::npos) return;
+      sim::HttpRequest request;
+      request.host = remoteHost;
+      size_t lineEnd = tx.find("\r\n");
+      std::string line = tx.substr(0, lineEnd);
+      size_t space1 = line.find(' ');
+      size_t space2 = line.find(' ', space1 + 1);
+      request.method = line.substr(0, space1);
+      request.path = line.substr(space1 + 1, space2 - space1 - 1);
+      size_t contentLength = 0;
+      for (size_t pos = lineEnd + 2; pos < headEnd;) {
+        size_t end = tx.find("\r\n", pos);
+        std::string header = tx.substr(pos, end - pos);
+        size_t colon = header.find(':');
+        std::string name = header.substr(0, colon);
+        std::string value = header.substr(std::min(header.size(), colon + 2));
+        if (strcasecmp(name.c_str(), "Content-Length") == 0) contentLength = std::strtoul(value.c_str(), nullptr, 10);
+        request.headers.emplace_back(name, value);
+        pos = end + 2;
+      }
+      if (tx.size() < headEnd + 4 + contentLength) return;
+      request.body = tx.substr(headEnd + 4, contentLength);
+      tx.erase(0, headEnd + 4 + contentLength);
+
+      if (isUpgrade(request)) {
+        std::string reply = sim::realtimeAccept(
+            request, [this](const std::string& bytes) { simReceive(bytes); },
+            [this] {
+              upgraded = false;
+              connectedFlag = false;
+            });
+        upgraded = reply.compare(0, 12, "HTTP/1.1 101") == 0;
+        simReceive(reply);
+        continue;
+      }
+      sim::HttpResponse response = sim::httpExchange(request);
+      simReceive("HTTP/1.1 " + std::to_string(response.status) + " \r\nContent-Length: " +
+                 std::to_string(response.body.size()) + "\r\nConnection: keep-alive\r\n\r\n" + response.body);
+    }
+  }
+
+  static bool isUpgrade(const sim::HttpRequest& request) {
+    for (const auto& header : request.headers) {
+      if (strcasecmp(header.first.c_str(), "Upgrade") == 0 && strcasecmp(header.second.c_str(), "websocket") == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void detachRealtime() {
+    if (upgraded) sim::realtimeDetach();
+    upgraded = false;
+  }
+
+  bool connectedFlag = false;
+  bool upgraded = false;
+  std::string remoteHost;
+  uint16_t remotePort = 0;
+  std::string rx;
+  size_t rxPos = 0;
+  std::string tx;
+};
@@ -0,0 +1,46 @@
+// Host shim for the ESP8266 BearSSL WiFiClientSecure
+// A new connection charges sim::net.tlsMicros for the handshake on top of
+// the TCP one; the bytes themselves are exchanged in the clear with sim::net.
+// As on the ESP8266, the session (and its heap) is held until stop();
+// sim::net.tlsSessions counts the ones held right now.
+
+#pragma once
+
+#include "WiFiClient.h"
+
+namespace BearSSL {
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  int connect(const char* host, uint16_t port) override {
+    uint64_t connects = sim::net.connects;
+    if (!WiFiClient::connect(host, port)) return 0;
+    if (sim::net.connects != connects) {
+      sim::net.tlsHandshakes++;
+      sim::advanceMicros(sim::net.tlsMicros);
+      if (!session) sim::net.tlsSessions++;
+      session = true;
+    }
+    return 1;
+  }
+  using WiFiClient::connect;
+
+  void stop() override {
+    WiFiClient::stop();
+    if (session) sim::net.tlsSessions--;
+    session = false;
+  }
+
+  ~WiFiClientSecure() override {
+    if (session) sim::net.tlsSessions--;
+  }
+
+  void setInsecure() {}
+
+private:
+  bool session = false;
+};
+
+}  // namespace BearSSL
+
+using namespace BearSSL;
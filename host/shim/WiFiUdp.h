@@ -0,0 +1,87 @@
+// Host shim for the ESP8266 WiFiUDP socket
+// Datagrams are handed to sim::udpSend() on endPacket(); replies queued in
+// sim::udp.inbox for the bound port are returned by parsePacket()/read().
+
+#pragma once
+
+#include <string>
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+class WiFiUDP : public Stream {
+public:
+  uint8_t begin(uint16_t port) {
+    localPort = port;
+    return 1;
+  }
+  // Group membership is not modelled: the bench delivers to the port
+  uint8_t beginMulticast(IPAddress, IPAddress, uint16_t port) { return begin(port); }
+  void stop() {
+    localPort = 0;
+    rx.clear();
+    rxPos = 0;
+  }
+
+  int beginPacket(IPAddress ip, uint16_t port) {
+    if (localPort == 0) return 0;
+    packet.remoteIp = (uint32_t)ip;
+    packet.remotePort = port;
+    packet.localPort = localPort;
+    packet.payload.clear();
+    return 1;
+  }
+  // Sending needs no begin(); the SDK binds an ephemeral port
+  int beginPacketMulticast(IPAddress group, uint16_t port, IPAddress, int = 1) {
+    if (localPort == 0) localPort = 49152;
+    return beginPacket(group, port);
+  }
+  int endPacket() {
+    if (!sim::wifiConnected()) return 0;
+    sim::udpSend(packet);
+    return 1;
+  }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    packet.payload.append((const char*)buffer, size);
+    return size;
+  }
+  using Print::write;
+
+  // Size of the next datagram for this port, 0 if none has arrived
+  int parsePacket() {
+    rx.clear();
+    rxPos = 0;
+    for (auto it = sim::udp.inbox.begin(); it != sim::udp.inbox.end(); ++it) {
+      if (localPort == 0 || it->localPort != localPort) continue;
+      rx = it->payload;
+      fromIp = it->remoteIp;
+      fromPort = it->remotePort;
+      sim::udp.inbox.erase(it);
+      return (int)rx.size();
+    }
+    return 0;
+  }
+  int available() override { return (int)(rx.size() - rxPos); }
+  int read() override { return rxPos < rx.size() ? (uint8_t)rx[rxPos++] : -1; }
+  int peek() override { return rxPos < rx.size() ? (uint8_t)rx[rxPos] : -1; }
+  int read(uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, rx.size() - rxPos);
+    std::memcpy(buffer, rx.data() + rxPos, n);
+    rxPos += n;
+    return (int)n;
+  }
+  int read(char* buffer, size_t size) { return read((uint8_t*)buffer, size); }
+
+  IPAddress remoteIP() const { return IPAddress(fromIp); }
+  uint16_t remotePort() const { return fromPort; }
+
+private:
+  uint16_t localPort = 0;
+  sim::Datagram packet;
+  std::string rx;
+  size_t rxPos = 0;
+  uint32_t fromIp = 0;
+  uint16_t fromPort = 0;
+};
@@ -0,0 +1,41 @@
+// Host shim for the Arduino Wire (I2C master) library
+// Transfers are charged to the virtual clock at 9 bit times per byte.
+
+#pragma once
+
+#include "Arduino.h"
+
+class TwoWire : public Stream {
+public:
+  void begin() {}
+  void begin(int, int) {}
+  void setClock(uint32_t frequency) { sim::i2c.clockHz = frequency; }
+  uint32_t getClock() const { return sim::i2c.clockHz; }
+
+  void beginTransmission(uint8_t address) {
+    (void)address;
+    pending = 1;  // address byte
+  }
+  size_t write(uint8_t) override {
+    pending++;
+    return 1;
+  }
+  using Print::write;
+  uint8_t endTransmission(bool = true) {
+    sim::i2c.transactions++;
+    sim::i2c.bytes += pending;
+    sim::advanceMicros((uint64_t)pending * 9 * 1000000 / sim::i2c.clockHz + 20);
+    pending = 0;
+    return 0;
+  }
+
+  uint8_t requestFrom(uint8_t, uint8_t) { return 0; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+private:
+  uint32_t pending = 0;
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,592 @@
+// Host simulation state behind the Arduino shims
+
+#include "sim.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "LittleFS.h"
+#include "ESP8266WiFi.h"
+#include "Wire.h"
+
+namespace sim {
+
+Gpio gpio;
+Hx711 hx711;
+Hopper hopper;
+ServoState servo;
+Dht dht;
+Ultrasonic ultrasonic;
+I2c i2c;
+Wifi wifi;
+Rtc rtc;
+Net net;
+Udp udp;
+Realtime realtime;
+Eeprom eeprom;
+Flash flash;
+Console console;
+
+namespace {
+
+uint64_t clockMicros = 0;
+std::multimap<uint64_t, std::function<void()>> events;
+
+}  // namespace
+
+uint64_t nowMicros() {
+  return clockMicros;
+}
+
+void advanceTo(uint64_t atMicros) {
+  while (!events.empty() && events.begin()->first <= atMicros) {
+    auto next = events.begin();
+    if (next->first > clockMicros) clockMicros = next->first;
+    std::function<void()> event = std::move(next->second);
+    events.erase(next);
+    event();
+  }
+  if (atMicros > clockMicros) clockMicros = atMicros;
+}
+
+void advanceMicros(uint64_t us) {
+  advanceTo(clockMicros + us);
+}
+
+void schedule(uint64_t atMicros, std::function<void()> event) {
+  events.emplace(atMicros, std::move(event));
+}
+
+void reset() {
+  clockMicros = 0;
+  events.clear();
+  gpio = Gpio();
+  hx711 = Hx711();
+  hopper = Hopper();
+  servo = ServoState();
+  dht = Dht();
+  ultrasonic = Ultrasonic();
+  i2c = I2c();
+  wifi = Wifi();
+  net = Net();
+  udp = Udp();
+  realtime = Realtime();
+  eeprom = Eeprom();
+  rtc = Rtc();
+  flash = Flash();
+  bool echo = std::getenv("SIM_SERIAL") != nullptr;
+  console = Console();
+  console.echo = echo;
+}
+
+void driveInput(uint8_t pin, int level) {
+  if (pin >= Gpio::PIN_COUNT) return;
+  int previous = gpio.level[pin];
+  gpio.level[pin] = level;
+  if (!gpio.isr[pin] || previous == level) return;
+  int mode = gpio.isrMode[pin];
+  bool rising = previous == LOW && level == HIGH;
+  bool falling = previous == HIGH && level == LOW;
+  if (mode == CHANGE || (mode == RISING && rising) || (mode == FALLING && falling)) {
+    gpio.isr[pin]();
+  }
+}
+
+namespace {
+
+long hx711Sample() {
+  hopperUpdate();
+  double grams = hx711.loadAt ? hx711.loadAt(clockMicros) : hopper.enabled ? hopper.grams : hx711.grams;
+  double noise = 0.0;
+  if (hx711.noiseCounts > 0) {
+    hx711.noiseState = hx711.noiseState * 1103515245u + 12345u;
+    noise = ((double)((hx711.noiseState >> 8) & 0xFFFF) / 32767.5 - 1.0) * hx711.noiseCounts;
+  }
+  long counts = hx711.zeroCounts + (long)(grams * hx711.countsPerGram + noise);
+  return std::max(-0x800000L, std::min(0x7FFFFFL, counts));  // 24-bit ADC range
+}
+
+void hx711Convert() {
+  hx711.conversions++;
+  hx711.bitIndex = 0;
+  hx711.latched = hx711Sample();
+  hx711.dataReady = true;
+  hx711.nextConversionMicros = clockMicros + hx711.periodMicros;
+  schedule(hx711.nextConversionMicros, hx711Convert);
+  driveInput(hx711.doutPin, LOW);
+}
+
+}  // namespace
+
+void hopperUpdate() {
+  // Integrate in 1 ms slices while the horn is moving, in one step otherwise
+  uint64_t t = hopper.lastUpdateMicros;
+  while (t < clockMicros) {
+    bool moving = servo.position != servo.angle;
+    uint64_t step = moving ? std::min<uint64_t>(1000, clockMicros - t) : clockMicros - t;
+    double seconds = step / 1e6;
+    double before = servo.position;
+    double travel = servo.degreesPerSecond * seconds;
+    if (servo.position < servo.angle) servo.position = std::min<double>(servo.angle, servo.position + travel);
+    else if (servo.position > servo.angle) servo.position = std::max<double>(servo.angle, servo.position - travel);
+
+    double opening = std::min(1.0, (before + servo.position) / 2 / hopper.fullOpenAngle);
+    if (hopper.enabled && opening > 0 && hopper.grams > 0) {
+      double out = std::min(hopper.grams, opening * hopper.fullFlowGramsPerSecond * seconds);
+      hopper.grams -= out;
+      hopper.dispensedGrams += out;
+    }
+    t += step;
+  }
+  hopper.lastUpdateMicros = clockMicros;
+}
+
+void hx711Start(uint8_t dout, uint8_t sck) {
+  hx711.doutPin = dout;
+  hx711.sckPin = sck;
+  if (hx711.started) return;
+  hx711.started = true;
+  hx711.nextConversionMicros = clockMicros + hx711.periodMicros;
+  schedule(hx711.nextConversionMicros, hx711Convert);
+}
+
+void hx711Clock(int level) {
+  if (level != HIGH || !hx711.dataReady) return;
+  if (hx711.bitIndex < 24) {
+    uint32_t bits = (uint32_t)hx711.latched & 0xFFFFFF;
+    driveInput(hx711.doutPin, (bits >> (23 - hx711.bitIndex)) & 1 ? HIGH : LOW);
+    hx711.bitIndex++;
+    return;
+  }
+  // Gain/channel pulse ends the transfer
+  hx711.bitIndex = 0;
+  hx711.dataReady = false;
+  hx711.reads++;
+  driveInput(hx711.doutPin, HIGH);
+}
+
+uint32_t ultrasonicFlightMicros() {
+  ultrasonic.pings++;
+  if (!ultrasonic.echo || (ultrasonic.missEvery && ultrasonic.pings % ultrasonic.missEvery == 0)) return 0;
+  float distance = ultrasonic.distanceCm;
+  if (ultrasonic.strayEvery && ultrasonic.pings % ultrasonic.strayEvery == 0) distance *= 0.4f;
+  if (ultrasonic.jitterCm > 0) {
+    ultrasonic.noiseSeed = ultrasonic.noiseSeed * 1103515245u + 12345u;
+    distance += ((ultrasonic.noiseSeed >> 16) % 2001 / 1000.0f - 1.0f) * ultrasonic.jitterCm;
+  }
+  float cmPerMicro = (331.3f + 0.606f * dht.temperature) / 10000.0f;
+  return (uint32_t)(distance * 2.0f / cmPerMicro);
+}
+
+void ultrasonicTrigger(int level) {
+  // The module pings on the falling edge of the trigger pulse, unless it is
+  // still busy with the previous one
+  bool falling = ultrasonic.triggerHigh && level == LOW;
+  ultrasonic.triggerHigh = level == HIGH;
+  if (!falling || ultrasonic.echoPin == 0xFF || gpio.level[ultrasonic.echoPin] == HIGH) return;
+  uint32_t flight = ultrasonicFlightMicros();
+  uint64_t rise = clockMicros + ultrasonic.burstMicros;
+  uint8_t echoPin = ultrasonic.echoPin;
+  schedule(rise, [echoPin] { driveInput(echoPin, HIGH); });
+  schedule(rise + (flight ? flight : ultrasonic.noEchoMicros), [echoPin] { driveInput(echoPin, LOW); });
+}
+
+}  // namespace sim
+
+HardwareSerial Serial;
+EspClass ESP;
+EEPROMClass EEPROM;
+FS LittleFS;
+ESP8266WiFiClass WiFi;
+TwoWire Wire;
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+  (void)pin;
+  (void)state;
+  uint32_t duration = sim::ultrasonicFlightMicros();
+  if (duration == 0 || sim::ultrasonic.burstMicros + duration > timeout) {
+    sim::advanceMicros(timeout);
+    return 0;
+  }
+  sim::advanceMicros(sim::ultrasonic.burstMicros + duration);  // burst + flight time
+  return duration;
+}
+
+namespace sim {
+
+bool wifiConnected() {
+  if (!wifi.apUp) {
+    if (wifi.connected || wifi.connecting) {
+      wifi.connected = false;
+      wifi.connecting = wifi.autoReconnect;
+      wifi.connectStartMicros = clockMicros;  // association restarts once the AP answers again
+    }
+    return false;
+  }
+  if (!wifi.connected && wifi.connecting && clockMicros - wifi.connectStartMicros >= wifi.associateMicros) {
+    wifi.connecting = false;
+    wifi.connected = !wifi.wrongHint;
+    wifi.noSsid = wifi.wrongHint;
+  }
+  return wifi.connected;
+}
+
+HttpResponse httpExchange(const HttpRequest& request) {
+  HttpResponse response;
+  if (net.handler) {
+    response = net.handler(request);
+  } else if (request.method == "GET") {
+    response.status = 200;
+    response.body = "[]";
+  }
+  net.requests++;
+  net.bytesSent += request.method.size() + request.path.size() + request.body.size() + 12;
+  for (const auto& header : request.headers) net.bytesSent += header.first.size() + header.second.size() + 4;
+  net.bytesReceived += response.body.size() + 64;
+  if (net.keepLog) net.log.push_back(request);
+  advanceMicros(net.requestMicros);
+  return response;
+}
+
+static bool udpLost() {
+  if (udp.lossPercent == 0) return false;
+  udp.lossSeed = udp.lossSeed * 1103515245u + 12345u;
+  return (udp.lossSeed >> 16) % 100 < udp.lossPercent;
+}
+
+void udpSend(const Datagram& datagram) {
+  udp.datagramsSent++;
+  udp.bytesSent += datagram.payload.size();
+  net.bytesSent += datagram.payload.size() + 28;  // IP + UDP headers
+  advanceMicros(udp.sendMicros);
+  if (udpLost()) {
+    udp.datagramsLost++;
+    return;
+  }
+  if (!udp.handler) return;
+  for (const std::string& payload : udp.handler(datagram)) {
+    if (udpLost()) {
+      udp.datagramsLost++;
+      continue;
+    }
+    Datagram reply;
+    reply.remoteIp = datagram.remoteIp;
+    reply.remotePort = datagram.remotePort;
+    reply.localPort = datagram.localPort;
+    reply.payload = payload;
+    schedule(clockMicros + udp.roundTripMicros, [reply]() {
+      udp.inbox.push_back(reply);
+      udp.bytesReceived += reply.payload.size();
+      net.bytesReceived += reply.payload.size() + 28;
+    });
+  }
+}
+
+void udpReceive(const Datagram& datagram, bool groupAddressed) {
+  if (udpLost()) {
+    udp.datagramsLost++;
+    return;
+  }
+  uint64_t at = clockMicros;
+  if (wifi.modemSleep) {
+    uint64_t period = groupAddressed ? wifi.dtimMicros : wifi.beaconMicros;
+    at = (clockMicros / period + 1) * period;
+  }
+  schedule(at, [datagram]() {
+    if (!wifiConnected()) return;
+    udp.inbox.push_back(datagram);
+    udp.bytesReceived += datagram.payload.size();
+    net.bytesReceived += datagram.payload.size() + 28;
+  });
+}
+
+namespace {
+
+// Unmasked server frame, as the server sends them
+std::string realtimeFrame(uint8_t opcode, const std::string& payload) {
+  std::string frame(1, (char)(0x80 | opcode));
+  if (payload.size() < 126) {
+    frame += (char)payload.size();
+  } else {
+    frame += (char)126;
+    frame += (char)(payload.size() >> 8);
+    frame += (char)(payload.size() & 0xFF);
+  }
+  return frame + payload;
+}
+
+void realtimeSend(uint8_t opcode, const std::string& payload) {
+  if (!realtime.deliver) return;
+  std::string frame = realtimeFrame(opcode, payload);
+  realtime.bytesReceived += frame.size();
+  net.bytesReceived += frame.size();
+  realtime.deliver(frame);
+}
+
+// Value of a string field, e.g. jsonField(text, "topic")
+std::string jsonField(const std::string& text, const char* name) {
+  std::string key = std::string("\"") + name + "\":\"";
+  size_t start = text.find(key);
+  if (start == std::string::npos) return std::string();
+  start += key.size();
+  return text.substr(start, text.find('"', start) - start);
+}
+
+std::string refField(const std::string& text) {
+  std::string ref = jsonField(text, "ref");
+  return ref.empty() ? "null" : "\"" + ref + "\"";
+}
+
+void realtimeMessage(const std::string& text) {
+  std::string topic = jsonField(text, "topic");
+  std::string event = jsonField(text, "event");
+  if (event == "heartbeat") {
+    realtime.heartbeats++;
+    realtime.lastHeartbeatMicros = nowMicros();
+    realtimeSend(0x1, "{\"event\":\"phx_reply\",\"payload\":{\"response\":{},\"status\":\"ok\"},\"ref\":" +
+                          refField(text) + ",\"topic\":\"phoenix\"}");
+  } else if (event == "phx_join") {
+    realtime.joins++;
+    realtime.joinedTopic = topic;
+    realtime.joinedTable = jsonField(text, "table");
+    realtimeSend(0x1, "{\"event\":\"phx_reply\",\"payload\":{\"response\":{\"postgres_changes\":[{\"event\":\"INSERT\","
+                      "\"id\":31339675,\"schema\":\"public\",\"table\":\"" +
+                          realtime.joinedTable + "\"}]},\"status\":\"ok\"},\"ref\":" + refField(text) +
+                          ",\"topic\":\"" + topic + "\"}");
+    realtimeSend(0x1, "{\"event\":\"presence_state\",\"payload\":{},\"ref\":null,\"topic\":\"" + topic + "\"}");
+  } else if (event == "phx_leave") {
+    realtime.joinedTopic.clear();
+    realtime.joinedTable.clear();
+  }
+}
+
+}  // namespace
+
+std::string realtimeAccept(const HttpRequest& request, std::function<void(const std::string&)> deliver,
+                           std::function<void()> close) {
+  net.bytesSent += request.method.size() + request.path.size() + 12;
+  for (const auto& header : request.headers) net.bytesSent += header.first.size() + header.second.size() + 4;
+  advanceMicros(net.requestMicros);
+  if (!realtime.accept) {
+    net.bytesReceived += 64;
+    return "HTTP/1.1 503 \r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n";
+  }
+  if (realtime.close) realtime.close();
+  realtimeDetach();
+  realtime.upgrades++;
+  realtime.deliver = std::move(deliver);
+  realtime.close = std::move(close);
+  realtime.lastHeartbeatMicros = nowMicros();
+  std::string response =
+      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n";
+  net.bytesReceived += response.size();
+  return response;
+}
+
+size_t realtimeReceive(const std::string& bytes) {
+  size_t used = 0;
+  while (bytes.size() - used >= 2) {
+    const uint8_t* frame = (const uint8_t*)bytes.data() + used;
+    size_t available = bytes.size() - used;
+    uint8_t opcode = frame[0] & 0x0F;
+    bool masked = frame[1] & 0x80;
+    uint64_t length = frame[1] & 0x7F;
+    size_t head = 2;
+    if (length == 126) {
+      if (available < 4) break;
+      length = (uint64_t)frame[2] << 8 | frame[3];
+      head = 4;
+    } else if (length == 127) {
+      if (available < 10) break;
+      length = 0;
+      for (int i = 0; i < 8; i++) length = length << 8 | frame[2 + i];
+      head = 10;
+    }
+    const uint8_t* mask = frame + head;
+    if (masked) head += 4;
+    if (available < head + length) break;
+    std::string payload((const char*)frame + head, length);
+    if (masked) {
+      for (size_t i = 0; i < payload.size(); i++) payload[i] ^= mask[i % 4];
+    }
+    used += head + length;
+    realtime.bytesSent += head + length;
+    net.bytesSent += head + length;
+
+    if (opcode == 0x1) {
+      realtimeMessage(payload);
+    } else if (opcode == 0x8) {
+      realtimeSend(0x8, payload.substr(0, 2));
+      std::function<void()> close = realtime.close;
+      realtimeDetach();
+      if (close) close();
+    } else if (opcode == 0x9) {
+      realtimeSend(0xA, payload);
+    }
+  }
+  return used;
+}
+
+void realtimeDetach() {
+  realtime.deliver = nullptr;
+  realtime.close = nullptr;
+  realtime.joinedTopic.clear();
+  realtime.joinedTable.clear();
+}
+
+bool realtimeInsert(const std::string& table, const std::string& recordJson) {
+  if (realtime.deliver && nowMicros() - realtime.lastHeartbeatMicros > realtime.timeoutMicros) {
+    realtime.timeouts++;
+    realtimeDrop();
+  }
+  if (!realtime.deliver || realtime.joinedTable != table) return false;
+
+  // The server lists every column of the row ahead of the record itself
+  std::string columns;
+  int depth = 0;
+  bool quoted = false;
+  size_t keyStart = 0;
+  for (size_t i = 0; i < recordJson.size(); i++) {
+    char c = recordJson[i];
+    if (quoted) {
+      if (c == '\\') i++;
+      else if (c == '"') quoted = false;
+      continue;
+    }
+    if (c == '"') {
+      quoted = true;
+      keyStart = i;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      depth--;
+    } else if (c == ':' && depth == 1) {
+      columns += std::string(columns.empty() ? "" : ",") + "{\"name\":" + recordJson.substr(keyStart, i - keyStart) +
+                 ",\"type\":\"text\"}";
+    }
+  }
+  realtime.pushes++;
+  realtimeSend(0x1, "{\"event\":\"postgres_changes\",\"payload\":{\"data\":{\"columns\":[" + columns +
+                        "],\"commit_timestamp\":\"2024-05-01T08:15:00.345Z\",\"errors\":null,\"record\":" + recordJson +
+                        ",\"schema\":\"public\",\"table\":\"" + table + "\",\"type\":\"INSERT\"},\"ids\":[31339675]},"
+                        "\"ref\":null,\"topic\":\"" + realtime.joinedTopic + "\"}");
+  return true;
+}
+
+void realtimeDrop() {
+  std::function<void()> close = realtime.close;
+  realtimeDetach();
+  if (close) close();
+}
+
+static void appendField(std::string& state, const std::string& field) {
+  uint32_t size = (uint32_t)field.size();
+  state.append((const char*)&size, sizeof(size));
+  state += field;
+}
+
+static std::string takeField(const std::string& state, size_t& pos) {
+  uint32_t size = 0;
+  if (pos + sizeof(size) > state.size()) return std::string();
+  std::memcpy(&size, state.data() + pos, sizeof(size));
+  pos += sizeof(size);
+  std::string field = state.substr(pos, size);
+  pos += field.size();
+  return field;
+}
+
+std::string saveNonVolatile() {
+  std::string state;
+  appendField(state, std::string((const char*)eeprom.bytes, Eeprom::SIZE));
+  appendField(state, std::string((const char*)rtc.userMemory, Rtc::USER_BYTES));
+  for (const auto& file : flash.files) {
+    appendField(state, file.first);
+    appendField(state, file.second);
+  }
+  return state;
+}
+
+void restoreNonVolatile(const std::string& state, bool keepRtcMemory) {
+  size_t pos = 0;
+  std::string bytes = takeField(state, pos);
+  std::memcpy(eeprom.bytes, bytes.data(), std::min(bytes.size(), Eeprom::SIZE));
+  bytes = takeField(state, pos);
+  if (keepRtcMemory) std::memcpy(rtc.userMemory, bytes.data(), std::min(bytes.size(), Rtc::USER_BYTES));
+  flash.files.clear();
+  while (pos < state.size()) {
+    std::string path = takeField(state, pos);
+    flash.files[path] = takeField(state, pos);
+  }
+}
+
+Heap& heap() {
+  static Heap state;  // constructed before the first global String needs it
+  return state;
+}
+
+void heapTrack(const void* pointer, size_t bytes) {
+  Heap& h = heap();
+  size_t size = ((bytes + Heap::GRANULE - 1) / Heap::GRANULE + 1) * Heap::GRANULE;
+  h.allocations++;
+  size_t offset = 0;
+  for (const auto& block : h.blocks) {
+    if (block.first - offset >= size) break;
+    offset = block.first + block.second;
+  }
+  if (offset + size > Heap::SIZE) {
+    h.failures++;  // the host still has the memory; only the books overflow
+    return;
+  }
+  h.blocks[offset] = size;
+  h.owners[pointer] = offset;
+}
+
+void heapUntrack(const void* pointer) {
+  Heap& h = heap();
+  auto owner = h.owners.find(pointer);
+  if (owner == h.owners.end()) return;
+  h.blocks.erase(owner->second);
+  h.owners.erase(owner);
+  h.frees++;
+}
+
+// Calls `gap` with the size of every free stretch of the arena
+template <typename Gap>
+static void forEachFreeGap(Gap gap) {
+  size_t offset = 0;
+  for (const auto& block : heap().blocks) {
+    if (block.first > offset) gap(block.first - offset);
+    offset = block.first + block.second;
+  }
+  if (Heap::SIZE > offset) gap(Heap::SIZE - offset);
+}
+
+size_t heapFreeBytes() {
+  size_t total = 0;
+  forEachFreeGap([&](size_t bytes) { total += bytes; });
+  return total;
+}
+
+size_t heapMaxFreeBlock() {
+  size_t largest = 0;
+  forEachFreeGap([&](size_t bytes) { largest = std::max(largest, bytes); });
+  return largest;
+}
+
+uint8_t heapFragmentation() {
+  // Same formula as the ESP8266 core: 100 - 100 * sqrt(sum(free_i^2)) / sum(free_i)
+  double total = 0;
+  double squares = 0;
+  forEachFreeGap([&](size_t bytes) {
+    total += bytes;
+    squares += (double)bytes * bytes;
+  });
+  return total > 0 ? (uint8_t)(100 - std::sqrt(squares) * 100 / total) : 0;
+}
+
+}  // namespace sim
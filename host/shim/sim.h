@@ -0,0 +1,388 @@
+// Host simulation state behind the Arduino shims
+// The sketches never include this file; benchmarks use it to drive the
+// virtual clock, the attached peripherals and the network.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+// ---------------------------------------------------------------------------
+// Virtual clock. millis()/micros() read it and delay() advances it, so a
+// blocking call shows up as simulated time rather than wall-clock time.
+
+uint64_t nowMicros();
+void advanceMicros(uint64_t us);
+void advanceTo(uint64_t atMicros);
+
+// Run `event` once the virtual clock reaches `atMicros`
+void schedule(uint64_t atMicros, std::function<void()> event);
+
+// Reset every simulated peripheral and the clock to power-on state
+void reset();
+
+// ---------------------------------------------------------------------------
+// GPIO
+
+struct Gpio {
+  static const int PIN_COUNT = 17;
+  Gpio() { for (int& l : level) l = 1; }  // inputs idle HIGH (pull-ups)
+  int level[PIN_COUNT];
+  int mode[PIN_COUNT] = {};
+  int analog[PIN_COUNT] = {};
+  void (*isr[PIN_COUNT])() = {};
+  int isrMode[PIN_COUNT] = {};
+};
+extern Gpio gpio;
+
+// Drive an input pin from outside the MCU, firing any attached interrupt
+void driveInput(uint8_t pin, int level);
+
+// ---------------------------------------------------------------------------
+// HX711 load cell amplifier. Conversions complete every `periodMicros`;
+// DOUT goes LOW when one is ready. Each SCK rising edge then shifts out the
+// next bit MSB first on DOUT, and the 25th edge returns DOUT HIGH.
+
+struct Hx711 {
+  uint8_t doutPin = 0xFF;
+  uint8_t sckPin = 0xFF;
+  bool started = false;
+  double grams = 0.0;              // load on the cell
+  double countsPerGram = -7050.0;  // physical gain of cell + amplifier
+  long zeroCounts = 84000;         // raw reading with nothing on the cell
+  double noiseCounts = 0.0;        // peak uniform noise per conversion
+  uint32_t periodMicros = 100000;  // 10 SPS
+  bool dataReady = false;
+  long latched = 0;
+  uint8_t bitIndex = 0;
+  uint64_t nextConversionMicros = 0;
+  uint64_t conversions = 0;
+  uint64_t reads = 0;
+  uint32_t noiseState = 12345;
+  std::function<double(uint64_t)> loadAt;  // optional grams(t) override
+};
+extern Hx711 hx711;
+
+void hx711Start(uint8_t dout, uint8_t sck);
+void hx711Clock(int level);  // SCK edge driven by the firmware
+
+// ---------------------------------------------------------------------------
+// Hopper on the load cell. When enabled, rice drains through the servo gate
+// at a rate proportional to the gate angle and the load cell sees the
+// remaining mass.
+
+struct Hopper {
+  bool enabled = false;
+  double grams = 2000.0;
+  double fullFlowGramsPerSecond = 40.0;
+  int fullOpenAngle = 90;
+  double dispensedGrams = 0.0;  // total that has left through the gate
+  uint64_t lastUpdateMicros = 0;
+};
+extern Hopper hopper;
+
+void hopperUpdate();
+
+// ---------------------------------------------------------------------------
+// Servo. The horn slews toward the commanded angle, so the gate keeps
+// passing rice for a moment after it is told to close.
+
+struct ServoState {
+  int angle = 0;              // commanded
+  double position = 0.0;      // actual horn angle
+  double degreesPerSecond = 500.0;  // SG90: ~0.12 s per 60 degrees
+  uint64_t writes = 0;
+  uint64_t lastWriteMicros = 0;
+  uint64_t openedMicros = 0;  // last transition from closed to open
+};
+extern ServoState servo;
+
+// ---------------------------------------------------------------------------
+// DHT22 and HC-SR04
+
+struct Dht {
+  float temperature = 24.5f;
+  float humidity = 55.0f;
+  uint32_t readMicros = 5000;  // bit-banged transfer with interrupts off
+  uint64_t reads = 0;
+};
+extern Dht dht;
+
+// HC-SR04: a trigger pulse on `trigPin` raises `echoPin` after the burst,
+// for the flight time at the speed of sound in dht.temperature. With no echo
+// the pin stays high for `noEchoMicros`.
+struct Ultrasonic {
+  float distanceCm = 12.0f;
+  bool echo = true;
+  uint8_t trigPin = 0xFF;
+  uint8_t echoPin = 0xFF;
+  float jitterCm = 0.0f;      // uniform +/- on every echo
+  uint32_t strayEvery = 0;    // every Nth ping returns a near reflection instead
+  uint32_t missEvery = 0;     // every Nth ping gets no echo
+  uint32_t burstMicros = 450; // 8 cycles at 40 kHz plus the module's delay
+  uint32_t noEchoMicros = 38000;
+  uint32_t noiseSeed = 1;
+  bool triggerHigh = false;
+  uint64_t pings = 0;
+};
+extern Ultrasonic ultrasonic;
+
+// Echo time for the next ping in microseconds, 0 for none
+uint32_t ultrasonicFlightMicros();
+void ultrasonicTrigger(int level);
+
+// ---------------------------------------------------------------------------
+// I2C bus
+
+struct I2c {
+  uint32_t clockHz = 100000;
+  uint64_t transactions = 0;
+  uint64_t bytes = 0;
+};
+extern I2c i2c;
+
+// ---------------------------------------------------------------------------
+// WiFi association
+
+struct Wifi {
+  bool apUp = true;
+  uint8_t apChannel = 6;
+  uint8_t apBssid[6] = {0x18, 0xE8, 0x29, 0x10, 0x20, 0x30};
+  uint32_t scanMicros = 1200000;  // all-channel scan; skipped when begin() is given the channel and BSSID
+  uint32_t authMicros = 100000;   // authentication, association and key handshake
+  uint32_t dhcpMicros = 200000;   // skipped with a static IP
+  uint32_t associateMicros = 1500000;  // set by WiFi.begin() from the above
+  bool wrongHint = false;              // begin() was given a channel/BSSID the AP no longer uses
+  bool noSsid = false;
+  bool connecting = false;
+  bool connected = false;
+  uint64_t connectStartMicros = 0;
+  uint64_t begins = 0;
+  bool autoReconnect = true;  // the SDK re-associates by itself once the AP is back
+  bool modemSleep = true;       // the SDK default; WiFi.setSleepMode(WIFI_NONE_SLEEP) clears it
+  uint32_t beaconMicros = 102400;
+  uint32_t dtimMicros = 307200; // DTIM period 3 x 102.4 ms beacons
+};
+extern Wifi wifi;
+
+bool wifiConnected();
+
+// ---------------------------------------------------------------------------
+// Network. Every request goes through `handler`; the latency fields are
+// charged to the virtual clock so blocking I/O is visible in benchmarks.
+
+struct HttpRequest {
+  std::string method;
+  std::string host;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+};
+
+struct HttpResponse {
+  int status = 201;
+  std::string body;
+};
+
+struct Net {
+  std::function<HttpResponse(const HttpRequest&)> handler;
+  uint32_t connectMicros = 30000;  // TCP handshake
+  uint32_t requestMicros = 40000;  // request/response round trip
+  uint32_t tlsMicros = 600000;     // BearSSL handshake on top of the TCP one
+  uint64_t requests = 0;
+  uint64_t connects = 0;
+  uint64_t tlsHandshakes = 0;
+  uint32_t tlsSessions = 0;        // BearSSL sessions holding their buffers
+  uint64_t bytesSent = 0;
+  uint64_t bytesReceived = 0;
+  std::vector<HttpRequest> log;
+  bool keepLog = false;
+};
+extern Net net;
+
+HttpResponse httpExchange(const HttpRequest& request);
+
+// ---------------------------------------------------------------------------
+// UDP. Every datagram the sketch sends goes to `handler`, which plays the
+// peer; the datagrams it returns arrive back at the sender's port one
+// round trip later. `lossPercent` drops datagrams in either direction,
+// from a fixed seed so runs are repeatable.
+
+struct Datagram {
+  uint32_t remoteIp = 0;
+  uint16_t remotePort = 0;
+  uint16_t localPort = 0;
+  std::string payload;
+};
+
+struct Udp {
+  std::function<std::vector<std::string>(const Datagram&)> handler;
+  uint32_t sendMicros = 300;        // lwIP + driver hand-off; nothing waits for the peer
+  uint32_t roundTripMicros = 4000;  // LAN
+  uint32_t lossPercent = 0;
+  uint32_t lossSeed = 12345;
+  std::deque<Datagram> inbox;       // delivered, not yet read by the sketch
+  uint64_t datagramsSent = 0;
+  uint64_t datagramsLost = 0;
+  uint64_t bytesSent = 0;
+  uint64_t bytesReceived = 0;
+};
+extern Udp udp;
+
+// Sends `datagram` from the sketch and schedules the peer's replies
+void udpSend(const Datagram& datagram);
+
+// Delivers a datagram from another station on the LAN to the sketch. For a
+// modem-sleeping station the AP holds unicast frames until the next beacon
+// and multicast and broadcast ones until the next DTIM beacon; otherwise
+// they arrive at once.
+void udpReceive(const Datagram& datagram, bool groupAddressed);
+
+// ---------------------------------------------------------------------------
+// Realtime. A local stand-in for the Supabase realtime server: Phoenix
+// channels over a websocket. A WiFiClient request with "Upgrade: websocket"
+// is answered with 101 while `accept` is set, and the socket then carries
+// frames. phx_join and heartbeat messages are answered as the server would,
+// and realtimeInsert() pushes a postgres_changes message to the socket that
+// joined the table. A socket that sends no heartbeat for `timeoutMicros` is
+// closed, as Phoenix does.
+
+struct Realtime {
+  bool accept = true;
+  uint64_t timeoutMicros = 60000000;
+  std::function<void(const std::string&)> deliver;  // bytes to the connected socket
+  std::function<void()> close;                      // the server hangs up
+  std::string joinedTopic;
+  std::string joinedTable;
+  uint64_t lastHeartbeatMicros = 0;
+  uint64_t upgrades = 0;
+  uint64_t joins = 0;
+  uint64_t heartbeats = 0;
+  uint64_t pushes = 0;
+  uint64_t timeouts = 0;
+  uint64_t bytesSent = 0;      // frames from the sketch
+  uint64_t bytesReceived = 0;  // frames to the sketch
+};
+extern Realtime realtime;
+
+// Answers an upgrade request; on 101 the socket is attached through the
+// two callbacks and any previous one is closed
+std::string realtimeAccept(const HttpRequest& request, std::function<void(const std::string&)> deliver,
+                           std::function<void()> close);
+// Handles the complete frames at the start of `bytes`; returns the bytes used
+size_t realtimeReceive(const std::string& bytes);
+// The socket went away on the device side
+void realtimeDetach();
+// A row was inserted: pushed to the socket joined to `table`, if any
+bool realtimeInsert(const std::string& table, const std::string& recordJson);
+// The server drops the connection without a close frame
+void realtimeDrop();
+
+// ---------------------------------------------------------------------------
+// Flash sector behind the EEPROM library (erased bytes read 0xFF)
+
+struct Eeprom {
+  static const size_t SIZE = 4096;
+  uint8_t bytes[SIZE];
+  uint64_t commits = 0;
+  Eeprom() { std::fill(bytes, bytes + SIZE, 0xFF); }
+};
+extern Eeprom eeprom;
+
+// ---------------------------------------------------------------------------
+// RTC user memory: kept across a reset or watchdog reboot, lost on power-off
+
+struct Rtc {
+  static const size_t USER_BYTES = 512;
+  uint8_t userMemory[USER_BYTES] = {};
+};
+extern Rtc rtc;
+
+// ---------------------------------------------------------------------------
+// LittleFS partition. Files live in memory; a flush or close that has new
+// data pays for the metadata commit, which dominates small appends.
+
+struct Flash {
+  size_t totalBytes = 2 * 1024 * 1024;  // "4MB (FS:2MB)" board setting
+  size_t blockSize = 8192;          // ESP8266 LittleFS block
+  uint32_t syncMicros = 3000;       // program + metadata commit per sync
+  bool mounted = false;
+  std::map<std::string, std::string> files;  // full path -> contents
+  uint64_t bytesWritten = 0;
+  uint64_t syncs = 0;
+  uint64_t removes = 0;
+};
+extern Flash flash;
+
+// Everything that survives a reboot (EEPROM, LittleFS files and RTC memory)
+// as one blob, so a benchmark can boot the sketch in a child process and boot
+// again from what it left behind. A power cycle drops the RTC memory.
+std::string saveNonVolatile();
+void restoreNonVolatile(const std::string& state, bool keepRtcMemory);
+
+// ---------------------------------------------------------------------------
+// Sketch heap. String buffers and DynamicJsonDocument pools are placed
+// first-fit in an arena the size of what an ESP8266 has left once WiFi is
+// up, so free heap, largest free block and fragmentation drift the way
+// umm_malloc's do. Host memory still holds the data. The arena outlives
+// reset(), because the sketch's global Strings do.
+
+struct Heap {
+  static const size_t SIZE = 40960;
+  static const size_t GRANULE = 8;          // umm_malloc block size; one more for the header
+  std::map<size_t, size_t> blocks;          // arena offset -> bytes
+  std::map<const void*, size_t> owners;     // host pointer -> arena offset
+  uint64_t allocations = 0;
+  uint64_t frees = 0;
+  uint64_t failures = 0;                    // no free gap was large enough
+};
+Heap& heap();
+
+void heapTrack(const void* pointer, size_t bytes);
+void heapUntrack(const void* pointer);
+size_t heapFreeBytes();
+size_t heapMaxFreeBlock();
+uint8_t heapFragmentation();  // 0..100, as ESP.getHeapFragmentation()
+
+// std::allocator that also books every allocation in the simulated heap
+template <typename T>
+struct HeapAllocator {
+  using value_type = T;
+  HeapAllocator() = default;
+  template <typename U>
+  HeapAllocator(const HeapAllocator<U>&) {}
+  T* allocate(size_t n) {
+    T* pointer = std::allocator<T>().allocate(n);
+    heapTrack(pointer, n * sizeof(T));
+    return pointer;
+  }
+  void deallocate(T* pointer, size_t n) {
+    heapUntrack(pointer);
+    std::allocator<T>().deallocate(pointer, n);
+  }
+  template <typename U>
+  bool operator==(const HeapAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const HeapAllocator<U>&) const { return false; }
+};
+
+// ---------------------------------------------------------------------------
+// Serial console
+
+struct Console {
+  bool echo = false;  // copy Serial output to stderr
+  uint64_t bytes = 0;
+  std::string captured;
+  bool capture = false;
+};
+extern Console console;
+
+}  // namespace sim
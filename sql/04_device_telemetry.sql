@@ -0,0 +1,43 @@
+-- ================================================
+-- Device Telemetry Tables
+-- Rows posted by the ESP8266 controllers, directly to Supabase or
+-- through the ingest gateway (host/gateway)
+-- ================================================
+
+-- Weight readings from the main controller (esp1.cpp)
+CREATE TABLE IF NOT EXISTS rice_weights (
+  id BIGSERIAL PRIMARY KEY,
+  device_id VARCHAR(24),
+  weight REAL,
+  timestamp VARCHAR(24),
+  received_at TIMESTAMP WITH TIME ZONE DEFAULT NOW()
+);
+
+-- Environment readings from the sensor controller (esp2.cpp)
+CREATE TABLE IF NOT EXISTS environmental_data (
+  id BIGSERIAL PRIMARY KEY,
+  device_id VARCHAR(24),
+  temperature REAL,
+  humidity REAL,
+  container_level REAL,
+  timestamp VARCHAR(24),
+  received_at TIMESTAMP WITH TIME ZONE DEFAULT NOW()
+);
+
+-- Columns the gateway writes that older installs may lack
+ALTER TABLE rice_weights ADD COLUMN IF NOT EXISTS device_id VARCHAR(24);
+ALTER TABLE rice_weights ADD COLUMN IF NOT EXISTS received_at TIMESTAMP WITH TIME ZONE DEFAULT NOW();
+ALTER TABLE environmental_data ADD COLUMN IF NOT EXISTS device_id VARCHAR(24);
+ALTER TABLE environmental_data ADD COLUMN IF NOT EXISTS received_at TIMESTAMP WITH TIME ZONE DEFAULT NOW();
+
+-- Indexes for performance
+CREATE INDEX IF NOT EXISTS idx_rice_weights_device_received ON rice_weights(device_id, received_at);
+CREATE INDEX IF NOT EXISTS idx_environmental_data_device_received ON environmental_data(device_id, received_at);
+
+-- Comments for documentation
+COMMENT ON TABLE rice_weights IS 'Weight telemetry from the dispenser controllers';
+COMMENT ON COLUMN rice_weights.timestamp IS 'Device time the reading was taken (ms since boot until NTP is used)';
+COMMENT ON COLUMN rice_weights.received_at IS 'When the server or gateway received the row';
+COMMENT ON TABLE environmental_data IS 'Temperature, humidity and container level from the sensor controller';
+COMMENT ON COLUMN environmental_data.timestamp IS 'Device time the reading was taken (ms since boot until NTP is used)';
+COMMENT ON COLUMN environmental_data.received_at IS 'When the server or gateway received the row';
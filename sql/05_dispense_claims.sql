@@ -0,0 +1,60 @@
+-- ================================================
+-- Dispense Request Claims
+-- Lets the dispensers pick up requests the app leaves in dispense_request
+-- without two of them running the same one
+-- ================================================
+
+-- A dispenser moves a row from pending to dispensing with an UPDATE that
+-- only matches while the row is still pending; whoever's UPDATE returns
+-- the row owns the request
+ALTER TABLE dispense_request DROP CONSTRAINT IF EXISTS dispense_request_status_check;
+ALTER TABLE dispense_request ADD CONSTRAINT dispense_request_status_check
+  CHECK (status IN ('pending', 'dispensing', 'completed', 'failed'));
+
+ALTER TABLE dispense_request ADD COLUMN IF NOT EXISTS claimed_by VARCHAR(24);
+ALTER TABLE dispense_request ADD COLUMN IF NOT EXISTS claimed_at TIMESTAMP WITH TIME ZONE;
+
+-- The controllers have no wall clock, so the claim time is set here
+CREATE OR REPLACE FUNCTION set_claimed_at()
+RETURNS TRIGGER AS $$
+BEGIN
+  IF NEW.status = 'dispensing' AND OLD.status != 'dispensing' THEN
+    NEW.claimed_at = NOW();
+  END IF;
+  RETURN NEW;
+END;
+$$ language 'plpgsql';
+
+DROP TRIGGER IF EXISTS update_dispense_request_claimed_at ON dispense_request;
+CREATE TRIGGER update_dispense_request_claimed_at
+  BEFORE UPDATE ON dispense_request
+  FOR EACH ROW
+  EXECUTE FUNCTION set_claimed_at();
+
+-- Likewise the finish time: a request ends completed, or failed when the
+-- dispenser turns it down at the claim, and either one is stamped here
+CREATE OR REPLACE FUNCTION set_completed_at()
+RETURNS TRIGGER AS $$
+BEGIN
+  IF NEW.status IN ('completed', 'failed') AND OLD.status NOT IN ('completed', 'failed') THEN
+    NEW.completed_at = NOW();
+  END IF;
+  RETURN NEW;
+END;
+$$ language 'plpgsql';
+
+DROP TRIGGER IF EXISTS update_dispense_request_completed_at ON dispense_request;
+CREATE TRIGGER update_dispense_request_completed_at
+  BEFORE UPDATE ON dispense_request
+  FOR EACH ROW
+  EXECUTE FUNCTION set_completed_at();
+
+-- The controllers poll for pending rows after (requested_at, id), oldest first
+CREATE INDEX IF NOT EXISTS idx_dispense_request_pending_cursor
+  ON dispense_request(requested_at, id) WHERE status = 'pending';
+
+-- Comments for documentation
+COMMENT ON COLUMN dispense_request.status IS 'Request status: pending, dispensing, completed, or failed';
+COMMENT ON COLUMN dispense_request.claimed_by IS 'Device that claimed the request';
+COMMENT ON COLUMN dispense_request.claimed_at IS 'When the request left pending; a row left in dispensing long after this was interrupted';
+COMMENT ON COLUMN dispense_request.completed_at IS 'When the request became completed or failed';
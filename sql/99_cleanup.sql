@@ -4,6 +4,8 @@
 -- ================================================
 
 -- Drop tables in reverse dependency order
+DROP TABLE IF EXISTS environmental_data CASCADE;
+DROP TABLE IF EXISTS rice_weights CASCADE;
 DROP TABLE IF EXISTS migrations CASCADE;
 DROP TABLE IF EXISTS dispense_request CASCADE;
 DROP TABLE IF EXISTS rice_weight CASCADE;
@@ -12,6 +14,7 @@ DROP TABLE IF EXISTS settings CASCADE;
 -- Drop functions
 DROP FUNCTION IF EXISTS update_updated_at_column() CASCADE;
 DROP FUNCTION IF EXISTS set_completed_at() CASCADE;
+DROP FUNCTION IF EXISTS set_claimed_at() CASCADE;
 
 -- Note: Run this only if you want to completely reset the database
 -- After running this, you'll need to run the schema creation script again
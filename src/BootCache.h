@@ -0,0 +1,98 @@
+// Boot-time cache for the Smart Rice Dispenser controllers
+// BootCache.h - One small record in RTC memory, mirrored to a LittleFS file
+//
+// Things that are slow to find out again at every boot (the access point's
+// channel and BSSID, the DHCP lease, the scale's tare offset) are saved here
+// once known. RTC user memory survives a reset or a watchdog reboot but not a
+// power cut, so the record is also kept in a file: load() tries RTC memory
+// first and falls back to flash. Both copies carry a magic number and a
+// CRC-32, so an old record layout or a half-written file reads as "no
+// cache". save() rewrites the file only when the value changed.
+//
+// T must be a plain struct; zero it before filling it in so padding bytes
+// do not make an unchanged value look different. The first 128 bytes of RTC
+// user memory are used by OTA updates, so use blocks 32 and up.
+
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "Crc32.h"
+
+template <typename T>
+class BootCache {
+public:
+  enum Source { FROM_NONE, FROM_RTC, FROM_FLASH };
+
+  // `rtcBlock` is the offset into RTC user memory in 4-byte blocks
+  BootCache(uint32_t recordMagic, uint8_t rtcBlock, const char* filePath)
+      : magic(recordMagic), block(rtcBlock), path(filePath) {}
+
+  // LittleFS.begin() must have been called for the flash copy
+  bool load(T& value) {
+    Record record;
+    if (ESP.rtcUserMemoryRead(block, (uint32_t*)&record, sizeof(record)) && isValid(record)) {
+      source = FROM_RTC;
+    } else if (readFile(record) && isValid(record)) {
+      source = FROM_FLASH;
+      ESP.rtcUserMemoryWrite(block, (uint32_t*)&record, sizeof(record));
+    } else {
+      source = FROM_NONE;
+      return false;
+    }
+    stored = record;
+    hasStored = true;
+    memcpy(&value, &record.value, sizeof(T));
+    return true;
+  }
+
+  void save(const T& value) {
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.magic = magic;
+    memcpy(&record.value, &value, sizeof(T));
+    record.check = Crc32::compute(&record, CHECKED_BYTES);
+    if (hasStored && memcmp(&record, &stored, sizeof(record)) == 0) return;
+
+    ESP.rtcUserMemoryWrite(block, (uint32_t*)&record, sizeof(record));
+    File file = LittleFS.open(path, "w");
+    if (file) {
+      file.write((const uint8_t*)&record, sizeof(record));
+      file.close();
+    }
+    stored = record;
+    hasStored = true;
+  }
+
+  // Where the last load() found the value
+  Source loadedFrom() const { return source; }
+
+private:
+  struct Record {
+    uint32_t magic;
+    T value;
+    uint32_t check;  // CRC-32 of everything before it
+  };
+  static const size_t CHECKED_BYTES = offsetof(Record, check);
+  static_assert(sizeof(Record) % 4 == 0, "RTC memory is written in 4-byte blocks");
+
+  bool isValid(const Record& record) const {
+    return record.magic == magic && record.check == Crc32::compute(&record, CHECKED_BYTES);
+  }
+
+  bool readFile(Record& record) {
+    File file = LittleFS.open(path, "r");
+    if (!file) return false;
+    bool complete = file.read((uint8_t*)&record, sizeof(record)) == sizeof(record);
+    file.close();
+    return complete;
+  }
+
+  uint32_t magic;
+  uint8_t block;
+  const char* path;
+
+  Record stored;
+  bool hasStored = false;
+  Source source = FROM_NONE;
+};
@@ -0,0 +1,197 @@
+// Interrupt-driven push buttons for the Smart Rice Dispenser controllers
+// ButtonEvents.h - Timestamped, debounced press/hold/repeat events
+//
+// A CHANGE interrupt on each button pin pushes the new level and the time
+// of the edge into a lock-free ring buffer. update() runs in loop() and
+// turns those edges into events. A press counts once the pin has stayed
+// low for DEBOUNCE_US, so a spike of interference never starts anything;
+// the event still carries the time of the edge. A release counts at its
+// first edge. Edges during the next DEBOUNCE_US are contact bounce and are
+// dropped, unless the level has ended up different. A button held for LONG_PRESS_US
+// reports LONG_PRESS, then REPEAT every REPEAT_US until it is released.
+//
+// Every event carries the time the edge happened, not the time update()
+// saw it. A press and release made while loop() was blocked in HTTP or in
+// a delay() therefore still come out, in order, with their real timing.
+// Pins that cannot interrupt (GPIO16 on the ESP8266) are sampled in
+// update() instead. Buttons are active low with the internal pull-up.
+
+#pragma once
+
+#include <Arduino.h>
+#include "SpscRingBuffer.h"
+
+struct ButtonEvent {
+  enum Type : uint8_t { PRESS, RELEASE, LONG_PRESS, REPEAT };
+  uint8_t button;  // index returned by ButtonEvents::add()
+  Type type;
+  uint32_t micros;
+};
+
+class ButtonEvents {
+public:
+  static const uint8_t MAX_BUTTONS = 4;
+  static const uint8_t INVALID_BUTTON = 0xFF;
+  static const uint32_t DEBOUNCE_US = 10000;
+  static const uint32_t LONG_PRESS_US = 600000;
+  static const uint32_t REPEAT_US = 150000;
+
+  struct Stats {
+    uint32_t presses;
+    uint32_t longPresses;
+    uint32_t repeats;
+    uint32_t edges;         // raw edges seen, bounce included
+    uint32_t droppedEdges;  // edge buffer full; the level is re-read instead
+    uint32_t droppedEvents; // events not read before the buffer filled
+  };
+
+  // Returns the button index, or INVALID_BUTTON when the table is full
+  uint8_t add(uint8_t pin) {
+    if (count >= MAX_BUTTONS) return INVALID_BUTTON;
+    Button& b = buttons[count];
+    b.pin = pin;
+    pinMode(pin, INPUT_PULLUP);
+    b.edgeLevel = digitalRead(pin);
+    b.raw = b.stable = b.edgeLevel == LOW;
+    b.changedAt = b.rawAt = (uint32_t)micros() - DEBOUNCE_US;
+    b.interrupt = digitalPinToInterrupt(pin) != NOT_AN_INTERRUPT;
+    instance = this;
+    count++;
+    if (b.interrupt) attachInterrupt(digitalPinToInterrupt(pin), onEdge, CHANGE);
+    return count - 1;
+  }
+
+  // Turns the edges captured since the last call into events
+  void update() {
+    Edge edge;
+    while (edges.pop(edge)) {
+      stats.edges++;
+      applyEdge(edge.button, edge.pressed, edge.micros);
+    }
+    uint32_t now = (uint32_t)micros();
+    for (uint8_t i = 0; i < count; i++) {
+      // Polled pins, and interrupt pins whose edge was dropped
+      bool pressed = digitalRead(buttons[i].pin) == LOW;
+      if (pressed != buttons[i].raw) applyEdge(i, pressed, now);
+      settle(i, now);
+    }
+  }
+
+  bool read(ButtonEvent& event) { return events.pop(event); }
+
+  bool isPressed(uint8_t button) const { return button < count && buttons[button].stable; }
+
+  Stats statistics() const {
+    Stats s = stats;
+    s.droppedEdges = droppedEdges;
+    return s;
+  }
+
+  void printStats(Print& out) const {
+    out.printf("buttons: %lu presses, %lu long, %lu repeats, %lu edges, %lu edges/%lu events dropped\n",
+               (unsigned long)stats.presses, (unsigned long)stats.longPresses, (unsigned long)stats.repeats,
+               (unsigned long)stats.edges, (unsigned long)droppedEdges, (unsigned long)stats.droppedEvents);
+  }
+
+private:
+  struct Edge {
+    uint8_t button;
+    bool pressed;
+    uint32_t micros;
+  };
+
+  struct Button {
+    uint8_t pin;
+    bool interrupt;
+    volatile uint8_t edgeLevel;  // last level the handler saw
+    bool raw;                    // last level update() saw
+    uint32_t rawAt;
+    bool stable;                 // debounced
+    uint32_t changedAt;
+    uint32_t pressedAt;
+    bool longSent;
+    uint32_t nextRepeatAt;
+  };
+
+  static void IRAM_ATTR onEdge() {
+    ButtonEvents* self = instance;
+    if (!self) return;
+    uint32_t now = micros();
+    for (uint8_t i = 0; i < self->count; i++) {
+      Button& b = self->buttons[i];
+      if (!b.interrupt) continue;
+      uint8_t level = digitalRead(b.pin);
+      if (level == b.edgeLevel) continue;
+      b.edgeLevel = level;
+      Edge edge = {i, level == LOW, now};
+      if (!self->edges.push(edge)) self->droppedEdges++;
+    }
+  }
+
+  void applyEdge(uint8_t i, bool pressed, uint32_t at) {
+    settle(i, at);
+    Button& b = buttons[i];
+    if (pressed == b.raw) return;
+    b.raw = pressed;
+    b.rawAt = at;
+    // Leading edge: a release after a quiet DEBOUNCE_US counts right away
+    if (!pressed && b.stable && at - b.changedAt >= DEBOUNCE_US) commit(i, at);
+  }
+
+  // Brings button i up to time `now`: a change left over from the bounce
+  // window or a press that has now been held for DEBOUNCE_US, then hold events
+  void settle(uint8_t i, uint32_t now) {
+    Button& b = buttons[i];
+    if (b.raw != b.stable) {
+      uint32_t at = b.changedAt + DEBOUNCE_US;
+      if ((int32_t)(b.rawAt - at) > 0) at = b.rawAt;
+      uint32_t due = at;
+      if (b.raw && (int32_t)(b.rawAt + DEBOUNCE_US - due) > 0) due = b.rawAt + DEBOUNCE_US;
+      if ((int32_t)(now - due) >= 0) commit(i, at);
+    }
+    if (b.stable) emitHolds(i, now);
+  }
+
+  void commit(uint8_t i, uint32_t at) {
+    Button& b = buttons[i];
+    if (b.stable) emitHolds(i, at);
+    b.stable = b.raw;
+    b.changedAt = at;
+    if (b.stable) {
+      b.pressedAt = at;
+      b.longSent = false;
+      stats.presses++;
+    }
+    emit(i, b.stable ? ButtonEvent::PRESS : ButtonEvent::RELEASE, at);
+  }
+
+  void emitHolds(uint8_t i, uint32_t until) {
+    Button& b = buttons[i];
+    if (!b.longSent) {
+      if (until - b.pressedAt < LONG_PRESS_US) return;
+      b.longSent = true;
+      b.nextRepeatAt = b.pressedAt + LONG_PRESS_US + REPEAT_US;
+      stats.longPresses++;
+      emit(i, ButtonEvent::LONG_PRESS, b.pressedAt + LONG_PRESS_US);
+    }
+    while ((int32_t)(until - b.nextRepeatAt) >= 0) {
+      stats.repeats++;
+      emit(i, ButtonEvent::REPEAT, b.nextRepeatAt);
+      b.nextRepeatAt += REPEAT_US;
+    }
+  }
+
+  void emit(uint8_t i, ButtonEvent::Type type, uint32_t at) {
+    ButtonEvent event = {i, type, at};
+    if (!events.push(event)) stats.droppedEvents++;
+  }
+
+  static inline ButtonEvents* instance = nullptr;
+
+  Button buttons[MAX_BUTTONS];
+  uint8_t count = 0;
+  SpscRingBuffer<Edge, 64> edges;        // handler -> update()
+  SpscRingBuffer<ButtonEvent, 32> events; // update() -> the UI
+  volatile uint32_t droppedEdges = 0;
+  Stats stats = {};
+};
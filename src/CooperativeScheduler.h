@@ -0,0 +1,169 @@
+// Cooperative deadline scheduler for the Smart Rice Dispenser controllers
+// CooperativeScheduler.h - Periodic tasks with per-task deadlines
+//
+// Each task has a period and a deadline (ms after its release). loop() runs
+// every due task, earliest deadline first, then sleeps exactly until the next
+// release instead of a fixed delay(). Per-task start jitter, execution time
+// and deadline overruns are recorded so timing problems show up in the logs.
+
+#pragma once
+
+#include <Arduino.h>
+
+class CooperativeScheduler {
+public:
+  static const uint8_t MAX_TASKS = 12;  // at most 16: runDueTasks() marks the tasks it ran in a uint16_t
+  static const uint8_t INVALID_TASK = 0xFF;
+
+  struct TaskStats {
+    uint32_t runs;
+    uint32_t overruns;      // finished later than release + deadline
+    uint32_t skipped;       // releases dropped because the task fell a full period behind
+    uint32_t maxJitterUs;   // start time - release time
+    uint32_t totalJitterUs;
+    uint32_t maxRunUs;
+  };
+
+  // Returns the task id, or INVALID_TASK when the table is full
+  uint8_t addTask(const char* name, void (*run)(), unsigned long periodMs, unsigned long deadlineMs, bool enabled = true) {
+    if (taskCount >= MAX_TASKS) return INVALID_TASK;
+    Task& task = tasks[taskCount];
+    task.name = name;
+    task.run = run;
+    task.periodUs = periodMs * 1000UL;
+    task.deadlineUs = deadlineMs * 1000UL;
+    task.enabled = enabled;
+    task.nextReleaseUs = (uint32_t)micros();
+    task.stats = TaskStats();
+    return taskCount++;
+  }
+
+  void setPeriod(uint8_t id, unsigned long periodMs) {
+    if (id < taskCount) tasks[id].periodUs = periodMs * 1000UL;
+  }
+
+  // Period and relative deadline together, for a task that changes rate and
+  // has to keep its place in the EDF order
+  void setPeriod(uint8_t id, unsigned long periodMs, unsigned long deadlineMs) {
+    if (id >= taskCount) return;
+    tasks[id].periodUs = periodMs * 1000UL;
+    tasks[id].deadlineUs = deadlineMs * 1000UL;
+  }
+
+  void setEnabled(uint8_t id, bool enabled) {
+    if (id >= taskCount || tasks[id].enabled == enabled) return;
+    tasks[id].enabled = enabled;
+    if (enabled) tasks[id].nextReleaseUs = (uint32_t)micros();
+  }
+
+  // Release a task now instead of at its next period boundary
+  void trigger(uint8_t id) {
+    if (id < taskCount) tasks[id].nextReleaseUs = (uint32_t)micros();
+  }
+
+  // Move a task's next release to `delayMs` from now; the period grid
+  // continues from there
+  void triggerIn(uint8_t id, unsigned long delayMs) {
+    if (id < taskCount) tasks[id].nextReleaseUs = (uint32_t)micros() + delayMs * 1000UL;
+  }
+
+  // Run every task that is due, earliest absolute deadline first. Each task
+  // runs at most once per call so loop() still returns to the core regularly.
+  void runDueTasks() {
+    uint16_t ran = 0;
+    for (;;) {
+      uint32_t now = (uint32_t)micros();
+      uint8_t next = INVALID_TASK;
+      uint32_t nextDeadline = 0;
+      for (uint8_t i = 0; i < taskCount; i++) {
+        Task& task = tasks[i];
+        if (!task.enabled || (ran & (1 << i)) || (int32_t)(now - task.nextReleaseUs) < 0) continue;
+        uint32_t deadline = task.nextReleaseUs + task.deadlineUs;
+        if (next == INVALID_TASK || (int32_t)(deadline - nextDeadline) < 0) {
+          next = i;
+          nextDeadline = deadline;
+        }
+      }
+      if (next == INVALID_TASK) return;
+      ran |= 1 << next;
+      runTask(tasks[next], now);
+    }
+  }
+
+  // Microseconds until the next enabled task is released (0 if one is due)
+  uint32_t microsUntilNextTask() const {
+    uint32_t now = (uint32_t)micros();
+    uint32_t wait = MAX_SLEEP_US;
+    for (uint8_t i = 0; i < taskCount; i++) {
+      if (!tasks[i].enabled) continue;
+      int32_t remaining = (int32_t)(tasks[i].nextReleaseUs - now);
+      if (remaining <= 0) return 0;
+      if ((uint32_t)remaining < wait) wait = (uint32_t)remaining;
+    }
+    return wait;
+  }
+
+  // delay() yields to the WiFi stack; the sub-millisecond rest is spun
+  void sleepUntilNextTask() {
+    uint32_t wait = microsUntilNextTask();
+    if (wait >= 1000) delay(wait / 1000);
+    if (wait % 1000) delayMicroseconds(wait % 1000);
+  }
+
+  uint8_t size() const { return taskCount; }
+  const char* taskName(uint8_t id) const { return id < taskCount ? tasks[id].name : ""; }
+  const TaskStats& stats(uint8_t id) const { return tasks[id].stats; }
+
+  void resetStats() {
+    for (uint8_t i = 0; i < taskCount; i++) tasks[i].stats = TaskStats();
+  }
+
+  void printStats(Print& out) const {
+    out.println(F("task        runs  overruns  skipped  jitter avg/max us  run max us"));
+    for (uint8_t i = 0; i < taskCount; i++) {
+      const TaskStats& s = tasks[i].stats;
+      out.printf("%-10s %5lu  %8lu  %7lu  %8lu/%-8lu  %10lu\n", tasks[i].name, (unsigned long)s.runs,
+                 (unsigned long)s.overruns, (unsigned long)s.skipped,
+                 (unsigned long)(s.runs ? s.totalJitterUs / s.runs : 0), (unsigned long)s.maxJitterUs,
+                 (unsigned long)s.maxRunUs);
+    }
+  }
+
+private:
+  static const uint32_t MAX_SLEEP_US = 100000;  // bound the sleep if nothing is enabled
+
+  struct Task {
+    const char* name;
+    void (*run)();
+    uint32_t periodUs;
+    uint32_t deadlineUs;
+    uint32_t nextReleaseUs;
+    bool enabled;
+    TaskStats stats;
+  };
+
+  void runTask(Task& task, uint32_t now) {
+    uint32_t release = task.nextReleaseUs;
+    uint32_t jitter = now - release;
+
+    // Keep releases on the period grid; drop any that were missed entirely
+    task.nextReleaseUs = release + task.periodUs;
+    while (task.periodUs && (int32_t)(now - task.nextReleaseUs) >= 0) {
+      task.nextReleaseUs += task.periodUs;
+      task.stats.skipped++;
+    }
+
+    task.run();
+
+    uint32_t finished = (uint32_t)micros();
+    TaskStats& s = task.stats;
+    s.runs++;
+    s.totalJitterUs += jitter;
+    if (jitter > s.maxJitterUs) s.maxJitterUs = jitter;
+    if (finished - now > s.maxRunUs) s.maxRunUs = finished - now;
+    if (finished - release > task.deadlineUs) s.overruns++;
+  }
+
+  Task tasks[MAX_TASKS];
+  uint8_t taskCount = 0;
+};
@@ -0,0 +1,26 @@
+// Checksums for the Smart Rice Dispenser controllers
+// Crc32.h - CRC-32 (IEEE 802.3) for records kept in flash and RTC memory
+//
+// Computed a nibble at a time from a 16-entry table: 64 bytes of flash
+// instead of 1 KB for the byte-wise table, at about twice the work per byte,
+// which does not matter for the few dozen bytes checked per record.
+
+#pragma once
+
+#include <Arduino.h>
+
+class Crc32 {
+public:
+  static uint32_t compute(const void* data, size_t length) {
+    static const uint32_t TABLE[16] = {0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+                                       0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                       0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+      crc = TABLE[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+      crc = TABLE[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+  }
+};
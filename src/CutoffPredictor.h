@@ -0,0 +1,156 @@
+// Dispense cutoff prediction for the Smart Rice Dispenser
+// CutoffPredictor.h - Closes the gate early by the rice still to come
+//
+// Once the gate is told to close, rice keeps arriving for a while: the
+// servo needs time to swing shut, grains already past the gate are still
+// falling, and the filtered weight lags the load cell. All of it scales with
+// the flow rate, so the model is a single lag time: in-flight mass =
+// flow rate * lag. The flow rate is measured live during each dispense; the
+// lag is learned from the overshoot seen after every dispense settles and
+// is kept in EEPROM so the dispenser does not re-learn it after a reboot.
+// The cutoff time is interpolated between weight samples, so the control
+// period does not quantize the dispensed amount.
+
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+class CutoffPredictor {
+public:
+  static const uint16_t EEPROM_BYTES = 24;
+
+  struct Model {
+    float lagSeconds;          // rice keeps arriving this long after the close decision
+    float flowGramsPerSecond;  // flow measured at the last cutoff; prior for the next dispense
+    uint16_t dispenses;        // dispenses folded into the model
+  };
+
+  // Load the model from EEPROM at `address` (EEPROM.begin() must cover it)
+  void begin(int address) {
+    eepromAddress = address;
+    Record record;
+    EEPROM.get(eepromAddress, record);
+    if (record.magic == MAGIC && record.checksum == checksum(record.model)) {
+      model = record.model;
+    } else {
+      model.lagSeconds = DEFAULT_LAG_SECONDS;
+      model.flowGramsPerSecond = 0;
+      model.dispenses = 0;
+    }
+    savedLagSeconds = model.lagSeconds;
+  }
+
+  void startDispense() {
+    flowGramsPerSecond = model.flowGramsPerSecond;
+    hasLastSample = false;
+    holdFlowUntilMs = 0;
+  }
+
+  // The gate angle changed: start from the expected new flow and ignore the
+  // measured slope until the servo and the weight filter have caught up
+  void restartFlow(float expectedGramsPerSecond, unsigned long nowMs) {
+    flowGramsPerSecond = expectedGramsPerSecond;
+    holdFlowUntilMs = nowMs + FLOW_HOLD_MS;
+  }
+
+  // Feed the dispensed weight every control period while the gate is open
+  void observe(float dispensedGrams, unsigned long nowMs) {
+    bool holding = holdFlowUntilMs && (long)(nowMs - holdFlowUntilMs) < 0;
+    if (hasLastSample && nowMs != lastSampleMs && !holding) {
+      float rate = (dispensedGrams - lastDispensedGrams) * 1000.0f / (nowMs - lastSampleMs);
+      flowGramsPerSecond += (rate - flowGramsPerSecond) * FLOW_SMOOTHING;
+      if (flowGramsPerSecond < 0) flowGramsPerSecond = 0;
+    }
+    lastDispensedGrams = dispensedGrams;
+    lastSampleMs = nowMs;
+    hasLastSample = true;
+  }
+
+  float inFlightGrams() const { return flowGramsPerSecond * model.lagSeconds; }
+
+  // Time from the last observe() until the gate should start closing
+  unsigned long millisUntilCutoff(float targetGrams) const {
+    float remaining = targetGrams - inFlightGrams() - lastDispensedGrams;
+    if (remaining <= 0) return 0;
+    if (flowGramsPerSecond < MIN_LEARNING_FLOW) return ULONG_MAX;
+    return (unsigned long)(remaining * 1000.0f / flowGramsPerSecond);
+  }
+
+  // The dispensed weight at close is extrapolated from the last sample
+  void gateClosed(unsigned long nowMs) {
+    dispensedAtClose = lastDispensedGrams + flowGramsPerSecond * (nowMs - lastSampleMs) / 1000.0f;
+    flowAtClose = flowGramsPerSecond;
+  }
+
+  // Call once the weight has settled after gateClosed(); learns and saves
+  void settled(float dispensedGrams) {
+    if (flowAtClose < MIN_LEARNING_FLOW) return;  // too little flow to tell lag from noise
+    float lag = (dispensedGrams - dispensedAtClose) / flowAtClose;
+    lag = constrain(lag, 0.0f, MAX_LAG_SECONDS);
+    if (model.dispenses == 0) model.lagSeconds = lag;
+    else model.lagSeconds += (lag - model.lagSeconds) * LAG_LEARNING_RATE;
+    model.flowGramsPerSecond = flowAtClose;
+    if (model.dispenses < 0xFFFF) model.dispenses++;
+    // Spare the flash sector: only rewrite once the model has really moved
+    if (fabsf(model.lagSeconds - savedLagSeconds) >= SAVE_THRESHOLD_SECONDS || model.dispenses == 1) save();
+  }
+
+  const Model& learned() const { return model; }
+  float flowRate() const { return flowGramsPerSecond; }
+
+private:
+  static const uint32_t MAGIC = 0x31545543;  // "CUT1"
+  static constexpr float DEFAULT_LAG_SECONDS = 0.3f;
+  static constexpr float MAX_LAG_SECONDS = 2.0f;
+  static constexpr float MIN_LEARNING_FLOW = 1.0f;  // g/s
+  static constexpr float FLOW_SMOOTHING = 0.3f;
+  static constexpr float LAG_LEARNING_RATE = 0.25f;
+  static constexpr float SAVE_THRESHOLD_SECONDS = 0.01f;
+  static const unsigned long FLOW_HOLD_MS = 300;
+
+  struct Record {
+    uint32_t magic;
+    Model model;
+    uint8_t checksum;
+  };
+  static_assert(sizeof(Record) <= EEPROM_BYTES, "cutoff model record outgrew its EEPROM slot");
+
+  // Field by field, so struct padding never takes part
+  static uint8_t checksum(const Model& m) {
+    uint8_t sum = 0xA5;
+    sum = mix(sum, &m.lagSeconds, sizeof(m.lagSeconds));
+    sum = mix(sum, &m.flowGramsPerSecond, sizeof(m.flowGramsPerSecond));
+    return mix(sum, &m.dispenses, sizeof(m.dispenses));
+  }
+
+  static uint8_t mix(uint8_t sum, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; i++) sum = (uint8_t)((sum << 1 | sum >> 7) ^ bytes[i]);
+    return sum;
+  }
+
+  void save() {
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.magic = MAGIC;
+    record.model = model;
+    record.checksum = checksum(model);
+    EEPROM.put(eepromAddress, record);
+    EEPROM.commit();
+    savedLagSeconds = model.lagSeconds;
+  }
+
+  Model model = {DEFAULT_LAG_SECONDS, 0, 0};
+  int eepromAddress = 0;
+  float savedLagSeconds = DEFAULT_LAG_SECONDS;
+
+  float flowGramsPerSecond = 0;
+  float lastDispensedGrams = 0;
+  unsigned long lastSampleMs = 0;
+  bool hasLastSample = false;
+  unsigned long holdFlowUntilMs = 0;
+
+  float dispensedAtClose = 0;
+  float flowAtClose = 0;
+};
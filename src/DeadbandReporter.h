@@ -0,0 +1,71 @@
+// Report-by-exception for the Smart Rice Dispenser telemetry
+// DeadbandReporter.h - Deadband plus heartbeat decision for one signal
+//
+// A reading is worth a row only when it moved more than `deadband` away
+// from the last value that was reported, or when nothing has been reported
+// for `heartbeatMs` (so the server can tell a quiet device from a dead one).
+// Comparing against the last reported value rather than the last reading
+// means a slow drift is still reported once it adds up. A failed reading
+// (NaN) going in or out counts as a change; it is never kept as the value
+// to compare with, since nothing compares as having moved away from NaN.
+// Signals that share a row are checked with due() one by one and then all
+// marked with reported().
+
+#pragma once
+
+#include <Arduino.h>
+
+class DeadbandReporter {
+public:
+  DeadbandReporter(float signalDeadband, unsigned long heartbeatIntervalMs)
+      : deadband(signalDeadband), heartbeatMs(heartbeatIntervalMs) {}
+
+  bool due(float value, unsigned long nowMs) const {
+    return !hasReported || changed(value) || nowMs - reportedAt >= heartbeatMs;
+  }
+
+  void reported(float value, unsigned long nowMs) {
+    if (!hasReported || changed(value)) {
+      changes++;
+    } else {
+      repeats++;
+    }
+    reportedMissing = isnan(value);
+    if (!reportedMissing) lastReported = value;
+    reportedAt = nowMs;
+    hasReported = true;
+  }
+
+  // Report the next reading whatever it is (e.g. a dispense just ended)
+  void expire() { hasReported = false; }
+
+  // Readings checked without a report; call once per reading
+  void skipped() { suppressed++; }
+
+  uint32_t reportedCount() const { return changes + repeats; }
+
+  void printStats(Print& out, const char* name) const {
+    uint32_t total = changes + repeats + suppressed;
+    out.printf("%s reports: %lu changed, %lu unchanged, %lu suppressed (%u%%)\n", name, (unsigned long)changes,
+               (unsigned long)repeats, (unsigned long)suppressed,
+               total ? (unsigned)(100ULL * suppressed / total) : 0);
+  }
+
+private:
+  bool changed(float value) const {
+    if (isnan(value) != reportedMissing) return true;
+    return !reportedMissing && fabsf(value - lastReported) > deadband;
+  }
+
+  float deadband;
+  unsigned long heartbeatMs;
+
+  float lastReported = 0;      // last valid value reported
+  bool reportedMissing = false;  // the last report had no reading
+  unsigned long reportedAt = 0;
+  bool hasReported = false;
+
+  uint32_t changes = 0;
+  uint32_t repeats = 0;  // heartbeats, or sent along with another signal's change
+  uint32_t suppressed = 0;
+};
@@ -0,0 +1,355 @@
+// Local dispense commands for the Smart Rice Dispenser controllers
+// DispenseCommand.h - Idempotent UDP requests to the main controller
+//
+// A dispense request from the display (or the app) goes straight to the main
+// controller on the LAN as one 18-byte datagram, so the gate opens within a
+// few tens of milliseconds of the button press instead of after a round trip
+// through Supabase. Little endian at fixed offsets:
+//   0  magic 0xD7          1  type (1 = DISPENSE, 2 = RESULT)
+//   2  idempotency key (u32), chosen by the sender
+//   6  grams (u16)         8  status (RESULT only)   9  reserved, 0
+//  10  tag (u64): SipHash-2-4 of bytes 0-9 under the shared secret
+// Both ends drop a datagram whose tag does not match, so only a sender that
+// knows the secret can open the gate. A captured command could still be
+// replayed once its key has left the server's memory; the tag keeps out
+// strangers on the LAN, not someone recording its traffic.
+// The sender repeats a DISPENSE until a RESULT with the same key comes back.
+// The server remembers the result of its last few keys and answers a repeat
+// with that result instead of running the command again, so a lost RESULT
+// can never dispense twice. The same key names the command's dispense_request
+// row (requestId()), so the server's audit row and a sender that falls back
+// to inserting the request in Supabase land on one row.
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+// The 128-bit SipHash key, derived from the configured secret string
+struct DispenseSecret {
+  uint64_t k0;
+  uint64_t k1;
+
+  // Each half is the SipHash of the secret under a fixed key
+  void set(const char* secret) {
+    DispenseSecret fixed = {0, 0};
+    size_t length = strlen(secret);
+    k0 = fixed.tag((const uint8_t*)secret, length);
+    fixed.k0 = 1;
+    k1 = fixed.tag((const uint8_t*)secret, length);
+  }
+
+  // SipHash-2-4 of `data` under this key
+  uint64_t tag(const uint8_t* data, size_t length) const {
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    size_t whole = length & ~(size_t)7;
+    for (size_t i = 0; i <= whole; i += 8) {
+      uint64_t m = 0;
+      if (i < whole) {
+        for (uint8_t b = 0; b < 8; b++) m |= (uint64_t)data[i + b] << (8 * b);
+      } else {
+        m = (uint64_t)length << 56;
+        for (uint8_t b = 0; i + b < length; b++) m |= (uint64_t)data[i + b] << (8 * b);
+      }
+      v3 ^= m;
+      for (uint8_t r = 0; r < 2; r++) round(v0, v1, v2, v3);
+      v0 ^= m;
+    }
+    v2 ^= 0xff;
+    for (uint8_t r = 0; r < 4; r++) round(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+  }
+
+private:
+  static uint64_t rotl(uint64_t x, uint8_t bits) { return (x << bits) | (x >> (64 - bits)); }
+
+  static void round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1;
+    v1 = rotl(v1, 13);
+    v1 ^= v0;
+    v0 = rotl(v0, 32);
+    v2 += v3;
+    v3 = rotl(v3, 16);
+    v3 ^= v2;
+    v0 += v3;
+    v3 = rotl(v3, 21);
+    v3 ^= v0;
+    v2 += v1;
+    v1 = rotl(v1, 17);
+    v1 ^= v2;
+    v2 = rotl(v2, 32);
+  }
+};
+
+struct DispenseCommand {
+  static const uint8_t MAGIC = 0xD7;
+  static const uint8_t TYPE_DISPENSE = 1;
+  static const uint8_t TYPE_RESULT = 2;
+  static const size_t SIGNED_BYTES = 10;  // covered by the tag
+  static const size_t BYTES = 18;
+
+  static const uint8_t STATUS_ACCEPTED = 0;   // the gate is opening
+  static const uint8_t STATUS_BUSY = 1;       // another dispense is running
+  static const uint8_t STATUS_REJECTED = 2;   // amount out of range
+  static const uint8_t STATUS_NO_ANSWER = 255; // client side: gave up waiting
+
+  uint8_t type;
+  uint32_t key;
+  uint16_t grams;
+  uint8_t status;
+
+  size_t encode(uint8_t* out, const DispenseSecret& secret) const {
+    out[0] = MAGIC;
+    out[1] = type;
+    for (uint8_t i = 0; i < 4; i++) out[2 + i] = (uint8_t)(key >> (8 * i));
+    out[6] = (uint8_t)grams;
+    out[7] = (uint8_t)(grams >> 8);
+    out[8] = type == TYPE_RESULT ? status : 0;
+    out[9] = 0;
+    uint64_t tag = secret.tag(out, SIGNED_BYTES);
+    for (uint8_t i = 0; i < 8; i++) out[SIGNED_BYTES + i] = (uint8_t)(tag >> (8 * i));
+    return BYTES;
+  }
+
+  // Checks the layout only; authentic() checks the tag
+  bool decode(const uint8_t* in, size_t length) {
+    if (length != BYTES || in[0] != MAGIC || (in[1] != TYPE_DISPENSE && in[1] != TYPE_RESULT)) return false;
+    type = in[1];
+    key = 0;
+    for (uint8_t i = 0; i < 4; i++) key |= (uint32_t)in[2 + i] << (8 * i);
+    grams = (uint16_t)(in[6] | in[7] << 8);
+    status = type == TYPE_RESULT ? in[8] : 0;
+    return true;
+  }
+
+  // dispense_request id for the command with `key`: the key in hex, then a
+  // fixed tail that keeps it a valid version 4 UUID
+  static void requestId(uint32_t key, char* out, size_t size) {
+    snprintf(out, size, "%08lx-0000-4000-8000-000000000000", (unsigned long)key);
+  }
+
+  // False for an id that requestId() did not make
+  static bool keyFromRequestId(const char* id, uint32_t& key) {
+    if (strlen(id) != 36 || strcmp(id + 8, "-0000-4000-8000-000000000000") != 0) return false;
+    char* end;
+    key = (uint32_t)strtoul(id, &end, 16);
+    return end == id + 8;
+  }
+
+  // Compares every tag byte, so the time taken does not tell how many matched
+  static bool authentic(const uint8_t* in, const DispenseSecret& secret) {
+    uint64_t tag = secret.tag(in, SIGNED_BYTES);
+    uint8_t difference = 0;
+    for (uint8_t i = 0; i < 8; i++) difference |= in[SIGNED_BYTES + i] ^ (uint8_t)(tag >> (8 * i));
+    return difference == 0;
+  }
+};
+
+class DispenseCommandServer {
+public:
+  static const uint8_t REMEMBERED_KEYS = 16;
+
+  struct Stats {
+    uint32_t commands;    // executed
+    uint32_t repeats;     // answered from the remembered result
+    uint32_t malformed;
+    uint32_t forged;      // tag did not match the shared secret
+  };
+
+  explicit DispenseCommandServer(uint16_t localPort) : port(localPort) {}
+
+  void begin(const char* sharedSecret) {
+    secret.set(sharedSecret);
+    udp.begin(port);
+  }
+
+  // Answers every queued DISPENSE. A new key runs execute(command), which
+  // returns the status to send back; a remembered key gets its old status.
+  template <typename Execute>
+  uint8_t poll(Execute execute) {
+    uint8_t buffer[DispenseCommand::BYTES + 1];  // one spare byte shows an oversized datagram
+    uint8_t count = 0;
+    int size;
+    while ((size = udp.parsePacket()) > 0) {
+      int length = udp.read(buffer, sizeof(buffer));
+      DispenseCommand command;
+      if (length != size || !command.decode(buffer, length) || command.type != DispenseCommand::TYPE_DISPENSE) {
+        stats.malformed++;
+        continue;
+      }
+      if (!DispenseCommand::authentic(buffer, secret)) {
+        stats.forged++;
+        continue;
+      }
+      DispenseCommand result = command;
+      result.type = DispenseCommand::TYPE_RESULT;
+      if (!recall(command.key, result.status)) {
+        result.status = execute(command);
+        remember(command.key, result.status);
+        stats.commands++;
+        count++;
+      } else {
+        stats.repeats++;
+      }
+      // Straight back to the sender; if this is lost, its repeat gets the same answer
+      size_t resultLength = result.encode(buffer, secret);
+      if (udp.beginPacket(udp.remoteIP(), udp.remotePort())) {
+        udp.write(buffer, resultLength);
+        udp.endPacket();
+      }
+    }
+    return count;
+  }
+
+  // True if the command with `key` came in recently, whatever its result
+  bool remembers(uint32_t key) const {
+    uint8_t status;
+    return recall(key, status);
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("dispense commands: %lu run, %lu repeats answered, %lu malformed, %lu forged\n",
+               (unsigned long)stats.commands, (unsigned long)stats.repeats, (unsigned long)stats.malformed,
+               (unsigned long)stats.forged);
+  }
+
+private:
+  bool recall(uint32_t key, uint8_t& status) const {
+    for (uint8_t i = 0; i < remembered; i++) {
+      if (keys[i] == key) {
+        status = statuses[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void remember(uint32_t key, uint8_t status) {
+    keys[next] = key;
+    statuses[next] = status;
+    next = (next + 1) % REMEMBERED_KEYS;
+    if (remembered < REMEMBERED_KEYS) remembered++;
+  }
+
+  WiFiUDP udp;
+  uint16_t port;
+  DispenseSecret secret = {};
+  uint32_t keys[REMEMBERED_KEYS];
+  uint8_t statuses[REMEMBERED_KEYS];
+  uint8_t next = 0;
+  uint8_t remembered = 0;
+  Stats stats = {};
+};
+
+class DispenseCommandClient {
+public:
+  struct Stats {
+    uint32_t commands;
+    uint32_t retransmits;
+    uint32_t answered;
+    uint32_t unanswered;  // every attempt went without a RESULT
+  };
+
+  typedef void (*ResultCallback)(const DispenseCommand& result);
+
+  DispenseCommandClient(uint16_t localPort, unsigned long retransmitIntervalMs, uint8_t attemptLimit)
+      : port(localPort), retransmitMs(retransmitIntervalMs), maxAttempts(attemptLimit) {}
+
+  void begin(const char* sharedSecret) {
+    secret.set(sharedSecret);
+    nextKey = ((uint32_t)random(0x10000) << 16) ^ (uint32_t)random(0x10000) ^ micros();
+    udp.begin(port);
+  }
+
+  // Called once per command with the server's RESULT, or with
+  // STATUS_NO_ANSWER when the attempts ran out
+  void onResult(ResultCallback callback) { resultCallback = callback; }
+
+  // Sends a new command; false while the previous one is still unanswered
+  bool send(IPAddress serverAddress, uint16_t serverPort, uint16_t grams) {
+    if (waiting) return false;
+    server = serverAddress;
+    remotePort = serverPort;
+    command.type = DispenseCommand::TYPE_DISPENSE;
+    command.key = nextKey++;
+    command.grams = grams;
+    command.status = 0;
+    attempts = 0;
+    waiting = true;
+    stats.commands++;
+    transmit(millis());
+    return true;
+  }
+
+  // Reads the RESULT and repeats the command every `retransmitMs` until it comes
+  void poll() {
+    uint8_t buffer[DispenseCommand::BYTES + 1];
+    int size;
+    while ((size = udp.parsePacket()) > 0) {
+      int length = udp.read(buffer, sizeof(buffer));
+      DispenseCommand result;
+      if (length != size || !result.decode(buffer, length) || result.type != DispenseCommand::TYPE_RESULT) continue;
+      if (!DispenseCommand::authentic(buffer, secret)) continue;
+      if (!waiting || result.key != command.key) continue;  // the answer to a repeat we no longer need
+      waiting = false;
+      stats.answered++;
+      if (resultCallback) resultCallback(result);
+    }
+
+    if (!waiting) return;
+    unsigned long now = millis();
+    if (now - sentAt < retransmitMs) return;
+    if (attempts >= maxAttempts) {
+      waiting = false;
+      stats.unanswered++;
+      DispenseCommand result = command;
+      result.type = DispenseCommand::TYPE_RESULT;
+      result.status = DispenseCommand::STATUS_NO_ANSWER;
+      if (resultCallback) resultCallback(result);
+      return;
+    }
+    stats.retransmits++;
+    transmit(now);
+  }
+
+  bool busy() const { return waiting; }
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("dispense commands: %lu sent, %lu retransmits, %lu answered, %lu unanswered\n",
+               (unsigned long)stats.commands, (unsigned long)stats.retransmits, (unsigned long)stats.answered,
+               (unsigned long)stats.unanswered);
+  }
+
+private:
+  void transmit(unsigned long now) {
+    // A failed send counts as an attempt too, so a dead link ends in NO_ANSWER
+    attempts++;
+    sentAt = now;
+    uint8_t buffer[DispenseCommand::BYTES];
+    size_t length = command.encode(buffer, secret);
+    if (!udp.beginPacket(server, remotePort)) return;
+    udp.write(buffer, length);
+    udp.endPacket();
+  }
+
+  WiFiUDP udp;
+  uint16_t port;
+  unsigned long retransmitMs;
+  uint8_t maxAttempts;
+  DispenseSecret secret = {};
+  IPAddress server;
+  uint16_t remotePort = 0;
+  uint32_t nextKey = 0;
+  DispenseCommand command = {};
+  bool waiting = false;
+  uint8_t attempts = 0;
+  unsigned long sentAt = 0;
+  ResultCallback resultCallback = nullptr;
+  Stats stats = {};
+};
@@ -0,0 +1,51 @@
+// Heap health tracking for the Smart Rice Dispenser controllers
+// HeapMonitor.h - Free heap, largest free block and fragmentation over time
+//
+// The ESP8266 leaves a sketch roughly 40 KB of heap once WiFi is up. Free
+// bytes alone hide the real failure mode: after enough short-lived Strings
+// the heap is chopped into pieces and the next JSON document or socket
+// buffer no longer fits in one block. sample() records the current numbers
+// and keeps the worst values seen, so the stats report shows whether the
+// heap is slowly degrading rather than just where it happens to be now.
+
+#pragma once
+
+#include <Arduino.h>
+
+class HeapMonitor {
+public:
+  struct Snapshot {
+    uint32_t freeBytes;
+    uint32_t maxFreeBlock;
+    uint8_t fragmentation;  // percent, 0 = one contiguous free block
+  };
+
+  void sample() {
+    current.freeBytes = ESP.getFreeHeap();
+    current.maxFreeBlock = ESP.getMaxFreeBlockSize();
+    current.fragmentation = ESP.getHeapFragmentation();
+    if (samples == 0) {
+      worst = current;
+    } else {
+      if (current.freeBytes < worst.freeBytes) worst.freeBytes = current.freeBytes;
+      if (current.maxFreeBlock < worst.maxFreeBlock) worst.maxFreeBlock = current.maxFreeBlock;
+      if (current.fragmentation > worst.fragmentation) worst.fragmentation = current.fragmentation;
+    }
+    samples++;
+  }
+
+  const Snapshot& latest() const { return current; }
+  const Snapshot& worstSeen() const { return worst; }
+
+  void printStats(Print& out) const {
+    out.printf("heap: %lu free (min %lu), max block %lu (min %lu), fragmentation %u%% (max %u%%)\n",
+               (unsigned long)current.freeBytes, (unsigned long)worst.freeBytes,
+               (unsigned long)current.maxFreeBlock, (unsigned long)worst.maxFreeBlock,
+               (unsigned)current.fragmentation, (unsigned)worst.fragmentation);
+  }
+
+private:
+  Snapshot current = {0, 0, 0};
+  Snapshot worst = {0, 0, 0};
+  uint32_t samples = 0;
+};
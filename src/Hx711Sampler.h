@@ -0,0 +1,87 @@
+// Interrupt-driven HX711 sampling for the Smart Rice Dispenser
+// Hx711Sampler.h - Captures every conversion into a ring buffer
+//
+// The HX711 pulls DOUT low when a conversion is ready. A FALLING-edge
+// interrupt on DOUT shifts the 24-bit result out right away and pushes it,
+// with a timestamp, into a lock-free ring buffer. loop() drains the buffer
+// without ever waiting on the chip, and no conversion is lost as long as it
+// is drained at least once per SAMPLE_BUFFER_SIZE conversions.
+//
+// Use the HX711 library for blocking calls such as tare() before begin();
+// after begin() this class owns the DOUT/SCK pins.
+
+#pragma once
+
+#include <Arduino.h>
+#include "SpscRingBuffer.h"
+
+struct Hx711Sample {
+  int32_t raw;      // signed 24-bit reading
+  uint32_t micros;  // capture time
+};
+
+class Hx711Sampler {
+public:
+  static const uint16_t SAMPLE_BUFFER_SIZE = 32;  // 3.2 s at 10 SPS
+
+  void begin(uint8_t dataPin, uint8_t clockPin) {
+    doutPin = dataPin;
+    sckPin = clockPin;
+    pinMode(sckPin, OUTPUT);
+    digitalWrite(sckPin, LOW);
+    pinMode(doutPin, INPUT);
+    instance = this;
+    attachInterrupt(digitalPinToInterrupt(doutPin), onDataReady, FALLING);
+    // A conversion may already be waiting with DOUT low; no edge will come
+    if (digitalRead(doutPin) == LOW) onDataReady();
+  }
+
+  void end() {
+    detachInterrupt(digitalPinToInterrupt(doutPin));
+    instance = nullptr;
+  }
+
+  bool read(Hx711Sample& sample) { return samples.pop(sample); }
+  uint16_t available() const { return samples.available(); }
+
+  uint32_t capturedCount() const { return captured; }
+  uint32_t droppedCount() const { return dropped; }
+
+private:
+  static void IRAM_ATTR onDataReady() {
+    Hx711Sampler* self = instance;
+    // Shifting toggles DOUT, which re-triggers this handler; ignore those
+    if (!self || self->shifting || digitalRead(self->doutPin) != LOW) return;
+    self->shifting = true;
+
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < 24; i++) {
+      digitalWrite(self->sckPin, HIGH);
+      delayMicroseconds(1);
+      value = (value << 1) | (digitalRead(self->doutPin) ? 1 : 0);
+      digitalWrite(self->sckPin, LOW);
+      delayMicroseconds(1);
+    }
+    // 25th pulse: channel A, gain 128 for the next conversion
+    digitalWrite(self->sckPin, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(self->sckPin, LOW);
+
+    self->shifting = false;
+
+    Hx711Sample sample;
+    sample.raw = (int32_t)(value << 8) >> 8;  // sign-extend 24 bits
+    sample.micros = micros();
+    if (self->samples.push(sample)) self->captured++;
+    else self->dropped++;
+  }
+
+  static inline Hx711Sampler* instance = nullptr;
+
+  SpscRingBuffer<Hx711Sample, SAMPLE_BUFFER_SIZE> samples;
+  volatile uint32_t captured = 0;
+  volatile uint32_t dropped = 0;
+  volatile bool shifting = false;
+  uint8_t doutPin = 0;
+  uint8_t sckPin = 0;
+};
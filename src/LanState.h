@@ -0,0 +1,220 @@
+// LAN state sharing for the Smart Rice Dispenser controllers
+// LanState.h - Multicast state frames between the controllers on one LAN
+//
+// The controllers sit a metre apart on the same access point, so the display
+// does not need the cloud to learn what the scale or the sensors measured.
+// Each measuring controller multicasts its current state as a STATE
+// TelemetryFrame whenever it changes and at least once per `heartbeatMs`;
+// any number of listeners join the group and apply each frame a few
+// milliseconds after it was measured. There are no acks: a lost frame is
+// replaced by the next change or heartbeat, and a listener treats a source it
+// has not heard from for a few heartbeats as gone (see heardFrom()).
+//
+// The ESP8266 modem-sleeps between beacons by default, and the access point
+// holds multicast frames for a sleeping station until the next DTIM beacon,
+// a few hundred milliseconds later. A listener that wants the frames promptly
+// has to run with WiFi.setSleepMode(WIFI_NONE_SLEEP).
+
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include "TelemetryFrame.h"
+
+class LanStatePublisher {
+public:
+  struct Stats {
+    uint32_t changes;     // frames sent because the state changed
+    uint32_t heartbeats;  // frames sent only because the heartbeat was due
+    uint32_t failed;      // no link, or the send failed
+  };
+
+  LanStatePublisher(IPAddress multicastGroup, uint16_t groupPort, unsigned long heartbeatIntervalMs,
+                    int32_t weightDeadbandMilligrams)
+      : group(multicastGroup), port(groupPort), heartbeatMs(heartbeatIntervalMs),
+        weightDeadbandMg(weightDeadbandMilligrams) {}
+
+  void begin(uint16_t device) {
+    deviceId = device;
+    bootId = ((uint32_t)random(0x10000) << 16) ^ (uint32_t)random(0x10000) ^ micros();
+  }
+
+  // Multicasts `frame` (built with TelemetryFrame::state()) if it differs
+  // from the last one sent or the heartbeat is due. Weight changes inside the
+  // deadband do not count, so filter noise does not flood the LAN.
+  bool publish(TelemetryFrame frame, unsigned long nowMs) {
+    bool changed = !sentAny || differs(frame);
+    if (!changed && nowMs - lastSentAt < heartbeatMs) return false;
+    if (WiFi.status() != WL_CONNECTED) return false;
+
+    frame.type = TelemetryFrame::TYPE_STATE;
+    frame.deviceId = deviceId;
+    frame.bootId = bootId;
+    frame.seq = lastSeq + 1;
+    frame.takenAtMs = nowMs;
+    uint8_t buffer[TelemetryFrame::DATA_BYTES];
+    size_t length = frame.encode(buffer);
+    if (!udp.beginPacketMulticast(group, port, WiFi.localIP())) {
+      stats.failed++;
+      return false;
+    }
+    udp.write(buffer, length);
+    if (!udp.endPacket()) {
+      stats.failed++;
+      return false;
+    }
+    lastSeq = frame.seq;
+    last = frame;
+    lastSentAt = nowMs;
+    sentAny = true;
+    if (changed) {
+      stats.changes++;
+    } else {
+      stats.heartbeats++;
+    }
+    return true;
+  }
+
+  // The next publish() sends even if nothing changed
+  void expire() { sentAny = false; }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("lan state: %lu changes, %lu heartbeats, %lu failed\n", (unsigned long)stats.changes,
+               (unsigned long)stats.heartbeats, (unsigned long)stats.failed);
+  }
+
+private:
+  bool differs(const TelemetryFrame& frame) const {
+    int32_t weightChange = frame.weightMg - last.weightMg;
+    if (weightChange < 0) weightChange = -weightChange;
+    return frame.fields != last.fields || frame.status != last.status || weightChange > weightDeadbandMg ||
+           frame.temperatureCentiC != last.temperatureCentiC || frame.humidityCentiPct != last.humidityCentiPct ||
+           frame.levelCentiPct != last.levelCentiPct;
+  }
+
+  WiFiUDP udp;
+  IPAddress group;
+  uint16_t port;
+  unsigned long heartbeatMs;
+  int32_t weightDeadbandMg;
+  uint16_t deviceId = 0;
+  uint32_t bootId = 0;
+  uint32_t lastSeq = 0;
+  TelemetryFrame last = {};
+  unsigned long lastSentAt = 0;
+  bool sentAny = false;
+  Stats stats = {};
+};
+
+class LanStateListener {
+public:
+  static const uint8_t MAX_SOURCES = 4;
+
+  struct Stats {
+    uint32_t applied;
+    uint32_t outOfOrder;  // older than a frame already applied from the same source
+    uint32_t malformed;
+  };
+
+  LanStateListener(IPAddress multicastGroup, uint16_t groupPort) : group(multicastGroup), port(groupPort) {}
+
+  // Joins the group on the station interface. The membership is tied to the
+  // interface address, so call it again after every reconnect.
+  void begin() {
+    udp.stop();
+    udp.beginMulticast(WiFi.localIP(), group, port);
+  }
+
+  // Reads every queued frame and calls apply(frame) for each one newer than
+  // the last applied from its source. Returns the number applied.
+  template <typename Apply>
+  uint8_t poll(Apply apply) {
+    uint8_t buffer[TelemetryFrame::DATA_BYTES + 1];  // one spare byte shows an oversized datagram
+    uint8_t count = 0;
+    int size;
+    while ((size = udp.parsePacket()) > 0) {
+      int length = udp.read(buffer, sizeof(buffer));
+      TelemetryFrame frame;
+      if (length != size || !frame.decode(buffer, length) || frame.type != TelemetryFrame::TYPE_STATE) {
+        stats.malformed++;
+        continue;
+      }
+      Source* source = sourceFor(frame.deviceId);
+      // Serial-number comparison within one boot; a new boot id starts over
+      if (source->heard && source->bootId == frame.bootId && (int32_t)(frame.seq - source->seq) <= 0) {
+        stats.outOfOrder++;
+        continue;
+      }
+      source->heard = true;
+      source->bootId = frame.bootId;
+      source->seq = frame.seq;
+      source->receivedAt = millis();
+      source->address = (uint32_t)udp.remoteIP();
+      stats.applied++;
+      count++;
+      apply(frame);
+    }
+    return count;
+  }
+
+  // True if `device` sent a frame within the last `withinMs`
+  bool heardFrom(uint16_t device, unsigned long withinMs) const {
+    for (const Source& source : sources) {
+      if (source.heard && source.deviceId == device) return millis() - source.receivedAt < withinMs;
+    }
+    return false;
+  }
+
+  // Where `device` sent its last frame from, so it can be reached without
+  // configuring its address; 0.0.0.0 if it has not been heard
+  IPAddress addressOf(uint16_t device) const {
+    for (const Source& source : sources) {
+      if (source.heard && source.deviceId == device) return IPAddress(source.address);
+    }
+    return IPAddress();
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("lan state: %lu applied, %lu out of order, %lu malformed\n", (unsigned long)stats.applied,
+               (unsigned long)stats.outOfOrder, (unsigned long)stats.malformed);
+  }
+
+private:
+  struct Source {
+    bool heard;
+    uint16_t deviceId;
+    uint32_t bootId;
+    uint32_t seq;
+    unsigned long receivedAt;
+    uint32_t address;
+  };
+
+  // The slot for `device`, else a free one, else the one heard from least recently
+  Source* sourceFor(uint16_t device) {
+    Source* oldest = &sources[0];
+    for (Source& source : sources) {
+      if (source.heard && source.deviceId == device) return &source;
+    }
+    for (Source& source : sources) {
+      if (!source.heard) {
+        source.deviceId = device;
+        return &source;
+      }
+      if (millis() - source.receivedAt > millis() - oldest->receivedAt) oldest = &source;
+    }
+    oldest->heard = false;
+    oldest->deviceId = device;
+    return oldest;
+  }
+
+  WiFiUDP udp;
+  IPAddress group;
+  uint16_t port;
+  Source sources[MAX_SOURCES] = {};
+  Stats stats = {};
+};
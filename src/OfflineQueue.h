@@ -0,0 +1,283 @@
+// Offline store-and-forward queue for the Smart Rice Dispenser controllers
+// OfflineQueue.h - Append-only, CRC-framed record log on LittleFS
+//
+// Records that could not be uploaded are appended to numbered segment files
+// in one directory. Each record is framed as
+//   0xA5 | length (1 byte) | payload | CRC-32 of length + payload (4 bytes, LE)
+// so a write torn by a power cut is detected and skipped on replay. A segment
+// is never rewritten: once full the next one is started, and once every
+// record in it has been uploaded the whole file is deleted. When all
+// `maxSegments` are full the oldest segment is dropped, which bounds both
+// the flash used and the wear. The replay position is kept in a small
+// cursor file, so a reboot mid-drain does not upload records twice.
+//
+// LittleFS.begin() must have been called before begin().
+
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "Crc32.h"
+
+class OfflineQueue {
+public:
+  static const uint8_t MAX_RECORD_BYTES = 64;
+
+  struct Stats {
+    uint32_t appended;
+    uint32_t replayed;
+    uint32_t droppedSegments;  // oldest segment discarded because the queue was full
+    uint32_t corruptFrames;    // torn or damaged records skipped on replay
+    uint32_t segmentsWritten;
+  };
+
+  OfflineQueue(const char* queueDirectory, uint32_t bytesPerSegment, uint8_t segmentLimit)
+      : directory(queueDirectory), segmentBytes(bytesPerSegment), maxSegments(segmentLimit) {}
+
+  // Finds the segments left by a previous boot and restores the replay
+  // cursor. Appends go to a new segment, so a record torn by the reset
+  // cannot hide the ones written after it.
+  bool begin() {
+    LittleFS.mkdir(directory);
+    bool found = false;
+    uint32_t lastSeq = 0;
+    uint32_t queued = 0;
+    Dir dir = LittleFS.openDir(directory);
+    while (dir.next()) {
+      uint32_t seq;
+      if (!parseSegmentName(dir.fileName().c_str(), seq)) continue;
+      if (!found || seq < firstSeq) firstSeq = seq;
+      if (!found || seq > lastSeq) lastSeq = seq;
+      queued += dir.fileSize();
+      found = true;
+    }
+    headSeq = found ? lastSeq + 1 : 0;
+    if (!found) firstSeq = headSeq;
+    headBytes = 0;
+    readSeq = firstSeq;
+    readOffset = 0;
+
+    Cursor cursor;
+    char path[48];
+    cursorPath(path, sizeof(path));
+    File file = LittleFS.open(path, "r");
+    if (file) {
+      if (file.read((uint8_t*)&cursor, sizeof(cursor)) == sizeof(cursor) &&
+          cursor.check == Crc32::compute(&cursor, CURSOR_CHECKED_BYTES) && cursor.seq >= firstSeq &&
+          cursor.seq <= headSeq) {
+        readSeq = cursor.seq;
+        readOffset = cursor.offset;
+      }
+      file.close();
+    }
+    // Segments before the cursor were drained but not yet deleted
+    while (firstSeq < readSeq) queued -= removeSegment(firstSeq++);
+    queuedBytes = queued > readOffset ? queued - readOffset : 0;
+    peekSeq = readSeq;
+    peekOffset = readOffset;
+    return true;
+  }
+
+  // Buffered until sync(); call it once per burst of appends
+  bool append(const void* record, uint8_t length) {
+    if (length == 0 || length > MAX_RECORD_BYTES) return false;
+    uint32_t frameBytes = length + FRAME_OVERHEAD;
+    if (headBytes > 0 && headBytes + frameBytes > segmentBytes) rotate();
+    if (!writer && !openWriter()) return false;
+
+    uint8_t frame[MAX_RECORD_BYTES + FRAME_OVERHEAD];
+    frame[0] = FRAME_MAGIC;
+    frame[1] = length;
+    memcpy(frame + 2, record, length);
+    uint32_t crc = Crc32::compute(frame + 1, length + 1);
+    for (uint8_t i = 0; i < 4; i++) frame[2 + length + i] = (uint8_t)(crc >> (8 * i));
+    if (writer.write(frame, frameBytes) != frameBytes) return false;
+
+    headBytes += frameBytes;
+    queuedBytes += frameBytes;
+    stats.appended++;
+    return true;
+  }
+
+  // Commit appended records to flash
+  void sync() {
+    if (writer) writer.flush();
+  }
+
+  bool isEmpty() const { return queuedBytes == 0; }
+  uint32_t bytesQueued() const { return queuedBytes; }
+
+  // Reads up to `maxRecords` from the replay position without consuming
+  // them; visit(data, length) is called for each. Returns the count read.
+  template <typename Visit>
+  uint16_t peek(uint16_t maxRecords, Visit visit) {
+    peekSeq = readSeq;
+    peekOffset = readOffset;
+    peekBytes = 0;
+    peekRecords = 0;
+    if (isEmpty()) return 0;
+    if (peekSeq == headSeq) sync();  // the head segment may hold unsynced appends
+
+    uint8_t frame[MAX_RECORD_BYTES + FRAME_OVERHEAD];
+    while (peekRecords < maxRecords && peekBytes < queuedBytes) {
+      char path[48];
+      segmentPath(peekSeq, path, sizeof(path));
+      File file = LittleFS.open(path, "r");
+      uint32_t size = file ? file.size() : 0;
+      if (file) file.seek(peekOffset);
+      while (peekRecords < maxRecords && peekOffset < size) {
+        uint8_t length = 0;
+        if (!readFrame(file, size - peekOffset, frame, length)) {
+          // Nothing after a bad frame in this segment can be trusted
+          stats.corruptFrames++;
+          peekBytes += size - peekOffset;
+          peekOffset = size;
+          if (peekSeq == headSeq) rotate();  // keep new appends out of the damaged file
+          break;
+        }
+        visit((const uint8_t*)frame + 2, length);
+        peekOffset += length + FRAME_OVERHEAD;
+        peekBytes += length + FRAME_OVERHEAD;
+        peekRecords++;
+      }
+      if (file) file.close();
+      if (peekOffset < size || peekSeq >= headSeq) break;
+      peekSeq++;
+      peekOffset = 0;
+    }
+    if (peekRecords == 0 && peekBytes > 0) consume();  // only damaged frames: skip them for good
+    return peekRecords;
+  }
+
+  // The records returned by the last peek() were delivered
+  void consume() {
+    while (readSeq < peekSeq) {
+      removeSegment(readSeq++);
+      firstSeq = readSeq;
+    }
+    readOffset = peekOffset;
+    queuedBytes = queuedBytes > peekBytes ? queuedBytes - peekBytes : 0;
+    stats.replayed += peekRecords;
+    peekBytes = 0;
+    peekRecords = 0;
+
+    char path[48];
+    cursorPath(path, sizeof(path));
+    if (isEmpty()) {
+      // Fully drained: drop the remaining segments and start the next one fresh
+      if (writer) writer.close();
+      while (readSeq <= headSeq) removeSegment(readSeq++);
+      headSeq++;
+      headBytes = 0;
+      firstSeq = readSeq = peekSeq = headSeq;
+      readOffset = peekOffset = 0;
+      if (LittleFS.exists(path)) LittleFS.remove(path);
+      return;
+    }
+    Cursor cursor = {readSeq, readOffset, 0};
+    cursor.check = Crc32::compute(&cursor, CURSOR_CHECKED_BYTES);
+    File file = LittleFS.open(path, "w");
+    if (file) {
+      file.write((const uint8_t*)&cursor, sizeof(cursor));
+      file.close();
+    }
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("queue %s: %lu bytes queued, %lu appended, %lu replayed, %lu segments dropped, %lu corrupt\n",
+               directory, (unsigned long)queuedBytes, (unsigned long)stats.appended, (unsigned long)stats.replayed,
+               (unsigned long)stats.droppedSegments, (unsigned long)stats.corruptFrames);
+  }
+
+private:
+  static const uint8_t FRAME_MAGIC = 0xA5;
+  static const uint8_t FRAME_OVERHEAD = 6;  // magic, length, CRC-32
+
+  struct Cursor {
+    uint32_t seq;
+    uint32_t offset;
+    uint32_t check;  // CRC-32 of seq and offset
+  };
+  static const size_t CURSOR_CHECKED_BYTES = 2 * sizeof(uint32_t);
+
+  bool readFrame(File& file, uint32_t available, uint8_t* frame, uint8_t& length) {
+    if (available < FRAME_OVERHEAD || file.read(frame, 2) != 2 || frame[0] != FRAME_MAGIC) return false;
+    length = frame[1];
+    if (length == 0 || length > MAX_RECORD_BYTES || available < (uint32_t)length + FRAME_OVERHEAD) return false;
+    if (file.read(frame + 2, length + 4) != (size_t)length + 4) return false;
+    uint32_t stored = 0;
+    for (uint8_t i = 0; i < 4; i++) stored |= (uint32_t)frame[2 + length + i] << (8 * i);
+    return stored == Crc32::compute(frame + 1, length + 1);
+  }
+
+  bool openWriter() {
+    char path[48];
+    segmentPath(headSeq, path, sizeof(path));
+    writer = LittleFS.open(path, "a");
+    if (writer && headBytes == 0) stats.segmentsWritten++;
+    return (bool)writer;
+  }
+
+  void rotate() {
+    if (writer) writer.close();
+    headSeq++;
+    headBytes = 0;
+    // Over the limit: give up the oldest records rather than the newest
+    while (headSeq - firstSeq + 1 > maxSegments) {
+      uint32_t removed = removeSegment(firstSeq);
+      uint32_t unread = firstSeq == readSeq ? (removed > readOffset ? removed - readOffset : 0) : removed;
+      queuedBytes = queuedBytes > unread ? queuedBytes - unread : 0;
+      if (readSeq == firstSeq) {
+        readSeq++;
+        readOffset = 0;
+      }
+      firstSeq++;
+      stats.droppedSegments++;
+    }
+  }
+
+  // Returns the size the segment had
+  uint32_t removeSegment(uint32_t seq) {
+    char path[48];
+    segmentPath(seq, path, sizeof(path));
+    File file = LittleFS.open(path, "r");
+    if (!file) return 0;
+    uint32_t size = file.size();
+    file.close();
+    LittleFS.remove(path);
+    return size;
+  }
+
+  void segmentPath(uint32_t seq, char* path, size_t size) const {
+    snprintf(path, size, "%s/%08lx", directory, (unsigned long)seq);
+  }
+  void cursorPath(char* path, size_t size) const { snprintf(path, size, "%s/cursor", directory); }
+
+  static bool parseSegmentName(const char* name, uint32_t& seq) {
+    if (strlen(name) != 8) return false;
+    char* end;
+    seq = strtoul(name, &end, 16);
+    return *end == 0;
+  }
+
+  const char* directory;
+  uint32_t segmentBytes;
+  uint8_t maxSegments;
+
+  File writer;
+  uint32_t firstSeq = 0;   // oldest segment on flash
+  uint32_t headSeq = 0;    // segment being appended to
+  uint32_t headBytes = 0;
+  uint32_t readSeq = 0;    // replay position
+  uint32_t readOffset = 0;
+  uint32_t queuedBytes = 0;
+
+  uint32_t peekSeq = 0;    // end of the last peek()
+  uint32_t peekOffset = 0;
+  uint32_t peekBytes = 0;
+  uint16_t peekRecords = 0;
+
+  Stats stats = {};
+};
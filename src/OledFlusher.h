@@ -0,0 +1,234 @@
+// Partial OLED updates for the Smart Rice Dispenser display
+// OledFlusher.h - Send the changed SSD1306 pages and columns in small slices
+//
+// Adafruit_SSD1306::display() pushes the whole framebuffer over I2C on every
+// call: 1 KB for a 128x64 panel, about 24 ms at 400 kHz, even if only the
+// weight digits moved. Nothing else runs while it does. Here the screen is
+// still drawn into the library's RAM buffer, which acts as the back buffer
+// and costs no bus time. present() compares it with the front buffer, a
+// copy of what the panel shows once the frame in flight is out. The spans
+// from the first to the last changed column of each 8-pixel page are copied
+// into the front buffer. An unchanged frame sends nothing.
+//
+// pump() then sends up to a byte budget of the frame in flight. It sends the
+// SSD1306 page and column window and then the span's bytes, at 400 kHz, and
+// returns. Calling it from a scheduler task lets buttons and network code run
+// between slices. A present() while a frame is in flight waits for it to
+// finish and is then taken from the back buffer as it is at that moment.
+// The front buffer is never changed under a slice, so the panel never shows
+// a torn frame. The panel must be in horizontal addressing mode, as
+// Adafruit_SSD1306::begin() leaves it.
+//
+// Anything that writes to the panel behind the flusher's back (display(), a
+// re-init after a brownout) must be followed by invalidate().
+
+#pragma once
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_SSD1306.h>
+
+template <uint8_t WIDTH, uint8_t HEIGHT>
+class OledFlusher {
+public:
+  static const uint8_t PAGES = (HEIGHT + 7) / 8;
+  static const uint8_t WIRE_CHUNK = 128;  // ESP8266 Wire buffer, address byte excluded by the library
+  static const uint32_t BUS_CLOCK = 400000;
+  static const uint32_t IDLE_CLOCK = 100000;
+
+  struct Stats {
+    uint32_t frames;       // frames that sent something
+    uint32_t unchanged;    // presents with nothing to send
+    uint32_t deferred;     // presents that waited for the frame in flight
+    uint32_t pages;        // page spans sent
+    uint32_t slices;       // pump() calls that sent something
+    uint64_t bytes;        // I2C payload bytes, commands included
+    uint32_t lastBytes;
+    uint32_t maxSliceUs;   // longest the bus was held in one pump()
+    uint32_t lastFrameUs;  // present() to the last byte of the frame
+    uint32_t maxFrameUs;
+    uint64_t totalFrameUs;
+  };
+
+  OledFlusher(Adafruit_SSD1306& oled, TwoWire& bus, uint8_t i2cAddress = 0x3C)
+      : display(oled), wire(bus), address(i2cAddress) {}
+
+  // The next frame sends the whole screen
+  void invalidate() { frontValid = false; }
+
+  // Queues the back buffer as the next frame. Returns true while a frame is
+  // waiting to be pumped out.
+  bool present() {
+    if (inFlight) {
+      if (!presentPending) {
+        presentPending = true;
+        pendingSinceUs = (uint32_t)micros();
+        stats.deferred++;
+      }
+      return true;
+    }
+    return startFrame((uint32_t)micros());
+  }
+
+  bool busy() const { return inFlight; }
+
+  // Sends at most about `byteBudget` bytes of the frame in flight; returns
+  // the bytes sent
+  uint32_t pump(uint32_t byteBudget) {
+    if (!inFlight) return 0;
+    uint32_t start = (uint32_t)micros();
+    uint32_t sent = 0;
+    wire.setClock(BUS_CLOCK);
+    while (inFlight && sent < byteBudget) {
+      if (page == PAGES) {
+        finishFrame();
+        if (presentPending) {
+          presentPending = false;
+          startFrame(pendingSinceUs);
+        }
+        continue;
+      }
+      if (spanFirst[page] < 0) {
+        page++;
+        continue;
+      }
+      if (!windowSent) {
+        sent += sendWindow(page, spanFirst[page], spanLast[page]);
+        windowSent = true;
+        column = spanFirst[page];
+        continue;
+      }
+      uint16_t count = spanLast[page] + 1 - column;
+      uint32_t room = byteBudget - sent > 1 ? byteBudget - sent - 1 : 1;
+      if (count > room) count = room;
+      if (count > WIRE_CHUNK - 1) count = WIRE_CHUNK - 1;
+      sent += sendData(front + page * WIDTH + column, count);
+      column += count;
+      if (column > spanLast[page]) {
+        stats.pages++;
+        page++;
+        windowSent = false;
+      }
+    }
+    if (inFlight && page == PAGES && !presentPending) finishFrame();  // last slice ended the frame
+    wire.setClock(IDLE_CLOCK);
+
+    if (sent) {
+      uint32_t elapsed = (uint32_t)micros() - start;
+      stats.slices++;
+      if (elapsed > stats.maxSliceUs) stats.maxSliceUs = elapsed;
+    }
+    return sent;
+  }
+
+  // Pumps until nothing is in flight; returns the bytes sent
+  uint32_t finish() {
+    uint32_t sent = 0;
+    while (inFlight) sent += pump(UINT32_MAX);
+    return sent;
+  }
+
+  // Blocking present: the back buffer is on the panel when this returns
+  uint32_t flush() {
+    uint32_t sent = finish();
+    present();
+    return sent + finish();
+  }
+
+  const Stats& statistics() const { return stats; }
+  void resetStats() { stats = Stats(); }
+
+  void printStats(Print& out) const {
+    out.printf("oled: %lu frames sent, %lu unchanged, %lu deferred, %lu bytes/frame, slice max %lu us, "
+               "frame avg/max %lu/%lu us\n",
+               (unsigned long)stats.frames, (unsigned long)stats.unchanged, (unsigned long)stats.deferred,
+               (unsigned long)(stats.frames ? stats.bytes / stats.frames : 0), (unsigned long)stats.maxSliceUs,
+               (unsigned long)(stats.frames ? stats.totalFrameUs / stats.frames : 0),
+               (unsigned long)stats.maxFrameUs);
+  }
+
+private:
+  // Diffs the back buffer against the front one and copies the changed
+  // spans across
+  bool startFrame(uint32_t presentedAt) {
+    const uint8_t* back = display.getBuffer();
+    if (!back) return false;
+    bool changed = false;
+    for (uint8_t p = 0; p < PAGES; p++) {
+      const uint8_t* row = back + p * WIDTH;
+      uint8_t* frontRow = front + p * WIDTH;
+      int16_t first = 0;
+      int16_t last = WIDTH - 1;
+      if (frontValid) {
+        while (first < WIDTH && row[first] == frontRow[first]) first++;
+        if (first == WIDTH) {
+          spanFirst[p] = -1;
+          continue;
+        }
+        while (row[last] == frontRow[last]) last--;
+      }
+      memcpy(frontRow + first, row + first, last - first + 1);
+      spanFirst[p] = first;
+      spanLast[p] = last;
+      changed = true;
+    }
+    frontValid = true;
+    if (!changed) {
+      stats.unchanged++;
+      return false;
+    }
+    inFlight = true;
+    page = 0;
+    windowSent = false;
+    frameBytes = 0;
+    frameStartUs = presentedAt;
+    return true;
+  }
+
+  void finishFrame() {
+    inFlight = false;
+    uint32_t elapsed = (uint32_t)micros() - frameStartUs;
+    stats.frames++;
+    stats.bytes += frameBytes;
+    stats.lastBytes = frameBytes;
+    stats.lastFrameUs = elapsed;
+    stats.totalFrameUs += elapsed;
+    if (elapsed > stats.maxFrameUs) stats.maxFrameUs = elapsed;
+  }
+
+  uint32_t sendWindow(uint8_t p, uint8_t first, uint8_t last) {
+    const uint8_t window[] = {0x00, SSD1306_PAGEADDR, p, p, SSD1306_COLUMNADDR, first, last};
+    wire.beginTransmission(address);
+    wire.write(window, sizeof(window));
+    wire.endTransmission();
+    frameBytes += sizeof(window);
+    return sizeof(window);
+  }
+
+  uint32_t sendData(const uint8_t* data, uint16_t count) {
+    wire.beginTransmission(address);
+    wire.write((uint8_t)0x40);
+    wire.write(data, count);
+    wire.endTransmission();
+    frameBytes += count + 1;
+    return count + 1;
+  }
+
+  Adafruit_SSD1306& display;
+  TwoWire& wire;
+  uint8_t address;
+  uint8_t front[WIDTH * PAGES];  // the panel, once the frame in flight is out
+  bool frontValid = false;
+  int16_t spanFirst[PAGES];      // changed columns per page, -1 for none
+  int16_t spanLast[PAGES];
+
+  bool inFlight = false;
+  uint8_t page = 0;              // pump() position
+  uint16_t column = 0;
+  bool windowSent = false;
+  uint32_t frameBytes = 0;
+  uint32_t frameStartUs = 0;
+  bool presentPending = false;
+  uint32_t pendingSinceUs = 0;
+  Stats stats = {};
+};
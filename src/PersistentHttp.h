@@ -0,0 +1,337 @@
+// Keep-alive HTTP connection for the Smart Rice Dispenser controllers
+// PersistentHttp.h - One reused socket per host with pre-rendered headers
+//
+// HTTPClient::begin()/end() around every call costs a TCP handshake each
+// time and rebuilds the apikey/Authorization headers with String
+// concatenation. This client keeps a single HTTP/1.1 keep-alive socket to
+// the Supabase host and renders the constant header block (Host, apikey,
+// Authorization, Connection) once in begin(). A request that fails on a
+// reused socket (the server may have closed it while idle) is retried once
+// on a fresh connection. Responses may be Content-Length framed or chunked;
+// body() streams either, and any unread body is skipped before the next
+// request so the socket stays in sync. An https URL goes over BearSSL. The
+// server certificate is not checked, so the link is encrypted but whoever
+// can intercept it can still pose as the server. The TLS buffers take
+// about 22 KB of heap while the socket is open. Call stop() to free them
+// when another TLS socket needs the room.
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+class PersistentHttp {
+public:
+  static const size_t HEADER_BLOCK_SIZE = 640;  // two Supabase JWTs plus the host
+  static const size_t REQUEST_HEAD_SIZE = 896;   // request line + header block + per-request headers
+
+  struct Stats {
+    uint32_t requests;
+    uint32_t connects;      // new TCP connections
+    uint32_t reuses;        // requests sent on an already open socket
+    uint32_t retries;       // reused socket had gone stale
+    uint32_t failures;
+    uint32_t lastLatencyUs; // request start to response headers
+    uint32_t maxLatencyUs;
+    uint64_t totalLatencyUs;
+  };
+
+  // Parses the base URL and renders the constant headers; does not connect
+  bool begin(const char* baseUrl, const char* apiKey) {
+    const char* host = strstr(baseUrl, "://");
+    port = 80;
+    client = &plainClient;
+    if (host) {
+      if (strncmp(baseUrl, "https://", 8) == 0) {
+        port = 443;
+        secureClient.setInsecure();
+        client = &secureClient;
+      } else if (strncmp(baseUrl, "http://", 7) != 0) {
+        return false;
+      }
+      host += 3;
+    } else {
+      host = baseUrl;
+    }
+    size_t hostLength = strcspn(host, ":/");
+    if (hostLength == 0 || hostLength >= sizeof(hostName)) return false;
+    memcpy(hostName, host, hostLength);
+    hostName[hostLength] = 0;
+    const char* rest = host + hostLength;
+    if (*rest == ':') {
+      port = (uint16_t)atoi(rest + 1);
+      rest += strcspn(rest, "/");
+    }
+    // Keep any base path (without a trailing slash) in front of every request
+    size_t basePathLength = strlen(rest);
+    while (basePathLength > 0 && rest[basePathLength - 1] == '/') basePathLength--;
+    if (basePathLength >= sizeof(basePath)) return false;
+    memcpy(basePath, rest, basePathLength);
+    basePath[basePathLength] = 0;
+
+    int n = snprintf(headerBlock, sizeof(headerBlock),
+                     "Host: %s\r\napikey: %s\r\nAuthorization: Bearer %s\r\nConnection: keep-alive\r\n", hostName,
+                     apiKey, apiKey);
+    headerBlockLength = n > 0 && (size_t)n < sizeof(headerBlock) ? (size_t)n : 0;
+    return headerBlockLength > 0;
+  }
+
+  void setTimeout(unsigned long ms) { timeoutMs = ms; }
+
+  int get(const char* path, const char* extraHeaders = nullptr) {
+    return request("GET", path, nullptr, 0, extraHeaders);
+  }
+  int post(const char* path, const char* body, size_t length, const char* extraHeaders = nullptr) {
+    return request("POST", path, (const uint8_t*)body, length, extraHeaders);
+  }
+  int patch(const char* path, const char* body, size_t length, const char* extraHeaders = nullptr) {
+    return request("PATCH", path, (const uint8_t*)body, length, extraHeaders);
+  }
+
+  // Returns the HTTP status, or a negative HTTPC_ERROR_* style code.
+  // extraHeaders must be complete lines ("Prefer: return=minimal\r\n").
+  int request(const char* method, const char* path, const uint8_t* body, size_t length,
+              const char* extraHeaders = nullptr) {
+    if (!headerBlockLength) return ERROR_NOT_CONFIGURED;
+    stats.requests++;
+    uint32_t start = (uint32_t)micros();
+
+    size_t headLength = renderHead(method, path, length, extraHeaders);
+    if (!headLength) {
+      stats.failures++;
+      return ERROR_REQUEST_TOO_LARGE;
+    }
+
+    int status = ERROR_CONNECTION_FAILED;
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+      skipUnreadBody();
+      bool reused = client->connected();
+      if (reused) {
+        stats.reuses++;
+      } else {
+        client->stop();
+        if (!client->connect(hostName, port)) break;
+        client->setNoDelay(true);  // the whole request goes out in one write anyway
+        stats.connects++;
+      }
+      status = exchange(head, headLength, body, length);
+      if (status > 0) break;
+      client->stop();
+      if (!reused) break;  // a fresh connection failing is not worth a retry
+      stats.retries++;
+    }
+
+    uint32_t latency = (uint32_t)micros() - start;
+    stats.lastLatencyUs = latency;
+    stats.totalLatencyUs += latency;
+    if (latency > stats.maxLatencyUs) stats.maxLatencyUs = latency;
+    if (status <= 0) stats.failures++;
+    return status;
+  }
+
+  // Response body of the last request; read() returns -1 at its end
+  Stream& body() { return responseBody; }
+  int bodyLength() const { return responseBody.length(); }  // -1 if chunked or unknown
+
+  // Copies up to size - 1 body bytes and NUL-terminates; returns the count.
+  // Whatever does not fit is skipped before the next request.
+  size_t readBody(char* buffer, size_t size) {
+    size_t n = 0;
+    int c;
+    while (n + 1 < size && (c = responseBody.read()) >= 0) buffer[n++] = (char)c;
+    if (size > 0) buffer[n] = 0;
+    return n;
+  }
+
+  String bodyString() {
+    String text;
+    if (responseBody.length() > 0) text.reserve(responseBody.length());
+    int c;
+    while ((c = responseBody.read()) >= 0) text += (char)c;
+    return text;
+  }
+
+  void stop() {
+    responseBody.finish();
+    client->stop();
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("http %s: %lu requests, %lu connects, %lu reused, %lu retries, %lu failed, latency avg/max %lu/%lu us\n",
+               hostName, (unsigned long)stats.requests, (unsigned long)stats.connects, (unsigned long)stats.reuses,
+               (unsigned long)stats.retries, (unsigned long)stats.failures,
+               (unsigned long)(stats.requests ? stats.totalLatencyUs / stats.requests : 0),
+               (unsigned long)stats.maxLatencyUs);
+  }
+
+  static const int ERROR_CONNECTION_FAILED = -1;
+  static const int ERROR_SEND_FAILED = -2;
+  static const int ERROR_READ_TIMEOUT = -11;
+  static const int ERROR_NOT_CONFIGURED = -20;
+  static const int ERROR_REQUEST_TOO_LARGE = -21;
+  static const int ERROR_BAD_RESPONSE = -22;
+
+private:
+  // Streams a Content-Length or chunked body straight off the socket
+  class BodyStream : public Stream {
+  public:
+    void start(WiFiClient* socket, long contentLength, bool isChunked, unsigned long timeout) {
+      client = socket;
+      remaining = contentLength;
+      chunked = isChunked;
+      chunkRemaining = 0;
+      timeoutMs = timeout;
+      done = !chunked && contentLength == 0;
+    }
+    void finish() { done = true; client = nullptr; }
+    bool finished() const { return done; }
+    // Unknown-length bodies end when the server closes the socket
+    bool delimited() const { return chunked || remaining >= 0; }
+    int length() const { return chunked ? -1 : (int)remaining; }
+
+    int available() override {
+      if (done || !client) return 0;
+      int n = client->available();
+      if (chunked) return n > 0 && chunkRemaining > 0 ? (int)min((long)n, chunkRemaining) : (n > 0 ? 1 : 0);
+      return remaining >= 0 ? (int)min((long)n, remaining) : n;
+    }
+    int peek() override { return -1; }
+    int read() override {
+      if (done || !client) return -1;
+      if (chunked && chunkRemaining == 0 && !nextChunk()) return -1;
+      int c = readByte();
+      if (c < 0) {
+        done = true;
+        return -1;
+      }
+      if (chunked) {
+        if (--chunkRemaining == 0) skipLine();  // CRLF after the chunk data
+      } else if (remaining > 0 && --remaining == 0) {
+        done = true;
+      }
+      return c;
+    }
+    size_t write(uint8_t) override { return 0; }
+    using Print::write;
+
+  private:
+    int readByte() {
+      unsigned long start = millis();
+      while (!client->available()) {
+        if (!client->connected() || millis() - start >= timeoutMs) return -1;
+        delay(1);
+      }
+      return client->read();
+    }
+    void skipLine() {
+      int c;
+      while ((c = readByte()) >= 0 && c != '\n') {
+      }
+    }
+    bool nextChunk() {
+      long size = 0;
+      int c;
+      while ((c = readByte()) >= 0 && c != '\n') {
+        if (c >= '0' && c <= '9') size = size * 16 + (c - '0');
+        else if (c >= 'a' && c <= 'f') size = size * 16 + (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') size = size * 16 + (c - 'A' + 10);
+      }
+      if (c < 0 || size == 0) {
+        if (c >= 0) skipLine();  // blank line after the last chunk
+        done = true;
+        return false;
+      }
+      chunkRemaining = size;
+      return true;
+    }
+
+    WiFiClient* client = nullptr;
+    long remaining = 0;
+    long chunkRemaining = 0;
+    bool chunked = false;
+    bool done = true;
+    unsigned long timeoutMs = 5000;
+  };
+
+  size_t renderHead(const char* method, const char* path, size_t length, const char* extraHeaders) {
+    int n;
+    if (length > 0) {
+      n = snprintf(head, sizeof(head),
+                   "%s %s%s HTTP/1.1\r\n%sContent-Type: application/json\r\nContent-Length: %u\r\n%s\r\n", method,
+                   basePath, path, headerBlock, (unsigned)length, extraHeaders ? extraHeaders : "");
+    } else {
+      n = snprintf(head, sizeof(head), "%s %s%s HTTP/1.1\r\n%s%s\r\n", method, basePath, path, headerBlock,
+                   extraHeaders ? extraHeaders : "");
+    }
+    return n > 0 && (size_t)n < sizeof(head) ? (size_t)n : 0;
+  }
+
+  int exchange(const char* requestHead, size_t headLength, const uint8_t* body, size_t length) {
+    if (client->write((const uint8_t*)requestHead, headLength) != headLength) return ERROR_SEND_FAILED;
+    if (length > 0 && client->write(body, length) != length) return ERROR_SEND_FAILED;
+    client->flush();
+
+    char line[128];
+    if (!readLine(line, sizeof(line))) return ERROR_READ_TIMEOUT;
+    if (strncmp(line, "HTTP/1.", 7) != 0) return ERROR_BAD_RESPONSE;
+    int status = atoi(line + 9);
+
+    long contentLength = -1;
+    bool chunked = false;
+    keepAlive = line[7] == '1';  // HTTP/1.1 defaults to keep-alive
+    for (;;) {
+      if (!readLine(line, sizeof(line))) return ERROR_READ_TIMEOUT;
+      if (line[0] == 0) break;
+      if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atol(line + 15);
+      else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) chunked = strstr(line + 18, "chunked") != nullptr;
+      else if (strncasecmp(line, "Connection:", 11) == 0) keepAlive = strstr(line + 11, "close") == nullptr;
+    }
+    responseBody.start(client, chunked ? -1 : contentLength, chunked, timeoutMs);
+    return status;
+  }
+
+  // Reads one header line without the CRLF; longer lines are truncated
+  bool readLine(char* buffer, size_t size) {
+    size_t n = 0;
+    unsigned long start = millis();
+    for (;;) {
+      if (!client->available()) {
+        if (!client->connected() || millis() - start >= timeoutMs) return false;
+        delay(1);
+        continue;
+      }
+      int c = client->read();
+      if (c == '\n') break;
+      if (c != '\r' && n + 1 < size) buffer[n++] = (char)c;
+    }
+    buffer[n] = 0;
+    return true;
+  }
+
+  // Keep the socket aligned on a response boundary before reusing it
+  void skipUnreadBody() {
+    if (!responseBody.finished() && responseBody.delimited()) {
+      while (responseBody.read() >= 0) {
+      }
+    }
+    if (!responseBody.finished() || !keepAlive) client->stop();
+    responseBody.finish();
+  }
+
+  WiFiClient plainClient;
+  BearSSL::WiFiClientSecure secureClient;  // no heap until it connects
+  WiFiClient* client = &plainClient;
+  BodyStream responseBody;
+  char hostName[64] = "";
+  char basePath[64] = "";
+  uint16_t port = 80;
+  char headerBlock[HEADER_BLOCK_SIZE];
+  size_t headerBlockLength = 0;
+  char head[REQUEST_HEAD_SIZE];
+  bool keepAlive = true;
+  unsigned long timeoutMs = 5000;
+  Stats stats = {};
+};
@@ -0,0 +1,396 @@
+// Supabase realtime subscription for the Smart Rice Dispenser controllers
+// RealtimeChannel.h - One websocket joined to the INSERTs on one table
+//
+// Supabase pushes row changes over a websocket speaking the Phoenix channel
+// protocol (vsn 1.0.0, JSON messages). begin() renders the socket path and
+// the phx_join message for one table. poll() connects, then reads the
+// upgrade reply and joins over later calls as the bytes arrive, so only the
+// TCP connect and TLS handshake wait. It then hands every postgres_changes
+// message to the caller as text, so an idle connection costs one small
+// heartbeat every HEARTBEAT_MS instead of a GET per poll. A dropped socket, a refused join or
+// an unanswered heartbeat closes the connection; the next attempt waits
+// RETRY_MIN_MS, doubling up to RETRY_MAX_MS while attempts keep failing.
+// Check joined() to tell whether changes are actually flowing.
+//
+// Server frames are read into a fixed buffer. A message longer than
+// FRAME_BUFFER_SIZE - 1 bytes, or split into fragments, is skipped and
+// counted. The upgrade reply is only checked for its 101 status: verifying
+// Sec-WebSocket-Accept would need SHA-1 for no gain, since the server
+// certificate is not checked either. An https URL runs the socket over
+// BearSSL, unverified as in PersistentHttp. The TLS buffers take about 22 KB
+// of heap, and two sessions of that size do not fit. The caller closes its
+// REST keep-alive socket when connectDue() says the next poll() opens this
+// one, and keeps REST closed between requests while open().
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+class RealtimeChannel {
+public:
+  static const size_t FRAME_BUFFER_SIZE = 1024;
+  static const unsigned long HEARTBEAT_MS = 25000;  // Phoenix drops a socket silent for 60 s
+  static const unsigned long JOIN_TIMEOUT_MS = 10000;
+  static const unsigned long RETRY_MIN_MS = 1000;
+  static const unsigned long RETRY_MAX_MS = 60000;
+
+  struct Stats {
+    uint32_t connects;    // upgraded sockets
+    uint32_t joins;       // joins the server accepted
+    uint32_t changes;     // postgres_changes messages handed to the caller
+    uint32_t heartbeats;
+    uint32_t drops;       // connections lost or given up on
+    uint32_t skipped;     // oversized or fragmented messages
+  };
+
+  // Renders the socket path and the join message; does not connect
+  bool begin(const char* baseUrl, const char* apiKey, const char* table) {
+    client->stop();
+    state = CLOSED;
+    retryAt = millis();
+    retryMs = RETRY_MIN_MS;
+    maskState = micros() | 1;
+
+    const char* host = strstr(baseUrl, "://");
+    port = 80;
+    client = &plainClient;
+    if (host) {
+      if (strncmp(baseUrl, "https://", 8) == 0) {
+        port = 443;
+        secureClient.setInsecure();
+        client = &secureClient;
+      } else if (strncmp(baseUrl, "http://", 7) != 0) {
+        return configured = false;
+      }
+      host += 3;
+    } else {
+      host = baseUrl;
+    }
+    size_t hostLength = strcspn(host, ":/");
+    if (hostLength == 0 || hostLength >= sizeof(hostName)) return configured = false;
+    memcpy(hostName, host, hostLength);
+    hostName[hostLength] = 0;
+    if (host[hostLength] == ':') port = (uint16_t)atoi(host + hostLength + 1);
+
+    int n = snprintf(path, sizeof(path), "/realtime/v1/websocket?apikey=%s&vsn=1.0.0", apiKey);
+    int m = snprintf(joinMessage, sizeof(joinMessage),
+                     "{\"topic\":\"realtime:public:%s\",\"event\":\"phx_join\",\"payload\":{\"config\":{"
+                     "\"postgres_changes\":[{\"event\":\"INSERT\",\"schema\":\"public\",\"table\":\"%s\"}]}},"
+                     "\"ref\":\"1\"}",
+                     table, table);
+    configured = n > 0 && (size_t)n < sizeof(path) && m > 0 && (size_t)m < sizeof(joinMessage);
+    return configured;
+  }
+
+  // Keeps the subscription up and calls onChange(message, length) for every
+  // row change received; returns how many there were. Never waits except
+  // for the TCP connect and TLS handshake of a new connection.
+  template <typename OnChange>
+  uint8_t poll(OnChange onChange) {
+    if (!configured) return 0;
+    unsigned long now = millis();
+    if (state != CLOSED && !client->connected()) drop();
+    if (state == CLOSED) {
+      if ((long)(now - retryAt) < 0 || !connect()) return 0;
+      now = millis();
+    }
+    if (state == UPGRADING && !readUpgrade(now)) return 0;
+
+    uint8_t changes = 0;
+    while (state != CLOSED && readFrame()) {
+      if (opcode == OPCODE_TEXT) {
+        changes += handleMessage(onChange);
+      } else if (opcode == OPCODE_PING) {
+        sendFrame(OPCODE_PONG, frame, frameLength);
+      } else if (opcode == OPCODE_CLOSE) {
+        drop();
+      }
+    }
+    if (state == CLOSED) return changes;
+
+    if (state == JOINING && now - joinSentAt >= JOIN_TIMEOUT_MS) {
+      drop();
+    } else if (state == JOINED && now - lastHeartbeatAt >= HEARTBEAT_MS) {
+      if (heartbeatPending) {
+        drop();  // the last one was never answered: the socket is dead
+      } else {
+        sendHeartbeat(now);
+      }
+    }
+    return changes;
+  }
+
+  bool joined() const { return state == JOINED; }
+
+  // True while the socket is open, joined or not
+  bool open() const { return state != CLOSED; }
+
+  // True if the next poll() will open the socket
+  bool connectDue() const { return configured && state == CLOSED && (long)(millis() - retryAt) >= 0; }
+
+  void stop() {
+    if (state != CLOSED) sendFrame(OPCODE_CLOSE, (const uint8_t*)"\x03\xe8", 2);  // 1000: normal closure
+    client->stop();
+    state = CLOSED;
+  }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("realtime %s: %s, %lu connects, %lu joins, %lu changes, %lu heartbeats, %lu drops, %lu skipped\n",
+               hostName, joined() ? "joined" : "not joined", (unsigned long)stats.connects,
+               (unsigned long)stats.joins, (unsigned long)stats.changes, (unsigned long)stats.heartbeats,
+               (unsigned long)stats.drops, (unsigned long)stats.skipped);
+  }
+
+private:
+  enum State { CLOSED, UPGRADING, JOINING, JOINED };
+
+  static const uint8_t OPCODE_CONTINUATION = 0x0;
+  static const uint8_t OPCODE_TEXT = 0x1;
+  static const uint8_t OPCODE_CLOSE = 0x8;
+  static const uint8_t OPCODE_PING = 0x9;
+  static const uint8_t OPCODE_PONG = 0xA;
+  static const size_t MAX_SEND_PAYLOAD = 320;
+
+  bool connect() {
+    if (!client->connect(hostName, port)) return retryLater();
+    client->setNoDelay(true);
+
+    // Sec-WebSocket-Key is 16 random bytes, base64 encoded
+    static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char key[25];
+    uint8_t nonce[18];
+    for (uint8_t i = 0; i < 16; i++) nonce[i] = (uint8_t)nextMask();
+    nonce[16] = nonce[17] = 0;
+    for (uint8_t i = 0; i < 6; i++) {
+      uint32_t group = (uint32_t)nonce[3 * i] << 16 | nonce[3 * i + 1] << 8 | nonce[3 * i + 2];
+      for (uint8_t j = 0; j < 4; j++) key[4 * i + j] = BASE64[(group >> (18 - 6 * j)) & 0x3F];
+    }
+    key[22] = key[23] = '=';
+    key[24] = 0;
+
+    char request[512];
+    int n = snprintf(request, sizeof(request),
+                     "GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                     path, hostName, key);
+    if (n <= 0 || (size_t)n >= sizeof(request) || client->write((const uint8_t*)request, n) != (size_t)n) {
+      client->stop();
+      return retryLater();
+    }
+    state = UPGRADING;
+    upgradeStartedAt = millis();
+    replyLineLength = 0;
+    statusSeen = false;
+    return true;
+  }
+
+  // Reads what has arrived of the upgrade reply, one header line at a time;
+  // true once the blank line after a 101 is in and the join has gone out
+  bool readUpgrade(unsigned long now) {
+    while (client->available() > 0) {
+      int c = client->read();
+      if (c != '\n') {
+        if (c != '\r' && (size_t)replyLineLength + 1 < sizeof(replyLine)) replyLine[replyLineLength++] = (char)c;
+        continue;
+      }
+      replyLine[replyLineLength] = 0;
+      bool blank = replyLineLength == 0;
+      replyLineLength = 0;
+      if (!statusSeen) {
+        statusSeen = true;
+        if (strncmp(replyLine, "HTTP/1.1 101", 12) != 0) return upgradeFailed();
+      } else if (blank) {
+        join(now);
+        return true;
+      }
+    }
+    if (now - upgradeStartedAt >= JOIN_TIMEOUT_MS) return upgradeFailed();
+    return false;
+  }
+
+  bool upgradeFailed() {
+    client->stop();
+    state = CLOSED;
+    return retryLater();
+  }
+
+  void join(unsigned long now) {
+    stats.connects++;
+    headerLength = 0;
+    payloadRead = 0;
+    state = JOINING;
+    joinSentAt = now;
+    lastHeartbeatAt = now;
+    heartbeatPending = false;
+    sendFrame(OPCODE_TEXT, (const uint8_t*)joinMessage, strlen(joinMessage));
+  }
+
+  bool retryLater() {
+    retryAt = millis() + retryMs;
+    retryMs = retryMs * 2 < RETRY_MAX_MS ? retryMs * 2 : RETRY_MAX_MS;
+    return false;
+  }
+
+  void drop() {
+    client->stop();
+    state = CLOSED;
+    stats.drops++;
+    retryLater();
+  }
+
+  // Reads what is available of the current frame; true once one is complete
+  bool readFrame() {
+    while (client->available() > 0) {
+      if (headerLength < headerNeeded()) {
+        header[headerLength++] = (uint8_t)client->read();
+        if (headerLength < headerNeeded()) continue;
+        startPayload();
+      } else if (payloadRead < sizeof(frame) - 1) {
+        size_t want = payloadLength - payloadRead;
+        size_t room = sizeof(frame) - 1 - payloadRead;
+        int n = client->read(frame + payloadRead, want < room ? want : room);
+        if (n <= 0) return false;
+        payloadRead += n;
+      } else {
+        client->read();  // past the buffer: skip the rest of an oversized frame
+        payloadRead++;
+      }
+      if (payloadRead < payloadLength) continue;
+
+      headerLength = 0;
+      payloadRead = 0;
+      bool final = header[0] & 0x80;
+      opcode = header[0] & 0x0F;
+      if (!final || opcode == OPCODE_CONTINUATION || payloadLength > sizeof(frame) - 1) {
+        stats.skipped++;
+        continue;
+      }
+      frameLength = (size_t)payloadLength;
+      frame[frameLength] = 0;
+      return true;
+    }
+    return false;
+  }
+
+  // 2 bytes, plus 2 or 8 for a 16- or 64-bit length (servers do not mask)
+  uint8_t headerNeeded() const {
+    if (headerLength < 2) return 2;
+    uint8_t length = header[1] & 0x7F;
+    return length == 126 ? 4 : length == 127 ? 10 : 2;
+  }
+
+  void startPayload() {
+    payloadLength = header[1] & 0x7F;
+    if (payloadLength == 126) {
+      payloadLength = (uint32_t)header[2] << 8 | header[3];
+    } else if (payloadLength == 127) {
+      payloadLength = 0;
+      for (uint8_t i = 6; i < 10; i++) payloadLength = payloadLength << 8 | header[i];
+    }
+    payloadRead = 0;
+  }
+
+  template <typename OnChange>
+  uint8_t handleMessage(OnChange onChange) {
+    const char* text = (const char*)frame;
+    const char* event = strstr(text, "\"event\":\"");
+    if (!event) return 0;
+    event += 9;
+    if (strncmp(event, "postgres_changes\"", 17) == 0) {
+      stats.changes++;
+      onChange(text, frameLength);
+      return 1;
+    }
+    if (strncmp(event, "phx_reply\"", 10) == 0) {
+      bool ok = strstr(text, "\"status\":\"ok\"") != nullptr;
+      if (strstr(text, "\"ref\":\"1\"")) {
+        if (!ok) {
+          drop();  // join refused: try again later
+          return 0;
+        }
+        state = JOINED;
+        stats.joins++;
+        retryMs = RETRY_MIN_MS;
+      } else {
+        heartbeatPending = false;
+      }
+    } else if (strncmp(event, "phx_error\"", 10) == 0 || strncmp(event, "phx_close\"", 10) == 0) {
+      drop();  // the channel died on the server: rejoin on a fresh socket
+    }
+    return 0;
+  }
+
+  void sendHeartbeat(unsigned long now) {
+    char message[80];
+    int n = snprintf(message, sizeof(message), "{\"topic\":\"phoenix\",\"event\":\"heartbeat\",\"payload\":{},\"ref\":\"%lu\"}",
+                     (unsigned long)++heartbeatRef);
+    sendFrame(OPCODE_TEXT, (const uint8_t*)message, n);
+    lastHeartbeatAt = now;
+    heartbeatPending = true;
+    stats.heartbeats++;
+  }
+
+  // Client frames are masked, as RFC 6455 requires
+  bool sendFrame(uint8_t frameOpcode, const uint8_t* payload, size_t length) {
+    if (length > MAX_SEND_PAYLOAD) return false;
+    uint8_t out[8 + MAX_SEND_PAYLOAD];
+    size_t n = 0;
+    out[n++] = 0x80 | frameOpcode;
+    if (length < 126) {
+      out[n++] = 0x80 | (uint8_t)length;
+    } else {
+      out[n++] = 0x80 | 126;
+      out[n++] = (uint8_t)(length >> 8);
+      out[n++] = (uint8_t)length;
+    }
+    uint32_t mask = nextMask();
+    uint8_t* maskBytes = out + n;
+    for (uint8_t i = 0; i < 4; i++) out[n++] = (uint8_t)(mask >> (8 * i));
+    for (size_t i = 0; i < length; i++) out[n++] = payload[i] ^ maskBytes[i % 4];
+    return client->write(out, n) == n;
+  }
+
+  uint32_t nextMask() {
+    // xorshift32, seeded from the clock; masking only has to be unpredictable to proxies
+    maskState ^= maskState << 13;
+    maskState ^= maskState >> 17;
+    maskState ^= maskState << 5;
+    return maskState;
+  }
+
+  WiFiClient plainClient;
+  BearSSL::WiFiClientSecure secureClient;  // no heap until it connects
+  WiFiClient* client = &plainClient;
+  bool configured = false;
+  char hostName[64] = "";
+  uint16_t port = 80;
+  char path[320];
+  char joinMessage[256];
+
+  State state = CLOSED;
+  unsigned long retryAt = 0;
+  unsigned long retryMs = RETRY_MIN_MS;
+  unsigned long upgradeStartedAt = 0;
+  char replyLine[64];  // longer header lines are truncated
+  uint8_t replyLineLength = 0;
+  bool statusSeen = false;
+  unsigned long joinSentAt = 0;
+  unsigned long lastHeartbeatAt = 0;
+  bool heartbeatPending = false;
+  uint32_t heartbeatRef = 1;  // "1" is the join
+  uint32_t maskState = 1;
+
+  uint8_t header[10];
+  uint8_t headerLength = 0;
+  uint32_t payloadLength = 0;
+  uint32_t payloadRead = 0;
+  uint8_t opcode = 0;
+  uint8_t frame[FRAME_BUFFER_SIZE];
+  size_t frameLength = 0;
+
+  Stats stats = {};
+};
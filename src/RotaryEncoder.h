@@ -0,0 +1,121 @@
+// Interrupt-driven rotary encoder for the Smart Rice Dispenser display
+// RotaryEncoder.h - Quadrature decoding with velocity acceleration
+//
+// A CHANGE interrupt on both encoder pins looks up each (previous, current)
+// A/B pair in a transition table. The quarter steps add up to a detent when
+// the encoder comes back to rest with both pins high. Contact bounce cancels
+// itself out, and a transition that skips a state (both pins changed) is
+// counted and ignored. Detents are timed in the handler, not in loop(), and
+// a quick one counts for more steps: ACCEL_INTERVAL_US / interval, up to
+// MAX_ACCEL. A brisk spin therefore covers the whole range, and a slow turn
+// still moves one step per click.
+//
+// The handler is the only writer of the step position and loop() only reads
+// it, so no lock is needed. Detents turned while loop() is blocked are
+// picked up by the next takeSteps().
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+class RotaryEncoder {
+public:
+  static const uint32_t ACCEL_INTERVAL_US = 60000;  // detents further apart than this move one step
+  static const uint8_t MAX_ACCEL = 8;
+
+  struct Stats {
+    uint32_t detents;
+    uint32_t accelerated;  // detents that counted for more than one step
+    uint32_t invalid;      // transitions with both pins changed
+  };
+
+  void begin(uint8_t pinA, uint8_t pinB) {
+    aPin = pinA;
+    bPin = pinB;
+    pinMode(aPin, INPUT_PULLUP);
+    pinMode(bPin, INPUT_PULLUP);
+    state = readState();
+    instance = this;
+    attachInterrupt(digitalPinToInterrupt(aPin), onEdge, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(bPin), onEdge, CHANGE);
+  }
+
+  void end() {
+    detachInterrupt(digitalPinToInterrupt(aPin));
+    detachInterrupt(digitalPinToInterrupt(bPin));
+    instance = nullptr;
+  }
+
+  // Steps turned since the last call, clockwise positive
+  int32_t takeSteps() {
+    int32_t now = position.load(std::memory_order_acquire);
+    int32_t steps = now - taken;
+    taken = now;
+    return steps;
+  }
+
+  Stats statistics() const { return {detents, accelerated, invalid}; }
+
+  void printStats(Print& out) const {
+    out.printf("encoder: %lu detents, %lu accelerated, %lu invalid transitions\n", (unsigned long)detents,
+               (unsigned long)accelerated, (unsigned long)invalid);
+  }
+
+private:
+  static const uint8_t REST = 3;  // both pins pulled high between detents
+
+  uint8_t IRAM_ATTR readState() const {
+    return (digitalRead(aPin) ? 2 : 0) | (digitalRead(bPin) ? 1 : 0);
+  }
+
+  static void IRAM_ATTR onEdge() {
+    RotaryEncoder* self = instance;
+    if (!self) return;
+    // Index: previous A/B state * 4 + current; A leads B clockwise
+    static const int8_t TRANSITIONS[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+    uint8_t current = self->readState();
+    uint8_t previous = self->state;
+    if (current == previous) return;
+    self->state = current;
+    int8_t quarter = TRANSITIONS[previous * 4 + current];
+    if (quarter == 0) {
+      self->invalid++;
+      return;
+    }
+    self->quarters += quarter;
+    if (current != REST) return;
+
+    // Back at rest: at least half a cycle one way makes a detent
+    int8_t direction = self->quarters >= 2 ? 1 : self->quarters <= -2 ? -1 : 0;
+    self->quarters = 0;
+    if (direction == 0) return;
+    uint32_t now = micros();
+    uint32_t interval = now - self->lastDetentUs;
+    uint32_t steps = 1;
+    if (direction == self->lastDirection && interval < ACCEL_INTERVAL_US) {
+      steps = ACCEL_INTERVAL_US / (interval ? interval : 1);
+      if (steps > MAX_ACCEL) steps = MAX_ACCEL;
+    }
+    self->lastDetentUs = now;
+    self->lastDirection = direction;
+    self->detents++;
+    if (steps > 1) self->accelerated++;
+    int32_t next = self->position.load(std::memory_order_relaxed) + direction * (int32_t)steps;
+    self->position.store(next, std::memory_order_release);
+  }
+
+  static inline RotaryEncoder* instance = nullptr;
+
+  std::atomic<int32_t> position{0};  // written by the handler only
+  int32_t taken = 0;                 // loop() side
+  volatile uint8_t state = REST;
+  volatile int8_t quarters = 0;
+  volatile int8_t lastDirection = 0;
+  volatile uint32_t lastDetentUs = 0;
+  volatile uint32_t detents = 0;
+  volatile uint32_t accelerated = 0;
+  volatile uint32_t invalid = 0;
+  uint8_t aPin = 0;
+  uint8_t bPin = 0;
+};
@@ -0,0 +1,49 @@
+// Lock-free single-producer/single-consumer ring buffer
+// SpscRingBuffer.h - Hands samples from an interrupt handler to loop()
+//
+// The producer (usually an ISR) only writes `head`, the consumer only writes
+// `tail`, so neither side needs to disable interrupts. Capacity must be a
+// power of two; one slot is kept free to tell full from empty.
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+template <typename T, uint16_t CAPACITY>
+class SpscRingBuffer {
+  static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+public:
+  // Producer side. Returns false (and drops the item) when full.
+  bool IRAM_ATTR push(const T& item) {
+    uint16_t head = headIndex.load(std::memory_order_relaxed);
+    uint16_t next = (head + 1) & MASK;
+    if (next == tailIndex.load(std::memory_order_acquire)) return false;
+    items[head] = item;
+    headIndex.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when empty.
+  bool pop(T& item) {
+    uint16_t tail = tailIndex.load(std::memory_order_relaxed);
+    if (tail == headIndex.load(std::memory_order_acquire)) return false;
+    item = items[tail];
+    tailIndex.store((tail + 1) & MASK, std::memory_order_release);
+    return true;
+  }
+
+  uint16_t available() const {
+    return (headIndex.load(std::memory_order_acquire) - tailIndex.load(std::memory_order_acquire)) & MASK;
+  }
+  bool isEmpty() const { return available() == 0; }
+  static uint16_t capacity() { return CAPACITY - 1; }
+
+private:
+  static const uint16_t MASK = CAPACITY - 1;
+
+  T items[CAPACITY];
+  std::atomic<uint16_t> headIndex{0};
+  std::atomic<uint16_t> tailIndex{0};
+};
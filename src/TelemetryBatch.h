@@ -0,0 +1,60 @@
+// Batched telemetry for the Smart Rice Dispenser controllers
+// TelemetryBatch.h - Fixed-size ring of samples waiting for a bulk insert
+//
+// Samples are recorded with the device time they were taken and uploaded
+// together as one JSON array, which PostgREST inserts as one row per
+// element. A batch is due once it holds `flushSize` samples or its oldest
+// sample is `maxAgeMs` old. If uploads keep failing, the ring overwrites
+// its oldest samples and counts them as dropped.
+
+#pragma once
+
+#include <Arduino.h>
+
+template <typename Sample, uint8_t CAPACITY>
+class TelemetryBatch {
+public:
+  TelemetryBatch(uint8_t batchSize, unsigned long batchAgeMs)
+      : flushSize(batchSize < CAPACITY ? batchSize : CAPACITY), maxAgeMs(batchAgeMs) {}
+
+  void add(const Sample& sample, unsigned long nowMs) {
+    if (count == CAPACITY) {
+      first = (first + 1) % CAPACITY;
+      count--;
+      dropped++;
+    }
+    uint8_t slot = (first + count) % CAPACITY;
+    samples[slot] = sample;
+    takenAt[slot] = nowMs;
+    count++;
+  }
+
+  bool due(unsigned long nowMs) const {
+    return count >= flushSize || (count > 0 && nowMs - takenAt[first] >= maxAgeMs);
+  }
+
+  uint8_t size() const { return count; }
+  static uint8_t capacity() { return CAPACITY; }
+
+  // Oldest first
+  const Sample& at(uint8_t index) const { return samples[(first + index) % CAPACITY]; }
+  unsigned long takenAtMs(uint8_t index) const { return takenAt[(first + index) % CAPACITY]; }
+
+  // Forget the oldest `uploaded` samples once the server has accepted them
+  void consume(uint8_t uploaded) {
+    if (uploaded > count) uploaded = count;
+    first = (first + uploaded) % CAPACITY;
+    count -= uploaded;
+  }
+
+  uint32_t droppedCount() const { return dropped; }
+
+private:
+  Sample samples[CAPACITY];
+  unsigned long takenAt[CAPACITY];
+  uint8_t first = 0;
+  uint8_t count = 0;
+  uint8_t flushSize;
+  unsigned long maxAgeMs;
+  uint32_t dropped = 0;
+};
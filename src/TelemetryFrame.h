@@ -0,0 +1,153 @@
+// Binary telemetry frames for the Smart Rice Dispenser controllers
+// TelemetryFrame.h - Fixed-layout UDP datagrams shared with the gateway
+//
+// A DATA frame carries one reading from one device in 28 bytes, against
+// roughly 450 bytes for the same row posted as JSON over HTTPS. All fields
+// are little endian at fixed offsets:
+//   0  magic 0xD5          1  type (1 = DATA, 2 = ACK, 3 = STATE)
+//   2  device id (u16)     4  boot id (u32, random per boot)
+//   8  sequence (u32)     12  taken at, device millis (u32)
+//  16  weight, mg (i32)   20  temperature, 0.01 C (i16)
+//  22  humidity, 0.01 % (u16)
+//  24  container level, 0.01 % (u16)
+//  26  fields present (bitmask)
+//  27  DATA: frames the sender still holds below this one; STATE: status
+// The sender's window base (the oldest sequence it still holds) is therefore
+// seq - byte 27: anything older was handed to its REST fallback and will
+// never be sent again, so the gateway acks past it. An ACK frame is the
+// first 12 bytes, with the sequence field holding the highest sequence
+// number up to which the gateway has every frame of that boot. A STATE
+// frame has the DATA layout and is multicast to the other controllers
+// rather than sent to the gateway (see LanState.h). Only standard headers
+// are used, so the gateway builds it unchanged.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct TelemetryFrame {
+  static const uint8_t MAGIC = 0xD5;
+  static const uint8_t TYPE_DATA = 1;
+  static const uint8_t TYPE_ACK = 2;
+  static const uint8_t TYPE_STATE = 3;
+  static const size_t DATA_BYTES = 28;
+  static const size_t ACK_BYTES = 12;
+
+  static const uint8_t HAS_WEIGHT = 0x01;
+  static const uint8_t HAS_TEMPERATURE = 0x02;
+  static const uint8_t HAS_HUMIDITY = 0x04;
+  static const uint8_t HAS_LEVEL = 0x08;
+  static const uint8_t HAS_STATUS = 0x10;
+
+  static const uint8_t STATUS_READY = 0;
+  static const uint8_t STATUS_DISPENSING = 1;
+  static const uint8_t STATUS_SETTLING = 2;
+
+  uint8_t type;
+  uint16_t deviceId;
+  uint32_t bootId;
+  uint32_t seq;
+  uint32_t takenAtMs;
+  int32_t weightMg;
+  int16_t temperatureCentiC;
+  uint16_t humidityCentiPct;
+  uint16_t levelCentiPct;
+  uint8_t fields;
+  uint8_t status;  // STATE frames only
+  uint8_t held;    // DATA frames only: seq minus the sender's window base
+
+  // Writes DATA_BYTES or ACK_BYTES to `out` and returns the count
+  size_t encode(uint8_t* out) const {
+    out[0] = MAGIC;
+    out[1] = type;
+    put16(out + 2, deviceId);
+    put32(out + 4, bootId);
+    put32(out + 8, seq);
+    if (type == TYPE_ACK) return ACK_BYTES;
+    put32(out + 12, takenAtMs);
+    put32(out + 16, (uint32_t)weightMg);
+    put16(out + 20, (uint16_t)temperatureCentiC);
+    put16(out + 22, humidityCentiPct);
+    put16(out + 24, levelCentiPct);
+    out[26] = fields;
+    out[27] = type == TYPE_STATE ? status : held;
+    return DATA_BYTES;
+  }
+
+  // False for anything that is not a well-formed frame
+  bool decode(const uint8_t* in, size_t length) {
+    if (length < ACK_BYTES || in[0] != MAGIC) return false;
+    type = in[1];
+    deviceId = get16(in + 2);
+    bootId = get32(in + 4);
+    seq = get32(in + 8);
+    takenAtMs = 0;
+    weightMg = 0;
+    temperatureCentiC = 0;
+    humidityCentiPct = 0;
+    levelCentiPct = 0;
+    fields = 0;
+    status = 0;
+    held = 0;
+    if (type == TYPE_ACK) return length == ACK_BYTES;
+    if ((type != TYPE_DATA && type != TYPE_STATE) || length != DATA_BYTES) return false;
+    takenAtMs = get32(in + 12);
+    weightMg = (int32_t)get32(in + 16);
+    temperatureCentiC = (int16_t)get16(in + 20);
+    humidityCentiPct = get16(in + 22);
+    levelCentiPct = get16(in + 24);
+    fields = in[26];
+    if (type == TYPE_STATE) status = in[27];
+    if (type == TYPE_DATA) held = in[27];
+    return true;
+  }
+
+  // Oldest sequence the sender of a DATA frame still holds
+  uint32_t windowBase() const { return seq - held; }
+
+  static TelemetryFrame data(uint16_t device) {
+    TelemetryFrame frame = {};
+    frame.type = TYPE_DATA;
+    frame.deviceId = device;
+    return frame;
+  }
+  static TelemetryFrame state(uint16_t device) {
+    TelemetryFrame frame = {};
+    frame.type = TYPE_STATE;
+    frame.deviceId = device;
+    return frame;
+  }
+  static TelemetryFrame ack(uint16_t device, uint32_t boot, uint32_t ackedSeq) {
+    TelemetryFrame frame = {};
+    frame.type = TYPE_ACK;
+    frame.deviceId = device;
+    frame.bootId = boot;
+    frame.seq = ackedSeq;
+    return frame;
+  }
+
+  // Scaled fixed-point values, clamped to the field range
+  static int32_t toMilli(float value) { return (int32_t)clamp(value * 1000.0f, -2147483000.0f, 2147483000.0f); }
+  static int16_t toCentiSigned(float value) { return (int16_t)clamp(value * 100.0f, -32768.0f, 32767.0f); }
+  static uint16_t toCenti(float value) { return (uint16_t)clamp(value * 100.0f, 0.0f, 65535.0f); }
+
+private:
+  static float clamp(float value, float low, float high) {
+    float rounded = value < 0 ? value - 0.5f : value + 0.5f;
+    return rounded < low ? low : rounded > high ? high : rounded;
+  }
+  static void put16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+  }
+  static void put32(uint8_t* out, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+  }
+  static uint16_t get16(const uint8_t* in) { return (uint16_t)(in[0] | in[1] << 8); }
+  static uint32_t get32(const uint8_t* in) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < 4; i++) value |= (uint32_t)in[i] << (8 * i);
+    return value;
+  }
+};
@@ -0,0 +1,147 @@
+// UDP telemetry transport for the Smart Rice Dispenser controllers
+// UdpTelemetry.h - Sequenced binary frames to a LAN gateway with cumulative acks
+//
+// Each reading is sent once as a TelemetryFrame and kept in a small window
+// until the gateway acknowledges it. Sequence numbers run per boot (the boot
+// id tells a restarted device from a replayed one), so the gateway can spot
+// gaps, and its ACK names the highest sequence up to which it has every
+// frame: one ack clears any number of frames. Frames not acknowledged
+// within `retransmitMs` are sent again from poll(), a few per call so the
+// loop never stalls. When the window is full the oldest frame is handed to
+// the eviction callback (typically the offline queue for the REST path)
+// instead of being lost, and every datagram names the oldest sequence still
+// held so the gateway stops waiting for the evicted ones and its acks move
+// on. Nothing here blocks: a send is one datagram.
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include "TelemetryFrame.h"
+
+class UdpTelemetry {
+public:
+  static const uint8_t WINDOW = 32;             // frames awaiting an ack
+  static const uint8_t RETRANSMITS_PER_POLL = 4;
+
+  struct Stats {
+    uint32_t frames;       // readings handed to send()
+    uint32_t datagrams;    // including retransmissions
+    uint32_t retransmits;
+    uint32_t acked;        // frames cleared by an ack
+    uint32_t acks;
+    uint32_t evicted;      // pushed out of a full window
+  };
+
+  typedef void (*EvictCallback)(const TelemetryFrame& frame);
+
+  UdpTelemetry(uint16_t localPort, unsigned long retransmitIntervalMs)
+      : port(localPort), retransmitMs(retransmitIntervalMs) {}
+
+  void begin(uint16_t device, IPAddress gatewayAddress, uint16_t gatewayPort) {
+    deviceId = device;
+    gateway = gatewayAddress;
+    remotePort = gatewayPort;
+    bootId = ((uint32_t)random(0x10000) << 16) ^ (uint32_t)random(0x10000) ^ micros();
+    udp.begin(port);
+  }
+
+  void onEvicted(EvictCallback callback) { evict = callback; }
+
+  // Assigns the next sequence number and transmits the frame; it stays in
+  // the window until acknowledged either way
+  void send(TelemetryFrame frame) {
+    if (count == WINDOW) {
+      stats.evicted++;
+      if (evict) evict(window[first].frame);
+      first = (first + 1) % WINDOW;
+      count--;
+    }
+    frame.type = TelemetryFrame::TYPE_DATA;
+    frame.deviceId = deviceId;
+    frame.bootId = bootId;
+    frame.seq = ++lastSeq;
+    Pending& slot = window[(first + count) % WINDOW];
+    slot.frame = frame;
+    slot.sentAt = 0;
+    slot.transmissions = 0;
+    count++;
+    stats.frames++;
+    transmit(slot, millis());
+  }
+
+  // Reads acks and retransmits overdue frames, oldest first
+  void poll() {
+    uint8_t buffer[TelemetryFrame::ACK_BYTES];
+    int size;
+    while ((size = udp.parsePacket()) > 0) {
+      int length = udp.read(buffer, sizeof(buffer));
+      TelemetryFrame ack;
+      if (length != size || !ack.decode(buffer, length) || ack.type != TelemetryFrame::TYPE_ACK) continue;
+      if (ack.deviceId != deviceId || ack.bootId != bootId) continue;
+      stats.acks++;
+      // Serial-number comparison: a sequence wrap is harmless
+      while (count > 0 && (int32_t)(ack.seq - window[first].frame.seq) >= 0) {
+        first = (first + 1) % WINDOW;
+        count--;
+        stats.acked++;
+      }
+    }
+
+    unsigned long now = millis();
+    uint8_t resent = 0;
+    for (uint8_t i = 0; i < count && resent < RETRANSMITS_PER_POLL; i++) {
+      Pending& slot = window[(first + i) % WINDOW];
+      if (slot.transmissions > 0 && now - slot.sentAt < retransmitMs) continue;
+      if (!transmit(slot, now)) break;  // no link: try again on the next poll
+      resent++;
+    }
+  }
+
+  uint8_t pending() const { return count; }
+  uint32_t lastSequence() const { return lastSeq; }
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("udp telemetry: %lu frames, %lu datagrams (%lu retransmits), %lu acked by %lu acks, %u pending, "
+               "%lu evicted\n",
+               (unsigned long)stats.frames, (unsigned long)stats.datagrams, (unsigned long)stats.retransmits,
+               (unsigned long)stats.acked, (unsigned long)stats.acks, (unsigned)count, (unsigned long)stats.evicted);
+  }
+
+private:
+  struct Pending {
+    TelemetryFrame frame;
+    unsigned long sentAt;
+    uint8_t transmissions;
+  };
+
+  bool transmit(Pending& slot, unsigned long now) {
+    uint8_t buffer[TelemetryFrame::DATA_BYTES];
+    slot.frame.held = (uint8_t)(slot.frame.seq - window[first].frame.seq);  // the base moves as acks arrive
+    size_t length = slot.frame.encode(buffer);
+    if (!udp.beginPacket(gateway, remotePort)) return false;
+    udp.write(buffer, length);
+    if (!udp.endPacket()) return false;
+    if (slot.transmissions > 0) stats.retransmits++;
+    if (slot.transmissions < 255) slot.transmissions++;
+    slot.sentAt = now;
+    stats.datagrams++;
+    return true;
+  }
+
+  WiFiUDP udp;
+  uint16_t port;
+  unsigned long retransmitMs;
+  uint16_t deviceId = 0;
+  IPAddress gateway;
+  uint16_t remotePort = 0;
+  uint32_t bootId = 0;
+  uint32_t lastSeq = 0;
+  EvictCallback evict = nullptr;
+
+  Pending window[WINDOW];
+  uint8_t first = 0;
+  uint8_t count = 0;
+  Stats stats = {};
+};
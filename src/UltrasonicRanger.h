@@ -0,0 +1,165 @@
+// Non-blocking HC-SR04 ranging for the Smart Rice Dispenser sensor controller
+// UltrasonicRanger.h - Interrupt-timed echoes, median of a burst of pings
+//
+// pulseIn() spins until the echo ends, or for its whole timeout (1 s by
+// default) when there is none. Here a CHANGE interrupt on the echo pin
+// timestamps both edges. update() is called from a scheduler task once per
+// PING_SPACING_MS. Each call collects the last ping's echo and fires the
+// next; the spacing lets the previous burst's ringing die down. After
+// BURST_PINGS pings the median of the good echoes becomes the distance, so
+// one stray reflection or missed echo does not move the level. A burst
+// with fewer than half good echoes leaves the previous distance in place.
+//
+// The speed of sound changes about 0.18 % per degree C: 331.3 + 0.606 * T
+// m/s. setTemperature() takes the latest air temperature, and echo times
+// are converted with it.
+//
+// The echo pin must be able to interrupt; GPIO16 (D0) cannot.
+
+#pragma once
+
+#include <Arduino.h>
+
+class UltrasonicRanger {
+public:
+  static const uint8_t BURST_PINGS = 5;
+  static const unsigned long PING_SPACING_MS = 60;  // HC-SR04 datasheet minimum cycle
+  static const uint32_t MAX_ECHO_US = 30000;        // about 5 m; longer means nothing came back
+
+  struct Stats {
+    uint32_t bursts;
+    uint32_t failedBursts;  // too few echoes for a median
+    uint32_t pings;
+    uint32_t echoes;
+    uint32_t missed;        // no echo, or echo still high at the next ping
+    float lastSpreadCm;     // max - min of the good echoes in the last burst
+  };
+
+  void begin(uint8_t triggerPin, uint8_t echoPin) {
+    trigPin = triggerPin;
+    echoInPin = echoPin;
+    pinMode(trigPin, OUTPUT);
+    digitalWrite(trigPin, LOW);
+    pinMode(echoInPin, INPUT);
+    instance = this;
+    attachInterrupt(digitalPinToInterrupt(echoInPin), onEcho, CHANGE);
+  }
+
+  // Air temperature in C for the next conversions; NAN keeps the last one
+  void setTemperature(float celsius) {
+    if (!isnan(celsius)) soundCmPerUs = (331.3f + 0.606f * celsius) / 10000.0f;
+  }
+
+  void startBurst() {
+    pingsFired = 0;
+    echoCount = 0;
+    bursting = true;
+  }
+
+  // Collects the last echo and fires the next ping; returns false once the
+  // burst is over
+  bool update() {
+    if (!bursting) return false;
+    if (pingsFired > 0) {
+      if (echoDone) {
+        uint32_t width = echoWidthUs;
+        if (width < MAX_ECHO_US) {
+          echoes[echoCount++] = width;
+          stats.echoes++;
+        } else {
+          stats.missed++;
+        }
+      } else {
+        // A sensor still holding the echo high ignores triggers; give it a
+        // few more periods before firing anyway
+        if (digitalRead(echoInPin) == HIGH && busyWaits++ < MAX_BUSY_WAITS) return true;
+        stats.missed++;
+      }
+    }
+    if (pingsFired < BURST_PINGS) {
+      fire();
+      return true;
+    }
+    finishBurst();
+    return false;
+  }
+
+  bool busy() const { return bursting; }
+  bool hasDistance() const { return !isnan(distance); }
+  float distanceCm() const { return distance; }
+
+  const Stats& statistics() const { return stats; }
+
+  void printStats(Print& out) const {
+    out.printf("ultrasonic: %lu bursts (%lu failed), %lu/%lu echoes, last spread %.1f cm, %.4f cm/us\n",
+               (unsigned long)stats.bursts, (unsigned long)stats.failedBursts, (unsigned long)stats.echoes,
+               (unsigned long)stats.pings, stats.lastSpreadCm, soundCmPerUs);
+  }
+
+private:
+  static const uint8_t MAX_BUSY_WAITS = 3;
+
+  void fire() {
+    busyWaits = 0;
+    echoDone = false;
+    echoHigh = false;
+    digitalWrite(trigPin, HIGH);
+    delayMicroseconds(10);
+    digitalWrite(trigPin, LOW);
+    pingsFired++;
+    stats.pings++;
+  }
+
+  void finishBurst() {
+    bursting = false;
+    stats.bursts++;
+    if (echoCount < BURST_PINGS / 2 + 1) {
+      stats.failedBursts++;
+      return;
+    }
+    // Insertion sort: at most BURST_PINGS values
+    for (uint8_t i = 1; i < echoCount; i++) {
+      uint32_t value = echoes[i];
+      uint8_t j = i;
+      while (j > 0 && echoes[j - 1] > value) {
+        echoes[j] = echoes[j - 1];
+        j--;
+      }
+      echoes[j] = value;
+    }
+    uint32_t median = echoCount % 2 ? echoes[echoCount / 2] : (echoes[echoCount / 2 - 1] + echoes[echoCount / 2]) / 2;
+    distance = median * soundCmPerUs / 2;  // there and back
+    stats.lastSpreadCm = (echoes[echoCount - 1] - echoes[0]) * soundCmPerUs / 2;
+  }
+
+  static void IRAM_ATTR onEcho() {
+    UltrasonicRanger* self = instance;
+    if (!self) return;
+    uint32_t now = micros();
+    if (digitalRead(self->echoInPin) == HIGH) {
+      self->echoRiseUs = now;
+      self->echoHigh = true;
+    } else if (self->echoHigh) {
+      self->echoWidthUs = now - self->echoRiseUs;
+      self->echoHigh = false;
+      self->echoDone = true;
+    }
+  }
+
+  static inline UltrasonicRanger* instance = nullptr;
+
+  uint8_t trigPin = 0;
+  uint8_t echoInPin = 0;
+  float soundCmPerUs = 0.03434f;  // 20 C until told otherwise
+  float distance = NAN;
+  bool bursting = false;
+  uint8_t busyWaits = 0;
+  uint8_t pingsFired = 0;
+  uint8_t echoCount = 0;
+  uint32_t echoes[BURST_PINGS];
+  volatile uint32_t echoRiseUs = 0;
+  volatile uint32_t echoWidthUs = 0;
+  volatile bool echoHigh = false;
+  volatile bool echoDone = false;
+  Stats stats = {};
+};
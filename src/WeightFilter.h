@@ -0,0 +1,144 @@
+// Streaming load cell filter for the Smart Rice Dispenser
+// WeightFilter.h - Fixed-point spike rejection, smoothing and auto-zero
+//
+// Every HX711 conversion goes through three integer stages, so the ESP8266
+// (no FPU) never touches soft-float per sample:
+//   1. raw counts -> milligrams with a Q16 reciprocal of the calibration
+//   2. median of the last N readings to reject single-sample spikes
+//   3. EMA (y += (x - y) >> shift) or a 1-D random-walk Kalman filter
+// While zero tracking is enabled, readings that stay within a small band
+// around zero slowly pull the zero point along, cancelling temperature and
+// creep drift the way commercial scales do. Disable it while dispensing.
+
+#pragma once
+
+#include <Arduino.h>
+
+class WeightFilter {
+public:
+  static const uint8_t MAX_MEDIAN_WINDOW = 7;
+
+  enum Smoothing : uint8_t { SMOOTH_NONE, SMOOTH_EMA, SMOOTH_KALMAN };
+
+  struct Config {
+    uint8_t medianWindow = 3;          // odd, 1..MAX_MEDIAN_WINDOW (1 disables)
+    Smoothing smoothing = SMOOTH_KALMAN;
+    uint8_t emaShift = 1;              // alpha = 1 / 2^emaShift
+    uint32_t processNoiseMg = 400;     // Kalman: expected change per sample (1 sigma)
+    uint32_t measurementNoiseMg = 500; // Kalman: reading noise after the median (1 sigma)
+    int32_t autoZeroBandMg = 2000;     // track zero only within +/- this band
+    uint8_t autoZeroShift = 8;         // zero moves 1/2^shift of the error per sample
+  };
+
+  void begin(const Config& filterConfig) {
+    config = filterConfig;
+    if (config.medianWindow < 1) config.medianWindow = 1;
+    if (config.medianWindow > MAX_MEDIAN_WINDOW) config.medianWindow = MAX_MEDIAN_WINDOW;
+    config.medianWindow |= 1;
+    processVariance = (uint64_t)config.processNoiseMg * config.processNoiseMg;
+    measurementVariance = (uint64_t)config.measurementNoiseMg * config.measurementNoiseMg;
+    reset();
+  }
+
+  // offsetCounts from tare(), countsPerGram is the HX711 scale factor
+  void setCalibration(int32_t offsetCounts, float countsPerGram) {
+    offset = offsetCounts;
+    mgPerCountQ16 = (int32_t)lroundf(65536.0f * 1000.0f / countsPerGram);
+  }
+
+  void setZeroTracking(bool enabled) { zeroTracking = enabled; }
+
+  // Forget history (e.g. after a re-tare); the next reading primes the filter
+  void reset() {
+    medianCount = 0;
+    medianNext = 0;
+    primed = false;
+    estimateMg = 0;
+    estimateVariance = 0;
+  }
+
+  // Feed one raw conversion; returns the filtered weight in milligrams
+  int32_t update(int32_t raw) {
+    int32_t mg = (int32_t)(((int64_t)(raw - offset) * mgPerCountQ16) >> 16);
+    int32_t x = median(mg);
+
+    if (!primed) {
+      estimateMg = x;
+      estimateVariance = measurementVariance;
+      primed = true;
+    } else if (config.smoothing == SMOOTH_EMA) {
+      estimateMg += (x - estimateMg) >> config.emaShift;
+    } else if (config.smoothing == SMOOTH_KALMAN) {
+      estimateVariance += processVariance;
+      uint64_t total = estimateVariance + measurementVariance;
+      int32_t gainQ16 = (int32_t)((estimateVariance << 16) / total);
+      estimateMg += (int32_t)(((int64_t)(x - estimateMg) * gainQ16) >> 16);
+      estimateVariance = (estimateVariance * (uint32_t)(65536 - gainQ16)) >> 16;
+    } else {
+      estimateMg = x;
+    }
+
+    int32_t weight = estimateMg - zeroMg;
+    if (zeroTracking && weight > -config.autoZeroBandMg && weight < config.autoZeroBandMg) {
+      // Round toward the error so the last few mg are tracked too
+      int32_t step = weight >> config.autoZeroShift;
+      if (step == 0 && weight != 0) step = weight > 0 ? 1 : -1;
+      zeroMg += step;
+      weight -= step;
+    }
+    outputMg = weight;
+    return weight;
+  }
+
+  // Takes the current load as the new zero while samples keep coming in;
+  // returns the new offset in counts for the caller to keep
+  int32_t tare() {
+    offset += (int32_t)(((int64_t)estimateMg << 16) / mgPerCountQ16);
+    zeroMg = 0;
+    outputMg = 0;
+    reset();
+    return offset;
+  }
+
+  int32_t weightMg() const { return outputMg; }
+  int32_t zeroDriftMg() const { return zeroMg; }
+
+private:
+  int32_t median(int32_t mg) {
+    window[medianNext] = mg;
+    medianNext = (medianNext + 1) % config.medianWindow;
+    if (medianCount < config.medianWindow) medianCount++;
+    if (medianCount == 1) return mg;
+
+    // Insertion sort of at most 7 values beats anything cleverer here
+    int32_t sorted[MAX_MEDIAN_WINDOW];
+    for (uint8_t i = 0; i < medianCount; i++) {
+      int32_t v = window[i];
+      uint8_t j = i;
+      while (j > 0 && sorted[j - 1] > v) {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = v;
+    }
+    return sorted[medianCount / 2];
+  }
+
+  Config config;
+  int32_t offset = 0;
+  int32_t mgPerCountQ16 = 0;
+
+  int32_t window[MAX_MEDIAN_WINDOW];
+  uint8_t medianCount = 0;
+  uint8_t medianNext = 0;
+
+  bool primed = false;
+  int32_t estimateMg = 0;
+  uint64_t estimateVariance = 0;
+  uint64_t processVariance = 0;
+  uint64_t measurementVariance = 0;
+
+  bool zeroTracking = false;
+  int32_t zeroMg = 0;
+  int32_t outputMg = 0;
+};
@@ -0,0 +1,243 @@
+// WiFi connection management for the Smart Rice Dispenser controllers
+// WifiLink.h - Non-blocking station connection with exponential backoff
+//
+// begin() only starts association; update() is called from a scheduler task
+// and moves the link through CONNECTING -> CONNECTED, or on a timeout or a
+// rejected association into BACKOFF, waiting 1 s, 2 s, 4 s ... up to
+// `maxBackoffMs` (plus up to 25% random jitter so the three controllers do
+// not retry in lockstep after a router reboot) before calling WiFi.begin()
+// again. A dropped link is first left to the SDK's own reconnect, which
+// usually succeeds within a few seconds, so the backoff only starts once
+// that has timed out. Nothing here waits, so the scale, servo, buttons and
+// display keep running while the access point is away.
+//
+// The AP's channel and BSSID and the DHCP lease of the last connection are
+// kept in a BootCache. After a reboot the first attempt goes straight to
+// that AP with the old address as a static IP, skipping the channel scan and
+// DHCP, which make up most of a cold connect. If that attempt fails, the
+// link falls back to a normal scan and DHCP at once, and the cache is
+// rewritten once it connects. If it works, the static address is handed
+// back to DHCP once the link has been up for `leaseCheckMs`, so the router
+// renews (or replaces) the lease while the controller keeps running.
+
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "BootCache.h"
+
+class WifiLink {
+public:
+  enum State { LINK_IDLE, LINK_CONNECTING, LINK_CONNECTED, LINK_BACKOFF };
+
+  struct Config {
+    unsigned long connectTimeoutMs = 15000;  // one association attempt
+    unsigned long minBackoffMs = 1000;
+    unsigned long maxBackoffMs = 60000;
+    unsigned long leaseCheckMs = 30000;      // after a fast connect, back to DHCP
+  };
+
+  struct Stats {
+    uint32_t attempts;         // WiFi.begin() calls
+    uint32_t connects;
+    uint32_t fastConnects;     // connects made with the cached AP and lease
+    uint32_t renewals;         // cached addresses handed back to DHCP
+    uint32_t drops;            // connected link lost
+    uint32_t totalDowntimeMs;  // completed outages, including the first connect
+    uint32_t longestOutageMs;
+  };
+
+  void begin(const char* networkSsid, const char* networkPassword) { begin(networkSsid, networkPassword, Config()); }
+
+  // LittleFS.begin() must have been called for the cached lease to survive
+  // a power cut
+  void begin(const char* networkSsid, const char* networkPassword, const Config& linkConfig) {
+    ssid = networkSsid;
+    password = networkPassword;
+    config = linkConfig;
+    WiFi.persistent(false);  // credentials come from the sketch; don't rewrite flash on every begin()
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+    usingLease = leaseCache.load(lease);
+    staticAddress = usingLease;
+    if (usingLease) {
+      WiFi.config(IPAddress(lease.ip), IPAddress(lease.gateway), IPAddress(lease.subnet), IPAddress(lease.dns));
+    }
+    downSince = millis();
+    startAttempt(downSince);
+  }
+
+  // Advances the state machine; returns true if the link went up or down
+  bool update() {
+    unsigned long now = millis();
+    wl_status_t status = WiFi.status();
+    switch (linkState) {
+      case LINK_IDLE:
+        return false;
+      case LINK_CONNECTED:
+        if (status == WL_CONNECTED) {
+          if (staticAddress && now - upSince >= config.leaseCheckMs) renewLease(now);
+          if (leaseSavePending && (long)(now - leaseSaveAt) >= 0) {
+            leaseSavePending = false;
+            saveLease();
+          }
+          return false;
+        }
+        // Let the SDK re-associate first; it already knows the channel
+        stats.drops++;
+        downSince = now;
+        attemptStart = now;
+        failedAttempts = 0;
+        linkState = LINK_CONNECTING;
+        return true;
+      case LINK_CONNECTING:
+        if (status == WL_CONNECTED) {
+          linkUp(now);
+          return true;
+        }
+        if (status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED || status == WL_WRONG_PASSWORD ||
+            now - attemptStart >= config.connectTimeoutMs) {
+          WiFi.disconnect();
+          if (usingLease) {
+            // The AP moved or is not up yet: scan and ask DHCP right away.
+            // The cache is rewritten once this connects.
+            usingLease = false;
+            staticAddress = false;
+            WiFi.config(IPAddress(), IPAddress(), IPAddress());
+            startAttempt(now);
+            return false;
+          }
+          unsigned long backoff = config.minBackoffMs << (failedAttempts < 16 ? failedAttempts : 16);
+          if (backoff > config.maxBackoffMs || backoff < config.minBackoffMs) backoff = config.maxBackoffMs;
+          backoff += random(backoff / 4 + 1);
+          failedAttempts++;
+          retryAt = now + backoff;
+          linkState = LINK_BACKOFF;
+        }
+        return false;
+      case LINK_BACKOFF:
+        if ((long)(now - retryAt) >= 0) startAttempt(now);
+        return false;
+    }
+    return false;
+  }
+
+  bool isConnected() const { return linkState == LINK_CONNECTED; }
+  State state() const { return linkState; }
+
+  // Length of the current outage, 0 while connected
+  unsigned long downtimeMs() const { return isConnected() ? 0 : millis() - downSince; }
+  unsigned long connectedForMs() const { return isConnected() ? millis() - upSince : 0; }
+
+  // How long the last successful attempt took, and whether it used the cache
+  unsigned long lastConnectMs() const { return connectMs; }
+  bool usedCachedLease() const { return connectedFromCache; }
+
+  const Stats& statistics() const { return stats; }
+
+  static const char* stateName(State state) {
+    switch (state) {
+      case LINK_CONNECTING: return "connecting";
+      case LINK_CONNECTED: return "connected";
+      case LINK_BACKOFF: return "backoff";
+      default: return "idle";
+    }
+  }
+
+  void printStats(Print& out) const {
+    out.printf("wifi: %s for %lu s, %lu connects (%lu fast, %lu renewed), %lu drops, %lu attempts, down %lu s "
+               "total (longest %lu s)\n",
+               stateName(linkState), (isConnected() ? connectedForMs() : downtimeMs()) / 1000,
+               (unsigned long)stats.connects, (unsigned long)stats.fastConnects, (unsigned long)stats.renewals,
+               (unsigned long)stats.drops,
+               (unsigned long)stats.attempts,
+               (unsigned long)stats.totalDowntimeMs / 1000, (unsigned long)stats.longestOutageMs / 1000);
+  }
+
+private:
+  // Channel, BSSID and address of the last connection; zeroed before use so
+  // the cache sees unchanged values as unchanged
+  struct Lease {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+  };
+  static const uint32_t LEASE_MAGIC = 0x31494657;  // "WFI1"
+  static const uint8_t LEASE_RTC_BLOCK = 32;
+  static const unsigned long DHCP_SETTLE_MS = 10000;  // a DHCP exchange takes well under this
+
+  void startAttempt(unsigned long now) {
+    if (usingLease) {
+      WiFi.begin(ssid, password, lease.channel, lease.bssid);
+    } else {
+      WiFi.begin(ssid, password);
+    }
+    stats.attempts++;
+    attemptStart = now;
+    linkState = LINK_CONNECTING;
+  }
+
+  void linkUp(unsigned long now) {
+    uint32_t outage = now - downSince;
+    stats.totalDowntimeMs += outage;
+    if (outage > stats.longestOutageMs) stats.longestOutageMs = outage;
+    stats.connects++;
+    if (usingLease) stats.fastConnects++;
+    connectedFromCache = usingLease;
+    usingLease = false;  // only the first attempt after boot skips the scan
+    failedAttempts = 0;
+    connectMs = now - attemptStart;
+    upSince = now;
+    linkState = LINK_CONNECTED;
+    saveLease();
+  }
+
+  // The cached address was never confirmed with the DHCP server, which may
+  // have let the lease lapse. Switching to DHCP keeps the association; the
+  // address it ends up with is cached once the exchange is done.
+  void renewLease(unsigned long now) {
+    staticAddress = false;
+    stats.renewals++;
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+    leaseSavePending = true;
+    leaseSaveAt = now + DHCP_SETTLE_MS;
+  }
+
+  void saveLease() {
+    Lease current;
+    memset(&current, 0, sizeof(current));
+    memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+    current.channel = (uint8_t)WiFi.channel();
+    current.ip = (uint32_t)WiFi.localIP();
+    current.gateway = (uint32_t)WiFi.gatewayIP();
+    current.subnet = (uint32_t)WiFi.subnetMask();
+    current.dns = (uint32_t)WiFi.dnsIP();
+    leaseCache.save(current);  // only reaches flash if something changed
+  }
+
+  const char* ssid = nullptr;
+  const char* password = nullptr;
+  Config config;
+
+  State linkState = LINK_IDLE;
+  uint8_t failedAttempts = 0;
+  unsigned long attemptStart = 0;
+  unsigned long retryAt = 0;
+  unsigned long downSince = 0;
+  unsigned long upSince = 0;
+  unsigned long connectMs = 0;
+
+  BootCache<Lease> leaseCache{LEASE_MAGIC, LEASE_RTC_BLOCK, "/boot/wifi"};
+  Lease lease;
+  bool usingLease = false;
+  bool staticAddress = false;  // WiFi.config() holds the cached address
+  bool connectedFromCache = false;
+  bool leaseSavePending = false;
+  unsigned long leaseSaveAt = 0;
+
+  Stats stats = {};
+};